@@ -15,6 +15,7 @@ struct Config {
   std::string input;
   std::string workingDir = ".";
   std::string publishUrl = "";
+  int servePort = 0;
   std::vector<Video> v;
   std::string logoPath;
   int segmentDurationInMs = 2000;
@@ -22,6 +23,7 @@ struct Config {
   bool isLive = false;
   bool loop = false;
   bool ultraLowLatency = false;
+  bool cmafMux = false;
   bool autoRotate = false;
   bool help = false;
   bool debugMonitor = false;
@@ -31,6 +31,7 @@ Config parseCommandLine(int argc, char const *argv[]) {
   CmdLineOptions opt;
   opt.add("o", "output-dir", &cfg.workingDir, "Set the destination directory.");
   opt.add("p", "publish", &cfg.publishUrl, "Publication URL (HTTP POST)");
+  opt.add("w", "serve", &cfg.servePort, "Serve the output over HTTP on this port, from memory (nothing is written).");
   opt.add("s", "seg-dur", &cfg.segmentDurationInMs, "Set the segment duration (in ms) (default value: 2000).");
   opt.add("t", "dvr", &cfg.timeshiftInSegNum,
         "Set the timeshift buffer depth in segment number (default value: infinite(0)).");
@@ -41,6 +42,7 @@ Config parseCommandLine(int argc, char const *argv[]) {
   opt.add("y", "logo", &cfg.logoPath, "Path to a logo file that will be overlayed on the picture.");
   opt.addFlag("u", "ultra-low-latency", &cfg.ultraLowLatency,
         "Lower the latency as much as possible (quality may be degraded).");
+  opt.addFlag("c", "cmaf-mux", &cfg.cmafMux, "Package with the native CMAF muxer (H.264, HEVC and AAC only).");
   opt.addFlag("r", "autorotate", &cfg.autoRotate, "Auto-rotate if the input height is bigger than the width.");
   opt.addFlag("h", "help", &cfg.help, "Print usage and exit.");
   opt.addFlag("l", "live", &cfg.isLive, "Run at system clock pace (otherwise runs as fast as possible).");
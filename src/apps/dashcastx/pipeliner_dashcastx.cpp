@@ -22,6 +22,7 @@
 #include "lib_media/transform/audio_convert.hpp"
 #include "lib_media/transform/logo_overlay.hpp"
 #include "plugins/Dasher/mpeg_dash.hpp"
+#include "plugins/HttpOrigin/http_origin.hpp"
 #include "plugins/RegulatorMono/regulator_mono.hpp"
 
 using namespace Modules;
@@ -193,7 +194,13 @@ std::unique_ptr<Pipeline> buildPipeline(const Config &cfg) {
 
   IFilter *sink{};
 
-  if(cfg.publishUrl.empty()) {
+  if(cfg.servePort) {
+    HttpOriginConfig originCfg;
+    originCfg.port = cfg.servePort;
+    originCfg.timeShiftBufferDepthInMs = (int64_t)cfg.segmentDurationInMs * cfg.timeshiftInSegNum;
+    originCfg.utcClock = &utcClock;
+    sink = pipeline->add("HttpOrigin", &originCfg);
+  } else if(cfg.publishUrl.empty()) {
     auto sinkCfg = FileSystemSinkConfig{cfg.workingDir};
     sink = pipeline->add("FileSystemSink", &sinkCfg);
   } else {
@@ -204,7 +211,7 @@ std::unique_ptr<Pipeline> buildPipeline(const Config &cfg) {
   pipeline->connect(GetOutputPin(dasher, 0), sink);
   pipeline->connect(GetOutputPin(dasher, 1), sink, true);
 
-  if(cfg.publishUrl.empty()) {
+  if(cfg.publishUrl.empty() && !cfg.servePort) {
     ensureDir(DASH_SUBDIR);
   }
 
@@ -247,7 +254,7 @@ std::unique_ptr<Pipeline> buildPipeline(const Config &cfg) {
     mp4config.compatFlags = FlushFragMemory | ExactInputDur | Browsers;
     mp4config.utcStartTime = &utcStartTime;
 
-    auto muxer = pipeline->add("GPACMuxMP4", &mp4config);
+    auto muxer = pipeline->add(cfg.cmafMux ? "CmafMux" : "GPACMuxMP4", &mp4config);
     pipeline->connect(compressed, muxer);
     return muxer;
   };
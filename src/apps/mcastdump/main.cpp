@@ -3,6 +3,7 @@
 #include "lib_media/out/null.hpp"
 #include "lib_pipeline/pipeline.hpp"
 #include "plugins/SocketInput/socket_input.hpp"
+#include "plugins/TsDemuxer/ts_demuxer.hpp"
 
 using namespace std;
 using namespace Modules;
@@ -11,6 +12,7 @@ using namespace Pipelines;
 struct Config {
   SocketInputConfig mcast;
   std::string outputPath;
+  bool analyze = false;
   bool help = false;
 };
 
@@ -23,6 +25,7 @@ Config parseCommandLine(int argc, char const *argv[]) {
   CmdLineOptions opt;
   opt.addFlag("h", "help", &cfg.help, "Print usage and exit");
   opt.add("o", "output", &cfg.outputPath, "Output file path");
+  opt.addFlag("a", "analyze", &cfg.analyze, "Count TR 101 290 errors, published in the stats registry");
 
   auto files = opt.parse(argc, argv);
 
@@ -49,6 +52,14 @@ void declarePipeline(Config const &cfg, Pipeline &pipeline) {
   else
     sink = pipeline.addModule<Out::File>(cfg.outputPath);
   pipeline.connect(receiver, sink);
+
+  if(cfg.analyze) {
+    TsDemuxerConfig analyzerCfg;
+    analyzerCfg.pids = {}; // no PES output
+    analyzerCfg.analyze = true;
+    auto analyzer = pipeline.add("TsDemuxer", &analyzerCfg);
+    pipeline.connect(receiver, analyzer);
+  }
 }
 
 }
@@ -1,9 +1,7 @@
 #include "lib_appcommon/options.hpp"
 #include "lib_media/in/file.hpp"
-#include "lib_media/transform/restamp.hpp" // BitrateRestamp
 #include "lib_pipeline/pipeline.hpp"
-#include "lib_utils/system_clock.hpp"
-#include "plugins/RegulatorMono/regulator_mono.hpp"
+#include "plugins/RegulatorPcr/regulator_pcr.hpp"
 #include "plugins/UdpOutput/udp_output.hpp"
 
 using namespace std;
@@ -22,7 +20,7 @@ Config parseCommandLine(int argc, char const *argv[]) {
 
   CmdLineOptions opt;
   opt.addFlag("h", "help", &cfg.help, "Print usage and exit.");
-  opt.add("b", "bitrate", &cfg.bitrate, "Set sending bitrate (default: 50Mbps)");
+  opt.add("b", "bitrate", &cfg.bitrate, "Set sending bitrate when the input has no PCR (default: 50Mbps)");
 
   auto files = opt.parse(argc, argv);
 
@@ -51,23 +49,20 @@ int safeMain(int argc, char const *argv[]) {
 
   Pipeline pipeline;
 
-  auto restamp = [&](OutputPin source) -> OutputPin {
-    auto r = pipeline.addNamedModule<Transform::BitrateRestamp>("Restamper", cfg.bitrate);
-    pipeline.connect(source, r);
-    return GetOutputPin(r);
-  };
-
+  // packets are sent at their PCR-interpolated departure time, 7 per datagram
   auto regulate = [&](OutputPin source) -> OutputPin {
-    RegulatorMonoConfig rmCfg;
-    auto r = pipeline.add("RegulatorMono", &rmCfg);
+    RegulatorPcrConfig rpCfg;
+    rpCfg.maxBurstPackets = 7;
+    rpCfg.fallbackBitrate = cfg.bitrate;
+    auto r = pipeline.add("RegulatorPcr", &rpCfg);
     pipeline.connect(source, r);
     return GetOutputPin(r);
   };
 
   FileInputConfig fileInputConfig;
   fileInputConfig.filename = cfg.path;
-  fileInputConfig.blockSize = 7 * 188;
-  auto file = regulate(restamp(pipeline.add("FileInput", &fileInputConfig)));
+  fileInputConfig.blockSize = 1024 * 188;
+  auto file = regulate(pipeline.add("FileInput", &fileInputConfig));
   auto sender = pipeline.add("UdpOutput", &cfg.udpConfig);
   pipeline.connect(file, sender);
   pipeline.start();
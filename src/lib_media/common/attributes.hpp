@@ -18,3 +18,9 @@ struct CueFlags {
   bool keyframe;
   bool unframed; // needs reframing
 };
+
+// wall-clock time at which the data was received (e.g kernel socket timestamp)
+struct ReceptionTime {
+  enum { TypeId = 0x2C7E31A5 };
+  int64_t timeInUs; // Unix time
+};
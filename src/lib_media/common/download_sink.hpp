@@ -0,0 +1,98 @@
+#pragma once
+
+#include "lib_modules/utils/helper.hpp" // OutputDefault
+
+#include <algorithm> // max, min
+#include <chrono>
+#include <cstring> // memcpy
+#include <functional>
+#include <memory>
+
+struct DownloadSinkConfig {
+  // the received chunks are coalesced into buffers of this size. 0: a single buffer for the whole download.
+  size_t bufferSize = 256 * 1024;
+
+  // a partially filled buffer is posted once its first byte is this old
+  int maxLatencyInMs = 100;
+};
+
+namespace Modules { namespace In {
+
+// Coalesces the chunks received by an IFilePuller into large buffers, allocated from 'output'.
+// The output allocator is bounded: when downstream is slow, 'write' blocks, which stalls the transfer.
+// Not thread-safe.
+class DownloadSink {
+  public:
+  DownloadSink(OutputDefault *output,
+        DownloadSinkConfig const &cfg = DownloadSinkConfig(),
+        std::function<void(Data)> post = nullptr)
+      : m_output(output)
+      , m_cfg(cfg)
+      , m_post(post) {
+    if(!m_post)
+      m_post = [output](Data data) { output->post(data); };
+  }
+
+  // to be called from the 'wget' callback
+  void write(SpanC chunk) {
+    while(chunk.len > 0) {
+      if(!m_pending) {
+        m_pending = m_output->allocData<DataRawResizable>(m_cfg.bufferSize ? m_cfg.bufferSize : chunk.len);
+        m_size = 0;
+        m_firstByteTime = std::chrono::steady_clock::now();
+      }
+
+      auto capacity = m_pending->buffer->data().len;
+      if(m_cfg.bufferSize == 0 && m_size + chunk.len > capacity) {
+        capacity = std::max(2 * capacity, m_size + chunk.len);
+        m_pending->resize(capacity);
+      }
+
+      auto const n = std::min(chunk.len, capacity - m_size);
+      memcpy(m_pending->buffer->data().ptr + m_size, chunk.ptr, n);
+      m_size += n;
+      chunk += n;
+
+      if(m_size == m_cfg.bufferSize)
+        flush();
+    }
+
+    flushIfStale();
+  }
+
+  // posts the pending buffer if it's older than 'maxLatencyInMs'.
+  // To be called periodically when no data is received (see IFilePuller::setProgressCallback).
+  void flushIfStale() {
+    if(m_pending && m_cfg.bufferSize && m_cfg.maxLatencyInMs >= 0) {
+      auto const age = std::chrono::steady_clock::now() - m_firstByteTime;
+      if(age >= std::chrono::milliseconds(m_cfg.maxLatencyInMs))
+        flush();
+    }
+  }
+
+  // posts the pending buffer, if any
+  void flush() {
+    if(auto data = take())
+      m_post(data);
+  }
+
+  // returns the pending buffer instead of posting it, e.g to set attributes. Null if nothing was written.
+  std::shared_ptr<DataRawResizable> take() {
+    auto data = std::move(m_pending);
+    m_pending = nullptr;
+    if(data)
+      data->resize(m_size);
+    return data;
+  }
+
+  private:
+  OutputDefault *const m_output;
+  DownloadSinkConfig const m_cfg;
+  std::function<void(Data)> m_post;
+
+  std::shared_ptr<DataRawResizable> m_pending;
+  size_t m_size = 0;
+  std::chrono::steady_clock::time_point m_firstByteTime;
+};
+
+}}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm> // max, min
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -8,10 +9,31 @@
 
 namespace Modules { namespace In {
 
+// forwards the part of 'chunk' within [offset, offset + size[. 'pos': position of 'chunk' in the resource.
+inline void forwardRange(
+      SpanC chunk, int64_t &pos, int64_t offset, int64_t size, std::function<void(SpanC)> const &callback) {
+  auto const first = std::max<int64_t>(offset, pos);
+  auto const last = std::min<int64_t>(offset + size, pos + chunk.len);
+  if(first < last)
+    callback({chunk.ptr + (first - pos), size_t(last - first)});
+  pos += chunk.len;
+}
+
 struct IFilePuller {
   virtual ~IFilePuller() = default;
   virtual void wget(const char *url, std::function<void(SpanC)> callback) = 0;
   virtual void askToExit() = 0;
+
+  // called periodically from the 'wget' thread during the downloads, even when no data is received.
+  // The default implementation never calls it.
+  virtual void setProgressCallback(std::function<void()> callback) { (void)callback; }
+
+  // downloads 'size' bytes starting at 'offset'.
+  // The default implementation downloads the whole resource, and drops what's out of the range.
+  virtual void wgetRange(const char *url, int64_t offset, int64_t size, std::function<void(SpanC)> callback) {
+    int64_t pos = 0;
+    wget(url, [&](SpanC chunk) { forwardRange(chunk, pos, offset, size, callback); });
+  }
 };
 
 struct IFilePullerFactory {
@@ -1,63 +1,179 @@
-#include <memory>
+#include "http_puller.hpp"
+
+#include <algorithm> // min
+#include <chrono>
+#include <cstring> // strncasecmp
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-#include "file_puller.hpp"
 #include "span.hpp"
 
 extern "C" {
 #include <curl/curl.h>
 }
 
-struct HttpSource : Modules::In::IFilePuller {
-  HttpSource()
-      : curl(curl_easy_init()) {
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#endif
+
+namespace {
+
+// DNS cache, TLS sessions and connections, shared by the handles of a source.
+// Each source has its own: a connection opened by a source is only reused by that source.
+struct CurlShare {
+  CurlShare() {
+    handle = curl_share_init();
+    curl_share_setopt(handle, CURLSHOPT_LOCKFUNC, &CurlShare::lock);
+    curl_share_setopt(handle, CURLSHOPT_UNLOCKFUNC, &CurlShare::unlock);
+    curl_share_setopt(handle, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+
+  CurlShare(CurlShare const &) = delete;
+  CurlShare &operator=(CurlShare const &) = delete;
+
+  ~CurlShare() { curl_share_cleanup(handle); }
+
+  static void lock(CURL *, curl_lock_data data, curl_lock_access, void *userp) {
+    ((CurlShare *)userp)->mutexes[data].lock();
+  }
+
+  static void unlock(CURL *, curl_lock_data data, void *userp) { ((CurlShare *)userp)->mutexes[data].unlock(); }
+
+  CURLSH *handle;
+  std::mutex mutexes[CURL_LOCK_DATA_LAST];
+};
+
+// the progress callback is called at least this often
+auto const PROGRESS_PERIOD_IN_MS = 20;
+
+struct HttpSource : IHttpSource {
+  HttpSource(HttpSourceConfig const &cfg)
+      : m_cfg(cfg)
+      , curl(curl_easy_init()) {
     if(!curl)
       throw std::runtime_error("can't init curl");
   }
 
-  ~HttpSource() { curl_easy_cleanup(curl); }
+  ~HttpSource() {
+    for(auto &worker : m_workers)
+      curl_easy_cleanup(worker.curl);
+    if(m_multi)
+      curl_multi_cleanup(m_multi);
+    curl_easy_cleanup(curl);
+  }
 
   void wget(const char *url, std::function<void(SpanC)> callback) override {
+    m_lastUpdate = std::chrono::steady_clock::now();
+
+    int64_t size = -1;
+    if(m_cfg.parallelConnections > 1)
+      size = probeRangeSupport(url);
+
+    if(size >= 2 * (int64_t)m_cfg.rangeSize)
+      wgetRanges(url, size, callback);
+    else
+      wgetSequential(url, callback);
+
+    updateDuration();
+  }
+
+  void wgetRange(const char *url, int64_t offset, int64_t size, std::function<void(SpanC)> callback) override {
+    m_lastUpdate = std::chrono::steady_clock::now();
+    auto const range = std::to_string(offset) + "-" + std::to_string(offset + size - 1);
+
+    // a server ignoring the range replies with the whole resource
+    int64_t pos = 0;
+    auto onBuffer = [&](SpanC chunk) {
+      long code = 0;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+      if(code == 206)
+        callback(chunk);
+      else
+        Modules::In::forwardRange(chunk, pos, offset, size, callback);
+    };
+    wgetSequential(url, onBuffer, range.c_str());
+    updateDuration();
+  }
+
+  void askToExit() override { exiting = true; }
+
+  void setProgressCallback(std::function<void()> callback) override { m_onProgress = callback; }
+
+  HttpSourceStats getStats() const override { return m_stats; }
+
+  private:
+  // called during the downloads, so 'getStats' is up to date when called from the callback
+  void updateDuration() {
+    auto const now = std::chrono::steady_clock::now();
+    m_stats.durationInUs += std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastUpdate).count();
+    m_lastUpdate = now;
+  }
+
+  void setup(CURL *handle, const char *url) {
+    curl_easy_reset(handle);
+
+    curl_easy_setopt(handle, CURLOPT_SHARE, m_share.handle);
+
+    // some servers require a user-agent field
+    curl_easy_setopt(handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+
+    // follow redirections
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
+
+    // don't check certificates
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, true);
+    curl_easy_setopt(handle, CURLOPT_VERBOSE, 0L);
+  }
+
+  void countConnections(CURL *handle) {
+    long connectCount = 0;
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connectCount);
+    m_stats.connectionCount += connectCount;
+  }
+
+  void wgetSequential(const char *url, std::function<void(SpanC)> callback, const char *range = nullptr) {
     struct HttpContext {
-      HttpContext(bool &exiting)
-          : exiting(exiting) {}
+      HttpContext(HttpSource *source)
+          : source(source) {}
 
       static size_t curlCallback(void *stream, size_t size, size_t nmemb, void *ptr) {
         auto pThis = (HttpContext *)ptr;
 
-        if(pThis->exiting)
+        if(pThis->source->exiting)
           return CURL_READFUNC_ABORT;
 
         auto const bytes = size * nmemb;
+        pThis->source->updateDuration();
         pThis->userCallback({(uint8_t *)stream, bytes});
+        pThis->source->m_stats.bytes += bytes;
         return bytes;
       }
 
       std::function<void(SpanC)> userCallback;
-      bool &exiting;
+      HttpSource *const source;
     };
 
-    HttpContext ctx(exiting);
+    HttpContext ctx(this);
     ctx.userCallback = callback;
 
-    // some servers require a user-agent field
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-
-    // follow redirections
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-
-    // don't check certificates
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-
-    curl_easy_setopt(curl, CURLOPT_URL, url);
+    setup(curl, url);
+    if(range)
+      curl_easy_setopt(curl, CURLOPT_RANGE, range);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &HttpContext::curlCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);
 
-    auto res = curl_easy_perform(curl);
+    auto res = perform(curl);
+    countConnections(curl);
     if(exiting)
       return;
     if(res == CURLE_HTTP_RETURNED_ERROR)
@@ -66,10 +182,260 @@ struct HttpSource : Modules::In::IFilePuller {
       throw std::runtime_error(std::string("HTTP download failed (url=\"") + url + "\"): " + curl_easy_strerror(res));
   }
 
-  void askToExit() override { exiting = true; }
+  // same as 'curl_easy_perform', but calls the progress callback while waiting for the data
+  CURLcode perform(CURL *handle) {
+    if(!m_onProgress)
+      return curl_easy_perform(handle);
+
+    if(!m_multi)
+      m_multi = curl_multi_init();
+
+    curl_multi_add_handle(m_multi, handle);
+    try {
+      while(1) {
+        int runningCount = 0;
+        curl_multi_perform(m_multi, &runningCount);
 
+        CURLMsg *msg;
+        int msgCount = 0;
+        while((msg = curl_multi_info_read(m_multi, &msgCount))) {
+          if(msg->msg == CURLMSG_DONE && msg->easy_handle == handle) {
+            auto const res = msg->data.result;
+            curl_multi_remove_handle(m_multi, handle);
+            return res;
+          }
+        }
+
+        if(exiting) {
+          curl_multi_remove_handle(m_multi, handle);
+          return CURLE_ABORTED_BY_CALLBACK;
+        }
+
+        m_onProgress();
+        curl_multi_poll(m_multi, nullptr, 0, PROGRESS_PERIOD_IN_MS, nullptr);
+      }
+    } catch(...) {
+      curl_multi_remove_handle(m_multi, handle);
+      throw;
+    }
+  }
+
+  // returns the size of the resource, or -1 if it's unknown or if byte ranges aren't supported
+  int64_t probeRangeSupport(const char *url) {
+    struct Headers {
+      static size_t onHeader(char *buffer, size_t size, size_t nitems, void *userp) {
+        auto const len = size * nitems;
+        static const char acceptRanges[] = "accept-ranges: bytes";
+        if(len >= strlen(acceptRanges) && !strncasecmp(buffer, acceptRanges, strlen(acceptRanges)))
+          ((Headers *)userp)->acceptRanges = true;
+        return len;
+      }
+
+      bool acceptRanges = false;
+    };
+
+    Headers headers;
+
+    setup(curl, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &Headers::onHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+
+    auto const res = curl_easy_perform(curl);
+    countConnections(curl);
+
+    curl_off_t size = -1;
+    if(res != CURLE_OK || curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size) != CURLE_OK)
+      return -1;
+
+    return headers.acceptRanges ? size : -1;
+  }
+
+  struct Worker {
+    CURL *curl = nullptr;
+    HttpSource *source = nullptr;
+    int64_t range = -1; // -1: idle
+    int64_t received = 0;
+    std::vector<uint8_t> buffer; // received before the previous ranges were delivered
+
+    static size_t onData(void *data, size_t size, size_t nmemb, void *userp) {
+      auto worker = (Worker *)userp;
+      auto const bytes = size * nmemb;
+      worker->received += bytes;
+      worker->source->onRangeData(*worker, {(uint8_t *)data, bytes});
+      return bytes;
+    }
+  };
+
+  // the range to deliver next is passed through without being buffered
+  void onRangeData(Worker &worker, SpanC data) {
+    if(worker.range == m_nextToDeliver)
+      deliver(data);
+    else
+      worker.buffer.insert(worker.buffer.end(), data.ptr, data.ptr + data.len);
+  }
+
+  void deliver(SpanC data) {
+    updateDuration();
+    m_deliver(data);
+    m_stats.bytes += data.len;
+  }
+
+  // Downloads 'parallelConnections' ranges at once, and delivers them in order.
+  // At most twice as many ranges are buffered, waiting for a late range to be delivered.
+  void wgetRanges(const char *url, int64_t size, std::function<void(SpanC)> callback) {
+    if(!m_multi)
+      m_multi = curl_multi_init();
+
+    while((int)m_workers.size() < m_cfg.parallelConnections) {
+      m_workers.push_back({});
+      m_workers.back().curl = curl_easy_init();
+      m_workers.back().source = this;
+    }
+
+    auto const rangeSize = (int64_t)m_cfg.rangeSize;
+    auto const rangeCount = (size + rangeSize - 1) / rangeSize;
+    auto const window = 2 * (int64_t)m_workers.size();
+    int64_t nextRange = 0;
+    std::map<int64_t, std::vector<uint8_t>> completed;
+    m_nextToDeliver = 0;
+    m_deliver = callback;
+
+    auto stopWorkers = [&]() {
+      for(auto &worker : m_workers) {
+        if(worker.range >= 0)
+          curl_multi_remove_handle(m_multi, worker.curl);
+        worker.range = -1;
+      }
+      for(auto &range : completed)
+        recycle(std::move(range.second));
+    };
+
+    try {
+      while(m_nextToDeliver < rangeCount) {
+        if(exiting) {
+          stopWorkers();
+          return;
+        }
+
+        for(auto &worker : m_workers) {
+          if(worker.range >= 0 || nextRange >= rangeCount || nextRange - m_nextToDeliver >= window)
+            continue;
+
+          auto const first = nextRange * rangeSize;
+          auto const last = std::min(first + rangeSize, size) - 1;
+          auto const rangeStr = std::to_string(first) + "-" + std::to_string(last);
+
+          worker.range = nextRange++;
+          worker.received = 0;
+          worker.buffer = allocBuffer();
+          setup(worker.curl, url);
+          curl_easy_setopt(worker.curl, CURLOPT_RANGE, rangeStr.c_str());
+          curl_easy_setopt(worker.curl, CURLOPT_WRITEFUNCTION, &Worker::onData);
+          curl_easy_setopt(worker.curl, CURLOPT_WRITEDATA, &worker);
+          curl_multi_add_handle(m_multi, worker.curl);
+        }
+
+        int runningCount = 0;
+        curl_multi_perform(m_multi, &runningCount);
+
+        CURLMsg *msg;
+        int msgCount = 0;
+        while((msg = curl_multi_info_read(m_multi, &msgCount))) {
+          if(msg->msg != CURLMSG_DONE)
+            continue;
+
+          auto worker = std::find_if(
+                m_workers.begin(), m_workers.end(), [&](Worker const &w) { return w.curl == msg->easy_handle; });
+          auto const res = msg->data.result;
+          curl_multi_remove_handle(m_multi, worker->curl);
+          countConnections(worker->curl);
+
+          long code = 0;
+          curl_easy_getinfo(worker->curl, CURLINFO_RESPONSE_CODE, &code);
+          auto const expectedSize = std::min(rangeSize, size - worker->range * rangeSize);
+
+          if(res != CURLE_OK || code != 206 || worker->received != expectedSize) {
+            worker->range = -1;
+            throw std::runtime_error(std::string("HTTP ranged download failed (url=\"") + url +
+                  "\"): " + curl_easy_strerror(res) + ", HTTP code " + std::to_string(code));
+          }
+
+          if(worker->range == m_nextToDeliver) {
+            // it may have become the next range during this loop
+            if(!worker->buffer.empty())
+              deliver({worker->buffer.data(), worker->buffer.size()});
+            recycle(std::move(worker->buffer));
+            m_nextToDeliver++;
+          } else {
+            completed[worker->range] = std::move(worker->buffer);
+          }
+          worker->range = -1;
+          m_stats.rangeCount++;
+        }
+
+        // deliver in order
+        while(!completed.empty() && completed.begin()->first == m_nextToDeliver) {
+          auto &buffer = completed.begin()->second;
+          deliver({buffer.data(), buffer.size()});
+          recycle(std::move(buffer));
+          completed.erase(completed.begin());
+          m_nextToDeliver++;
+        }
+
+        // the range to deliver next, if still running, delivers what it has buffered so far
+        for(auto &worker : m_workers) {
+          if(worker.range == m_nextToDeliver && !worker.buffer.empty()) {
+            deliver({worker.buffer.data(), worker.buffer.size()});
+            worker.buffer.clear();
+          }
+        }
+
+        if(m_nextToDeliver < rangeCount) {
+          if(m_onProgress)
+            m_onProgress();
+          curl_multi_poll(m_multi, nullptr, 0, PROGRESS_PERIOD_IN_MS, nullptr);
+        }
+      }
+    } catch(...) {
+      stopWorkers();
+      throw;
+    }
+  }
+
+  std::vector<uint8_t> allocBuffer() {
+    std::vector<uint8_t> r;
+    if(!m_freeBuffers.empty()) {
+      r = std::move(m_freeBuffers.back());
+      m_freeBuffers.pop_back();
+    }
+    r.clear();
+    r.reserve(m_cfg.rangeSize);
+    return r;
+  }
+
+  void recycle(std::vector<uint8_t> buffer) { m_freeBuffers.push_back(std::move(buffer)); }
+
+  HttpSourceConfig const m_cfg;
+  HttpSourceStats m_stats;
+
+  CurlShare m_share; // outlives the handles using it, see the destructor
   CURL *const curl;
   bool exiting = false;
+  std::function<void()> m_onProgress;
+  std::chrono::steady_clock::time_point m_lastUpdate; // see 'updateDuration'
+
+  // parallel mode
+  CURLM *m_multi = nullptr;
+  std::vector<Worker> m_workers;
+  std::vector<std::vector<uint8_t>> m_freeBuffers;
+  int64_t m_nextToDeliver = 0;
+  std::function<void(SpanC)> m_deliver;
 };
+}
+
+std::unique_ptr<IHttpSource> createHttpSource(HttpSourceConfig const &config) {
+  return std::make_unique<HttpSource>(config);
+}
 
-std::unique_ptr<Modules::In::IFilePuller> createHttpSource() { return std::make_unique<HttpSource>(); }
+std::unique_ptr<Modules::In::IFilePuller> createHttpSource() { return createHttpSource(HttpSourceConfig{}); }
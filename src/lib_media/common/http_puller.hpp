@@ -0,0 +1,29 @@
+#pragma once
+
+#include "file_puller.hpp"
+
+#include <cstdint>
+#include <memory>
+
+struct HttpSourceConfig {
+  // more than 1: large files are downloaded using several connections, with HTTP Range requests
+  // (when the server supports them), and reassembled in order.
+  int parallelConnections = 1;
+  size_t rangeSize = 4 * 1024 * 1024;
+};
+
+struct HttpSourceStats {
+  int64_t bytes = 0;
+  int64_t durationInUs = 0; // spent in 'wget'
+  int64_t rangeCount = 0;
+  int64_t connectionCount = 0; // newly established
+};
+
+struct IHttpSource : Modules::In::IFilePuller {
+  // cumulated over all the downloads. Not thread-safe: to be called from the 'wget' thread.
+  virtual HttpSourceStats getStats() const = 0;
+};
+
+// Connections, DNS and TLS sessions are shared by all the sources.
+std::unique_ptr<IHttpSource> createHttpSource(HttpSourceConfig const &config);
+std::unique_ptr<Modules::In::IFilePuller> createHttpSource();
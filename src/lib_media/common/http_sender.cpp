@@ -3,8 +3,13 @@
 #include "lib_utils/log_sink.hpp" // Warning
 
 #include <algorithm> // std::min
+#include <chrono>
 #include <condition_variable>
 #include <cstring> // memcpy
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
 #include <mutex>
 #include <thread>
 
@@ -60,13 +65,60 @@ void append(std::vector<uint8_t> &dst, SpanC data) {
     memcpy(&dst[offset], data.ptr, data.len);
 }
 
-void prepend(std::vector<uint8_t> &dst, SpanC data) {
-  auto offset = dst.size();
-  dst.resize(offset + data.len);
-  if(data.len) {
-    memmove(&dst[data.len], &dst[0], offset);
-    memcpy(&dst[0], data.ptr, data.len);
+// A piece of data waiting to be uploaded: it is read in place, from 'pos'.
+struct Chunk {
+  std::shared_ptr<const void> owner; // keeps 'data' alive
+  SpanC data;
+  bool isPrefix = false; // not accounted in the pending bytes
+  size_t pos = 0;
+};
+
+// copies as much queued data as possible to 'dst'. Returns the number of bytes copied.
+// The chunks completely read are moved to 'history', if any.
+size_t readChunks(std::deque<Chunk> &fifo, span<uint8_t> dst, size_t &pendingBytes, std::deque<Chunk> *history) {
+  size_t N = 0;
+  while(N < dst.len && !fifo.empty()) {
+    auto &chunk = fifo.front();
+    auto const n = std::min(dst.len - N, chunk.data.len - chunk.pos);
+    memcpy(dst.ptr + N, chunk.data.ptr + chunk.pos, n);
+    chunk.pos += n;
+    N += n;
+
+    if(!chunk.isPrefix)
+      pendingBytes -= n;
+
+    if(chunk.pos == chunk.data.len) {
+      if(history && !chunk.isPrefix)
+        history->push_back(std::move(chunk));
+      fifo.pop_front();
+    }
   }
+  return N;
+}
+
+void pushPrefix(std::deque<Chunk> &fifo, std::shared_ptr<std::vector<uint8_t>> const &prefix) {
+  while(!fifo.empty() && fifo.front().isPrefix)
+    fifo.pop_front(); // partially sent on the previous connection
+  if(prefix->size())
+    fifo.push_front({prefix, {prefix->data(), prefix->size()}, true});
+}
+
+// logs the outcome of a transfer, and maintains the count of consecutive connection failures
+bool checkResult(KHost *log, CURL *curl, CURLcode res, std::string const &url, int &connectFailCount) {
+  if(res != CURLE_OK) {
+    log->log(Warning, (std::string("Transfer failed: ") + curl_easy_strerror(res)).c_str());
+    if(res == CURLE_COULDNT_CONNECT || res == CURLE_GOT_NOTHING)
+      connectFailCount++;
+  } else {
+    connectFailCount = 0;
+  }
+
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if(http_code >= 400)
+    log->log(Warning, ("HTTP error: " + std::to_string(http_code) + " (" + url + ")").c_str());
+
+  return res == CURLE_OK && http_code < 400;
 }
 
 struct CurlHttpSender : HttpSender {
@@ -79,6 +131,7 @@ struct CurlHttpSender : HttpSender {
     destroying = true;
     m_allDataSent.notify_one();
     m_dataReady.notify_one();
+    m_spaceAvailable.notify_all();
     if(curlThread.joinable())
       curlThread.join();
   }
@@ -91,45 +144,66 @@ struct CurlHttpSender : HttpSender {
       // don't try to send anything on DELETE
       return;
 
+    if(data.len) {
+      auto copy = std::make_shared<std::vector<uint8_t>>(data.ptr, data.ptr + data.len);
+      push({copy, {copy->data(), copy->size()}});
+      return;
+    }
+
     {
       std::unique_lock<std::mutex> lock(m_mutex);
-      if(data.len) {
-        append(m_fifo, data);
-      } else {
-        endOfDataFlag = true;
-      }
+      endOfDataFlag = true;
       m_dataReady.notify_one();
     }
 
-    if(!data.len) {
-      if(connectFailCountExceeded)
-        throw std::runtime_error("http_sender too many connection failures");
+    if(connectFailCountExceeded)
+      throw std::runtime_error("http_sender too many connection failures");
 
-      // wait for flush finished, before returning
-      std::unique_lock<std::mutex> lock(m_mutex);
-      auto pred = [this]() { return allDataSent || destroying || connectFailCountExceeded; };
-      while(!pred())
-        m_allDataSent.wait(lock, pred);
-    }
+    // wait for flush finished, before returning
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto pred = [this]() { return allDataSent || destroying || connectFailCountExceeded; };
+    while(!pred())
+      m_allDataSent.wait(lock, pred);
   }
 
-  void appendPrefix(span<const uint8_t> prefix) override { append(m_prefixData, prefix); }
+  void send(Data data, span<const uint8_t> range) override {
+    if(!curlThread.joinable())
+      curlThread = std::thread(&CurlHttpSender::threadProc, this);
+
+    if(m_cfg.request == DELETEX || !range.len)
+      return;
+
+    push({data, range});
+  }
+
+  void appendPrefix(span<const uint8_t> prefix) override {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // copy-on-write: the previous prefix may be being uploaded
+    auto newPrefix = std::make_shared<std::vector<uint8_t>>(*m_prefixData);
+    append(*newPrefix, prefix);
+    m_prefixData = newPrefix;
+  }
 
   private:
+  void push(Chunk chunk) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // backpressure: wait for the upload to catch up
+    auto pred = [&]() {
+      return m_pendingBytes == 0 || m_pendingBytes + chunk.data.len <= m_cfg.maxPendingBytes || destroying ||
+            connectFailCountExceeded;
+    };
+    while(!pred())
+      m_spaceAvailable.wait(lock, pred);
+
+    m_pendingBytes += chunk.data.len;
+    m_fifo.push_back(std::move(chunk));
+    m_dataReady.notify_one();
+  }
+
   void perform(CURL *curl) {
     auto res = curl_easy_perform(curl);
-    if(res != CURLE_OK) {
-      m_log->log(Warning, (std::string("Transfer failed: ") + curl_easy_strerror(res)).c_str());
-      if(res == CURLE_COULDNT_CONNECT || res == CURLE_GOT_NOTHING)
-        connectFailCount++;
-    } else {
-      connectFailCount = 0;
-    }
-
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if(http_code >= 400)
-      m_log->log(Warning, ("HTTP error: " + std::to_string(http_code) + " (" + m_cfg.url + ")").c_str());
+    checkResult(m_log, curl, res, m_cfg.url, connectFailCount);
   }
 
   void threadProc() {
@@ -155,9 +229,9 @@ struct CurlHttpSender : HttpSender {
 
     while(!destroying && !allDataSent) {
       // load prefix, if any
-      if(m_prefixData.size()) {
+      {
         std::unique_lock<std::mutex> lock(m_mutex);
-        prepend(m_fifo, {m_prefixData.data(), m_prefixData.size()});
+        pushPrefix(m_fifo, m_prefixData);
       }
 
       perform(curl.get());
@@ -165,6 +239,7 @@ struct CurlHttpSender : HttpSender {
         std::unique_lock<std::mutex> lock(m_mutex);
         connectFailCountExceeded = true;
         m_allDataSent.notify_one();
+        m_spaceAvailable.notify_all();
         break;
       }
     }
@@ -191,12 +266,8 @@ struct CurlHttpSender : HttpSender {
     while(!pred())
       m_dataReady.wait(lock, pred);
 
-    auto const N = std::min<int>(buffer.len, m_fifo.size());
-    if(N > 0) {
-      memcpy(buffer.ptr, m_fifo.data(), N);
-      memmove(m_fifo.data(), m_fifo.data() + N, m_fifo.size() - N);
-      m_fifo.resize(m_fifo.size() - N);
-    }
+    auto const N = readChunks(m_fifo, buffer, m_pendingBytes, nullptr);
+    m_spaceAvailable.notify_all();
 
     if(m_fifo.empty() && endOfDataFlag) {
       allDataSent = true;
@@ -217,7 +288,7 @@ struct CurlHttpSender : HttpSender {
   int connectFailCount = 0;
 
   // data to send first at the beginning of each connection
-  std::vector<uint8_t> m_prefixData;
+  std::shared_ptr<std::vector<uint8_t>> m_prefixData = std::make_shared<std::vector<uint8_t>>();
 
   Modules::KHost *m_log{};
   curl_slist *headers{};
@@ -226,15 +297,505 @@ struct CurlHttpSender : HttpSender {
   // data to upload
   std::mutex m_mutex;
   std::condition_variable m_dataReady;
+  std::condition_variable m_spaceAvailable;
   bool endOfDataFlag = false; // 'true' means 'm_fifo will not grow anymore'
-  std::vector<uint8_t> m_fifo;
+  std::deque<Chunk> m_fifo;
+  size_t m_pendingBytes = 0; // in 'm_fifo', prefixes excluded
+};
+
+struct CurlHttpUploader;
+
+// An upload run by the uploader thread.
+// Shared by the sender and the uploader thread: guarded by the uploader mutex.
+struct Upload {
+  ~Upload() { curl_slist_free_all(headers); }
+
+  HttpSenderConfig cfg;
+  std::shared_ptr<CURL> curl;
+  curl_slist *headers{};
+  CurlHttpUploader *uploader;
+  int64_t id = 0;
+  // to complete before this one starts. It fails if one of them fails.
+  std::vector<std::shared_ptr<Upload>> dependencies;
+
+  std::shared_ptr<std::vector<uint8_t>> prefix = std::make_shared<std::vector<uint8_t>>();
+  std::deque<Chunk> fifo;
+  std::deque<Chunk> history; // already sent: kept for retries
+  size_t pendingBytes = 0; // in 'fifo', prefixes excluded
+  bool endOfData = false;
+  bool allDataSent = false;
+  bool abandoned = false; // the sender was destroyed before the end of the data
+
+  bool started = false;
+  bool paused = false; // by the read callback, because 'fifo' was empty
+  bool resume = false;
+  bool done = false;
+  bool success = false; // once done
+  int attemptCount = 0;
+  int connectFailCount = 0;
+  bool connectFailCountExceeded = false;
+
+  std::chrono::steady_clock::time_point finishTime;
+  std::function<void(HttpUploadResult const &)> onDone;
+};
+
+struct CurlUploaderSender;
+
+struct CurlHttpUploader : HttpUploader {
+  CurlHttpUploader(HttpUploaderConfig const &cfg, KHost *log)
+      : m_cfg(cfg)
+      , m_log(log) {
+    m_multi = curl_multi_init();
+    if(!m_multi)
+      throw std::runtime_error("Couldn't init the HTTP stack.");
+
+    curl_multi_setopt(m_multi, CURLMOPT_MAXCONNECTS, (long)m_cfg.maxConnections);
+
+    m_thread = std::thread(&CurlHttpUploader::threadProc, this);
+  }
+
+  ~CurlHttpUploader() {
+    {
+      // let the finished uploads complete
+      std::unique_lock<std::mutex> lock(m_mutex);
+      auto pred = [&]() { return m_uploads.empty(); };
+      while(!pred())
+        m_changed.wait(lock, pred);
+
+      m_stop = true;
+      m_changed.notify_all();
+    }
+
+    curl_multi_wakeup(m_multi);
+    m_thread.join();
+
+    curl_multi_cleanup(m_multi);
+  }
+
+  std::unique_ptr<HttpSender> createSender(HttpSenderConfig const &cfg, bool afterFinished) override;
+  void finish(std::unique_ptr<HttpSender> sender, std::function<void(HttpUploadResult const &)> onDone) override;
+
+  Stats getStats() const override {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_stats;
+  }
+
+  // sender side
+  void init(Upload &upload, bool afterFinished) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    upload.id = m_nextId++;
+    if(afterFinished)
+      for(auto &finished : m_finished)
+        upload.dependencies.push_back(finished.second);
+  }
+
+  void push(std::shared_ptr<Upload> const &uploadPtr, Chunk chunk) {
+    auto &upload = *uploadPtr;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    start(uploadPtr);
+
+    // backpressure: wait for the upload to catch up
+    auto pred = [&]() {
+      return upload.pendingBytes == 0 || upload.pendingBytes + chunk.data.len <= upload.cfg.maxPendingBytes ||
+            upload.done || m_stop;
+    };
+    while(!pred())
+      m_changed.wait(lock, pred);
+
+    upload.pendingBytes += chunk.data.len;
+    upload.fifo.push_back(std::move(chunk));
+    wakeUp(upload);
+  }
+
+  void flush(std::shared_ptr<Upload> const &uploadPtr) {
+    auto &upload = *uploadPtr;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    start(uploadPtr);
+    setEndOfData(uploadPtr);
+
+    auto pred = [&]() { return upload.done || m_stop; };
+    while(!pred())
+      m_changed.wait(lock, pred);
+
+    if(upload.connectFailCountExceeded)
+      throw std::runtime_error("http_sender too many connection failures");
+  }
+
+  void appendPrefix(Upload &upload, SpanC prefix) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // copy-on-write: the previous prefix may be being uploaded
+    auto newPrefix = std::make_shared<std::vector<uint8_t>>(*upload.prefix);
+    append(*newPrefix, prefix);
+    upload.prefix = newPrefix;
+  }
+
+  void abandon(Upload &upload) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(upload.endOfData)
+      return; // completes in the background
+
+    upload.abandoned = true;
+    wakeUp(upload);
+  }
+
+  static size_t staticCurlCallback(void *buffer, size_t size, size_t nmemb, void *userp) {
+    auto upload = (Upload *)userp;
+    return upload->uploader->fillBuffer(*upload, span<uint8_t>((uint8_t *)buffer, size * nmemb));
+  }
+
+  private:
+  // called with the lock held
+  void start(std::shared_ptr<Upload> const &upload) {
+    if(upload->started)
+      return;
+
+    upload->started = true;
+    m_waiting.push_back(upload->curl.get());
+    m_uploads[upload->curl.get()] = upload; // keeps it alive until it is done
+    curl_multi_wakeup(m_multi);
+  }
+
+  // called with the lock held
+  void setEndOfData(std::shared_ptr<Upload> const &upload) {
+    if(!upload->endOfData) {
+      upload->endOfData = true;
+      upload->finishTime = std::chrono::steady_clock::now();
+      m_finished[upload->id] = upload;
+    }
+    wakeUp(*upload);
+  }
+
+  // called with the lock held
+  void wakeUp(Upload &upload) {
+    if(upload.paused)
+      upload.resume = true;
+    curl_multi_wakeup(m_multi);
+  }
+
+  // called with the lock held
+  static bool hasFailedDependency(Upload const &upload) {
+    for(auto &dep : upload.dependencies)
+      if(dep->done && !dep->success)
+        return true;
+    return false;
+  }
+
+  // called with the lock held
+  bool canStart(Upload const &upload) const {
+    for(auto &dep : upload.dependencies)
+      if(!dep->done)
+        return false;
+
+    // the uploads still being produced start right away: they don't wait for the producer's other uploads
+    if(!upload.endOfData)
+      return true;
+
+    return m_cfg.maxParallelUploads <= 0 || (int)m_running.size() < m_cfg.maxParallelUploads;
+  }
+
+  void threadProc() {
+    while(1) {
+      std::vector<CURL *> toResume;
+      auto pollTimeout = std::chrono::milliseconds(100);
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(m_stop)
+          break;
+
+        auto const now = std::chrono::steady_clock::now();
+        while(!m_delayed.empty() && m_delayed.begin()->first <= now) {
+          m_waiting.push_back(m_delayed.begin()->second);
+          m_delayed.erase(m_delayed.begin());
+        }
+
+        if(!m_delayed.empty())
+          pollTimeout = std::min(pollTimeout,
+                std::chrono::duration_cast<std::chrono::milliseconds>(m_delayed.begin()->first - now));
+
+        for(auto i = m_waiting.begin(); i != m_waiting.end();) {
+          auto curl = *i;
+          auto upload = m_uploads[curl].get();
+
+          if(upload->abandoned) {
+            complete(*upload, false);
+            i = m_waiting.erase(i);
+          } else if(hasFailedDependency(*upload)) {
+            // e.g don't publish a manifest referencing a missing segment
+            auto const msg = "Dependency failed, cancelling upload (" + upload->cfg.url + ")";
+            m_log->log(Warning, msg.c_str());
+            complete(*upload, false);
+            i = m_waiting.erase(i);
+          } else if(canStart(*upload)) {
+            upload->dependencies.clear();
+            pushPrefix(upload->fifo, upload->prefix);
+            m_running[curl] = upload;
+            curl_multi_add_handle(m_multi, curl);
+            i = m_waiting.erase(i);
+          } else {
+            ++i;
+          }
+        }
+
+        for(auto &running : m_running) {
+          if(running.second->resume) {
+            running.second->resume = false;
+            running.second->paused = false;
+            toResume.push_back(running.first);
+          }
+        }
+      }
+
+      // may call the read callback
+      for(auto curl : toResume)
+        curl_easy_pause(curl, CURLPAUSE_CONT);
+
+      int runningCount = 0;
+      curl_multi_perform(m_multi, &runningCount);
+
+      CURLMsg *msg;
+      int msgCount = 0;
+      while((msg = curl_multi_info_read(m_multi, &msgCount))) {
+        if(msg->msg == CURLMSG_DONE) {
+          onTransferDone(msg->easy_handle, msg->data.result);
+          pollTimeout = std::chrono::milliseconds(0); // a waiting upload may start now
+        }
+      }
+
+      // user callbacks are called without the lock held
+      std::vector<std::function<void()>> callbacks;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::swap(callbacks, m_callbacks);
+      }
+      for(auto &callback : callbacks)
+        callback();
+
+      curl_multi_poll(m_multi, nullptr, 0, (int)pollTimeout.count(), nullptr);
+    }
+  }
+
+  void onTransferDone(CURL *curl, CURLcode res) {
+    curl_multi_remove_handle(m_multi, curl);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto &upload = *m_uploads[curl];
+    m_running.erase(curl);
+
+    upload.attemptCount++;
+    auto const success = checkResult(m_log, curl, res, upload.cfg.url, upload.connectFailCount);
+
+    long connectCount = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connectCount);
+    m_stats.connectionCount += connectCount;
+    m_stats.requestCount++;
+
+    if(upload.abandoned)
+      return complete(upload, false);
+
+    auto const allSent = upload.cfg.request == DELETEX || upload.allDataSent;
+
+    if(m_cfg.maxRetries > 0) {
+      if(success && allSent)
+        return complete(upload, true);
+
+      if(upload.attemptCount > m_cfg.maxRetries)
+        return complete(upload, false);
+
+      // retry the whole upload later
+      auto const delay = std::chrono::milliseconds(m_cfg.retryDelayInMs << std::min(upload.attemptCount - 1, 10));
+      auto const msg = "Retrying upload in " + std::to_string(delay.count()) + "ms (" + upload.cfg.url + ")";
+      m_log->log(Warning, msg.c_str());
+      rewind(upload);
+      m_delayed.insert({std::chrono::steady_clock::now() + delay, curl});
+      return;
+    }
+
+    auto const maxConnectFailCount = upload.cfg.maxConnectFailCount;
+    if(maxConnectFailCount > 0 && upload.connectFailCount >= maxConnectFailCount) {
+      upload.connectFailCountExceeded = true;
+      return complete(upload, false);
+    }
+
+    if(allSent)
+      return complete(upload, success);
+
+    m_waiting.push_front(curl); // reconnect, and send the rest
+  }
+
+  // called with the lock held: requeues all the data
+  void rewind(Upload &upload) {
+    while(!upload.fifo.empty() && upload.fifo.front().isPrefix)
+      upload.fifo.pop_front();
+
+    for(auto &chunk : upload.fifo) {
+      upload.pendingBytes += chunk.pos;
+      chunk.pos = 0;
+    }
+
+    while(!upload.history.empty()) {
+      upload.pendingBytes += upload.history.back().data.len;
+      upload.history.back().pos = 0;
+      upload.fifo.push_front(std::move(upload.history.back()));
+      upload.history.pop_back();
+    }
+
+    upload.allDataSent = false;
+  }
+
+  // called with the lock held
+  void complete(Upload &upload, bool success) {
+    HttpUploadResult result;
+    result.url = upload.cfg.url;
+    result.success = success;
+    result.attemptCount = upload.attemptCount;
+    if(upload.endOfData)
+      result.latencyInUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - upload.finishTime)
+                                 .count();
+
+    if(!upload.abandoned) {
+      m_stats.uploadCount++;
+      m_stats.failedCount += success ? 0 : 1;
+      m_stats.totalLatencyInUs += result.latencyInUs;
+      m_stats.maxLatencyInUs = std::max(m_stats.maxLatencyInUs, result.latencyInUs);
+    }
+
+    if(upload.onDone)
+      m_callbacks.push_back(std::bind(upload.onDone, result));
+
+    upload.done = true;
+    upload.success = success;
+    upload.history.clear();
+    upload.dependencies.clear();
+    m_finished.erase(upload.id);
+    m_changed.notify_all();
+
+    m_uploads.erase(upload.curl.get()); // may destroy 'upload'
+  }
+
+  size_t fillBuffer(Upload &upload, span<uint8_t> buffer) {
+    // curl ends the request when we return 0.
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // don't let the server take a truncated upload for a complete one
+    if(upload.abandoned || m_stop)
+      return CURL_READFUNC_ABORT;
+
+    if(upload.fifo.empty()) {
+      if(upload.endOfData) {
+        upload.allDataSent = true;
+        return 0;
+      }
+
+      // resumed when data is pushed
+      upload.paused = true;
+      return CURL_READFUNC_PAUSE;
+    }
+
+    auto history = m_cfg.maxRetries > 0 ? &upload.history : nullptr;
+    auto const N = readChunks(upload.fifo, buffer, upload.pendingBytes, history);
+    m_changed.notify_all();
+    return N;
+  }
+
+  HttpUploaderConfig const m_cfg;
+  KHost *const m_log;
+
+  CurlScope m_curlScope;
+  CURLM *m_multi;
+  std::thread m_thread;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_changed;
+  bool m_stop = false;
+  Stats m_stats;
+  int64_t m_nextId = 0;
+  std::map<int64_t, std::shared_ptr<Upload>> m_finished; // all their data was provided, but they're not complete yet
+  std::map<CURL *, std::shared_ptr<Upload>> m_uploads; // started, and not complete
+  std::list<CURL *> m_waiting; // for a free slot, or for their dependencies
+  std::multimap<std::chrono::steady_clock::time_point, CURL *> m_delayed; // retries
+  std::map<CURL *, Upload *> m_running;
+  std::vector<std::function<void()>> m_callbacks;
 };
+
+struct CurlUploaderSender : HttpSender {
+  CurlUploaderSender(CurlHttpUploader *uploader, HttpSenderConfig const &cfg)
+      : m_uploader(uploader)
+      , m_upload(std::make_shared<Upload>()) {
+    auto &upload = *m_upload;
+    upload.cfg = cfg;
+    upload.uploader = uploader;
+    upload.curl = createCurl(cfg.url, cfg.request);
+
+    auto curl = upload.curl.get();
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, upload.cfg.userAgent.c_str());
+
+    for(auto &h : cfg.extraHeaders)
+      upload.headers = curl_slist_append(upload.headers, h.c_str());
+
+    if(cfg.request != DELETEX) {
+      upload.headers = curl_slist_append(upload.headers, "Transfer-Encoding: chunked");
+      curl_easy_setopt(curl, CURLOPT_READFUNCTION, &CurlHttpUploader::staticCurlCallback);
+      curl_easy_setopt(curl, CURLOPT_READDATA, m_upload.get());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, upload.headers);
+  }
+
+  ~CurlUploaderSender() { m_uploader->abandon(*m_upload); }
+
+  void send(span<const uint8_t> data) override {
+    if(!data.len) {
+      m_uploader->flush(m_upload);
+      return;
+    }
+
+    if(m_upload->cfg.request == DELETEX)
+      return;
+
+    auto copy = std::make_shared<std::vector<uint8_t>>(data.ptr, data.ptr + data.len);
+    m_uploader->push(m_upload, {copy, {copy->data(), copy->size()}});
+  }
+
+  void send(Data data, span<const uint8_t> range) override {
+    if(m_upload->cfg.request == DELETEX || !range.len)
+      return;
+
+    m_uploader->push(m_upload, {data, range});
+  }
+
+  void appendPrefix(span<const uint8_t> prefix) override { m_uploader->appendPrefix(*m_upload, prefix); }
+
+  CurlHttpUploader *const m_uploader;
+  std::shared_ptr<Upload> const m_upload;
+};
+
+std::unique_ptr<HttpSender> CurlHttpUploader::createSender(HttpSenderConfig const &cfg, bool afterFinished) {
+  auto sender = std::make_unique<CurlUploaderSender>(this, cfg);
+  init(*sender->m_upload, afterFinished);
+  return sender;
+}
+
+void CurlHttpUploader::finish(std::unique_ptr<HttpSender> sender,
+      std::function<void(HttpUploadResult const &)> onDone) {
+  auto &upload = static_cast<CurlUploaderSender &>(*sender).m_upload;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  upload->onDone = std::move(onDone);
+  start(upload);
+  setEndOfData(upload);
+}
 }
 
 std::unique_ptr<HttpSender> createHttpSender(HttpSenderConfig const &config, Modules::KHost *log) {
   return std::make_unique<CurlHttpSender>(config, log);
 }
 
+std::unique_ptr<HttpUploader> createHttpUploader(HttpUploaderConfig const &config, Modules::KHost *log) {
+  return std::make_unique<CurlHttpUploader>(config, log);
+}
+
 void enforceConnection(std::string url, HttpRequest request) {
   CurlScope curlScope;
 
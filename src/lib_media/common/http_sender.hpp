@@ -10,18 +10,22 @@
 //|    auto s = createHttpSender(...);
 //|    s->appendPrefix(prefix_part1); // sent once per (re)connection
 //|    s->appendPrefix(prefix_part2); // append
-//|    s->send(data1);
-//|    s->send(data2);
+//|    s->send(data1); // copied
+//|    s->send(data2, data2->data()); // zero-copy: 'data2' is kept alive until it is sent
 //|    s->send({}); // flush (this line is optional, but guarantees that all data will be transfered)
 //|    // 'send' cannot be called anymore after flushing.
 //|  } // here the connection gets destroyed (whether all data was transfered or not)
 //|
+//| 'send' blocks while too much data is waiting to be transfered (see HttpSenderConfig::maxPendingBytes).
+//|
 struct HttpSender {
   virtual ~HttpSender() = default;
   virtual void send(span<const uint8_t> data) = 0; // (send an empty span to flush)
+  virtual void send(Modules::Data data, span<const uint8_t> range) = 0; // 'range' must point inside 'data'
   virtual void appendPrefix(span<const uint8_t> prefix) = 0; // may be called multiple times
 };
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -40,6 +44,53 @@ struct HttpSenderConfig {
   HttpRequest request = POST;
   std::vector<std::string> extraHeaders;
   int maxConnectFailCount = 0;
+  size_t maxPendingBytes = 16 * 1024 * 1024; // backpressure
 };
 
 std::unique_ptr<HttpSender> createHttpSender(HttpSenderConfig const &config, Modules::KHost *log);
+
+struct HttpUploaderConfig {
+  int maxParallelUploads = 0; // 0: unlimited. Otherwise, the complete uploads wait for a free slot.
+  int maxConnections = 16; // kept alive for reuse
+
+  // whole-upload retries, with exponential backoff. The data is then kept until the upload completes.
+  int maxRetries = 0;
+  int retryDelayInMs = 250;
+};
+
+struct HttpUploadResult {
+  std::string url;
+  bool success = false;
+  int attemptCount = 0;
+  int64_t latencyInUs = 0; // from the end of the data to the completion
+};
+
+// Shared upload engine: runs the uploads of the senders it creates concurrently, from a single thread
+// (curl multi handle). Connections, DNS and TLS sessions are reused from one upload to the next.
+struct HttpUploader {
+  struct Stats {
+    int64_t uploadCount = 0; // complete
+    int64_t failedCount = 0;
+    int64_t requestCount = 0; // including the retries and reconnections
+    int64_t connectionCount = 0; // newly established
+    int64_t totalLatencyInUs = 0;
+    int64_t maxLatencyInUs = 0;
+  };
+
+  virtual ~HttpUploader() = default; // waits for the finished uploads to complete
+
+  // same semantics as 'createHttpSender'. The senders must not outlive the uploader.
+  // 'afterFinished': the upload only starts once the uploads finished so far are complete
+  // (e.g a manifest is published after the segments it references). It fails if one of them failed.
+  // Beware: with 'maxParallelUploads', flushing a sender waits for its upload to get a slot.
+  virtual std::unique_ptr<HttpSender> createSender(HttpSenderConfig const &config, bool afterFinished = false) = 0;
+
+  // no more data, don't wait: the upload completes in the background.
+  // 'onDone' (optional) is then called from the uploader thread.
+  virtual void finish(std::unique_ptr<HttpSender> sender,
+        std::function<void(HttpUploadResult const &)> onDone = nullptr) = 0;
+
+  virtual Stats getStats() const = 0;
+};
+
+std::unique_ptr<HttpUploader> createHttpUploader(HttpUploaderConfig const &config, Modules::KHost *log);
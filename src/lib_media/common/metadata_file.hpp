@@ -1,7 +1,9 @@
 #pragma once
 
 #include "lib_media/common/resolution.hpp"
+#include "lib_modules/core/database.hpp"
 #include "lib_modules/core/metadata.hpp"
+#include "lib_utils/tools.hpp" // safe_cast
 
 #include <stdint.h>
 #include <string>
@@ -41,4 +43,9 @@ struct MetadataFile : IMetadata {
   bool EOS = true;
 };
 
+// named data with no contents: the muxer wrote it to a file
+inline bool isOnDisk(Data data) {
+  return data->data().len == 0 && !safe_cast<const MetadataFile>(data->getMetadata())->filename.empty();
+}
+
 }
@@ -13,6 +13,8 @@
 
 #include <algorithm> //std::max
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -241,10 +243,15 @@ struct LibavDemux : Module {
         m_host->activate(false); // stop source
         return;
       }
-      std::this_thread::sleep_for(10ms);
+      // woken up by the input thread. Also return regularly, so the pipeline can stop us.
+      std::unique_lock<std::mutex> lock(queueMutex);
+      packetAvailable.wait_for(
+            lock, milliseconds(IDLE_TIMEOUT_IN_MS), [&]() { return done || !packetQueue.isEmpty(); });
       return;
     }
 
+    notify(roomAvailable);
+
     if(!rectifyTimestamps(pkt)) {
       av_packet_unref(&pkt);
       return;
@@ -259,6 +266,12 @@ struct LibavDemux : Module {
     av_packet_unref(&pkt);
   }
 
+  // locked: the waiter can't miss the notification between checking the queue and waiting
+  void notify(std::condition_variable &cv) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    cv.notify_one();
+  }
+
   void declareStreams() {
     for(auto &stream : m_streams) {
       auto output = stream.output;
@@ -282,6 +295,7 @@ struct LibavDemux : Module {
 
   void clean() {
     done = true;
+    notify(roomAvailable);
     if(workingThread.joinable()) {
       workingThread.join();
     }
@@ -420,6 +434,11 @@ struct LibavDemux : Module {
   }
 
   void inputThread() {
+    readPackets();
+    notify(packetAvailable); // 'done' was set
+  }
+
+  void readPackets() {
     if(highPriority && !setHighThreadPriority())
       m_host->log(Warning, "Couldn't change reception thread priority to realtime.");
 
@@ -469,8 +488,11 @@ struct LibavDemux : Module {
         }
         m_host->log(
               m_formatCtx->pb && !m_formatCtx->pb->seekable ? Warning : Debug, "Dispatch queue is full - regulating.");
-        std::this_thread::sleep_for(10ms);
+        std::unique_lock<std::mutex> lock(queueMutex);
+        roomAvailable.wait(lock, [&]() { return done || !packetQueue.isFull(); });
       }
+
+      notify(packetAvailable);
     }
   }
 
@@ -571,6 +593,12 @@ struct LibavDemux : Module {
   std::thread workingThread;
   std::atomic_bool done;
   QueueLockFree<AVPacket> packetQueue;
+
+  // wake-ups between process() and the input thread
+  static auto const IDLE_TIMEOUT_IN_MS = 100;
+  std::mutex queueMutex;
+  std::condition_variable packetAvailable;
+  std::condition_variable roomAvailable;
   AVFormatContext *m_formatCtx;
   AVIOContext *m_avioCtx = nullptr;
   const DemuxConfig::ReadFunc m_read;
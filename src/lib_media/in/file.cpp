@@ -4,9 +4,18 @@
 #include "lib_modules/utils/factory.hpp" // registerModule
 #include "lib_modules/utils/helper.hpp"
 #include "lib_utils/format.hpp"
-#include "lib_utils/log_sink.hpp" // Info
+#include "lib_utils/log_sink.hpp" // Info, Warning
 #include "lib_utils/tools.hpp"
 
+#include <algorithm> // min
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h> // sysconf
+#endif
+
 using namespace Modules;
 
 namespace {
@@ -15,6 +24,53 @@ auto const IOSIZE = 66176;
 static_assert(IOSIZE % 32 == 0, "IOSIZE must be a multiple of 32");
 static_assert(IOSIZE % 188 == 0, "IOSIZE must be a multiple of 188");
 
+#ifndef _WIN32
+// memory-mapped mode: pages are prefetched this far ahead of the reader...
+size_t const READ_AHEAD = 4 * 1024 * 1024;
+// ... and released from our address space this far behind it.
+// Views still held downstream remain valid: the pages are read again from the file if needed.
+size_t const RELEASE_DELAY = 16 * 1024 * 1024;
+
+struct MappedFile {
+  MappedFile(uint8_t *ptr_, size_t size_)
+      : ptr(ptr_)
+      , size(size_) {}
+  ~MappedFile() { munmap(ptr, size); }
+  uint8_t *const ptr;
+  size_t const size;
+};
+
+// Read-only: the mapping is PROT_READ, and writing to it would crash.
+// A mutable view is refused right away, instead of failing later on the first write.
+struct MappedBuffer : IBuffer {
+  MappedBuffer(std::shared_ptr<MappedFile> file_, size_t offset, size_t len)
+      : file(file_)
+      , view{file->ptr + offset, len} {}
+
+  Span data() override { throw std::runtime_error("FileInput: memory-mapped buffers are read-only"); }
+
+  SpanC data() const override { return view; }
+
+  private:
+  std::shared_ptr<MappedFile> const file; // keeps the mapping alive
+  SpanC const view;
+};
+
+// returns nullptr when the file can't be mapped (pipes, special files, empty files...)
+std::shared_ptr<MappedFile> mapFile(FILE *file) {
+  struct stat st;
+  if(fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return nullptr;
+
+  auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if(ptr == MAP_FAILED)
+    return nullptr;
+
+  madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+  return std::make_shared<MappedFile>((uint8_t *)ptr, st.st_size);
+}
+#endif
+
 class FileInput : public Module {
   public:
   FileInput(KHost *host, FileInputConfig const &config)
@@ -33,6 +89,17 @@ class FileInput : public Module {
                   config.filename, size, m_blockSize)
                   .c_str());
 
+    if(config.memoryMapped) {
+#ifndef _WIN32
+      m_mapping = mapFile(file);
+      m_pageSize = sysconf(_SC_PAGESIZE);
+      if(!m_mapping)
+        m_host->log(Info, format("File %s can't be memory-mapped: reading it instead", config.filename).c_str());
+#else
+      m_host->log(Warning, "Memory-mapped files aren't supported on this platform: reading instead");
+#endif
+    }
+
     m_host->activate(true);
 
     output = addOutput();
@@ -41,6 +108,13 @@ class FileInput : public Module {
   ~FileInput() { fclose(file); }
 
   void process() override {
+#ifndef _WIN32
+    if(m_mapping) {
+      processMapped();
+      return;
+    }
+#endif
+
     auto out = output->allocData<DataRawResizable>(m_blockSize);
     size_t read = fread(out->buffer->data().ptr, 1, m_blockSize, file);
     if(read == 0) {
@@ -53,6 +127,46 @@ class FileInput : public Module {
   }
 
   private:
+#ifndef _WIN32
+  void processMapped() {
+    auto const size = std::min((size_t)m_blockSize, m_mapping->size - m_pos);
+    if(size == 0) {
+      m_host->activate(false);
+      return;
+    }
+
+    auto out = output->allocData<DataRaw>(0);
+    out->buffer = std::make_shared<MappedBuffer>(m_mapping, m_pos, size);
+    out->set(PresentationTime{0});
+    m_pos += size;
+
+    adviseKernel();
+    output->post(out);
+  }
+
+  // a few calls per READ_AHEAD bytes, whatever the block size
+  void adviseKernel() {
+    if(m_pos + READ_AHEAD / 2 > m_prefetchedPos && m_prefetchedPos < m_mapping->size) {
+      auto const begin = m_prefetchedPos / m_pageSize * m_pageSize;
+      auto const end = std::min(m_pos + READ_AHEAD, m_mapping->size);
+      madvise(m_mapping->ptr + begin, end - begin, MADV_WILLNEED);
+      m_prefetchedPos = end;
+    }
+
+    if(m_pos > m_releasedPos + RELEASE_DELAY + READ_AHEAD) {
+      auto const end = (m_pos - RELEASE_DELAY) / m_pageSize * m_pageSize;
+      madvise(m_mapping->ptr + m_releasedPos, end - m_releasedPos, MADV_DONTNEED);
+      m_releasedPos = end;
+    }
+  }
+
+  std::shared_ptr<MappedFile> m_mapping;
+  size_t m_pageSize = 0;
+  size_t m_pos = 0; // next byte to output
+  size_t m_prefetchedPos = 0;
+  size_t m_releasedPos = 0;
+#endif
+
   KHost *const m_host;
   FILE *file;
   OutputDefault *output;
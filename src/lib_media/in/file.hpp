@@ -5,4 +5,8 @@
 struct FileInputConfig {
   std::string filename;
   int blockSize = 0;
+
+  // output data are read-only views over the memory-mapped file, instead of copies.
+  // Pipes and special files are read normally.
+  bool memoryMapped = false;
 };
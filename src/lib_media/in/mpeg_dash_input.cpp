@@ -5,15 +5,14 @@
 #include "lib_utils/format.hpp"
 #include "lib_utils/log_sink.hpp"
 #include "lib_utils/queue.hpp"
-#include "lib_utils/time.hpp" // getUTC
+#include "lib_utils/scheduler.hpp"
+#include "lib_utils/time.hpp" // g_UtcClock
 #include "lib_utils/tools.hpp"
 
 #include <algorithm> // max
-#include <atomic>
 #include <chrono>
-#include <cstring> // memcpy
+#include <climits> // INT64_MAX
 #include <map>
-#include <thread>
 
 using namespace std;
 using namespace Modules::In;
@@ -22,84 +21,72 @@ string expandVars(string input, map<string, string> const &values);
 
 namespace Modules { namespace In {
 
-/*binary threaded executor: will execute the latest queued request only*/
-struct BinaryExecutor {
-  BinaryExecutor(exception_ptr eptr)
-      : eptr(eptr)
-      , th(&BinaryExecutor::threadProc, this)
-      , fct(nullptr) {
-    done = false;
-  }
-
-  ~BinaryExecutor() {
-    fct = nullptr; // cancel unflushed task (if any) and signal end of queue
-    done = true; // unlock queue
-    th.join(); // return as soon as current processing is finished
-  }
-
-  void post(function<void()> next, bool priority = false) {
-    if(eptr)
-      rethrow_exception(eptr);
-
-    unique_lock<mutex> lock(m);
-    if(fct && !priority)
-      return;
-
-    fct = next;
-  }
-
-  private:
-  void threadProc() {
-    try {
-      while(!done) {
-        function<void()> next = nullptr;
-
-        {
-          unique_lock<mutex> lock(m);
-          if(fct) {
-            next = fct;
-            fct = nullptr;
-          }
-        }
-
-        if(next)
-          next();
-        else
-          this_thread::sleep_for(chrono::milliseconds(100));
-      }
-    } catch(...) {
-      eptr = current_exception();
-    }
-  }
-
-  exception_ptr eptr;
-  thread th;
-  mutex m; // protects @fct
-  function<void()> fct;
-  std::atomic_bool done;
+struct MPEG_DASH_Input::Segment {
+  int64_t seq; // delivery order
+  int64_t number; // -1: initialization segment
+  string url;
+  vector<uint8_t> buffered; // received while an older segment was being delivered
+  bool complete = false;
+  int retryCount = 0;
 };
 
 struct MPEG_DASH_Input::Stream {
   Stream(OutputDefault *out,
+        int setIdx,
         Representation const *rep,
         Fraction segmentDuration,
-        unique_ptr<IFilePuller> source,
-        exception_ptr eptr)
+        DownloadSinkConfig const &sinkCfg)
       : out(out)
+      , setIdx(setIdx)
       , rep(rep)
       , segmentDuration(segmentDuration)
-      , source(std::move(source))
-      , executor(new BinaryExecutor(eptr)) {}
+      , sink(out, sinkCfg) {}
 
   OutputDefault *out;
-  Representation const *rep;
+  int setIdx;
+  Representation const *rep; // nullptr: disabled
   bool initializationChunkSent = false;
-  int64_t currNumber = 0;
+  int64_t currNumber = 0; // next segment to request
   Fraction segmentDuration;
-  unique_ptr<IFilePuller> source;
-  unique_ptr<BinaryExecutor> executor;
+  bool ended = false; // end of period, or missing segment
+  bool wakeUpPending = false;
+
+  int inFlight = 0;
+  int64_t nextSeq = 0;
+  map<int64_t, shared_ptr<Segment>> pending; // requested, not fully delivered yet
+  bool delivering = false; // a thread is writing to 'sink', without holding the lock: one at a time
+  condition_variable deliveryDone;
+  DownloadSink sink;
+
+  Queue<shared_ptr<Segment>> jobs; // nullptr: exit
+  vector<unique_ptr<IFilePuller>> sources;
+  vector<thread> workers;
 };
 
+namespace {
+// exclusive access to the sink of a stream. 'lock' (on the module mutex) must be held on construction.
+struct DeliveryToken {
+  DeliveryToken(bool &delivering, unique_lock<mutex> &lock, condition_variable &changed)
+      : delivering(delivering)
+      , lock(lock)
+      , changed(changed) {
+    changed.wait(lock, [&]() { return !delivering; });
+    delivering = true;
+  }
+
+  ~DeliveryToken() {
+    if(!lock.owns_lock())
+      lock.lock();
+    delivering = false;
+    changed.notify_all();
+  }
+
+  bool &delivering;
+  unique_lock<mutex> &lock;
+  condition_variable &changed;
+};
+}
+
 static string dirName(string path) {
   auto i = path.rfind('/');
   if(i != path.npos)
@@ -121,8 +108,19 @@ shared_ptr<IMetadata> MPEG_DASH_Input::createMetadata(Representation const &rep)
   }
 }
 
-MPEG_DASH_Input::MPEG_DASH_Input(KHost *host, IFilePullerFactory *filePullerFactory, string const &url)
-    : m_host(host) {
+MPEG_DASH_Input::MPEG_DASH_Input(
+      KHost *host, IFilePullerFactory *filePullerFactory, string const &url, MpegDashInputConfig const &cfg)
+    : m_host(host)
+    , m_cfg(cfg)
+    , m_url(url)
+    , m_scheduler(new Scheduler)
+    , m_segmentsInFlight(host, "segments_in_flight")
+    , m_bufferAheadMs(host, "buffer_ahead_ms")
+    , m_retryCount(host, "segment_retries")
+    , m_mpdUpdateCount(host, "mpd_updates") {
+  if(m_cfg.segmentsInFlight < 1)
+    throw error("segmentsInFlight must be positive");
+
   m_host->activate(true);
 
   // GET MPD FROM HTTP
@@ -135,7 +133,8 @@ MPEG_DASH_Input::MPEG_DASH_Input(KHost *host, IFilePullerFactory *filePullerFact
   mpd = parseMpd({(const char *)mpdAsText.data(), mpdAsText.size()});
 
   // DECLARE OUTPUT PORTS
-  for(auto &set : mpd->sets) {
+  for(int setIdx = 0; setIdx < (int)mpd->sets.size(); ++setIdx) {
+    auto &set = mpd->sets[setIdx];
     if(!set.representations.empty()) {
       auto &rep = set.representations.front();
       auto meta = createMetadata(rep);
@@ -146,8 +145,8 @@ MPEG_DASH_Input::MPEG_DASH_Input(KHost *host, IFilePullerFactory *filePullerFact
 
       auto out = addOutput();
       out->setMetadata(meta);
-      auto stream = make_unique<Stream>(
-            out, &rep, Fraction(rep.duration(mpd.get()), rep.timescale(mpd.get())), filePullerFactory->create(), eptr);
+      auto const segmentDuration = Fraction(rep.duration(mpd.get()), rep.timescale(mpd.get()));
+      auto stream = make_unique<Stream>(out, setIdx, &rep, segmentDuration, m_cfg.output);
       m_streams.push_back(std::move(stream));
     }
   }
@@ -155,93 +154,335 @@ MPEG_DASH_Input::MPEG_DASH_Input(KHost *host, IFilePullerFactory *filePullerFact
   for(auto &stream : m_streams) {
     stream->currNumber = stream->rep->startNumber(mpd.get());
     if(mpd->dynamic) {
-      auto now = mpd->publishTime;
-      if(!mpd->publishTime)
-        now = (int64_t)getUTC();
-
       if(stream->segmentDuration.num == 0)
         throw runtime_error("No duration for stream");
 
-      stream->currNumber += int64_t(stream->segmentDuration.inverse() * (now - mpd->availabilityStartTime)) / 1000 + 1;
-      // HACK: add one segment latency
-      stream->currNumber = std::max<int64_t>(stream->currNumber - 2, stream->rep->startNumber(mpd.get()));
+      stream->currNumber = liveEdgeNumber(*stream->rep);
     }
   }
-}
 
-MPEG_DASH_Input::~MPEG_DASH_Input() {}
+  for(auto &stream : m_streams) {
+    for(int i = 0; i < m_cfg.segmentsInFlight; ++i) {
+      auto source = filePullerFactory->create();
+      stream->workers.push_back(thread(&MPEG_DASH_Input::downloadProc, this, stream.get(), source.get()));
+      stream->sources.push_back(std::move(source));
+    }
+  }
 
-void MPEG_DASH_Input::processStream(Stream *stream) {
-  // evaluate once at start as it may be modified from another thread
-  auto rep = stream->rep;
+  if(mpd->dynamic && mpd->minUpdatePeriod > 0) {
+    m_mpdSource = filePullerFactory->create();
+    m_mpdThread = thread(&MPEG_DASH_Input::mpdUpdateProc, this);
+  }
+}
 
-  if(!rep) {
-    // this adaptation set is disabled: move to the next step
-    if(stream->initializationChunkSent)
-      stream->currNumber++;
+MPEG_DASH_Input::~MPEG_DASH_Input() {
+  {
+    unique_lock<mutex> lock(m_mutex);
+    m_stopping = true;
+    m_changed.notify_all();
+  }
 
-    return;
+  if(m_mpdThread.joinable()) {
+    m_mpdSource->askToExit();
+    m_mpdThread.join();
   }
 
-  if(mpd->periodDuration) {
-    if(stream->segmentDuration * (stream->currNumber - rep->startNumber(mpd.get())) >= mpd->periodDuration) {
-      m_host->log(Info, "End of period");
-      m_host->activate(false);
-      return;
+  // no more wake-ups nor retries
+  m_scheduler.reset();
+
+  for(auto &stream : m_streams) {
+    for(auto &source : stream->sources) {
+      source->askToExit();
+      stream->jobs.push(nullptr);
     }
+    for(auto &worker : stream->workers)
+      worker.join();
   }
+}
 
-  string url;
+// the latest segment available at this time
+int64_t MPEG_DASH_Input::liveEdgeNumber(Representation const &rep) const {
+  auto const startNumber = rep.startNumber(mpd.get());
+  if(rep.duration(mpd.get()) == 0)
+    return startNumber;
 
-  {
-    map<string, string> vars;
+  auto const now = int64_t(g_UtcClock->getTime() * 1000);
+  auto const elapsedInMs = now - mpd->availabilityStartTime;
+  auto const segmentCount = elapsedInMs * rep.timescale(mpd.get()) / (1000 * (int64_t)rep.duration(mpd.get()));
+  return std::max<int64_t>(startNumber + segmentCount - 1, startNumber);
+}
 
+// a live segment becomes available once it's complete
+int64_t MPEG_DASH_Input::availabilityTimeInMs(Representation const &rep, int64_t number) const {
+  if(!mpd->dynamic)
+    return 0;
+
+  auto const endTime = (number - rep.startNumber(mpd.get()) + 1) * rep.duration(mpd.get());
+  return mpd->availabilityStartTime + endTime * 1000 / rep.timescale(mpd.get());
+}
+
+// requests the next segments, up to 'segmentsInFlight', as soon as they're available
+void MPEG_DASH_Input::schedule(Stream *stream) {
+  auto const rep = stream->rep;
+
+  while(m_started && !m_stopping && rep && !stream->ended && stream->inFlight < m_cfg.segmentsInFlight) {
+    auto segment = make_shared<Segment>();
+
+    map<string, string> vars;
     vars["RepresentationID"] = rep->id;
 
     if(stream->initializationChunkSent) {
+      if(mpd->periodDuration) {
+        if(stream->segmentDuration * (stream->currNumber - rep->startNumber(mpd.get())) >= mpd->periodDuration) {
+          stream->ended = true;
+          break;
+        }
+      }
+
+      auto const delayInMs = availabilityTimeInMs(*rep, stream->currNumber) - int64_t(g_UtcClock->getTime() * 1000);
+      if(delayInMs > 0) {
+        if(!stream->wakeUpPending) {
+          stream->wakeUpPending = true;
+          auto wakeUp = [this, stream](Fraction) {
+            unique_lock<mutex> lock(m_mutex);
+            stream->wakeUpPending = false;
+            schedule(stream);
+          };
+          m_scheduler->scheduleIn(wakeUp, Fraction(delayInMs, 1000));
+        }
+        break;
+      }
+
       vars["Number"] = format("%s", stream->currNumber);
-      stream->currNumber++;
-      url = m_mpdDirname + "/" + expandVars(rep->media(mpd.get()), vars);
+      segment->number = stream->currNumber++;
+      segment->url = m_mpdDirname + "/" + expandVars(rep->media(mpd.get()), vars);
     } else {
-      url = m_mpdDirname + "/" + expandVars(rep->initialization(mpd.get()), vars);
+      stream->initializationChunkSent = true;
+      segment->number = -1;
+      segment->url = m_mpdDirname + "/" + expandVars(rep->initialization(mpd.get()), vars);
+    }
+
+    segment->seq = stream->nextSeq++;
+    stream->pending[segment->seq] = segment;
+    stream->inFlight++;
+    stream->jobs.push(segment);
+  }
+
+  updateStats();
+}
+
+void MPEG_DASH_Input::updateStats() {
+  int inFlight = 0;
+  int64_t bufferAheadMs = INT64_MAX;
+
+  for(auto &stream : m_streams) {
+    inFlight += stream->inFlight;
+    if(!stream->rep || stream->ended)
+      continue;
+
+    // media requested ahead of the segment being delivered
+    auto headNumber = stream->currNumber;
+    for(auto &segment : stream->pending) {
+      if(segment.second->number >= 0) {
+        headNumber = segment.second->number;
+        break;
+      }
     }
+    auto const aheadMs = (int64_t)(stream->segmentDuration * (stream->currNumber - headNumber) * 1000);
+    bufferAheadMs = std::min(bufferAheadMs, aheadMs);
   }
 
-  m_host->log(Debug, format("wget: '%s'", url).c_str());
+  *m_segmentsInFlight = inFlight;
+  *m_bufferAheadMs = bufferAheadMs == INT64_MAX ? 0 : (int32_t)bufferAheadMs;
+}
+
+void MPEG_DASH_Input::downloadProc(Stream *stream, IFilePuller *source) {
+  source->setProgressCallback([this, stream]() { flushIfStale(stream); });
+
+  while(auto segment = stream->jobs.pop()) {
+    try {
+      downloadSegment(stream, source, segment);
+    } catch(std::runtime_error const &) {
+      unique_lock<mutex> lock(m_mutex);
+      if(!eptr)
+        eptr = current_exception();
+      m_changed.notify_all();
+    }
+  }
+}
+
+void MPEG_DASH_Input::downloadSegment(Stream *stream, IFilePuller *source, shared_ptr<Segment> segment) {
+  m_host->log(Debug, format("wget: '%s'", segment->url).c_str());
 
   bool empty = true;
 
+  // the segment being delivered goes straight to the output buffers, the next ones wait for their turn
   auto onBuffer = [&](SpanC chunk) {
     empty = false;
 
-    auto data = make_shared<DataRaw>(chunk.len);
-    memcpy(data->buffer->data().ptr, chunk.ptr, chunk.len);
-    stream->out->post(data);
+    unique_lock<mutex> lock(m_mutex);
+    auto const isHead = !stream->pending.empty() && stream->pending.begin()->second == segment;
+    if(!isHead) {
+      segment->buffered.insert(segment->buffered.end(), chunk.ptr, chunk.ptr + chunk.len);
+      return;
+    }
+
+    // the sink may block (backpressure): the other downloads keep buffering meanwhile
+    DeliveryToken token(stream->delivering, lock, stream->deliveryDone);
+    auto buffered = std::move(segment->buffered);
+    segment->buffered = {};
+    lock.unlock();
+
+    if(!buffered.empty())
+      stream->sink.write({buffered.data(), buffered.size()});
+    stream->sink.write(chunk);
   };
-  try {
-    stream->source->wget(url.c_str(), onBuffer);
-  } catch(std::runtime_error const &) {
-    m_host->activate(false);
-    throw;
+  source->wget(segment->url.c_str(), onBuffer);
+
+  {
+    unique_lock<mutex> lock(m_mutex);
+
+    if(m_stopping)
+      return;
+
+    if(empty && mpd->dynamic && segment->number >= 0 && segment->retryCount >= m_cfg.maxRetries) {
+      // deliver the next ones
+      m_host->log(Warning, format("skipping missing segment: '%s'", segment->url).c_str());
+    } else if(empty) {
+      if(mpd->dynamic) {
+        // too early, retry
+        segment->retryCount++;
+        (*m_retryCount)++;
+        auto retry = [this, stream, segment](Fraction) {
+          unique_lock<mutex> lock(m_mutex);
+          if(!m_stopping)
+            stream->jobs.push(segment);
+        };
+        m_scheduler->scheduleIn(retry, Fraction(m_cfg.retryDelayInMs, 1000));
+        return;
+      }
+
+      if(!stream->ended)
+        m_host->log(Error, format("can't download file: '%s'", segment->url).c_str());
+
+      // don't deliver anything past the missing segment
+      stream->ended = true;
+      stream->pending.erase(stream->pending.upper_bound(segment->seq), stream->pending.end());
+    }
+
+    segment->complete = true;
+    stream->inFlight--;
+    schedule(stream);
   }
 
-  if(empty) {
-    if(mpd->dynamic) {
-      stream->currNumber = std::max<int64_t>(stream->currNumber - 1, rep->startNumber(mpd.get())); // too early, retry
+  deliver(stream);
+  m_changed.notify_all();
+}
+
+// posts, in order, what was received for the oldest pending segments
+void MPEG_DASH_Input::deliver(Stream *stream) {
+  unique_lock<mutex> lock(m_mutex);
+  DeliveryToken token(stream->delivering, lock, stream->deliveryDone);
+
+  while(!stream->pending.empty()) {
+    auto head = stream->pending.begin()->second;
+    auto buffered = std::move(head->buffered);
+    head->buffered = {};
+    lock.unlock();
+
+    if(!buffered.empty())
+      stream->sink.write({buffered.data(), buffered.size()});
+
+    lock.lock();
+    if(!head->complete)
+      return;
+    stream->pending.erase(stream->pending.begin());
+    lock.unlock();
+
+    // don't hold the end of a segment until the next one arrives
+    stream->sink.flush();
+    lock.lock();
+  }
+}
+
+// posts the partial output buffer when the download of the head segment stalls
+void MPEG_DASH_Input::flushIfStale(Stream *stream) {
+  unique_lock<mutex> lock(m_mutex);
+  if(stream->delivering)
+    return; // the sink is being written to
+
+  DeliveryToken token(stream->delivering, lock, stream->deliveryDone);
+  lock.unlock();
+  stream->sink.flushIfStale();
+}
+
+void MPEG_DASH_Input::mpdUpdateProc() {
+  unique_lock<mutex> lock(m_mutex);
+
+  while(!m_stopping) {
+    auto const deadline = chrono::steady_clock::now() + chrono::seconds(mpd->minUpdatePeriod);
+    if(m_changed.wait_until(lock, deadline, [&]() { return m_stopping; }))
+      break;
+
+    lock.unlock();
+    unique_ptr<DashMpd> newMpd;
+    try {
+      auto mpdAsText = download(m_mpdSource.get(), m_url.c_str());
+      if(mpdAsText.empty())
+        throw runtime_error(format("can't get mpd '%s'", m_url));
+      newMpd = parseMpd({(const char *)mpdAsText.data(), mpdAsText.size()});
+    } catch(std::exception const &e) {
+      m_host->log(Warning, format("MPD update failed: %s", e.what()).c_str());
+    }
+    lock.lock();
+
+    if(newMpd && !m_stopping)
+      updateMpd(std::move(newMpd));
+  }
+}
+
+void MPEG_DASH_Input::updateMpd(unique_ptr<DashMpd> newMpd) {
+  for(auto &stream : m_streams) {
+    auto const &oldReps = mpd->sets[stream->setIdx].representations;
+    if(stream->setIdx >= (int)newMpd->sets.size()
+          || newMpd->sets[stream->setIdx].representations.size() != oldReps.size()) {
+      m_host->log(Warning, "Ignoring mpd update: the adaptation sets changed");
       return;
     }
-    m_host->log(Error, format("can't download file: '%s'", url).c_str());
-    m_host->activate(false);
   }
 
-  stream->initializationChunkSent = true;
+  for(auto &stream : m_streams) {
+    if(stream->rep) {
+      auto const repIdx = stream->rep - mpd->sets[stream->setIdx].representations.data();
+      stream->rep = &newMpd->sets[stream->setIdx].representations[repIdx];
+    }
+  }
+
+  mpd = std::move(newMpd);
+  (*m_mpdUpdateCount)++;
+
+  for(auto &stream : m_streams)
+    schedule(stream.get());
+
+  m_changed.notify_all();
 }
 
 void MPEG_DASH_Input::process() {
-  bool allDisabled = true;
-  for(auto &s : m_streams)
-    if(s->rep)
+  unique_lock<mutex> lock(m_mutex);
+
+  if(eptr) {
+    m_host->activate(false);
+    rethrow_exception(eptr);
+  }
+
+  bool allDisabled = true, allEnded = true;
+  for(auto &s : m_streams) {
+    if(s->rep) {
       allDisabled = false;
+      if(!s->ended || !s->pending.empty())
+        allEnded = false;
+    }
+  }
 
   if(allDisabled) {
     // all streams disabled, stop session
@@ -249,8 +490,20 @@ void MPEG_DASH_Input::process() {
     return;
   }
 
-  for(auto &stream : m_streams)
-    stream->executor->post(std::bind(&MPEG_DASH_Input::processStream, this, stream.get()));
+  if(allEnded) {
+    m_host->log(Info, "End of period");
+    m_host->activate(false);
+    return;
+  }
+
+  if(!m_started) {
+    m_started = true;
+    for(auto &stream : m_streams)
+      schedule(stream.get());
+  }
+
+  // the downloads are driven by segment availability: only wait for the end of the session, or an error
+  m_changed.wait_for(lock, chrono::milliseconds(50));
 }
 
 int MPEG_DASH_Input::getNumAdaptationSets() const { return getNumOutputs(); }
@@ -259,38 +512,46 @@ int MPEG_DASH_Input::getNumRepresentationsInAdaptationSet(int adaptationSetIdx)
   if(adaptationSetIdx < 0 || adaptationSetIdx >= (int)m_streams.size())
     throw error("getNumRepresentationsInAdaptationSet(): wrong index");
 
-  return m_streams[adaptationSetIdx]->rep->set(mpd.get()).representations.size();
+  unique_lock<mutex> lock(m_mutex);
+  return mpd->sets[m_streams[adaptationSetIdx]->setIdx].representations.size();
 }
 
 std::string MPEG_DASH_Input::getSRD(int adaptationSetIdx) const {
   if(adaptationSetIdx < 0 || adaptationSetIdx >= (int)m_streams.size())
     throw error("getSRD(): wrong AdaptationSet index");
 
-  return m_streams[adaptationSetIdx]->rep->set(mpd.get()).srd;
+  unique_lock<mutex> lock(m_mutex);
+  return mpd->sets[m_streams[adaptationSetIdx]->setIdx].srd;
 }
 
 void MPEG_DASH_Input::enableStream(int asIdx, int repIdx) {
   if(asIdx < 0 || asIdx >= (int)m_streams.size())
     throw error("enableStream(): wrong adaptation set index");
 
-  if(repIdx < 0 || repIdx >= (int)m_streams[asIdx]->rep->set(mpd.get()).representations.size())
+  unique_lock<mutex> lock(m_mutex);
+  auto stream = m_streams[asIdx].get();
+  auto &reps = mpd->sets[stream->setIdx].representations;
+
+  if(repIdx < 0 || repIdx >= (int)reps.size())
     throw error("enableStream(): wrong representation index");
 
-  m_streams[asIdx]->executor->post(
-        [this, asIdx, repIdx]() {
-          auto curRep = m_streams[asIdx]->rep;
-          auto &newRep = curRep->set(mpd.get()).representations[repIdx];
-          m_streams[asIdx]->currNumber += newRep.startNumber(mpd.get()) - curRep->startNumber(mpd.get());
-          m_streams[asIdx]->rep = &newRep;
-        },
-        true);
+  auto &newRep = reps[repIdx];
+  if(stream->rep)
+    stream->currNumber += newRep.startNumber(mpd.get()) - stream->rep->startNumber(mpd.get());
+  else if(mpd->dynamic)
+    stream->currNumber = std::max(stream->currNumber, liveEdgeNumber(newRep)); // catch up after having been disabled
+  stream->rep = &newRep;
+
+  schedule(stream);
 }
 
 void MPEG_DASH_Input::disableStream(int asIdx) {
   if(asIdx < 0 || asIdx >= (int)m_streams.size())
     throw error("disableStream(): wrong adaptation set index");
 
-  m_streams[asIdx]->executor->post([this, asIdx]() { m_streams[asIdx]->rep = nullptr; }, true);
+  unique_lock<mutex> lock(m_mutex);
+  m_streams[asIdx]->rep = nullptr;
+  updateStats();
 }
 
 }}
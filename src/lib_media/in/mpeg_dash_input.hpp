@@ -1,9 +1,13 @@
 #pragma once
 
+#include "lib_media/common/download_sink.hpp"
 #include "lib_media/common/file_puller.hpp"
 #include "lib_modules/utils/helper.hpp"
 
+#include <condition_variable>
 #include <exception>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 struct IAdaptationControl {
@@ -12,19 +16,39 @@ struct IAdaptationControl {
   virtual std::string getSRD(int adaptationSetIdx) const = 0;
 
   // no more that one stream per adaptation set can be enabled
-  // be aware that these calls will block until the command is effectively enqueued
+  // the change applies to the segments which aren't requested yet
   virtual void enableStream(int asIdx, int repIdx) = 0;
   virtual void disableStream(int asIdx) = 0;
 };
 
 struct DashMpd;
 struct Representation;
+struct IScheduler;
+
+struct MpegDashInputConfig {
+  // segments downloaded concurrently, for each stream
+  int segmentsInFlight = 2;
+
+  // live: a segment missing at its availability time is requested again after this delay
+  int retryDelayInMs = 200;
+
+  // live: a segment still missing after this many retries is skipped
+  int maxRetries = 10;
+
+  DownloadSinkConfig output;
+};
 
 namespace Modules { namespace In {
 
+// Downloads the segments of a DASH presentation (SegmentTemplate with $Number$).
+// Live segments are requested as soon as they become available. Several segments per stream
+// are downloaded concurrently, and delivered in order.
 class MPEG_DASH_Input : public Module, public IAdaptationControl {
   public:
-  MPEG_DASH_Input(KHost *host, IFilePullerFactory *filePullerFactory, std::string const &url);
+  MPEG_DASH_Input(KHost *host,
+        IFilePullerFactory *filePullerFactory,
+        std::string const &url,
+        MpegDashInputConfig const &cfg = MpegDashInputConfig());
   ~MPEG_DASH_Input();
   void process() override;
 
@@ -37,19 +61,50 @@ class MPEG_DASH_Input : public Module, public IAdaptationControl {
   void disableStream(int asIdx) override;
 
   private:
+  struct Stream;
+  struct Segment;
+
   std::shared_ptr<IMetadata> createMetadata(Representation const &rep);
 
-  KHost *const m_host;
+  // all these are called with 'm_mutex' held
+  int64_t liveEdgeNumber(Representation const &rep) const;
+  int64_t availabilityTimeInMs(Representation const &rep, int64_t number) const;
+  void schedule(Stream *stream);
+  void updateMpd(std::unique_ptr<DashMpd> newMpd);
+  void updateStats();
 
-  std::vector<std::unique_ptr<IFilePuller>> m_sources;
+  void downloadProc(Stream *stream, IFilePuller *source);
+  void downloadSegment(Stream *stream, IFilePuller *source, std::shared_ptr<Segment> segment);
+  void deliver(Stream *stream);
+  void flushIfStale(Stream *stream);
+  void mpdUpdateProc();
+
+  KHost *const m_host;
+  MpegDashInputConfig const m_cfg;
+  std::string const m_url;
 
   std::unique_ptr<DashMpd> mpd;
   std::string m_mpdDirname;
 
-  struct Stream;
   std::vector<std::unique_ptr<Stream>> m_streams;
+
+  mutable std::mutex m_mutex; // protects the MPD and the streams
+  std::condition_variable m_changed;
+  bool m_started = false;
+  bool m_stopping = false;
   std::exception_ptr eptr;
-  void processStream(Stream *stream);
+
+  // wakes us up when the next segments become available
+  std::unique_ptr<IScheduler> m_scheduler;
+
+  // live: background MPD updates, every 'minimumUpdatePeriod'
+  std::unique_ptr<IFilePuller> m_mpdSource;
+  std::thread m_mpdThread;
+
+  HostCounter m_segmentsInFlight;
+  HostCounter m_bufferAheadMs;
+  HostCounter m_retryCount;
+  HostCounter m_mpdUpdateCount;
 };
 
 }}
@@ -0,0 +1,436 @@
+// Fragmented MP4 muxer for H.264, HEVC and AAC: a lightweight alternative to GPACMuxMP4 for the live CMAF case
+// (FragmentedSegment policy). Each sample is written on arrival into the output buffer (Annex B converted to
+// length-prefixed NAL units), so the input is released right away. The output is always in memory: 'baseName' only
+// names the segments.
+// The init segment is laid out as GPACMuxMP4's (brands, movie timescale, edit list for the initial offset), and so is
+// the timeline.
+
+#include "fmp4_writer.hpp"
+#include "mux_mp4_config.hpp"
+
+#include "../common/attributes.hpp"
+#include "../common/metadata.hpp"
+#include "../common/metadata_file.hpp"
+#include "lib_modules/utils/factory.hpp"
+#include "lib_modules/utils/helper.hpp"
+#include "lib_utils/format.hpp"
+#include "lib_utils/log_sink.hpp"
+#include "lib_utils/tools.hpp" // enforce, safe_cast
+
+#include <algorithm> // std::max
+
+auto const TIMESCALE_MUL = 100; // same as GPACMuxMP4
+
+namespace Modules {
+namespace Mux {
+
+class CmafMux : public ModuleS {
+  public:
+  CmafMux(KHost *host, Mp4MuxConfig const &cfg)
+      : m_host(host)
+      , m_utcStartTime(cfg.utcStartTime)
+      , m_compatFlags(cfg.compatFlags)
+      , m_fragmentPolicy(cfg.fragmentPolicy)
+      , m_segmentDurationInMs(cfg.segmentDurationInMs)
+      , m_fragmentDurationInMs(cfg.fragmentDurationInMs)
+      , m_baseName(cfg.baseName)
+      , m_lang(cfg.lang) {
+    if(cfg.segmentPolicy != FragmentedSegment)
+      throw error("Unsupported segment policy: only FragmentedSegment is supported (use GPACMuxMP4).");
+    if(m_fragmentPolicy == NoFragment)
+      throw error("Inconsistent parameters: segmented policies require fragmentation to be enabled.");
+    if(m_segmentDurationInMs == 0)
+      throw error("Inconsistent parameters: segment duration is 0 ms.");
+    if(m_fragmentDurationInMs && m_fragmentPolicy != OneFragmentPerFrame)
+      throw error("Inconsistent parameters: fragment duration requires the OneFragmentPerFrame policy.");
+    if(m_compatFlags & SmoothStreaming)
+      throw error("Unsupported compatibility flag: SmoothStreaming (use GPACMuxMP4).");
+
+    if(m_compatFlags & FlushFragMemory)
+      this->allocatorSize = 100 * ALLOC_NUM_BLOCKS_DEFAULT; // same as GPACMuxMP4
+
+    m_output = addOutput();
+  }
+
+  void processOne(Data data) override {
+    if(isDeclaration(data))
+      return;
+
+    if(inputs[0]->updateMetadata(data)) {
+      if(m_writer)
+        m_host->log(Warning, "Input format changed: ignored.");
+      else
+        declareStream(data);
+    }
+    if(!m_writer)
+      throw error("Unknown input format: no metadata.");
+
+    auto const dataDTS = data->get<DecodingTime>().time;
+    auto dataDurationInTs = clockToTimescale(dataDTS - m_initDTSIn180k, m_track.timescale) - m_DTS;
+
+    // same sample durations as GPACMuxMP4
+    if(m_compatFlags & ExactInputDur) {
+      if(m_lastData) {
+        if(dataDurationInTs <= 0) {
+          m_host->log(Warning,
+                format("Computed duration is inferior or equal to zero (%s). Inferring to %s", dataDurationInTs,
+                      m_track.defaultSampleDuration)
+                      .c_str());
+          dataDurationInTs = m_track.defaultSampleDuration;
+        }
+        processSample(m_lastData, dataDurationInTs);
+      }
+
+      m_lastData = data;
+    } else {
+      auto durationInTs = dataDurationInTs + m_track.defaultSampleDuration;
+      if(m_DTS > 0) {
+        if(!dataDTS) {
+          durationInTs = m_track.defaultSampleDuration;
+          m_host->log(Warning, format("Received time 0: inferring duration of %s", durationInTs).c_str());
+        }
+        if(durationInTs != m_track.defaultSampleDuration)
+          durationInTs = std::max<int64_t>(durationInTs, 1);
+      }
+
+      processSample(data, durationInTs);
+    }
+  }
+
+  void flush() override {
+    if(m_lastData) {
+      processSample(m_lastData, m_track.defaultSampleDuration);
+      m_lastData = nullptr;
+    }
+
+    if(m_writer)
+      closeSegment();
+  }
+
+  private:
+  void declareStream(Data data) {
+    auto const meta = data->getMetadata().get();
+    auto const pkt = safe_cast<const MetadataPkt>(meta);
+
+    // parameter sets: from the extradata, otherwise in-band
+    auto paramSets = pkt->getExtradata();
+    if(!paramSets.len)
+      paramSets = data->data();
+    auto const isConfigRecord = paramSets.len && paramSets[0] == 1; // e.g. 'h264_avcc' extradata
+
+    if(auto video = dynamic_cast<const MetadataPktVideo *>(meta)) {
+      m_streamType = VIDEO_PKT;
+      m_mimeType = "video/mp4";
+      m_track.timescale = (uint32_t)(video->timeScale.num * TIMESCALE_MUL);
+      m_track.defaultSampleDuration = (uint32_t)(video->timeScale.den * TIMESCALE_MUL);
+      m_track.width = video->resolution.width;
+      m_track.height = video->resolution.height;
+      m_resolution = video->resolution;
+
+      if(video->codec == "h264_annexb" || video->codec == "h264_avcc") {
+        m_track.sampleEntry4CC = 0x61766331; // 'avc1'
+        m_isAnnexB = video->codec == "h264_annexb";
+        m_track.decoderConfig = isConfigRecord ? pkt->codecSpecificInfo : Fmp4::makeAvcDecoderConfig(paramSets);
+      } else if(video->codec == "hevc_annexb" || video->codec == "hevc_avcc") {
+        m_track.sampleEntry4CC = 0x68766331; // 'hvc1'
+        m_isAnnexB = video->codec == "hevc_annexb";
+        m_track.decoderConfig = isConfigRecord ? pkt->codecSpecificInfo : Fmp4::makeHevcDecoderConfig(paramSets);
+      } else {
+        throw error(format("Unsupported video codec \"%s\" (use GPACMuxMP4)", video->codec));
+      }
+    } else if(auto audio = dynamic_cast<const MetadataPktAudio *>(meta)) {
+      if(audio->codec != "aac_raw")
+        throw error(format("Unsupported audio codec \"%s\" (use GPACMuxMP4)", audio->codec));
+
+      m_streamType = AUDIO_PKT;
+      m_mimeType = "audio/mp4";
+      m_track.sampleEntry4CC = 0x6D703461; // 'mp4a'
+      m_track.timescale = m_sampleRate = audio->sampleRate;
+      m_track.defaultSampleDuration = audio->frameSize;
+      m_track.sampleRate = audio->sampleRate;
+      m_track.numChannels = audio->numChannels;
+      m_track.bitsPerSample = std::min(16, (int)audio->bitsPerSample);
+      m_track.decoderConfig = Fmp4::makeAacDecoderConfig(audio->sampleRate, audio->numChannels);
+
+      if(!(m_compatFlags & SegmentAtAny)) {
+        m_host->log(Info, "Audio detected: assuming all segments are RAPs.");
+        m_compatFlags = m_compatFlags | SegmentAtAny;
+      }
+    } else {
+      throw error("Stream creation failed: only audio and video are supported.");
+    }
+
+    if(!m_track.timescale)
+      throw error("Stream creation failed: null timescale.");
+    if(!m_track.defaultSampleDuration) {
+      m_host->log(Warning, "Computed default sample duration is 0, forcing the ExactInputDur flag.");
+      m_compatFlags = m_compatFlags | ExactInputDur;
+    }
+
+    m_track.lang = m_lang;
+    m_codecName = Fmp4::getCodecName(m_track);
+    m_writer = make_unique<Fmp4::FragmentWriter>(m_track.trackId, m_streamType == VIDEO_PKT);
+
+    m_initDTSIn180k = data->get<DecodingTime>().time;
+    m_firstDataAbsTimeInMs = clockToTimescale(m_utcStartTime->query(), 1000);
+    if(m_initDTSIn180k)
+      handleInitialTimeOffset();
+    m_absTimeInTs = rescale(m_firstDataAbsTimeInMs, 1000, m_track.timescale);
+    m_segmentDurationInTs = rescale<int64_t>(m_segmentDurationInMs, 1000, m_track.timescale);
+    m_fragmentDurationInTs = rescale<int64_t>(m_fragmentDurationInMs, 1000, m_track.timescale);
+    m_nextSegmentBoundaryInTs = getNextSegmentBoundary();
+    if(!(m_compatFlags & SegNumStartsAtZero))
+      m_segmentNum = m_firstDataAbsTimeInMs / m_segmentDurationInMs;
+
+    auto const init = Fmp4::writeInitSegment(m_track);
+    auto out = m_output->allocData<DataRaw>(init.size());
+    memcpy(out->buffer->data().ptr, init.data(), init.size());
+    post(out, m_baseName.empty() ? "" : m_baseName + "-init.mp4", 0, true);
+  }
+
+  // same edit list as GPACMuxMP4
+  void handleInitialTimeOffset() {
+    m_host->log(Info, format("Initial offset: %ss", m_initDTSIn180k / (double)IClock::Rate).c_str());
+    if(m_compatFlags & NoEditLists) {
+      m_firstDataAbsTimeInMs += clockToTimescale(m_initDTSIn180k, 1000);
+      return;
+    }
+
+    auto const edtsInMovieTs = clockToTimescale(m_initDTSIn180k, Fmp4::MOVIE_TIMESCALE);
+    auto const edtsInMediaTs = clockToTimescale(m_initDTSIn180k, m_track.timescale);
+    if(edtsInMovieTs > 0) {
+      m_track.edits = {{uint64_t(edtsInMovieTs), -1}, {uint64_t(edtsInMovieTs), 0}};
+      m_segmentAlignmentInTs = edtsInMediaTs; // the segments are aligned on the presentation timeline
+    } else {
+      m_track.edits = {{0, -edtsInMediaTs}};
+    }
+  }
+
+  int64_t getNextSegmentBoundary() const {
+    return ((m_DTS + m_segmentAlignmentInTs) / m_segmentDurationInTs + 1) * m_segmentDurationInTs -
+          m_segmentAlignmentInTs;
+  }
+
+  void processSample(Data data, int64_t durationInTs) {
+    auto const isRap = data->get<CueFlags>().keyframe;
+
+    // segments are aligned on the nominal segment duration
+    auto const segmentIsComplete = [&]() { return m_DTS >= m_nextSegmentBoundaryInTs; };
+
+    if(m_DTS > m_segmentStartInTs && segmentIsComplete() && isRap)
+      closeSegment();
+
+    if(m_fragmentOpen && m_fragmentPolicy == OneFragmentPerRAP && isRap)
+      closeFragment();
+
+    if(m_DTS == m_segmentStartInTs)
+      m_segmentStartsWithRAP = isRap;
+
+    if(!m_fragmentOpen)
+      openFragment();
+
+    Fmp4::Sample sample{};
+    sample.duration = (uint32_t)durationInTs;
+    sample.rap = isRap;
+    auto const pts = data->get<PresentationTime>().time;
+    if(pts != INT64_MAX) {
+      auto const ctsOffset = clockToTimescale(pts - data->get<DecodingTime>().time, m_track.timescale);
+      if(ctsOffset < 0)
+        throw error("Negative CTS offset is not supported");
+      sample.ctsOffset = (uint32_t)ctsOffset;
+    }
+
+    // the input is not kept: its allocator may be bounded
+    if(m_isAnnexB) {
+      m_nalus.clear();
+      sample.size = (uint32_t)Fmp4::splitAnnexB(data->data(), m_nalus);
+      Fmp4::writeLengthPrefixed(m_nalus.data(), m_nalus.size(), reserve(sample.size));
+    } else {
+      auto const src = data->data();
+      sample.size = (uint32_t)src.len;
+      memcpy(reserve(src.len), src.ptr, src.len);
+    }
+
+    m_samples.push_back(sample);
+    m_payloadSize += sample.size;
+    m_DTS += durationInTs;
+
+    if(m_fragmentPolicy == OneFragmentPerFrame && m_DTS - m_fragmentStartInTs >= m_fragmentDurationInTs)
+      closeFragment();
+
+    if(segmentIsComplete() && (m_compatFlags & SegmentAtAny))
+      closeSegment();
+  }
+
+  // The samples are written after the room left for the 'moof' and the 'mdat' header: the size of the previous ones.
+  // This is exact for regular streams, otherwise the samples are moved when closing the fragment.
+  void openFragment() {
+    m_fragmentOpen = true;
+    m_fragmentStartInTs = m_DTS;
+    m_sequenceNumber++;
+    m_baseMediaDecodeTime = uint64_t(m_DTS + m_absTimeInTs);
+
+    if(!m_out)
+      openOutput(!(m_compatFlags & FlushFragMemory) || !m_segmentChunkCount);
+    m_fragmentOffset = m_outSize;
+    reserve(m_headerRoom);
+  }
+
+  void closeFragment() {
+    if(!m_fragmentOpen)
+      return;
+    m_fragmentOpen = false;
+
+    auto const headerSize =
+          m_writer->moofSize(m_samples.data(), m_samples.size()) + Fmp4::FragmentWriter::MDAT_HEADER_SIZE;
+    if(headerSize > m_headerRoom)
+      reserve(headerSize - m_headerRoom);
+    else
+      m_outSize -= m_headerRoom - headerSize;
+    auto const fragment = m_out->buffer->data().ptr + m_fragmentOffset;
+    if(headerSize != m_headerRoom) {
+      memmove(fragment + headerSize, fragment + m_headerRoom, m_payloadSize);
+      m_headerRoom = headerSize;
+    }
+    m_writer->write(fragment, m_sequenceNumber, m_baseMediaDecodeTime, m_samples.data(), m_samples.size());
+
+    // the capacity is kept: no allocation once the stream is established
+    m_samples.clear();
+    m_payloadSize = 0;
+
+    if(m_compatFlags & FlushFragMemory) {
+      m_segmentChunkCount++;
+      post(closeOutput(), getSegmentName(), m_DTS - m_fragmentStartInTs, false);
+    }
+  }
+
+  void closeSegment() {
+    closeFragment();
+    if(m_DTS == m_segmentStartInTs)
+      return; // empty
+
+    if(m_compatFlags & FlushFragMemory)
+      post(m_output->allocData<DataRaw>(0), getSegmentName(), 0, true);
+    else
+      post(closeOutput(), getSegmentName(), m_DTS - m_segmentStartInTs, true);
+
+    m_host->log(Debug,
+          format("Segment %s completed (startsWithSAP=%s)", getSegmentName(), m_segmentStartsWithRAP).c_str());
+
+    m_segmentNum++;
+    m_segmentChunkCount = 0;
+    m_segmentStartInTs = m_DTS;
+    m_nextSegmentBoundaryInTs = getNextSegmentBoundary();
+  }
+
+  // the data is written directly in the output buffer, which grows as needed
+  void openOutput(bool withStyp) {
+    m_out = m_output->allocData<DataRawResizable>(std::max(m_outCapacity, size_t(Fmp4::FragmentWriter::STYP_SIZE)));
+    m_outSize = 0;
+    if(withStyp)
+      Fmp4::FragmentWriter::writeStyp(reserve(Fmp4::FragmentWriter::STYP_SIZE));
+  }
+
+  uint8_t *reserve(size_t size) {
+    auto const capacity = m_out->buffer->data().len;
+    if(m_outSize + size > capacity)
+      m_out->resize(std::max(2 * capacity, m_outSize + size));
+    auto const r = m_out->buffer->data().ptr + m_outSize;
+    m_outSize += size;
+    return r;
+  }
+
+  std::shared_ptr<DataRaw> closeOutput() {
+    m_out->resize(m_outSize);
+    m_outCapacity = m_outSize + m_outSize / 4; // growing copies the data: leave some room for bigger outputs
+    return std::move(m_out);
+  }
+
+  std::string getSegmentName() const {
+    return m_baseName.empty() ? "" : m_baseName + "-" + std::to_string(m_segmentNum) + ".m4s";
+  }
+
+  void post(std::shared_ptr<DataRaw> out, std::string const &filename, int64_t durationInTs, bool EOS) {
+    auto const durationIn180k = timescaleToClock(durationInTs, m_track.timescale);
+    auto const fragmentDurationInTs = std::max<int64_t>(m_track.defaultSampleDuration, m_fragmentDurationInTs);
+    auto const latencyIn180k = m_fragmentPolicy == OneFragmentPerFrame
+          ? timescaleToClock(fragmentDurationInTs, m_track.timescale)
+          : std::min<int64_t>(durationIn180k, timescaleToClock<int64_t>(m_segmentDurationInMs, 1000));
+
+    auto metadata = make_shared<MetadataFile>(m_streamType);
+    metadata->filename = filename;
+    metadata->mimeType = m_mimeType;
+    metadata->codecName = m_codecName;
+    metadata->lang = m_lang;
+    metadata->durationIn180k = durationIn180k;
+    metadata->filesize = out->data().len;
+    metadata->latencyIn180k = latencyIn180k;
+    metadata->startsWithRAP = m_segmentStartsWithRAP;
+    metadata->EOS = EOS;
+    metadata->resolution = m_resolution;
+    metadata->sampleRate = m_sampleRate;
+    out->setMetadata(metadata);
+
+    auto segmentStartInTs = m_segmentStartInTs;
+    if(!(m_compatFlags & SegNumStartsAtZero))
+      segmentStartInTs += m_absTimeInTs;
+    out->set(PresentationTime{timescaleToClock(segmentStartInTs, m_track.timescale)});
+    m_output->post(out);
+  }
+
+  KHost *const m_host;
+  IUtcStartTimeQuery const *const m_utcStartTime;
+  CompatibilityFlag m_compatFlags;
+  FragmentPolicy const m_fragmentPolicy;
+  uint64_t const m_segmentDurationInMs, m_fragmentDurationInMs;
+  std::string const m_baseName, m_lang;
+  OutputDefault *m_output;
+
+  // stream
+  Fmp4::TrackInfo m_track;
+  std::unique_ptr<Fmp4::FragmentWriter> m_writer; // set once the stream is declared
+  bool m_isAnnexB = false;
+  StreamType m_streamType = UNKNOWN_ST;
+  std::string m_mimeType, m_codecName;
+  Resolution m_resolution;
+  int m_sampleRate = 0;
+  Data m_lastData; // used with ExactInputDur
+
+  // timeline, in the track timescale
+  int64_t m_initDTSIn180k = 0, m_firstDataAbsTimeInMs = 0, m_absTimeInTs = 0;
+  int64_t m_DTS = 0, m_segmentStartInTs = 0, m_fragmentStartInTs = 0;
+  int64_t m_segmentDurationInTs = 0, m_fragmentDurationInTs = 0, m_nextSegmentBoundaryInTs = 0;
+  int64_t m_segmentAlignmentInTs = 0; // the initial offset, with edit lists
+  uint64_t m_segmentNum = 0;
+  uint32_t m_sequenceNumber = 0;
+  int m_segmentChunkCount = 0;
+  bool m_segmentStartsWithRAP = true;
+
+  // output not sent yet: the whole segment, or the current fragment with FlushFragMemory
+  std::shared_ptr<DataRawResizable> m_out;
+  size_t m_outSize = 0, m_outCapacity = 0;
+
+  // current fragment
+  bool m_fragmentOpen = false;
+  uint64_t m_baseMediaDecodeTime = 0;
+  size_t m_fragmentOffset = 0, m_headerRoom = 0, m_payloadSize = 0;
+  std::vector<Fmp4::Sample> m_samples;
+  std::vector<SpanC> m_nalus; // Annex B: the NAL units of the current sample
+};
+
+}
+}
+
+namespace {
+
+using namespace Modules;
+
+IModule *createObject(KHost *host, void *va) {
+  auto config = (Mp4MuxConfig *)va;
+  enforce(host, "CmafMux: host can't be NULL");
+  enforce(config, "CmafMux: config can't be NULL");
+  return createModule<Mux::CmafMux>(host, *config).release();
+}
+
+auto const registered = Factory::registerModule("CmafMux", &createObject);
+}
@@ -0,0 +1,745 @@
+#include "fmp4_writer.hpp"
+
+#include <algorithm> // any_of
+#include <cstdio> // snprintf
+#include <cstring> // memcpy, memchr
+#include <stdexcept>
+
+namespace Fmp4 {
+
+namespace {
+
+uint8_t *put32(uint8_t *p, uint32_t val) {
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+  return p + 4;
+}
+
+uint8_t *put64(uint8_t *p, uint64_t val) {
+  p = put32(p, val >> 32);
+  return put32(p, (uint32_t)val);
+}
+
+uint8_t *putFourcc(uint8_t *p, const char *fourcc) {
+  memcpy(p, fourcc, 4);
+  return p + 4;
+}
+
+uint32_t get32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+uint32_t const SYNC_SAMPLE_FLAGS = 0x02000000; // sample_depends_on=2
+uint32_t const NON_SYNC_SAMPLE_FLAGS = 0x01010000; // sample_depends_on=1, sample_is_non_sync_sample=1
+uint32_t const DEFAULT_SAMPLE_FLAGS = 0x00010000; // 'trex': sample_is_non_sync_sample=1, as GPAC
+
+int32_t const MATRIX[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+// Growable buffer of nested boxes
+struct BoxWriter {
+  std::vector<uint8_t> &out;
+  std::vector<size_t> openBoxes;
+
+  void u8(uint8_t val) { out.push_back(val); }
+  void u16(uint16_t val) {
+    u8(val >> 8);
+    u8(val);
+  }
+  void u24(uint32_t val) {
+    u8(val >> 16);
+    u16(val);
+  }
+  void u32(uint32_t val) {
+    u16(val >> 16);
+    u16(val);
+  }
+  void fourcc(uint32_t val) { u32(val); }
+  void fourcc(const char *val) { out.insert(out.end(), val, val + 4); }
+  void bytes(std::vector<uint8_t> const &val) { out.insert(out.end(), val.begin(), val.end()); }
+  void zeros(size_t n) { out.insert(out.end(), n, 0); }
+  void matrix() {
+    for(auto val : MATRIX)
+      u32(val);
+  }
+
+  void open(uint32_t type) {
+    openBoxes.push_back(out.size());
+    u32(0); // size, set when closing
+    fourcc(type);
+  }
+  void open(const char *type) { open(get32((const uint8_t *)type)); }
+  void openFull(const char *type, uint8_t version, uint32_t flags) {
+    open(type);
+    u8(version);
+    u24(flags);
+  }
+  void close() {
+    auto const start = openBoxes.back();
+    openBoxes.pop_back();
+    put32(out.data() + start, uint32_t(out.size() - start));
+  }
+};
+
+// MPEG-4 audio profile and level of AAC-LC, as GPAC computes it
+uint8_t getAacProfileLevel(int sampleRate, int numChannels) {
+  if(numChannels <= 2)
+    return sampleRate <= 24000 ? 0x28 : 0x29; // AAC Profile L1 or L2
+  if(numChannels <= 5)
+    return sampleRate <= 48000 ? 0x2A : 0x2B; // L4 or L5
+  return sampleRate <= 48000 ? 0x50 : 0x51;
+}
+
+void writeEsds(BoxWriter &w, TrackInfo const &track) {
+  auto const &asc = track.decoderConfig;
+  if(asc.size() > 100)
+    throw std::runtime_error("AudioSpecificConfig is too big");
+
+  // descriptor sizes fit in one byte
+  auto const decoderConfigSize = 13 + 2 + asc.size();
+  auto const esSize = 3 + 2 + decoderConfigSize + 3;
+
+  w.openFull("esds", 0, 0);
+  w.u8(0x03); // ES_Descriptor
+  w.u8(esSize);
+  w.u16(0); // ES_ID: not used in files
+  w.u8(0); // flags
+  w.u8(0x04); // DecoderConfigDescriptor
+  w.u8(decoderConfigSize);
+  w.u8(0x40); // MPEG-4 audio
+  w.u8((0x05 << 2) | 1); // audio stream
+  w.u24(0); // bufferSizeDB
+  w.u32(0); // maxBitrate
+  w.u32(0); // avgBitrate
+  w.u8(0x05); // DecoderSpecificInfo
+  w.u8(asc.size());
+  w.bytes(asc);
+  w.u8(0x06); // SLConfigDescriptor
+  w.u8(1);
+  w.u8(0x02); // predefined: MP4
+  w.close();
+}
+
+void writeSampleEntry(BoxWriter &w, TrackInfo const &track) {
+  auto const isAudio = track.sampleEntry4CC == get32((const uint8_t *)"mp4a");
+
+  w.open(track.sampleEntry4CC);
+  w.zeros(6);
+  w.u16(1); // data_reference_index
+
+  if(isAudio) {
+    w.zeros(8);
+    w.u16(track.numChannels);
+    w.u16(track.bitsPerSample);
+    w.zeros(4);
+    w.u32(track.sampleRate << 16);
+    writeEsds(w, track);
+  } else {
+    auto const isAvc = track.sampleEntry4CC == get32((const uint8_t *)"avc1");
+    w.zeros(16);
+    w.u16(track.width);
+    w.u16(track.height);
+    w.u32(0x00480000); // 72 dpi
+    w.u32(0x00480000);
+    w.u32(0);
+    w.u16(1); // frame_count
+    {
+      // compressorname: a Pascal string, as GPAC
+      std::string const name = isAvc ? "AVC Coding" : "HEVC Coding";
+      w.u8(name.size());
+      w.out.insert(w.out.end(), name.begin(), name.end());
+      w.zeros(31 - name.size());
+    }
+    w.u16(0x0018); // depth
+    w.u16(0xFFFF);
+    w.open(isAvc ? "avcC" : "hvcC");
+    w.bytes(track.decoderConfig);
+    w.close();
+  }
+
+  w.close();
+}
+
+// RBSP of a NAL unit: emulation prevention bytes removed
+std::vector<uint8_t> unescape(SpanC nal) {
+  std::vector<uint8_t> r;
+  r.reserve(nal.len);
+  int zeros = 0;
+  for(auto byte : nal) {
+    if(zeros >= 2 && byte == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    zeros = byte ? 0 : zeros + 1;
+    r.push_back(byte);
+  }
+  return r;
+}
+
+struct BitReader {
+  std::vector<uint8_t> const &src;
+  size_t pos = 0;
+
+  int bit() {
+    if(pos >= src.size() * 8)
+      throw std::runtime_error("Truncated parameter set");
+    auto const r = (src[pos / 8] >> (7 - pos % 8)) & 1;
+    pos++;
+    return r;
+  }
+
+  uint32_t u(int n) {
+    uint32_t r = 0;
+    for(int i = 0; i < n; ++i)
+      r = (r << 1) | bit();
+    return r;
+  }
+
+  // Exp-Golomb
+  uint32_t ue() {
+    int zeros = 0;
+    while(!bit()) {
+      if(++zeros > 31)
+        throw std::runtime_error("Invalid Exp-Golomb code in parameter set");
+    }
+    return ((1u << zeros) - 1) + u(zeros);
+  }
+
+  void skip(int n) { pos += n; }
+};
+
+struct ChromaInfo {
+  uint32_t chromaFormat, lumaBitDepthMinus8, chromaBitDepthMinus8;
+};
+
+uint32_t readChromaFormat(BitReader &br) {
+  auto const chromaFormat = br.ue();
+  if(chromaFormat == 3)
+    br.skip(1); // separate_colour_plane_flag
+  return chromaFormat;
+}
+
+std::vector<uint8_t> &appendParameterSet(std::vector<uint8_t> &cfg, SpanC nal) {
+  if(nal.len > 0xFFFF)
+    throw std::runtime_error("Parameter set is too big");
+  cfg.push_back(nal.len >> 8);
+  cfg.push_back(nal.len);
+  cfg.insert(cfg.end(), nal.ptr, nal.ptr + nal.len);
+  return cfg;
+}
+
+// 'moof' template offsets
+enum {
+  MOOF_SIZE = 0,
+  MFHD_SEQUENCE_NUMBER = 20,
+  TRAF_SIZE = 24,
+  TFDT_BASE_MEDIA_DECODE_TIME = 60,
+  TRUN_SIZE = 68,
+  TRUN_FLAGS = 76,
+  TRUN_SAMPLE_COUNT = 80,
+  TRUN_DATA_OFFSET = 84,
+  TRUN_SAMPLES = 88,
+};
+
+uint32_t getTrunFlags(bool sampleFlags, Sample const *samples, size_t count) {
+  uint32_t flags = 0x000001 | 0x000100 | 0x000200; // data-offset, sample-duration, sample-size
+  if(sampleFlags)
+    flags |= 0x000400;
+  for(size_t i = 0; i < count; ++i) {
+    if(samples[i].ctsOffset) {
+      flags |= 0x000800;
+      break;
+    }
+  }
+  return flags;
+}
+
+size_t getTrunEntrySize(uint32_t trunFlags) {
+  return 8 + ((trunFlags & 0x000400) ? 4 : 0) + ((trunFlags & 0x000800) ? 4 : 0);
+}
+
+}
+
+std::vector<uint8_t> writeInitSegment(TrackInfo const &track) {
+  auto const isAudio = track.sampleEntry4CC == get32((const uint8_t *)"mp4a");
+
+  uint64_t durationInMovieTs = 0; // the edits only: the media is empty
+  for(auto &edit : track.edits)
+    durationInMovieTs += edit.duration;
+  if(durationInMovieTs > UINT32_MAX)
+    throw std::runtime_error("Edit list is too long");
+
+  std::vector<uint8_t> out;
+  out.reserve(1024);
+  BoxWriter w{out, {}};
+
+  w.open("ftyp");
+  w.fourcc("isom");
+  w.u32(1);
+  w.fourcc("isom");
+  w.fourcc("dash");
+  w.close();
+
+  w.open("moov");
+
+  w.openFull("mvhd", 0, 0);
+  w.u32(0); // creation_time
+  w.u32(0); // modification_time
+  w.u32(MOVIE_TIMESCALE);
+  w.u32(durationInMovieTs);
+  w.u32(0x00010000); // rate
+  w.u16(0x0100); // volume
+  w.zeros(10);
+  w.matrix();
+  w.zeros(24);
+  w.u32(track.trackId + 1); // next_track_ID
+  w.close();
+
+  // GPACMuxMP4 signals the audio profile and level
+  if(isAudio) {
+    w.openFull("iods", 0, 0);
+    w.u8(0x10); // MP4_IOD_Tag
+    w.u8(7);
+    w.u16((1 << 6) | 0xF); // ObjectDescriptorID=1, no URL, no inline profiles
+    w.u8(0xFF); // OD
+    w.u8(0xFF); // scene
+    w.u8(getAacProfileLevel(track.sampleRate, track.numChannels));
+    w.u8(0xFF); // visual
+    w.u8(0xFF); // graphics
+    w.close();
+  }
+
+  w.open("mvex");
+  w.openFull("trex", 0, 0);
+  w.u32(track.trackId);
+  w.u32(1); // default_sample_description_index
+  w.u32(track.defaultSampleDuration);
+  w.u32(0); // default_sample_size
+  w.u32(DEFAULT_SAMPLE_FLAGS);
+  w.close();
+  w.close();
+
+  w.open("trak");
+
+  w.openFull("tkhd", 0, 0x1); // enabled
+  w.u32(0);
+  w.u32(0);
+  w.u32(track.trackId);
+  w.u32(0);
+  w.u32(durationInMovieTs);
+  w.zeros(8);
+  w.u16(0); // layer
+  w.u16(0); // alternate_group
+  w.u16(isAudio ? 0x0100 : 0); // volume
+  w.u16(0);
+  w.matrix();
+  w.u32(track.width << 16);
+  w.u32(track.height << 16);
+  w.close();
+
+  if(!track.edits.empty()) {
+    auto const isLong = [](Edit const &edit) {
+      return edit.duration > UINT32_MAX || edit.mediaTime > INT32_MAX || edit.mediaTime < INT32_MIN;
+    };
+    auto const version = std::any_of(track.edits.begin(), track.edits.end(), isLong) ? 1 : 0;
+
+    w.open("edts");
+    w.openFull("elst", version, 0);
+    w.u32(track.edits.size());
+    for(auto &edit : track.edits) {
+      if(version) {
+        w.u32(edit.duration >> 32);
+        w.u32(edit.duration);
+        w.u32(uint64_t(edit.mediaTime) >> 32);
+      } else {
+        w.u32(edit.duration);
+      }
+      w.u32(edit.mediaTime);
+      w.u32(0x00010000); // media_rate: 1.0
+    }
+    w.close();
+    w.close();
+  }
+
+  w.open("mdia");
+
+  w.openFull("mdhd", 0, 0);
+  w.u32(0);
+  w.u32(0);
+  w.u32(track.timescale);
+  w.u32(0); // duration
+  {
+    auto const lang = track.lang.size() == 3 ? track.lang : std::string("und");
+    w.u16(((lang[0] - 0x60) & 0x1F) << 10 | ((lang[1] - 0x60) & 0x1F) << 5 | ((lang[2] - 0x60) & 0x1F));
+  }
+  w.u16(0);
+  w.close();
+
+  w.openFull("hdlr", 0, 0);
+  w.u32(0);
+  w.fourcc(isAudio ? "soun" : "vide");
+  w.zeros(12);
+  {
+    std::string const name = isAudio ? "GPAC ISO Audio Handler" : "GPAC ISO Video Handler";
+    out.insert(out.end(), name.c_str(), name.c_str() + name.size() + 1);
+  }
+  w.close();
+
+  w.open("minf");
+
+  if(isAudio) {
+    w.openFull("smhd", 0, 0);
+    w.u32(0); // balance, reserved
+  } else {
+    w.openFull("vmhd", 0, 1);
+    w.zeros(8); // graphicsmode, opcolor
+  }
+  w.close();
+
+  w.open("dinf");
+  w.openFull("dref", 0, 0);
+  w.u32(1);
+  w.openFull("url ", 0, 1); // data in the same file
+  w.close();
+  w.close();
+  w.close();
+
+  w.open("stbl");
+  w.openFull("stsd", 0, 0);
+  w.u32(1);
+  writeSampleEntry(w, track);
+  w.close();
+  auto const emptyTable = [&](const char *type) {
+    w.openFull(type, 0, 0);
+    w.u32(0); // entry_count
+    w.close();
+  };
+  emptyTable("stts");
+  if(!isAudio)
+    emptyTable("stss"); // GPAC declares the video sync samples
+  emptyTable("stsc");
+  w.openFull("stsz", 0, 0);
+  w.u32(0);
+  w.u32(0);
+  w.close();
+  emptyTable("stco");
+  w.close(); // stbl
+
+  w.close(); // minf
+  w.close(); // mdia
+  w.close(); // trak
+
+  w.close(); // moov
+
+  return out;
+}
+
+std::vector<uint8_t> makeAvcDecoderConfig(SpanC annexB) {
+  std::vector<SpanC> nalus, sps, pps;
+  splitAnnexB(annexB, nalus);
+  for(auto nal : nalus) {
+    auto const type = nal[0] & 0x1F;
+    if(type == 7)
+      sps.push_back(nal);
+    else if(type == 8)
+      pps.push_back(nal);
+  }
+
+  if(sps.empty() || pps.empty() || sps[0].len < 4)
+    throw std::runtime_error("H.264: no SPS/PPS found");
+
+  std::vector<uint8_t> cfg;
+  cfg.push_back(1); // configurationVersion
+  cfg.push_back(sps[0][1]); // AVCProfileIndication
+  cfg.push_back(sps[0][2]); // profile_compatibility
+  cfg.push_back(sps[0][3]); // AVCLevelIndication
+  cfg.push_back(0xFC | 3); // lengthSizeMinusOne
+  cfg.push_back(0xE0 | sps.size());
+  for(auto nal : sps)
+    appendParameterSet(cfg, nal);
+  cfg.push_back(pps.size());
+  for(auto nal : pps)
+    appendParameterSet(cfg, nal);
+
+  auto const profile = sps[0][1];
+  if(profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+    auto const rbsp = unescape(sps[0]);
+    BitReader br{rbsp};
+    br.skip(32); // NAL header, profile_idc, constraint flags, level_idc
+    br.ue(); // seq_parameter_set_id
+    ChromaInfo info;
+    info.chromaFormat = readChromaFormat(br);
+    info.lumaBitDepthMinus8 = br.ue();
+    info.chromaBitDepthMinus8 = br.ue();
+
+    cfg.push_back(0xFC | info.chromaFormat);
+    cfg.push_back(0xF8 | info.lumaBitDepthMinus8);
+    cfg.push_back(0xF8 | info.chromaBitDepthMinus8);
+    cfg.push_back(0); // numOfSequenceParameterSetExt
+  }
+
+  return cfg;
+}
+
+std::vector<uint8_t> makeHevcDecoderConfig(SpanC annexB) {
+  enum { VPS = 32, SPS = 33, PPS = 34 };
+  std::vector<SpanC> nalus, arrays[3];
+  splitAnnexB(annexB, nalus);
+  for(auto nal : nalus) {
+    auto const type = (nal[0] >> 1) & 0x3F;
+    if(type >= VPS && type <= PPS)
+      arrays[type - VPS].push_back(nal);
+  }
+
+  if(arrays[SPS - VPS].empty())
+    throw std::runtime_error("HEVC: no SPS found");
+
+  auto const rbsp = unescape(arrays[SPS - VPS][0]);
+  BitReader br{rbsp};
+  br.skip(16); // NAL header
+  br.skip(4); // sps_video_parameter_set_id
+  auto const maxSubLayersMinus1 = br.u(3);
+  auto const temporalIdNesting = br.u(1);
+
+  // general profile_tier_level: copied as is
+  uint8_t profileTierLevel[12];
+  for(auto &byte : profileTierLevel)
+    byte = br.u(8);
+
+  int subLayerProfilePresent[8], subLayerLevelPresent[8];
+  for(uint32_t i = 0; i < maxSubLayersMinus1; ++i) {
+    subLayerProfilePresent[i] = br.u(1);
+    subLayerLevelPresent[i] = br.u(1);
+  }
+  if(maxSubLayersMinus1 > 0)
+    br.skip(2 * (8 - maxSubLayersMinus1));
+  for(uint32_t i = 0; i < maxSubLayersMinus1; ++i) {
+    if(subLayerProfilePresent[i])
+      br.skip(88);
+    if(subLayerLevelPresent[i])
+      br.skip(8);
+  }
+
+  br.ue(); // sps_seq_parameter_set_id
+  ChromaInfo info;
+  info.chromaFormat = readChromaFormat(br);
+  br.ue(); // pic_width_in_luma_samples
+  br.ue(); // pic_height_in_luma_samples
+  if(br.u(1)) { // conformance_window_flag
+    for(int i = 0; i < 4; ++i)
+      br.ue();
+  }
+  info.lumaBitDepthMinus8 = br.ue();
+  info.chromaBitDepthMinus8 = br.ue();
+
+  std::vector<uint8_t> cfg;
+  cfg.push_back(1); // configurationVersion
+  cfg.insert(cfg.end(), profileTierLevel, profileTierLevel + 12);
+  cfg.push_back(0xF0); // min_spatial_segmentation_idc
+  cfg.push_back(0x00);
+  cfg.push_back(0xFC); // parallelismType
+  cfg.push_back(0xFC | info.chromaFormat);
+  cfg.push_back(0xF8 | info.lumaBitDepthMinus8);
+  cfg.push_back(0xF8 | info.chromaBitDepthMinus8);
+  cfg.push_back(0); // avgFrameRate
+  cfg.push_back(0);
+  cfg.push_back(((maxSubLayersMinus1 + 1) << 3) | (temporalIdNesting << 2) | 3);
+
+  int numArrays = 0;
+  for(auto &array : arrays)
+    numArrays += !array.empty();
+  cfg.push_back(numArrays);
+
+  for(int i = 0; i < 3; ++i) {
+    if(arrays[i].empty())
+      continue;
+    cfg.push_back(0x80 | (VPS + i)); // array_completeness
+    cfg.push_back(arrays[i].size() >> 8);
+    cfg.push_back(arrays[i].size());
+    for(auto nal : arrays[i])
+      appendParameterSet(cfg, nal);
+  }
+
+  return cfg;
+}
+
+std::vector<uint8_t> makeAacDecoderConfig(int sampleRate, int numChannels) {
+  static const int sampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000,
+    7350};
+  int index = 0;
+  while(index < 13 && sampleRates[index] != sampleRate)
+    index++;
+
+  auto const objectType = 2; // AAC-LC
+  if(index < 13) {
+    auto const val = (objectType << 11) | (index << 7) | (numChannels << 3);
+    return {uint8_t(val >> 8), uint8_t(val)};
+  }
+
+  // explicit sample rate
+  auto const val = (uint64_t(objectType) << 35) | (uint64_t(0xF) << 31) | (uint64_t(sampleRate) << 7) |
+        (uint64_t(numChannels) << 3);
+  return {uint8_t(val >> 32), uint8_t(val >> 24), uint8_t(val >> 16), uint8_t(val >> 8), uint8_t(val)};
+}
+
+std::string getCodecName(TrackInfo const &track) {
+  auto const &cfg = track.decoderConfig;
+  char buffer[64];
+
+  switch(track.sampleEntry4CC) {
+  case 0x61766331: // 'avc1'
+    snprintf(buffer, sizeof buffer, "avc1.%02X%02X%02X", cfg.at(1), cfg.at(2), cfg.at(3));
+    return buffer;
+  case 0x68766331: { // 'hvc1'
+    if(cfg.size() < 13)
+      throw std::runtime_error("Invalid HEVC decoder configuration");
+    static const char *profileSpaces[] = {"", "A", "B", "C"};
+    uint32_t compatibility = 0, flags = get32(&cfg[2]);
+    for(int i = 0; i < 32; ++i)
+      compatibility |= ((flags >> i) & 1) << (31 - i);
+
+    std::string r = "hvc1.";
+    snprintf(buffer, sizeof buffer, "%s%d.%X.%c%d", profileSpaces[cfg[1] >> 6], cfg[1] & 0x1F, compatibility,
+          (cfg[1] & 0x20) ? 'H' : 'L', cfg[12]);
+    r += buffer;
+
+    // constraint flags, trailing zero bytes omitted
+    int last = 11;
+    while(last >= 6 && !cfg[last])
+      last--;
+    for(int i = 6; i <= last; ++i) {
+      snprintf(buffer, sizeof buffer, ".%X", cfg[i]);
+      r += buffer;
+    }
+    return r;
+  }
+  case 0x6D703461: // 'mp4a'
+    snprintf(buffer, sizeof buffer, "mp4a.40.%d", cfg.at(0) >> 3);
+    return buffer;
+  default:
+    throw std::runtime_error("Unknown sample entry");
+  }
+}
+
+size_t splitAnnexB(SpanC annexB, std::vector<SpanC> &nalus) {
+  auto const end = annexB.ptr + annexB.len;
+  const uint8_t *nal = nullptr; // current NAL unit
+  size_t size = 0;
+
+  auto push = [&](const uint8_t *nalEnd) {
+    // a NAL unit never ends with a zero byte: trailing_zero_8bits, or the first byte of a 4-byte start code
+    while(nalEnd > nal && nalEnd[-1] == 0)
+      nalEnd--;
+    if(nalEnd > nal) {
+      nalus.push_back({nal, size_t(nalEnd - nal)});
+      size += 4 + (nalEnd - nal);
+    }
+  };
+
+  auto p = annexB.ptr;
+  while(end - p >= 3) {
+    auto one = (const uint8_t *)memchr(p + 2, 1, end - (p + 2));
+    if(!one)
+      break;
+    if(one[-1] == 0 && one[-2] == 0) {
+      if(nal)
+        push(one - 2);
+      nal = one + 1;
+    }
+    p = one - 1;
+  }
+
+  if(nal) {
+    push(end);
+  } else if(annexB.len) {
+    nalus.push_back(annexB);
+    size = 4 + annexB.len;
+  }
+
+  return size;
+}
+
+size_t writeLengthPrefixed(SpanC const *nalus, size_t count, uint8_t *dst) {
+  auto p = dst;
+  for(size_t i = 0; i < count; ++i) {
+    p = put32(p, (uint32_t)nalus[i].len);
+    memcpy(p, nalus[i].ptr, nalus[i].len);
+    p += nalus[i].len;
+  }
+  return p - dst;
+}
+
+FragmentWriter::FragmentWriter(uint32_t trackId, bool sampleFlags)
+    : m_sampleFlags(sampleFlags) {
+  static_assert(sizeof m_template == TRUN_SAMPLES, "'moof' template size");
+  memset(m_template, 0, sizeof m_template);
+
+  auto p = m_template;
+  p = putFourcc(p + 4, "moof");
+
+  p = put32(p, 16);
+  p = putFourcc(p, "mfhd");
+  p += 8; // version, flags, sequence_number
+
+  p = putFourcc(p + 4, "traf");
+
+  p = put32(p, 16);
+  p = putFourcc(p, "tfhd");
+  p = put32(p, 0x020000); // default-base-is-moof
+  p = put32(p, trackId);
+
+  p = put32(p, 20);
+  p = putFourcc(p, "tfdt");
+  p = put32(p, 1 << 24); // version 1
+  p += 8;
+
+  putFourcc(p + 4, "trun");
+}
+
+size_t FragmentWriter::moofSize(Sample const *samples, size_t count) const {
+  return TRUN_SAMPLES + count * getTrunEntrySize(getTrunFlags(m_sampleFlags, samples, count));
+}
+
+uint8_t *FragmentWriter::write(uint8_t *dst, uint32_t sequenceNumber, uint64_t baseMediaDecodeTime,
+      Sample const *samples, size_t count) const {
+  auto const trunFlags = getTrunFlags(m_sampleFlags, samples, count);
+  auto const moofSize = TRUN_SAMPLES + count * getTrunEntrySize(trunFlags);
+
+  memcpy(dst, m_template, sizeof m_template);
+  put32(dst + MOOF_SIZE, moofSize);
+  put32(dst + MFHD_SEQUENCE_NUMBER, sequenceNumber);
+  put32(dst + TRAF_SIZE, moofSize - TRAF_SIZE);
+  put64(dst + TFDT_BASE_MEDIA_DECODE_TIME, baseMediaDecodeTime);
+  put32(dst + TRUN_SIZE, moofSize - TRUN_SIZE);
+  put32(dst + TRUN_FLAGS, trunFlags);
+  put32(dst + TRUN_SAMPLE_COUNT, count);
+  put32(dst + TRUN_DATA_OFFSET, moofSize + MDAT_HEADER_SIZE);
+
+  auto p = dst + TRUN_SAMPLES;
+  uint64_t mdatSize = MDAT_HEADER_SIZE;
+  for(size_t i = 0; i < count; ++i) {
+    auto const &sample = samples[i];
+    p = put32(p, sample.duration);
+    p = put32(p, sample.size);
+    if(trunFlags & 0x000400)
+      p = put32(p, sample.rap ? SYNC_SAMPLE_FLAGS : NON_SYNC_SAMPLE_FLAGS);
+    if(trunFlags & 0x000800)
+      p = put32(p, sample.ctsOffset);
+    mdatSize += sample.size;
+  }
+
+  if(mdatSize > UINT32_MAX)
+    throw std::runtime_error("'mdat' is too big");
+  p = put32(p, mdatSize);
+  return putFourcc(p, "mdat");
+}
+
+uint8_t *FragmentWriter::writeStyp(uint8_t *dst) {
+  auto p = put32(dst, STYP_SIZE);
+  p = putFourcc(p, "styp");
+  p = putFourcc(p, "msdh");
+  p = put32(p, 0);
+  p = putFourcc(p, "msdh");
+  return putFourcc(p, "msix");
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// Serialization of fragmented MP4 (ISO/IEC 14496-12, CMAF) for a single track, without an ISOBMFF object model:
+// the init segment is written once, fragments are written directly into their output buffer.
+
+#include "lib_utils/span.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Fmp4 {
+
+// same as GPAC
+uint32_t const MOVIE_TIMESCALE = 600;
+
+struct Edit {
+  uint64_t duration; // in the movie timescale
+  int64_t mediaTime; // in the track timescale. -1 for an empty edit.
+};
+
+// what the init segment depends on
+struct TrackInfo {
+  uint32_t trackId = 1;
+  uint32_t sampleEntry4CC = 0; // 'avc1', 'hvc1' or 'mp4a'
+  std::vector<uint8_t> decoderConfig; // 'avcC' or 'hvcC' payload, or the AudioSpecificConfig
+  uint32_t timescale = 0;
+  uint32_t defaultSampleDuration = 0;
+  std::string lang; // ISO 639-2/T. Empty means "und".
+  std::vector<Edit> edits;
+
+  // video
+  int width = 0, height = 0;
+
+  // audio
+  int sampleRate = 0, numChannels = 0, bitsPerSample = 16;
+};
+
+// 'ftyp' and 'moov', laid out as GPAC writes them for a DASH segmented track (i.e. as GPACMuxMP4's init segments):
+// 'isom' and 'dash' brands, 600 movie timescale, 'iods' for audio, 'mvex' before the track, empty sample tables.
+// The creation and modification times are 0.
+std::vector<uint8_t> writeInitSegment(TrackInfo const &track);
+
+// Decoder configuration records from the Annex B parameter sets (e.g. the codec extradata).
+// Throw when no parameter set can be found.
+std::vector<uint8_t> makeAvcDecoderConfig(SpanC annexB);
+std::vector<uint8_t> makeHevcDecoderConfig(SpanC annexB);
+
+// AAC-LC AudioSpecificConfig
+std::vector<uint8_t> makeAacDecoderConfig(int sampleRate, int numChannels);
+
+// as per RFC 6381, e.g. "avc1.64001F"
+std::string getCodecName(TrackInfo const &track);
+
+// Appends the NAL units of 'annexB' to 'nalus' (without their start code).
+// Data without any start code is considered as a single NAL unit.
+// Returns the size once converted to 4-byte length-prefixed NAL units.
+size_t splitAnnexB(SpanC annexB, std::vector<SpanC> &nalus);
+
+// Writes 4-byte length-prefixed NAL units. Returns the written size.
+size_t writeLengthPrefixed(SpanC const *nalus, size_t count, uint8_t *dst);
+
+struct Sample {
+  uint32_t size;
+  uint32_t duration;
+  uint32_t ctsOffset;
+  bool rap;
+};
+
+// Writes 'moof' boxes. The box headers are prepared once: only the sizes, the counters and the sample table are
+// written for each fragment.
+class FragmentWriter {
+  public:
+  // 'sampleFlags': signal the RAPs in the sample table (i.e. not all the samples are sync samples)
+  FragmentWriter(uint32_t trackId, bool sampleFlags);
+
+  static const size_t STYP_SIZE = 24;
+  static const size_t MDAT_HEADER_SIZE = 8;
+
+  // 'moof' size for these samples
+  size_t moofSize(Sample const *samples, size_t count) const;
+
+  // Writes the 'moof' and the 'mdat' header at 'dst'. The payload of the samples, in order, must follow.
+  // Returns the end of the written data.
+  uint8_t *write(uint8_t *dst, uint32_t sequenceNumber, uint64_t baseMediaDecodeTime, Sample const *samples,
+        size_t count) const;
+
+  static uint8_t *writeStyp(uint8_t *dst);
+
+  private:
+  uint8_t m_template[88];
+  bool const m_sampleFlags;
+};
+
+}
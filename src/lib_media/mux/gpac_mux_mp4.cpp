@@ -387,8 +387,10 @@ GPACMuxMP4::GPACMuxMP4(KHost *host, Mp4MuxConfig const &cfg)
     , MP4_4CC(cfg.MP4_4CC)
     , compatFlags(cfg.compatFlags)
     , fragmentPolicy(cfg.fragmentPolicy)
+    , fragmentDurationInMs(cfg.fragmentDurationInMs)
     , segmentPolicy(cfg.segmentPolicy)
-    , segmentDuration(cfg.segmentDurationInMs, 1000) {
+    , segmentDuration(cfg.segmentDurationInMs, 1000)
+    , inMemory(cfg.inMemory) {
   if((cfg.segmentDurationInMs == 0) != (segmentPolicy == NoSegment || segmentPolicy == SingleSegment))
     throw error(format("Inconsistent parameters: segment duration is %sms but no segment.", cfg.segmentDurationInMs));
   if((cfg.segmentDurationInMs == 0) && (fragmentPolicy == OneFragmentPerSegment))
@@ -397,9 +399,12 @@ GPACMuxMP4::GPACMuxMP4(KHost *host, Mp4MuxConfig const &cfg)
     throw error("Inconsistent parameters: segmented policies require fragmentation to be enabled.");
   if((compatFlags & SmoothStreaming) && (segmentPolicy != IndependentSegment))
     throw error("Inconsistent parameters: SmoothStreaming compatibility requires IndependentSegment policy.");
-  if((compatFlags & FlushFragMemory) && (!cfg.baseName.empty() || segmentPolicy != FragmentedSegment))
-    throw error(
-          "Inconsistent parameters: FlushFragMemory requires an empty segment name and FragmentedSegment policy.");
+  if((compatFlags & FlushFragMemory) && !cfg.baseName.empty() && !inMemory)
+    throw error("Inconsistent parameters: FlushFragMemory requires an empty segment name, or in-memory output.");
+  if((compatFlags & FlushFragMemory) && segmentPolicy != FragmentedSegment)
+    throw error("Inconsistent parameters: FlushFragMemory requires the FragmentedSegment policy.");
+  if(cfg.fragmentDurationInMs && fragmentPolicy != OneFragmentPerFrame)
+    throw error("Inconsistent parameters: fragment duration requires the OneFragmentPerFrame policy.");
 
   const char *pInitName = nullptr;
 
@@ -412,9 +417,10 @@ GPACMuxMP4::GPACMuxMP4(KHost *host, Mp4MuxConfig const &cfg)
       initName = baseName + ".mp4";
     }
 
-    pInitName = initName.c_str();
+    pInitName = isoFilename(initName);
 
-    m_host->log(Warning, "File mode is deprecated");
+    if(!inMemory)
+      m_host->log(Warning, "File mode is deprecated");
   }
 
   isoInit = gf_isom_open(pInitName, GF_ISOM_OPEN_WRITE, nullptr);
@@ -451,8 +457,11 @@ void GPACMuxMP4::flush() {
     assert(isoInit);
     gf_isom_delete(isoInit);
     isoInit = nullptr;
-    if(!initName.empty())
+    if(isoFilename(initName))
       gf_delete_file(initName.c_str());
+  } else if(inMemory) {
+    gf_isom_delete(isoCur); // everything was already sent: don't write anything more
+    isoCur = nullptr;
   } else {
     GF_Err e = gf_isom_close(isoCur);
     if(e != GF_OK && e != GF_ISOM_INVALID_FILE)
@@ -461,6 +470,10 @@ void GPACMuxMP4::flush() {
   }
 }
 
+const char *GPACMuxMP4::isoFilename(std::string const &name) const {
+  return (inMemory || name.empty()) ? nullptr : name.c_str();
+}
+
 void GPACMuxMP4::updateSegmentName() {
   if(!initName.empty()) {
     auto ss = baseName + "-" + std::to_string(segmentNum);
@@ -480,7 +493,7 @@ void GPACMuxMP4::startSegment() {
     break;
   case IndependentSegment:
     updateSegmentName();
-    isoCur = gf_isom_open(segmentName.empty() ? nullptr : segmentName.c_str(), GF_ISOM_OPEN_WRITE, nullptr);
+    isoCur = gf_isom_open(isoFilename(segmentName), GF_ISOM_OPEN_WRITE, nullptr);
     if(!isoCur)
       throw error("Cannot open isoCur file");
     declareStream(inputs[0]->getMetadata().get());
@@ -490,7 +503,7 @@ void GPACMuxMP4::startSegment() {
     break;
   case FragmentedSegment:
     updateSegmentName();
-    SAFE(gf_isom_start_segment(isoCur, segmentName.empty() ? nullptr : segmentName.c_str(), GF_TRUE));
+    SAFE(gf_isom_start_segment(isoCur, isoFilename(segmentName), GF_TRUE));
     break;
   }
 }
@@ -506,8 +519,9 @@ void GPACMuxMP4::closeSegment(bool isLastSeg) {
   }
 
   if(segmentPolicy == FragmentedSegment) {
+    auto const closeSegmentFile = (Bool)(isoFilename(initName) != nullptr);
     GF_Err e =
-          gf_isom_close_segment(isoCur, 0, 0, 0, 0, 0, GF_FALSE, GF_FALSE, (Bool)isLastSeg, (Bool)(!initName.empty()),
+          gf_isom_close_segment(isoCur, 0, 0, 0, 0, 0, GF_FALSE, GF_FALSE, (Bool)isLastSeg, closeSegmentFile,
                 (compatFlags & Browsers) ? 0 : GF_4CC('e', 'o', 'd', 's'), nullptr, nullptr, &lastSegmentSize);
     if(e != GF_OK) {
       if(m_DTS == 0)
@@ -877,6 +891,12 @@ void GPACMuxMP4::sendSegmentToOutput(bool EOS) {
   if(segmentPolicy == IndependentSegment) {
     nextFragmentNum = gf_isom_get_next_moof_number(isoCur);
     SAFE(gf_isom_write(isoCur));
+  } else if(inMemory && EOS && segmentPolicy == NoSegment) {
+    // the file is sent as a whole: the 'moov', or the last fragment, must be in it
+    if(fragmentPolicy == NoFragment)
+      SAFE(gf_isom_write(isoCur));
+    else
+      SAFE(gf_isom_flush_fragments(isoCur, GF_TRUE));
   }
 
   std::shared_ptr<DataRaw> out;
@@ -926,8 +946,9 @@ void GPACMuxMP4::sendSegmentToOutput(bool EOS) {
 
   auto const consideredDurationInTs = (compatFlags & FlushFragMemory) ? curFragmentDurInTs : curSegmentDurInTs;
   auto const consideredDurationIn180k = timescaleToClock(consideredDurationInTs, timeScale);
+  auto const fragmentDurationInTs = rescale(fragmentDurationInMs, 1000, timeScale);
   auto const containerLatency = fragmentPolicy == OneFragmentPerFrame
-        ? timescaleToClock(defaultSampleIncInTs, timeScale)
+        ? timescaleToClock(std::max(defaultSampleIncInTs, fragmentDurationInTs), timeScale)
         : std::min<uint64_t>(consideredDurationIn180k, fractionToClock(segmentDuration));
 
   auto metadata = make_shared<MetadataFile>(streamType);
@@ -997,14 +1018,16 @@ void GPACMuxMP4::addData(gpacpp::IsoSample const *const sample, int64_t lastData
       closeFragment();
       startFragment(sample->DTS, sample->DTS + sample->CTS_Offset);
     }
-    if(curSegmentDurInTs && (fragmentPolicy == OneFragmentPerFrame)) {
+    if(curSegmentDurInTs && (!fragmentDurationInMs || !curFragmentDurInTs) && (fragmentPolicy == OneFragmentPerFrame)) {
       startFragment(sample->DTS, sample->DTS + sample->CTS_Offset);
     }
 
     SAFE(gf_isom_fragment_add_sample(isoCur, trackId, sample, 1, (u32)lastDataDurationInTs, 0, 0, GF_FALSE));
     curFragmentDurInTs += lastDataDurationInTs;
 
-    if(fragmentPolicy == OneFragmentPerFrame) {
+    // with a fragment duration, the frames are grouped
+    if(fragmentPolicy == OneFragmentPerFrame &&
+          (!fragmentDurationInMs || curFragmentDurInTs >= (int64_t)rescale(fragmentDurationInMs, 1000, timeScale))) {
       closeFragment();
     }
   } else {
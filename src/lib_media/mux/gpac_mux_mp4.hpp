@@ -42,6 +42,7 @@ class GPACMuxMP4 : public ModuleS {
   void closeChunk(bool nextSampleIsRAP);
   void processSample(Data data, int64_t lastDataDurationInTs);
   void updateSegmentName();
+  const char *isoFilename(std::string const &name) const;
 
   uint32_t MP4_4CC;
   CompatibilityFlag compatFlags;
@@ -56,6 +57,7 @@ class GPACMuxMP4 : public ModuleS {
   void startFragment(uint64_t DTS, uint64_t PTS);
   void closeFragment();
   const FragmentPolicy fragmentPolicy;
+  const uint64_t fragmentDurationInMs;
   int64_t curFragmentDurInTs = 0;
   // SmoothStreaming compat only, for fragments:
   uint64_t nextFragmentNum /*used with IndependentSegment*/ = 1;
@@ -70,6 +72,7 @@ class GPACMuxMP4 : public ModuleS {
   std::string segmentName;
   std::string initName;
   std::string baseName;
+  const bool inMemory; // names are only conveyed in the metadata
 
   OutputDefault *output;
   Resolution resolution;
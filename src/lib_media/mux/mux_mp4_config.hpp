@@ -42,6 +42,11 @@ struct Mp4MuxConfig {
   IUtcStartTimeQuery const *utcStartTime = &g_NullStartTime;
   uint32_t MP4_4CC = 0; // when non-null forces a generic descriptor when codec is not recognized
   std::string lang = "";
+  uint64_t fragmentDurationInMs = 0; // OneFragmentPerFrame: groups the frames into fragments of at least this duration
+
+  // Segments (including the init segment) are built in memory and sent as Data, for every policy: the filesystem is
+  // never used. 'baseName' only names them in the metadata, e.g. for a downstream FileSystemSink.
+  bool inMemory = false;
 };
 
 struct Mp4MuxConfigMss {
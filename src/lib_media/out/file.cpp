@@ -6,15 +6,23 @@
 namespace Modules { namespace Out {
 
 File::File(KHost *host, std::string const &path)
-    : m_host(host) {
-  (void)m_host;
-  file = fopen(path.c_str(), "wb");
-  if(!file)
+    : m_stats(host) {
+  m_file = m_writer.open(path);
+  m_writer.flush();
+  if(!m_writer.takeErrors().empty())
     throw error(format("Can't open file for writing: %s", path));
 }
 
-File::~File() { fclose(file); }
+File::~File() { m_writer.close(m_file); }
 
-void File::processOne(Data data) { fwrite(data->data().ptr, 1, data->data().len, file); }
+void File::processOne(Data data) {
+  m_writer.write(m_file, data->data());
+  m_stats.update(m_writer);
+}
+
+void File::flush() {
+  m_writer.flush();
+  m_stats.update(m_writer);
+}
 
 }}
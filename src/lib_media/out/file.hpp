@@ -1,18 +1,23 @@
 #pragma once
 
 #include "lib_modules/utils/helper.hpp"
+#include "lib_utils/async_writer.hpp"
+#include "writer_stats.hpp"
 
 namespace Modules { namespace Out {
 
+// writes from a background thread: a slow disk doesn't stall the upstream modules
 class File : public ModuleS {
   public:
   File(KHost *host, std::string const &path);
   ~File();
   void processOne(Data data) override;
+  void flush() override;
 
   private:
-  KHost *const m_host;
-  FILE *file;
+  AsyncWriter m_writer;
+  AsyncWriter::FileId m_file;
+  WriterStats m_stats;
 };
 
 }}
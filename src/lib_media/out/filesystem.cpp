@@ -1,26 +1,21 @@
 #include "filesystem.hpp"
 
 #include "lib_media/common/metadata_file.hpp"
+#include "lib_media/out/writer_stats.hpp"
 #include "lib_modules/utils/factory.hpp"
 #include "lib_modules/utils/helper.hpp"
+#include "lib_utils/async_writer.hpp"
 #include "lib_utils/log_sink.hpp"
 #include "lib_utils/os.hpp"
 #include "lib_utils/tools.hpp" // enforce
 
-#include <fstream>
+#include <cstdio> // remove
 #include <map>
 
 using namespace Modules;
 
 namespace {
 
-std::ofstream openOutput(std::string path) {
-  auto fp = std::ofstream(path, std::ios::binary);
-  if(!fp.is_open())
-    throw std::runtime_error("can't open for writing: '" + path + "'");
-  return fp;
-}
-
 std::string dirName(std::string path) {
   auto i = path.rfind('/');
   if(i == std::string::npos)
@@ -41,11 +36,19 @@ void ensureDirRecurse(std::string path) {
   }
 }
 
+AsyncWriterConfig writerConfig(FileSystemSinkConfig const &cfg) {
+  AsyncWriterConfig r;
+  r.directIo = cfg.directIo;
+  return r;
+}
+
+// directories are created, and files are opened and written, from a background thread
 class FileSystemSink : public ModuleS {
   public:
   FileSystemSink(KHost *host, FileSystemSinkConfig cfg)
-      : m_host(host)
-      , m_config(cfg) {}
+      : m_config(cfg)
+      , m_writer(writerConfig(cfg))
+      , m_stats(host) {}
 
   void processOne(Data data) override {
     auto meta = safe_cast<const MetadataFile>(data->getMetadata());
@@ -53,29 +56,45 @@ class FileSystemSink : public ModuleS {
     auto const path = m_config.directory + "/" + meta->filename;
 
     if(meta->filesize == INT64_MAX) {
-      remove(path.c_str());
+      close(path);
+      m_writer.post([path]() { remove(path.c_str()); });
       return;
     }
 
     if(m_files.find(path) == m_files.end()) {
-      ensureDirRecurse(dirName(path));
-      m_files.insert(std::pair<std::string, std::ofstream>{path, openOutput(path)});
+      m_writer.post([path]() { ensureDirRecurse(dirName(path)); });
+      m_files[path] = m_writer.open(path);
     }
 
-    auto &fp = m_files[path];
-    auto contents = data->data();
-    fp.write((char *)contents.ptr, contents.len);
-    if(!fp)
-      m_host->log(Error, "write failure");
+    m_writer.write(m_files[path], data->data());
 
+    // a chunk is available to the readers of the file without waiting for the block to be full
     if(meta->EOS)
-      m_files.erase(path);
+      close(path);
+    else
+      m_writer.submit(m_files[path]);
+
+    m_stats.update(m_writer);
+  }
+
+  void flush() override {
+    m_writer.flush();
+    m_stats.update(m_writer);
   }
 
   private:
-  KHost *const m_host;
+  void close(std::string const &path) {
+    auto i = m_files.find(path);
+    if(i == m_files.end())
+      return;
+    m_writer.close(i->second);
+    m_files.erase(i);
+  }
+
   FileSystemSinkConfig const m_config;
-  std::map<std::string, std::ofstream> m_files;
+  AsyncWriter m_writer;
+  std::map<std::string, AsyncWriter::FileId> m_files;
+  Out::WriterStats m_stats;
 };
 
 IModule *createObject(KHost *host, void *va) {
@@ -4,4 +4,7 @@
 
 struct FileSystemSinkConfig {
   std::string directory = ".";
+
+  // bypass the page cache when writing big files (O_DIRECT), if the platform and the filesystem allow it
+  bool directIo = false;
 };
@@ -37,7 +37,7 @@ class HTTP : public ModuleS {
 
   void processOne(Data data) final {
     if(data)
-      m_sender->send(data->data());
+      m_sender->send(data, data->data());
   }
 
   void flush() final {
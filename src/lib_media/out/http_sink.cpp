@@ -1,103 +1,134 @@
 #include "http_sink.hpp"
 
+#include "../common/http_sender.hpp"
 #include "../common/metadata_file.hpp"
 #include "lib_modules/utils/factory.hpp"
 #include "lib_modules/utils/helper.hpp" // ModuleS
-#include "lib_modules/utils/loader.hpp"
 #include "lib_utils/format.hpp"
 #include "lib_utils/log_sink.hpp"
 #include "lib_utils/tools.hpp" // safe_cast
 
-#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
-#include <thread>
-
-#include "http.hpp"
 
 using namespace std;
 using namespace Modules;
 
 namespace {
 
+auto const MAX_CONNECT_FAIL_COUNT = 3;
+
 template<typename T, typename V>
 bool exists(T const &container, V const &val) {
   return container.find(val) != container.end();
 }
 
 struct HttpSink : ModuleS {
-  HttpSink(KHost *host, string baseURL, string userAgent, const vector<string> &headers)
+  HttpSink(KHost *host, HttpSinkConfig const &cfg)
       : m_host(host)
-      , baseURL(baseURL)
-      , userAgent(userAgent)
-      , headers(headers) {
-    done = false;
-
-    HttpOutputConfig httpConfig{};
-    httpConfig.flags.InitialEmptyPost = true; // we want immediate failure if the URL is not reachable
-    httpConfig.flags.request = POST;
-    httpConfig.url = baseURL;
-    httpConfig.userAgent = userAgent;
-    httpConfig.headers = headers;
-    auto http = loadModule("HTTP", m_host, &httpConfig);
+      , baseURL(cfg.baseURL)
+      , userAgent(cfg.userAgent)
+      , headers(cfg.headers)
+      , m_uploadCount(host, "http_uploads")
+      , m_failedCount(host, "http_upload_failures")
+      , m_connectionCount(host, "http_connections")
+      , m_latencyAvgMs(host, "http_upload_latency_avg_ms")
+      , m_latencyMaxMs(host, "http_upload_latency_max_ms") {
+    // we want immediate failure if the URL is not reachable
+    enforceConnection(baseURL, POST);
+
+    HttpUploaderConfig uploaderConfig{};
+    uploaderConfig.maxParallelUploads = cfg.maxParallelUploads;
+    uploaderConfig.maxRetries = cfg.maxRetries;
+    m_uploader = createHttpUploader(uploaderConfig, m_host);
   }
-  ~HttpSink() { done = true; }
+
   void processOne(Data data) override {
     auto const meta = safe_cast<const MetadataFile>(data->getMetadata());
     auto const url = baseURL + meta->filename;
 
-    HttpOutputConfig httpConfig{};
-    httpConfig.flags.InitialEmptyPost = false;
-    httpConfig.flags.request = POST;
-    httpConfig.url = url;
-    httpConfig.userAgent = userAgent;
-    httpConfig.headers = headers;
+    HttpSenderConfig senderConfig{url, userAgent, POST, headers, MAX_CONNECT_FAIL_COUNT};
 
     if(meta->filesize == INT64_MAX) {
       m_host->log(Info, format("Delete at URL: \"%s\"", url).c_str());
-      httpConfig.flags.request = DELETEX;
-      auto http = loadModule("HTTP", m_host, &httpConfig);
-      http->getInput(0)->push(data);
+      senderConfig.request = DELETEX;
+      m_uploader->finish(m_uploader->createSender(senderConfig), onDone());
     } else if(meta->filesize == 0 && !meta->EOS) {
       if(exists(zeroSizeConnections, url))
         throw error(format("Received zero-sized metadata but transfer is already initialized for URL: \"%s\"", url));
 
       m_host->log(Info, format("Initialize transfer for URL: \"%s\"", url).c_str());
-      auto http = loadModule("HTTP", m_host, &httpConfig);
-      http->getInput(0)->push(data);
-      zeroSizeConnections[url] = std::move(http);
+      zeroSizeConnections[url] = createSender(senderConfig, meta);
     } else {
       if(!exists(zeroSizeConnections, url)) {
         m_host->log(Info, format("Starting transfer to URL: \"%s\"", url).c_str());
-        zeroSizeConnections[url] = loadModule("HTTP", m_host, &httpConfig);
+        zeroSizeConnections[url] = createSender(senderConfig, meta);
       }
 
       m_host->log(Debug, format("Continue transfer (%s bytes) for URL: \"%s\"", meta->filesize, url).c_str());
       if(meta->filesize) {
-        zeroSizeConnections[url]->getInput(0)->push(data);
+        zeroSizeConnections[url]->send(data, data->data());
       }
       if(meta->EOS) {
         m_host->log(Info, format("Ending transfer for URL: \"%s\"", url).c_str());
-        zeroSizeConnections[url]->getInput(0)->push(nullptr);
-        zeroSizeConnections[url]->flush();
+        // completes in the background, while the next files are being uploaded
+        m_uploader->finish(std::move(zeroSizeConnections[url]), onDone());
         zeroSizeConnections.erase(url);
       }
     }
+
+    updateStats();
   }
 
   private:
+  unique_ptr<HttpSender> createSender(HttpSenderConfig const &senderConfig, shared_ptr<const MetadataFile> meta) {
+    // a playlist is only published after the segments it references
+    auto const afterFinished = meta->type == PLAYLIST;
+    return m_uploader->createSender(senderConfig, afterFinished);
+  }
+
+  function<void(HttpUploadResult const &)> onDone() {
+    auto host = m_host;
+    return [host](HttpUploadResult const &res) {
+      if(res.success)
+        host->log(Debug,
+              format("Upload complete for URL: \"%s\" (%sms, %s attempts)", res.url, res.latencyInUs / 1000,
+                    res.attemptCount)
+                    .c_str());
+      else
+        host->log(Warning,
+              format("Upload failed for URL: \"%s\" (%s attempts)", res.url, res.attemptCount).c_str());
+    };
+  }
+
+  void updateStats() {
+    auto const stats = m_uploader->getStats();
+    *m_uploadCount = (int32_t)stats.uploadCount;
+    *m_failedCount = (int32_t)stats.failedCount;
+    *m_connectionCount = (int32_t)stats.connectionCount;
+    if(stats.uploadCount)
+      *m_latencyAvgMs = (int32_t)(stats.totalLatencyInUs / stats.uploadCount / 1000);
+    *m_latencyMaxMs = (int32_t)(stats.maxLatencyInUs / 1000);
+  }
+
   KHost *const m_host;
-  atomic_bool done;
-  map<string, shared_ptr<IModule>> zeroSizeConnections;
+  std::unique_ptr<HttpUploader> m_uploader; // must outlive the senders
+  map<string, unique_ptr<HttpSender>> zeroSizeConnections;
   const string baseURL, userAgent;
   const vector<string> headers;
+  HostCounter m_uploadCount;
+  HostCounter m_failedCount;
+  HostCounter m_connectionCount;
+  HostCounter m_latencyAvgMs;
+  HostCounter m_latencyMaxMs;
 };
 
 IModule *createObject(KHost *host, void *va) {
   auto config = (HttpSinkConfig *)va;
   enforce(host, "HttpSink: host can't be NULL");
   enforce(config, "HttpSink: config can't be NULL");
-  return createModule<HttpSink>(host, config->baseURL, config->userAgent, config->headers).release();
+  return createModule<HttpSink>(host, *config).release();
 }
 
 auto const registered = Factory::registerModule("HttpSink", &createObject);
@@ -7,4 +7,6 @@ struct HttpSinkConfig {
   std::string baseURL;
   std::string userAgent;
   std::vector<std::string> headers;
+  int maxParallelUploads = 8; // complete files uploaded concurrently. 0: unlimited
+  int maxRetries = 3; // per file
 };
@@ -0,0 +1,25 @@
+#include "writer_stats.hpp"
+
+#include "lib_utils/log_sink.hpp" // Error
+
+namespace Modules { namespace Out {
+
+WriterStats::WriterStats(KHost *host)
+    : m_host(host)
+    , m_writtenMB(host, "written_mb")
+    , m_writeLatencyAvgUs(host, "write_latency_avg_us")
+    , m_writeLatencyMaxUs(host, "write_latency_max_us")
+    , m_writeErrors(host, "write_errors") {}
+
+void WriterStats::update(AsyncWriter &writer) {
+  for(auto &msg : writer.takeErrors())
+    m_host->log(Error, msg.c_str());
+
+  auto const stats = writer.getStats();
+  *m_writtenMB = (int32_t)(stats.bytesWritten >> 20);
+  *m_writeLatencyAvgUs = (int32_t)(stats.writeCount ? stats.totalLatencyInUs / stats.writeCount : 0);
+  *m_writeLatencyMaxUs = (int32_t)stats.maxLatencyInUs;
+  *m_writeErrors = (int32_t)stats.errorCount;
+}
+
+}}
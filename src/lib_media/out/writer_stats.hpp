@@ -0,0 +1,22 @@
+#pragma once
+
+#include "lib_modules/utils/helper.hpp" // HostCounter
+#include "lib_utils/async_writer.hpp"
+
+namespace Modules { namespace Out {
+
+// publishes the statistics of an AsyncWriter as host counters, and logs its errors
+class WriterStats {
+  public:
+  WriterStats(KHost *host);
+  void update(AsyncWriter &writer);
+
+  private:
+  KHost *const m_host;
+  HostCounter m_writtenMB;
+  HostCounter m_writeLatencyAvgUs;
+  HostCounter m_writeLatencyMaxUs;
+  HostCounter m_writeErrors;
+};
+
+}}
@@ -81,7 +81,8 @@ void AdaptiveStreamingCommon::processInitSegment(Quality const *const quality, s
       initFn = format("%s%s", manifestDir, getInitName(quality, index));
     } else if(!(flags & SegmentsNotOwned)) {
       auto const dst = format("%s%s", manifestDir, getInitName(quality, index));
-      moveFile(initFn, dst);
+      if(isOnDisk(quality->lastData))
+        moveFile(initFn, dst);
       initFn = dst;
     }
 
@@ -167,7 +168,7 @@ std::shared_ptr<DataBase> AdaptiveStreamingCommon::getPresignalledData(uint64_t
   if(!(flags & PresignalNextSegment)) {
     return data->clone();
   }
-  if(!safe_cast<const MetadataFile>(data->getMetadata())->filename.empty() && !EOS) {
+  if(isOnDisk(data) && !EOS) {
     return nullptr;
   }
 
@@ -253,7 +254,7 @@ void AdaptiveStreamingCommon::threadProc() {
       auto const &meta = qualities[i]->getMeta();
 
       auto metaFn = make_shared<MetadataFile>(SEGMENT);
-      metaFn->filename = getSegmentName(qualities[i].get(), i, std::to_string(getCurSegNum()));
+      metaFn->filename = manifestDir + getSegmentName(qualities[i].get(), i, std::to_string(getCurSegNum()));
       metaFn->mimeType = meta->mimeType;
       metaFn->codecName = meta->codecName;
       metaFn->lang = meta->lang;
@@ -331,6 +332,8 @@ void AdaptiveStreamingCommon::threadProc() {
         }
         if(curSegDurIn180k[i] < timescaleToClock(segDurationInMs, 1000) || !meta->EOS) {
           sendLocalData(meta->filesize, meta->EOS);
+          if(!meta->EOS)
+            onNewChunk(i);
         }
       }
     }
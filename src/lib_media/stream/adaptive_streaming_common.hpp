@@ -33,6 +33,8 @@ class AdaptiveStreamingCommon : public ModuleDynI {
   virtual void generateManifest() = 0;
   /*last manifest to be written: usually the VoD one*/
   virtual void finalizeManifest() = 0;
+  /*called each time a chunk of the segment in progress was forwarded (low latency)*/
+  virtual void onNewChunk(size_t /*index*/) {}
 
   enum Type {
     Static,
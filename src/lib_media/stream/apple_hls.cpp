@@ -1,8 +1,13 @@
 #include "apple_hls.hpp"
 
 #include "lib_media/common/attributes.hpp"
+#include "lib_utils/os.hpp" // moveFile
 
+#include <algorithm> // std::max
 #include <cassert>
+#include <cstdio> // snprintf
+#include <cstring> // memcpy
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -11,14 +16,42 @@ namespace Modules { namespace Stream {
 
 struct Apple_HLS::HLSQuality : public Quality {
   struct Segment {
-    std::string path;
     uint64_t startTimeInMs;
+    uint64_t num;
+    size_t textSize; // in 'segmentsText'
   };
   HLSQuality() {}
-  std::stringstream playlistVariant;
-  std::vector<Segment> segments;
+  std::deque<Segment> segments;
+
+  // The playlist text is built incrementally: entries are appended as segments and parts are produced, and removed
+  // from the front when they leave the timeshift buffer.
+  std::string segmentsText;
+  std::string lastSegmentPartsText; // low latency: the parts of the last segment...
+  std::string partsText; // ... and of the segment in progress
+  std::string partsPath; // the segment in progress (or the next one)
+  uint64_t partsOffset = 0;
+
+  // the last generated playlist: new parts are inserted before its preload hint
+  std::string playlist;
+  size_t playlistHintPos = 0;
+  uint64_t playlistPartTargetInMs = 0;
 };
 
+static std::string formatSeconds(uint64_t timeInMs) {
+  char buffer[32];
+  snprintf(buffer, sizeof buffer, "%g", timeInMs / 1000.0);
+  return buffer;
+}
+
+static uint64_t parseSegmentNum(const std::string &fn) {
+  auto const sepPos = fn.find_last_of(".");
+  auto const segNumPos = fn.substr(0, sepPos).find_last_of("-");
+  uint64_t segNum = 0;
+  std::istringstream buffer(fn.substr(segNumPos + 1, sepPos - (segNumPos + 1)));
+  buffer >> segNum;
+  return segNum;
+}
+
 Apple_HLS::Apple_HLS(KHost *host, HlsMuxConfig *cfg)
     : AdaptiveStreamingCommon(host,
             cfg->type,
@@ -28,9 +61,15 @@ Apple_HLS::Apple_HLS(KHost *host, HlsMuxConfig *cfg)
     , m_host(host)
     , playlistMasterPath(format("%s%s", cfg->m3u8Dir, cfg->m3u8Filename))
     , genVariantPlaylist(cfg->genVariantPlaylist)
+    , lowLatency(cfg->lowLatency)
+    , canBlockReload(cfg->canBlockReload)
     , timeShiftBufferDepthInMs(cfg->timeShiftBufferDepthInMs) {
   if(segDurationInMs % 1000)
     throw error("Segment duration must be an integer number of seconds.");
+  if(lowLatency && !genVariantPlaylist)
+    throw error("Inconsistent parameters: low latency requires the variant playlists to be generated.");
+  if(lowLatency && (flags & PresignalNextSegment))
+    throw error("Inconsistent parameters: low latency uses preload hints instead of next segment pre-signalling.");
 }
 
 Apple_HLS::~Apple_HLS() { endOfStream(); }
@@ -129,17 +168,20 @@ std::string Apple_HLS::getManifestMasterInternal() {
 
 void Apple_HLS::generateManifestMaster() {
   if(!masterManifestIsWritten) {
+    auto const playlistMaster = getManifestMasterInternal();
     std::ofstream mpl(playlistMasterPath, std::ofstream::out | std::ofstream::trunc);
-    mpl << getManifestMasterInternal();
+    mpl << playlistMaster;
     mpl.close();
     masterManifestIsWritten = true;
 
     if(type != Static) {
-      auto out = outputManifest->allocData<DataRaw>(0);
+      auto out = outputManifest->allocData<DataRaw>(playlistMaster.size());
+      memcpy(out->buffer->data().ptr, playlistMaster.data(), playlistMaster.size());
 
       auto metadata = make_shared<MetadataFile>(PLAYLIST);
       metadata->filename = playlistMasterPath;
       metadata->durationIn180k = timescaleToClock(segDurationInMs, 1000);
+      metadata->filesize = playlistMaster.size();
 
       out->setMetadata(metadata);
       out->set(PresentationTime{timescaleToClock((int64_t)totalDurationInMs, 1000)});
@@ -148,9 +190,49 @@ void Apple_HLS::generateManifestMaster() {
   }
 }
 
+void Apple_HLS::updateVersion(const std::string &segmentName) {
+  if(!version) {
+    auto const ext = segmentName.substr(segmentName.find_last_of(".") + 1);
+    if(ext == "m4s") {
+      version = 7;
+      isCMAF = true;
+    } else {
+      version = 3;
+    }
+  }
+}
+
+void Apple_HLS::appendSegment(HLSQuality *quality, std::string path, uint64_t startTimeInMs, uint64_t num) {
+  if(path.empty())
+    throw error("HLS segment path is empty. Even when using memory mode, you must set a valid path in the metadata.");
+
+  auto &text = quality->segmentsText;
+  auto const prevSize = text.size();
+  text += "#EXTINF:" + formatSeconds(segDurationInMs) + "\n";
+  if(type != Static) {
+    char cmd[100];
+    long tv_sec = (long)(startTimeInMs / 1000);
+    assert(!(tv_sec & 0xFFFFFFFF00000000));
+    time_t sec = tv_sec;
+    auto *tm = gmtime(&sec);
+    if(!tm) {
+      m_host->log(Warning,
+            format("Segment \"%s\": could not convert UTC start time %sms. Skippping PROGRAM-DATE-TIME.", path,
+                  startTimeInMs)
+                  .c_str());
+    } else {
+      snprintf(cmd, sizeof(cmd), "%d-%02d-%02dT%02d:%02d:%02d.%03d+00:00", 1900 + tm->tm_year, 1 + tm->tm_mon,
+            tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int)(startTimeInMs % 1000));
+      text += "#EXT-X-PROGRAM-DATE-TIME:" + std::string(cmd) + "\n";
+    }
+  }
+  text += path + "\n";
+
+  quality->segments.push_back({startTimeInMs, num, text.size() - prevSize});
+}
+
 void Apple_HLS::updateManifestVariants() {
   if(genVariantPlaylist) {
-    firstSegNums.resize(getNumInputs());
     for(int i = 0; i < getNumInputs() - 1; ++i) {
       auto quality = safe_cast<HLSQuality>(qualities[i].get());
       auto const &meta = quality->getMeta();
@@ -158,20 +240,8 @@ void Apple_HLS::updateManifestVariants() {
       if(fn.empty()) {
         fn = getSegmentName(quality, i, std::to_string(getCurSegNum()));
       }
-      auto const sepPos = fn.find_last_of(".");
-      auto const ext = fn.substr(sepPos + 1);
-      if(!version) {
-        if(ext == "m4s") {
-          version = 7;
-          isCMAF = true;
-        } else {
-          version = 3;
-        }
-      }
-      auto const firstSegNumPos = fn.substr(0, sepPos).find_last_of("-");
-      auto const firstSegNumStr = fn.substr(firstSegNumPos + 1, sepPos - (firstSegNumPos + 1));
-      std::istringstream buffer(firstSegNumStr);
-      buffer >> firstSegNums[i];
+      updateVersion(fn);
+      auto const segNum = parseSegmentNum(fn);
 
       auto out = quality->lastData->clone();
       {
@@ -193,21 +263,25 @@ void Apple_HLS::updateManifestVariants() {
 
       if(flags & PresignalNextSegment) {
         if(quality->segments.empty()) {
-          quality->segments.push_back({fn, startTimeInMs + totalDurationInMs});
+          appendSegment(quality, fn, startTimeInMs + totalDurationInMs, segNum);
         }
-        if(quality->segments.back().path != fn)
-          throw error(format("PresignalNextSegment but segment names are inconsistent (\"%s\" versus \"%s\")",
-                quality->segments.back().path, fn));
+        if(quality->segments.back().num != segNum)
+          throw error(format("PresignalNextSegment but segment numbers are inconsistent (%s versus %s)",
+                quality->segments.back().num, segNum));
 
+        auto const sepPos = fn.find_last_of(".");
         auto const segNumPos = fn.substr(0, sepPos).find_last_of("-");
-        auto const segNumStr = fn.substr(segNumPos + 1, sepPos - (segNumPos + 1));
-        uint64_t segNum;
-        std::istringstream buffer(segNumStr);
-        buffer >> segNum;
         auto fnNext = format("%s%s%s", fn.substr(0, segNumPos + 1), segNum + 1, fn.substr(sepPos));
-        quality->segments.push_back({fnNext, startTimeInMs + totalDurationInMs + segDurationInMs});
+        appendSegment(quality, fnNext, startTimeInMs + totalDurationInMs + segDurationInMs, segNum + 1);
       } else {
-        quality->segments.push_back({fn, startTimeInMs + totalDurationInMs});
+        appendSegment(quality, fn, startTimeInMs + totalDurationInMs, segNum);
+      }
+
+      if(lowLatency) {
+        quality->lastSegmentPartsText = std::move(quality->partsText);
+        quality->partsText.clear();
+        quality->partsPath = getSegmentName(quality, i, std::to_string(getCurSegNum() + 1));
+        quality->partsOffset = 0;
       }
     }
 
@@ -215,80 +289,141 @@ void Apple_HLS::updateManifestVariants() {
   }
 }
 
-void Apple_HLS::generateManifestVariantFull(bool isLast) {
-  if(genVariantPlaylist) {
-    for(int i = 0; i < getNumInputs() - 1; ++i) {
-      auto quality = safe_cast<HLSQuality>(qualities[i].get());
-      quality->playlistVariant.str(std::string());
-      quality->playlistVariant << "#EXTM3U" << std::endl;
-      quality->playlistVariant << "#EXT-X-VERSION:" << version << std::endl;
-      quality->playlistVariant << "#EXT-X-TARGETDURATION:" << (segDurationInMs + 500) / 1000 << std::endl;
-      if((int)firstSegNums.size() > i)
-        quality->playlistVariant << "#EXT-X-MEDIA-SEQUENCE:" << firstSegNums[i] << std::endl;
-      if(version >= 6)
-        quality->playlistVariant << "#EXT-X-INDEPENDENT-SEGMENTS" << std::endl;
-      if(isCMAF)
-        quality->playlistVariant << "#EXT-X-MAP:URI=\"" << getInitName(quality, i) << "\"" << std::endl;
-      if(!timeShiftBufferDepthInMs)
-        quality->playlistVariant << "#EXT-X-PLAYLIST-TYPE:EVENT" << std::endl;
-
-      for(auto &seg : quality->segments) {
-        quality->playlistVariant << "#EXTINF:" << segDurationInMs / 1000.0 << std::endl;
-        if(type != Static) {
-          char cmd[100];
-          long tv_sec = (long)(seg.startTimeInMs / 1000);
-          assert(!(tv_sec & 0xFFFFFFFF00000000));
-          time_t sec = tv_sec;
-          auto *tm = gmtime(&sec);
-          if(!tm) {
-            m_host->log(Warning,
-                  format("Segment \"%s\": could not convert UTC start time %sms. Skippping PROGRAM-DATE-TIME.",
-                        seg.startTimeInMs, seg.path)
-                        .c_str());
-          } else {
-            snprintf(cmd, sizeof(cmd), "%d-%02d-%02dT%02d:%02d:%02d.%03d+00:00", 1900 + tm->tm_year, 1 + tm->tm_mon,
-                  tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int)(seg.startTimeInMs % 1000));
-            quality->playlistVariant << "#EXT-X-PROGRAM-DATE-TIME:" << cmd << std::endl;
-          }
-        }
+void Apple_HLS::onNewChunk(size_t index) {
+  if(!lowLatency)
+    return;
 
-        if(seg.path.empty())
-          error("HLS segment path is empty. Even when using memory mode, you must set a valid path in the metadata.");
-        quality->playlistVariant << seg.path << std::endl;
-      }
+  auto quality = safe_cast<HLSQuality>(qualities[index].get());
+  auto const &meta = quality->getMeta();
+  auto const fn = getSegmentName(quality, index, std::to_string(getCurSegNum()));
+  updateVersion(fn);
+  if(quality->partsPath != fn) {
+    quality->partsPath = fn;
+    quality->partsOffset = 0;
+  }
 
-      if(isLast) {
-        quality->playlistVariant << "#EXT-X-ENDLIST" << std::endl;
-      }
+  // parts are byte ranges of the segment in progress
+  auto const durationInMs = clockToTimescale(meta->durationIn180k, 1000);
+  partTargetInMs = std::max<uint64_t>(partTargetInMs, durationInMs);
+  auto const part = format("#EXT-X-PART:DURATION=%s,URI=\"%s\",BYTERANGE=\"%s@%s\"%s\n",
+        formatSeconds(durationInMs), fn, meta->filesize, quality->partsOffset,
+        quality->partsOffset ? "" : ",INDEPENDENT=YES");
+  quality->partsText += part;
+  quality->partsOffset += meta->filesize;
+
+  // the header depends on the part target
+  if(quality->playlist.empty() || quality->playlistPartTargetInMs != partTargetInMs) {
+    generateManifestVariant(index, false);
+    return;
+  }
 
-      if(timeShiftBufferDepthInMs) {
-        auto seg = quality->segments.begin();
-        while(seg != quality->segments.end()) {
-          if((*seg).startTimeInMs + timeShiftBufferDepthInMs < startTimeInMs + totalDurationInMs) {
-            seg = quality->segments.erase(seg);
-          } else {
-            ++seg;
-          }
-        }
-      }
+  auto &playlist = quality->playlist;
+  auto const prevHintPos = quality->playlistHintPos;
+  playlist.resize(prevHintPos);
+  playlist += part;
+  appendPreloadHint(quality);
+  postManifestVariant(index);
+}
 
-      std::ofstream vpl;
-      auto const playlistCurVariantPath = getVariantPlaylistName(quality, manifestDir, i);
-      vpl.open(playlistCurVariantPath, std::ofstream::out | std::ofstream::trunc);
-      vpl << quality->playlistVariant.str();
-      vpl.close();
+void Apple_HLS::appendPreloadHint(HLSQuality *quality) {
+  quality->playlistHintPos = quality->playlist.size();
+  quality->playlist += format("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s\",BYTERANGE-START=%s\n", quality->partsPath,
+        quality->partsOffset);
+}
 
-      auto out = outputManifest->allocData<DataRaw>(0);
+void Apple_HLS::generateManifestVariant(size_t index, bool isLast) {
+  auto quality = safe_cast<HLSQuality>(qualities[index].get());
+  auto &playlist = quality->playlist;
+  auto const &segments = quality->segments;
+  auto const mediaSequence = segments.empty() ? getCurSegNum() : segments.front().num;
+
+  playlist.clear();
+  playlist += "#EXTM3U\n";
+  playlist += format("#EXT-X-VERSION:%s\n", version);
+  playlist += format("#EXT-X-TARGETDURATION:%s\n", (segDurationInMs + 500) / 1000);
+  if(lowLatency) {
+    playlist += format("#EXT-X-SERVER-CONTROL:%sPART-HOLD-BACK=%s\n", canBlockReload ? "CAN-BLOCK-RELOAD=YES," : "",
+          formatSeconds(3 * partTargetInMs));
+    playlist += format("#EXT-X-PART-INF:PART-TARGET=%s\n", formatSeconds(partTargetInMs));
+  } else if(canBlockReload) {
+    playlist += "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES\n";
+  }
+  playlist += format("#EXT-X-MEDIA-SEQUENCE:%s\n", mediaSequence);
+  if(version >= 6)
+    playlist += "#EXT-X-INDEPENDENT-SEGMENTS\n";
+  if(isCMAF)
+    playlist += format("#EXT-X-MAP:URI=\"%s\"\n", getInitName(quality, index));
+  if(!timeShiftBufferDepthInMs)
+    playlist += "#EXT-X-PLAYLIST-TYPE:EVENT\n";
+
+  // the parts of the last segment are listed before it
+  auto const &text = quality->segmentsText;
+  auto const lastSegmentPos = segments.empty() ? text.size() : text.size() - segments.back().textSize;
+  playlist.append(text, 0, lastSegmentPos);
+  playlist += quality->lastSegmentPartsText;
+  playlist.append(text, lastSegmentPos, std::string::npos);
+  playlist += quality->partsText;
+
+  quality->playlistPartTargetInMs = partTargetInMs;
+  if(isLast) {
+    quality->playlistHintPos = playlist.size();
+    playlist += "#EXT-X-ENDLIST\n";
+  } else if(lowLatency && !quality->partsPath.empty()) {
+    appendPreloadHint(quality);
+  } else {
+    quality->playlistHintPos = playlist.size();
+  }
 
-      {
-        auto meta = make_shared<MetadataFile>(PLAYLIST);
-        meta->filename = playlistCurVariantPath;
-        meta->durationIn180k = timescaleToClock(segDurationInMs, 1000);
-        out->setMetadata(meta);
-      }
+  postManifestVariant(index);
+}
 
-      out->set(PresentationTime{timescaleToClock((int64_t)totalDurationInMs, 1000)});
-      outputManifest->post(out);
+void Apple_HLS::postManifestVariant(size_t index) {
+  auto quality = safe_cast<HLSQuality>(qualities[index].get());
+  auto const &playlist = quality->playlist;
+  auto const playlistCurVariantPath = getVariantPlaylistName(quality, manifestDir, index);
+
+  // in memory mode, the playlist is only posted
+  if(isOnDisk(quality->lastData)) {
+    // replaced at once: a client reading the playlist never sees it partially written
+    auto const tmpPath = playlistCurVariantPath + ".tmp";
+    {
+      std::ofstream vpl(tmpPath, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+      vpl << playlist;
+    }
+    ::moveFile(tmpPath, playlistCurVariantPath);
+  }
+
+  auto out = outputManifest->allocData<DataRaw>(playlist.size());
+  memcpy(out->buffer->data().ptr, playlist.data(), playlist.size());
+
+  {
+    auto meta = make_shared<MetadataFile>(PLAYLIST);
+    meta->filename = playlistCurVariantPath;
+    meta->durationIn180k = timescaleToClock(segDurationInMs, 1000);
+    meta->filesize = playlist.size();
+    out->setMetadata(meta);
+  }
+
+  out->set(PresentationTime{timescaleToClock((int64_t)totalDurationInMs, 1000)});
+  outputManifest->post(out);
+}
+
+void Apple_HLS::generateManifestVariantFull(bool isLast) {
+  if(genVariantPlaylist) {
+    for(int i = 0; i < getNumInputs() - 1; ++i) {
+      generateManifestVariant(i, isLast);
+
+      if(timeShiftBufferDepthInMs) {
+        auto quality = safe_cast<HLSQuality>(qualities[i].get());
+        auto &segments = quality->segments;
+        while(!segments.empty() &&
+              segments.front().startTimeInMs + timeShiftBufferDepthInMs < startTimeInMs + totalDurationInMs) {
+          quality->segmentsText.erase(0, segments.front().textSize);
+          segments.pop_front();
+        }
+        if(segments.empty())
+          quality->lastSegmentPartsText.clear();
+      }
     }
   }
 }
@@ -13,6 +13,10 @@ struct HlsMuxConfig {
   bool genVariantPlaylist = false;
   Modules::Stream::AdaptiveStreamingCommon::AdaptiveStreamingCommonFlags flags =
         Modules::Stream::AdaptiveStreamingCommon::None;
+  // LL-HLS: the chunks of the segments in progress are listed as parts.
+  bool lowLatency = false;
+  // the playlists advertise blocking reloads (CAN-BLOCK-RELOAD): the origin serving them must support them
+  bool canBlockReload = false;
 };
 
 namespace Modules { namespace Stream {
@@ -26,11 +30,17 @@ class Apple_HLS : public AdaptiveStreamingCommon {
   std::unique_ptr<Quality> createQuality() const override;
   void generateManifest() override;
   void finalizeManifest() override;
+  void onNewChunk(size_t index) override;
 
   struct HLSQuality;
 
   std::string getVariantPlaylistName(HLSQuality const *const quality, const std::string &subDir, size_t index);
+  void updateVersion(const std::string &segmentName);
+  void appendSegment(HLSQuality *quality, std::string path, uint64_t startTimeInMs, uint64_t num);
   void updateManifestVariants();
+  void generateManifestVariant(size_t index, bool isLast);
+  void appendPreloadHint(HLSQuality *quality);
+  void postManifestVariant(size_t index);
   void generateManifestVariantFull(bool isLast);
 
   std::string getManifestMasterInternal();
@@ -40,11 +50,13 @@ class Apple_HLS : public AdaptiveStreamingCommon {
 
   std::string playlistMasterPath;
   const bool genVariantPlaylist;
+  const bool lowLatency;
+  const bool canBlockReload;
 
   unsigned version = 0;
   bool masterManifestIsWritten = false, isCMAF = false;
-  std::vector<uint64_t> firstSegNums;
   uint64_t timeShiftBufferDepthInMs = 0;
+  uint64_t partTargetInMs = 0; // the longest part so far
 };
 
 }}
@@ -75,7 +75,7 @@ struct MS_HSS : public ModuleS {
     }
 
     if(m_httpSender)
-      m_httpSender->send(bs);
+      m_httpSender->send(data, bs);
   }
 
   void flush() override {
@@ -0,0 +1,179 @@
+#include "lib_media/common/attributes.hpp"
+#include "lib_media/common/metadata_file.hpp"
+#include "lib_media/stream/apple_hls.hpp"
+#include "lib_modules/modules.hpp"
+#include "tests/tests.hpp"
+
+#include <cstdio> // remove
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace Modules;
+
+namespace {
+
+struct PlaylistRecorder : ModuleS {
+  void processOne(Data data) override {
+    auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+    playlists[meta->filename].push_back(std::string((const char *)data->data().ptr, data->data().len));
+  }
+  std::map<std::string, std::vector<std::string>> playlists;
+};
+
+// 'filename': the muxer wrote the chunk to this file
+Data createChunk(size_t size, int64_t durationInMs, bool EOS, std::string filename = "") {
+  auto chunk = make_shared<DataRaw>(filename.empty() ? size : 0);
+  chunk->set(PresentationTime{0});
+  auto meta = make_shared<MetadataFile>(VIDEO_PKT);
+  meta->filename = filename;
+  meta->durationIn180k = timescaleToClock(durationInMs, 1000);
+  meta->filesize = size;
+  meta->EOS = EOS;
+  chunk->setMetadata(meta);
+  return chunk;
+}
+
+std::string readFile(std::string path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+}
+
+unittest("Apple HLS: low latency, parts and preload hints") {
+  std::remove("v_0_0x0_.m3u8");
+  auto cfg = HlsMuxConfig{"", "ll.m3u8", Stream::AdaptiveStreamingCommon::Live, 2000, 0, true};
+  cfg.lowLatency = true;
+  auto hls = createModule<Stream::Apple_HLS>(&NullHost, &cfg);
+  auto recorder = createModule<PlaylistRecorder>();
+  ConnectOutputToInput(hls->getOutput(1), recorder->getInput(0));
+  hls->getInput(0)->connect();
+
+  hls->getInput(0)->push(createChunk(100, 0, true)); // init
+  for(int i = 0; i < 2; ++i) {
+    for(int j = 0; j < 4; ++j)
+      hls->getInput(0)->push(createChunk(1000, 500, false));
+    hls->getInput(0)->push(createChunk(8, 0, true));
+  }
+  hls->flush();
+
+  auto const &playlists = recorder->playlists["v_0_0x0_.m3u8"];
+  ASSERT_EQUALS(2 * 4 + 2 + 1, (int)playlists.size()); // one per part, per segment, and the final one
+
+  // second part of the second segment
+  ASSERT_EQUALS("#EXTM3U\n"
+                "#EXT-X-VERSION:7\n"
+                "#EXT-X-TARGETDURATION:2\n"
+                "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=1.5\n"
+                "#EXT-X-PART-INF:PART-TARGET=0.5\n"
+                "#EXT-X-MEDIA-SEQUENCE:0\n"
+                "#EXT-X-INDEPENDENT-SEGMENTS\n"
+                "#EXT-X-MAP:URI=\"v_0_0x0/v_0_0x0-init.mp4\"\n"
+                "#EXT-X-PLAYLIST-TYPE:EVENT\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-0.m4s\",BYTERANGE=\"1000@0\",INDEPENDENT=YES\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-0.m4s\",BYTERANGE=\"1000@1000\"\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-0.m4s\",BYTERANGE=\"1000@2000\"\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-0.m4s\",BYTERANGE=\"1000@3000\"\n"
+                "#EXTINF:2\n"
+                "#EXT-X-PROGRAM-DATE-TIME:1970-01-01T00:00:00.000+00:00\n"
+                "v_0_0x0/v_0_0x0-0.m4s\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-1.m4s\",BYTERANGE=\"1000@0\",INDEPENDENT=YES\n"
+                "#EXT-X-PART:DURATION=0.5,URI=\"v_0_0x0/v_0_0x0-1.m4s\",BYTERANGE=\"1000@1000\"\n"
+                "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"v_0_0x0/v_0_0x0-1.m4s\",BYTERANGE-START=2000\n",
+        playlists[6]);
+
+  // the parts of the older segments are not listed anymore
+  auto const &last = playlists.back();
+  ASSERT(last.find("BYTERANGE=\"1000@0\",INDEPENDENT=YES\n#EXT-X-PART") != std::string::npos);
+  ASSERT(last.find("URI=\"v_0_0x0/v_0_0x0-0.m4s\",BYTERANGE") == std::string::npos);
+  ASSERT(last.find("#EXT-X-PRELOAD-HINT") == std::string::npos);
+  ASSERT(last.find("v_0_0x0/v_0_0x0-1.m4s\n#EXT-X-ENDLIST\n") != std::string::npos);
+
+  // in memory mode, the playlists are only posted
+  ASSERT(!std::ifstream("v_0_0x0_.m3u8").good());
+}
+
+unittest("Apple HLS: low latency, the playlist on disk is replaced at once") {
+  struct FileChecker : ModuleS {
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      if(meta->filename != "v_0_0x0_.m3u8")
+        return;
+      ++count;
+      if(readFile(meta->filename) != std::string((const char *)data->data().ptr, data->data().len))
+        ++mismatches;
+    }
+    int count = 0, mismatches = 0;
+  };
+
+  {
+    auto cfg = HlsMuxConfig{"", "ll_disk.m3u8", Stream::AdaptiveStreamingCommon::Live, 2000, 0, true};
+    cfg.lowLatency = true;
+    cfg.canBlockReload = true;
+    auto hls = createModule<Stream::Apple_HLS>(&NullHost, &cfg);
+    auto checker = createModule<FileChecker>();
+    ConnectOutputToInput(hls->getOutput(1), checker->getInput(0));
+    hls->getInput(0)->connect();
+
+    hls->getInput(0)->push(createChunk(100, 0, true, "init.mp4"));
+    for(int i = 0; i < 2; ++i) {
+      for(int j = 0; j < 4; ++j)
+        hls->getInput(0)->push(createChunk(1000, j ? 500 : 400, false, "chunk.m4s"));
+      hls->getInput(0)->push(createChunk(8, 0, true, "chunk.m4s"));
+    }
+    hls->flush();
+
+    ASSERT_EQUALS(2 * 4 + 2 + 1, checker->count);
+    ASSERT_EQUALS(0, checker->mismatches);
+  }
+
+  auto const playlist = readFile("v_0_0x0_.m3u8");
+  ASSERT(playlist.find("#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=") != std::string::npos);
+  ASSERT(!std::ifstream("v_0_0x0_.m3u8.tmp").good());
+
+  std::remove("v_0_0x0_.m3u8");
+  std::remove("ll_disk.m3u8");
+}
+
+unittest("Apple HLS: only the segments written to disk are moved") {
+  struct Recorder : ModuleS {
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      segments.push_back(format("%s %s", meta->filename, data->data().len));
+    }
+    std::vector<std::string> segments;
+  };
+
+  auto run = [](bool inMemory) {
+    std::ofstream("mux-init.mp4") << "init";
+    auto cfg = HlsMuxConfig{"", "moved.m3u8", Stream::AdaptiveStreamingCommon::Live, 2000};
+    auto hls = createModule<Stream::Apple_HLS>(&NullHost, &cfg);
+    auto recorder = createModule<Recorder>();
+    ConnectOutputToInput(hls->getOutput(0), recorder->getInput(0));
+    hls->getInput(0)->connect();
+    auto init = createChunk(4, 0, true, "mux-init.mp4");
+    if(inMemory) {
+      auto data = make_shared<DataRaw>(4);
+      data->set(PresentationTime{0});
+      data->setMetadata(init->getMetadata());
+      init = data;
+    }
+    hls->getInput(0)->push(init);
+    hls->flush();
+    return recorder->segments;
+  };
+
+  // in memory, the name is only conveyed in the metadata
+  ASSERT_EQUALS(std::vector<std::string>({"v_0_0x0/v_0_0x0-init.mp4 4"}), run(true));
+  ASSERT(std::ifstream("mux-init.mp4").good());
+  ASSERT(!std::ifstream("v_0_0x0/v_0_0x0-init.mp4").good());
+
+  ASSERT_EQUALS(std::vector<std::string>({"v_0_0x0/v_0_0x0-init.mp4 0"}), run(false));
+  ASSERT(!std::ifstream("mux-init.mp4").good());
+  ASSERT_EQUALS("init", readFile("v_0_0x0/v_0_0x0-init.mp4"));
+
+  std::remove("v_0_0x0/v_0_0x0-init.mp4");
+}
@@ -0,0 +1,517 @@
+#include "lib_media/common/attributes.hpp"
+#include "lib_media/common/metadata.hpp"
+#include "lib_media/common/metadata_file.hpp"
+#include "lib_media/mux/fmp4_writer.hpp"
+#include "lib_media/mux/mux_mp4_config.hpp"
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "lib_utils/format.hpp"
+#include "lib_utils/profiler.hpp"
+#include "lib_utils/tools.hpp" // safe_cast
+#include "tests/tests.hpp"
+
+#include <cstring> // memcpy, memset
+#include <stdexcept>
+
+using namespace std;
+using namespace Tests;
+using namespace Modules;
+
+namespace {
+
+typedef vector<uint8_t> Bytes;
+
+const Bytes H264_SPS = {0x67, 0x64, 0x00, 0x1F, 0xAC, 0xD9, 0x40, 0x50, 0x05, 0xBB, 0x01, 0x10, 0x00, 0x00, 0x03, 0x00,
+  0x10, 0x00, 0x00, 0x03, 0x03, 0xC0, 0xF1, 0x83, 0x19, 0x60};
+const Bytes H264_PPS = {0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0};
+
+// Main profile, level 3.1, 1280x720
+const Bytes HEVC_SPS = {0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+  0x00, 0x5D, 0xA0, 0x02, 0x80, 0x80, 0x2D, 0x17};
+
+Bytes annexB(vector<Bytes> const &nalus) {
+  Bytes r;
+  for(auto &nal : nalus) {
+    r.insert(r.end(), {0, 0, 0, 1});
+    r.insert(r.end(), nal.begin(), nal.end());
+  }
+  return r;
+}
+
+Bytes lengthPrefixed(vector<Bytes> const &nalus) {
+  Bytes r;
+  for(auto &nal : nalus) {
+    r.insert(r.end(), {0, 0, uint8_t(nal.size() >> 8), uint8_t(nal.size())});
+    r.insert(r.end(), nal.begin(), nal.end());
+  }
+  return r;
+}
+
+SpanC toSpan(Bytes const &bytes) { return {bytes.data(), bytes.size()}; }
+
+uint32_t read32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+// offset of the first child box
+size_t getChildrenOffset(string const &type) {
+  if(type == "stsd" || type == "dref")
+    return 16;
+  if(type == "avc1" || type == "hvc1")
+    return 8 + 78;
+  if(type == "mp4a")
+    return 8 + 28;
+  return 8;
+}
+
+// returns the box (header included) at 'path', e.g "moov/trak/mdia". Empty if not found.
+SpanC findBox(SpanC data, string const &path) {
+  auto const slash = path.find('/');
+  auto const type = path.substr(0, slash);
+  while(data.len >= 8) {
+    auto const size = read32(data.ptr);
+    if(size < 8 || size > data.len)
+      return {nullptr, 0};
+    if(string((const char *)data.ptr + 4, 4) == type) {
+      SpanC box{data.ptr, size};
+      if(slash == string::npos)
+        return box;
+      box += getChildrenOffset(type);
+      return findBox(box, path.substr(slash + 1));
+    }
+    data += size;
+  }
+  return {nullptr, 0};
+}
+
+// the init segment without what depends on the time and on the GPAC version: the creation and modification times,
+// and the top-level 'free' boxes
+Bytes normalizeInitSegment(SpanC data) {
+  Bytes r;
+  while(data.len >= 8) {
+    auto const size = read32(data.ptr);
+    if(string((const char *)data.ptr + 4, 4) != "free")
+      r.insert(r.end(), data.ptr, data.ptr + size);
+    data += size;
+  }
+  for(auto path : {"moov/mvhd", "moov/trak/tkhd", "moov/trak/mdia/mdhd"}) {
+    auto const box = findBox(toSpan(r), path);
+    if(box.len >= 20 && box[8] == 0)
+      memset((uint8_t *)box.ptr + 12, 0, 8);
+  }
+  return r;
+}
+
+vector<string> getTopLevelBoxes(SpanC data) {
+  vector<string> r;
+  while(data.len >= 8) {
+    r.push_back(string((const char *)data.ptr + 4, 4));
+    data += read32(data.ptr);
+  }
+  return r;
+}
+
+struct Recorder : ModuleS {
+  void processOne(Data data) override { outputs.push_back(data); }
+  vector<Data> outputs;
+
+  shared_ptr<const MetadataFile> meta(size_t i) const {
+    return safe_cast<const MetadataFile>(outputs[i]->getMetadata());
+  }
+  SpanC contents(size_t i) const { return outputs[i]->data(); }
+};
+
+Data createFrame(shared_ptr<const IMetadata> meta, Bytes const &contents, int64_t dts, int64_t pts, bool keyframe) {
+  auto data = make_shared<DataRaw>(contents.size());
+  memcpy(data->buffer->data().ptr, contents.data(), contents.size());
+  data->setMetadata(meta);
+  data->set(DecodingTime{dts});
+  data->set(PresentationTime{pts});
+  CueFlags flags{};
+  flags.keyframe = keyframe;
+  data->set(flags);
+  return data;
+}
+
+}
+
+unittest("CmafMux: Annex B to length-prefixed NAL units") {
+  const Bytes input = {0, 0, 0, 1, 0x09, 0xF0, 0, 0, 1, 0x65, 0x88, 0, 0, 3, 1, 0, 0, 0, 0, 1, 0x41, 0x9A, 0};
+
+  vector<SpanC> nalus;
+  auto const size = Fmp4::splitAnnexB(toSpan(input), nalus);
+
+  auto const expected = lengthPrefixed({{0x09, 0xF0}, {0x65, 0x88, 0, 0, 3, 1}, {0x41, 0x9A}});
+  ASSERT_EQUALS(expected.size(), size);
+  Bytes output(size);
+  ASSERT_EQUALS(size, Fmp4::writeLengthPrefixed(nalus.data(), nalus.size(), output.data()));
+  ASSERT_EQUALS(expected, output);
+
+  // no start code: a single NAL unit
+  nalus.clear();
+  ASSERT_EQUALS(6u, Fmp4::splitAnnexB(toSpan({0xAA, 0xBB}), nalus));
+  ASSERT_EQUALS(1u, nalus.size());
+}
+
+unittest("CmafMux: decoder configurations and codec names") {
+  {
+    Fmp4::TrackInfo track;
+    track.sampleEntry4CC = 0x61766331; // 'avc1'
+    track.decoderConfig = Fmp4::makeAvcDecoderConfig(toSpan(annexB({{0x09, 0x10}, H264_SPS, H264_PPS})));
+
+    Bytes expected = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, (uint8_t)H264_SPS.size()};
+    expected.insert(expected.end(), H264_SPS.begin(), H264_SPS.end());
+    expected.insert(expected.end(), {0x01, 0x00, (uint8_t)H264_PPS.size()});
+    expected.insert(expected.end(), H264_PPS.begin(), H264_PPS.end());
+    expected.insert(expected.end(), {0xFD, 0xF8, 0xF8, 0x00}); // High profile: 4:2:0, 8 bits
+    ASSERT_EQUALS(expected, track.decoderConfig);
+    ASSERT_EQUALS("avc1.64001F", Fmp4::getCodecName(track));
+  }
+  {
+    const Bytes vps = {0x40, 0x01, 0x0C}, pps = {0x44, 0x01, 0xC1};
+    Fmp4::TrackInfo track;
+    track.sampleEntry4CC = 0x68766331; // 'hvc1'
+    track.decoderConfig = Fmp4::makeHevcDecoderConfig(toSpan(annexB({vps, HEVC_SPS, pps})));
+
+    Bytes expected = {0x01, 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5D, 0xF0, 0x00, 0xFC,
+      0xFD, 0xF8, 0xF8, 0x00, 0x00, 0x0F, 0x03};
+    expected.insert(expected.end(), {0xA0, 0x00, 0x01, 0x00, 0x03, 0x40, 0x01, 0x0C});
+    expected.insert(expected.end(), {0xA1, 0x00, 0x01, 0x00, (uint8_t)HEVC_SPS.size()});
+    expected.insert(expected.end(), HEVC_SPS.begin(), HEVC_SPS.end());
+    expected.insert(expected.end(), {0xA2, 0x00, 0x01, 0x00, 0x03, 0x44, 0x01, 0xC1});
+    ASSERT_EQUALS(expected, track.decoderConfig);
+    ASSERT_EQUALS("hvc1.1.6.L93.90", Fmp4::getCodecName(track));
+  }
+  {
+    Fmp4::TrackInfo track;
+    track.sampleEntry4CC = 0x6D703461; // 'mp4a'
+    track.decoderConfig = Fmp4::makeAacDecoderConfig(44100, 2);
+    ASSERT_EQUALS(Bytes({0x12, 0x10}), track.decoderConfig);
+    ASSERT_EQUALS("mp4a.40.2", Fmp4::getCodecName(track));
+  }
+
+  ASSERT_THROWN(Fmp4::makeAvcDecoderConfig(toSpan(annexB({H264_PPS}))));
+  ASSERT_THROWN(Fmp4::makeHevcDecoderConfig(toSpan(annexB({{0x42, 0x01, 0x01}})))); // truncated SPS
+}
+
+unittest("CmafMux: H.264 Annex B, one fragment per segment") {
+  auto meta = make_shared<MetadataPktVideo>();
+  meta->codec = "h264_annexb";
+  meta->codecSpecificInfo = annexB({H264_SPS, H264_PPS});
+  meta->timeScale = {25, 1};
+  meta->resolution = {1280, 720};
+
+  auto cfg = Mp4MuxConfig{"v", 2000, FragmentedSegment, OneFragmentPerSegment, SegNumStartsAtZero};
+  auto mux = loadModule("CmafMux", &NullHost, &cfg);
+  auto recorder = createModule<Recorder>();
+  ConnectModules(mux.get(), 0, recorder.get(), 0);
+
+  // a GOP per second, B-frames delay
+  Bytes expectedMdat[2];
+  for(int i = 0; i < 100; ++i) {
+    auto const slice = Bytes{uint8_t(i % 25 ? 0x41 : 0x65), uint8_t(i), 0, 0, 3, 0x80};
+    auto frame = annexB({{0x09, 0x10}});
+    frame.insert(frame.end(), {0, 0, 1}); // 3-byte start code
+    frame.insert(frame.end(), slice.begin(), slice.end());
+    mux->getInput(0)->push(createFrame(meta, frame, i * 7200, (i + 2) * 7200, i % 25 == 0));
+
+    auto const converted = lengthPrefixed({{0x09, 0x10}, slice});
+    expectedMdat[i / 50].insert(expectedMdat[i / 50].end(), converted.begin(), converted.end());
+  }
+  mux->flush();
+
+  auto &r = *recorder;
+  ASSERT_EQUALS(3u, r.outputs.size());
+
+  // init segment
+  ASSERT_EQUALS("v-init.mp4", r.meta(0)->filename);
+  ASSERT_EQUALS("avc1.64001F", r.meta(0)->codecName);
+  ASSERT_EQUALS("video/mp4", r.meta(0)->mimeType);
+  ASSERT_EQUALS(vector<string>({"ftyp", "moov"}), getTopLevelBoxes(r.contents(0)));
+  auto const ftyp = findBox(r.contents(0), "ftyp");
+  ASSERT_EQUALS("isom", string((const char *)ftyp.ptr + 8, 4));
+  auto const mvhd = findBox(r.contents(0), "moov/mvhd");
+  ASSERT_EQUALS(600u, read32(mvhd.ptr + 20)); // timescale
+  ASSERT(!findBox(r.contents(0), "moov/trak/edts").ptr);
+  auto const avcC = findBox(r.contents(0), "moov/trak/mdia/minf/stbl/stsd/avc1/avcC");
+  ASSERT(avcC.ptr);
+  ASSERT_EQUALS(Bytes(avcC.ptr + 8, avcC.ptr + avcC.len), Fmp4::makeAvcDecoderConfig(toSpan(meta->codecSpecificInfo)));
+  auto const mdhd = findBox(r.contents(0), "moov/trak/mdia/mdhd");
+  ASSERT_EQUALS(2500u, read32(mdhd.ptr + 20)); // timescale
+  auto const trex = findBox(r.contents(0), "moov/mvex/trex");
+  ASSERT_EQUALS(100u, read32(trex.ptr + 20)); // default_sample_duration
+
+  for(int i = 1; i <= 2; ++i) {
+    auto const seg = r.contents(i);
+    ASSERT_EQUALS("v-" + to_string(i - 1) + ".m4s", r.meta(i)->filename);
+    ASSERT_EQUALS(360000u, r.meta(i)->durationIn180k);
+    ASSERT_EQUALS(seg.len, r.meta(i)->filesize);
+    ASSERT(r.meta(i)->startsWithRAP);
+    ASSERT(r.meta(i)->EOS);
+    ASSERT_EQUALS((i - 1) * 360000, r.outputs[i]->get<PresentationTime>().time);
+    ASSERT_EQUALS(vector<string>({"styp", "moof", "mdat"}), getTopLevelBoxes(seg));
+
+    auto const mfhd = findBox(seg, "moof/mfhd");
+    ASSERT_EQUALS(uint32_t(i), read32(mfhd.ptr + 12)); // sequence_number
+    auto const tfdt = findBox(seg, "moof/traf/tfdt");
+    ASSERT_EQUALS((i - 1) * 5000u, read32(tfdt.ptr + 16));
+
+    auto const trun = findBox(seg, "moof/traf/trun");
+    ASSERT_EQUALS(0x000F01u, read32(trun.ptr + 8)); // data-offset, duration, size, flags, composition time offset
+    ASSERT_EQUALS(50u, read32(trun.ptr + 12));
+    auto const moof = findBox(seg, "moof");
+    ASSERT_EQUALS(moof.len + 8, read32(trun.ptr + 16)); // data_offset: start of the 'mdat' payload
+    ASSERT_EQUALS(0x02000000u, read32(trun.ptr + 20 + 8)); // first sample: sync
+    ASSERT_EQUALS(0x01010000u, read32(trun.ptr + 20 + 16 + 8));
+    ASSERT_EQUALS(200u, read32(trun.ptr + 20 + 12)); // composition time offset
+
+    auto const mdat = findBox(seg, "mdat");
+    ASSERT_EQUALS(expectedMdat[i - 1], Bytes(mdat.ptr + 8, mdat.ptr + mdat.len));
+  }
+}
+
+unittest("CmafMux: AAC, low latency chunks flushed in memory") {
+  auto meta = make_shared<MetadataPktAudio>();
+  meta->codec = "aac_raw";
+  meta->sampleRate = 48000;
+  meta->numChannels = 2;
+  meta->bitsPerSample = 16;
+  meta->frameSize = 1024;
+
+  auto cfg = Mp4MuxConfig{"a", 1000, FragmentedSegment, OneFragmentPerFrame, SegNumStartsAtZero | FlushFragMemory};
+  cfg.fragmentDurationInMs = 100;
+  auto mux = loadModule("CmafMux", &NullHost, &cfg);
+  auto recorder = createModule<Recorder>();
+  ConnectModules(mux.get(), 0, recorder.get(), 0);
+
+  for(int i = 0; i < 100; ++i)
+    mux->getInput(0)->push(createFrame(meta, Bytes(10, uint8_t(i)), i * 3840, i * 3840, true));
+  mux->flush();
+
+  auto &r = *recorder;
+  ASSERT_EQUALS("a-init.mp4", r.meta(0)->filename);
+  ASSERT_EQUALS("mp4a.40.2", r.meta(0)->codecName);
+  auto const esds = findBox(r.contents(0), "moov/trak/mdia/minf/stbl/stsd/mp4a/esds");
+  ASSERT(esds.ptr);
+
+  // each segment: its chunks (the first one starts with 'styp'), then an empty EOS
+  uint64_t totalDurationIn180k = 0;
+  int segmentNum = 0, frameCount = 0;
+  bool firstChunk = true;
+  for(size_t i = 1; i < r.outputs.size(); ++i) {
+    auto const meta = r.meta(i);
+    ASSERT_EQUALS("a-" + to_string(segmentNum) + ".m4s", meta->filename);
+    ASSERT_EQUALS(18000u, meta->latencyIn180k); // 100ms
+    totalDurationIn180k += meta->durationIn180k;
+
+    if(meta->EOS) {
+      ASSERT_EQUALS(0u, r.contents(i).len);
+      segmentNum++;
+      firstChunk = true;
+      continue;
+    }
+
+    auto const boxes = getTopLevelBoxes(r.contents(i));
+    ASSERT_EQUALS(firstChunk ? "styp" : "moof", boxes[0]);
+    firstChunk = false;
+
+    auto const trun = findBox(r.contents(i), "moof/traf/trun");
+    ASSERT_EQUALS(0x000301u, read32(trun.ptr + 8)); // all samples are sync samples
+    auto const sampleCount = read32(trun.ptr + 12);
+    ASSERT(sampleCount == 5 || meta->durationIn180k < 18000); // at least 100ms, but at the end of a segment
+    frameCount += sampleCount;
+  }
+
+  ASSERT_EQUALS(3, segmentNum); // 47 + 47 + 6 frames
+  ASSERT_EQUALS(100, frameCount);
+  ASSERT_EQUALS(uint64_t(100 * 3840), totalDurationIn180k);
+}
+
+unittest("CmafMux: initial offset") {
+  auto meta = make_shared<MetadataPktAudio>();
+  meta->codec = "aac_raw";
+  meta->sampleRate = 48000;
+  meta->numChannels = 2;
+  meta->bitsPerSample = 16;
+  meta->frameSize = 1024;
+
+  // 0.5s, as GPACMuxMP4: the initial offset is in the edit list, or in the segment times with NoEditLists
+  auto const initialDTS = IClock::Rate / 2;
+  for(auto noEditLists : {false, true}) {
+    auto cfg = Mp4MuxConfig{"a", 2000, FragmentedSegment, OneFragmentPerSegment, SegNumStartsAtZero};
+    if(noEditLists)
+      cfg.compatFlags = cfg.compatFlags | NoEditLists;
+    auto mux = loadModule("CmafMux", &NullHost, &cfg);
+    auto recorder = createModule<Recorder>();
+    ConnectModules(mux.get(), 0, recorder.get(), 0);
+
+    for(int i = 0; i < 150; ++i)
+      mux->getInput(0)->push(createFrame(meta, Bytes(10), initialDTS + i * 3840, initialDTS + i * 3840, true));
+    mux->flush();
+
+    auto &r = *recorder;
+    auto const elst = findBox(r.contents(0), "moov/trak/edts/elst");
+    auto const tfdt = findBox(r.contents(1), "moof/traf/tfdt");
+    if(noEditLists) {
+      ASSERT(!elst.ptr);
+      ASSERT_EQUALS(24000u, read32(tfdt.ptr + 16));
+      ASSERT(r.meta(1)->durationIn180k >= (uint64_t)IClock::Rate * 2);
+      ASSERT(r.meta(1)->durationIn180k < (uint64_t)IClock::Rate * 2 + 3840);
+    } else {
+      ASSERT_EQUALS(2u, read32(elst.ptr + 12));
+      ASSERT_EQUALS(300u, read32(elst.ptr + 16)); // empty edit: 0.5s in the movie timescale
+      ASSERT_EQUALS(0xFFFFFFFFu, read32(elst.ptr + 20));
+      ASSERT_EQUALS(300u, read32(elst.ptr + 28));
+      ASSERT_EQUALS(0u, read32(elst.ptr + 32));
+      ASSERT_EQUALS(0u, read32(tfdt.ptr + 16));
+      // the segments are aligned on the presentation timeline: the first one is shorter
+      ASSERT(r.meta(1)->durationIn180k < (uint64_t)IClock::Rate * 2);
+      ASSERT(r.meta(1)->durationIn180k >= (uint64_t)IClock::Rate * 3 / 2);
+    }
+  }
+}
+
+unittest("CmafMux: same init segment as GPACMuxMP4") {
+  auto audio = make_shared<MetadataPktAudio>();
+  audio->codec = "aac_raw";
+  audio->sampleRate = 48000;
+  audio->numChannels = 2;
+  audio->bitsPerSample = 16;
+  audio->frameSize = 1024;
+
+  auto video = make_shared<MetadataPktVideo>();
+  video->codec = "h264_annexb";
+  video->codecSpecificInfo = annexB({H264_SPS, H264_PPS});
+  video->timeScale = {25, 1};
+  video->resolution = {1280, 720};
+
+  auto getInitSegment = [](string const &muxName, shared_ptr<const IMetadata> meta, int64_t frameDuration) {
+    auto cfg = Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerSegment, SegNumStartsAtZero};
+    auto mux = loadModule(muxName.c_str(), &NullHost, &cfg);
+    auto recorder = createModule<Recorder>();
+    ConnectModules(mux.get(), 0, recorder.get(), 0);
+
+    // with an initial offset: the edit lists are compared too
+    for(int i = 0; i < 10; ++i) {
+      auto const dts = (i + 3) * frameDuration;
+      mux->getInput(0)->push(createFrame(meta, annexB({{0x65, uint8_t(i)}}), dts, dts, i == 0));
+    }
+    mux->flush();
+    return normalizeInitSegment(recorder->contents(0));
+  };
+
+  ASSERT_EQUALS(getInitSegment("GPACMuxMP4", audio, 3840), getInitSegment("CmafMux", audio, 3840));
+  ASSERT_EQUALS(getInitSegment("GPACMuxMP4", video, 7200), getInitSegment("CmafMux", video, 7200));
+}
+
+unittest("CmafMux: the input is released on arrival") {
+  // bounded allocator: a muxer keeping the input until the end of the segment would block it
+  struct Source : ModuleS {
+    Source() { output = addOutput(); }
+    void processOne(Data) override {}
+    OutputDefault *output;
+  };
+  auto source = createModule<Source>();
+
+  auto meta = make_shared<MetadataPktVideo>();
+  meta->codec = "h264_annexb";
+  meta->codecSpecificInfo = annexB({H264_SPS, H264_PPS});
+  meta->timeScale = {25, 1};
+  meta->resolution = {1280, 720};
+
+  auto cfg = Mp4MuxConfig{"v", 2000, FragmentedSegment, OneFragmentPerSegment, SegNumStartsAtZero};
+  auto mux = loadModule("CmafMux", &NullHost, &cfg);
+  auto recorder = createModule<Recorder>();
+  ConnectModules(source.get(), 0, mux.get(), 0);
+  ConnectModules(mux.get(), 0, recorder.get(), 0);
+
+  for(int i = 0; i < 100; ++i) {
+    auto const frame = annexB({{uint8_t(i % 25 ? 0x41 : 0x65), uint8_t(i + 1)}});
+    auto data = source->output->allocData<DataRaw>(frame.size());
+    memcpy(data->buffer->data().ptr, frame.data(), frame.size());
+    data->setMetadata(meta);
+    data->set(DecodingTime{i * 7200});
+    data->set(PresentationTime{i * 7200});
+    CueFlags flags{};
+    flags.keyframe = i % 25 == 0;
+    data->set(flags);
+
+    weak_ptr<const DataBase> input = data;
+    source->output->post(data);
+    data = nullptr;
+    ASSERT(input.expired());
+  }
+  mux->flush();
+
+  auto &r = *recorder;
+  ASSERT_EQUALS(3u, r.outputs.size());
+  auto const mdat = findBox(r.contents(1), "mdat");
+  ASSERT_EQUALS(lengthPrefixed({{0x65, 1}}), Bytes(mdat.ptr + 8, mdat.ptr + 8 + 6));
+}
+
+unittest("CmafMux: unsupported configurations") {
+  auto cfg = Mp4MuxConfig{"", 0, NoSegment, OneFragmentPerRAP};
+  ASSERT_THROWN(loadModule("CmafMux", &NullHost, &cfg));
+
+  cfg = Mp4MuxConfig{"", 2000, FragmentedSegment, NoFragment};
+  ASSERT_THROWN(loadModule("CmafMux", &NullHost, &cfg));
+
+  cfg = Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerSegment};
+  auto mux = loadModule("CmafMux", &NullHost, &cfg);
+  auto meta = make_shared<MetadataPktAudio>();
+  meta->codec = "mp2";
+  meta->sampleRate = 48000;
+  meta->frameSize = 1152;
+  ASSERT_THROWN(mux->getInput(0)->push(createFrame(meta, Bytes(10), 0, 0, true)));
+}
+
+secondclasstest("CmafMux: throughput") {
+  auto meta = make_shared<MetadataPktVideo>();
+  meta->codec = "h264_annexb";
+  meta->codecSpecificInfo = annexB({H264_SPS, H264_PPS});
+  meta->timeScale = {25, 1};
+  meta->resolution = {1280, 720};
+
+  auto const numFrames = 20000;
+  vector<Data> frames;
+  for(int i = 0; i < numFrames; ++i) {
+    auto slice = Bytes(8 * 1024, uint8_t(i));
+    slice[0] = i % 25 ? 0x41 : 0x65;
+    frames.push_back(createFrame(meta, annexB({slice}), i * 7200, i * 7200, i % 25 == 0));
+  }
+
+  struct Counter : ModuleS {
+    void processOne(Data) override {}
+  };
+
+  // same input for both muxers
+  for(auto muxName : {"CmafMux", "GPACMuxMP4"}) {
+    for(auto flags : {SegNumStartsAtZero, CompatibilityFlag(SegNumStartsAtZero | FlushFragMemory)}) {
+      auto cfg = Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerSegment, flags};
+      if(flags & FlushFragMemory)
+        cfg.fragmentPolicy = OneFragmentPerFrame;
+      auto mux = loadModule(muxName, &NullHost, &cfg);
+      auto counter = createModule<Counter>();
+      ConnectModules(mux.get(), 0, counter.get(), 0);
+
+      Tools::Profiler profiler(format("%s: %s frames of 8kB, %s", muxName, numFrames,
+            (flags & FlushFragMemory) ? "one chunk per frame" : "one fragment per segment"));
+      for(auto &frame : frames)
+        mux->getInput(0)->push(frame);
+      mux->flush();
+    }
+  }
+}
+
+fuzztest("CmafMux: parameter sets") {
+  SpanC testdata;
+  GetFuzzTestData(testdata.ptr, testdata.len);
+
+  try {
+    Fmp4::makeAvcDecoderConfig(testdata);
+  } catch(std::exception const &) {
+  }
+
+  try {
+    Fmp4::makeHevcDecoderConfig(testdata);
+  } catch(std::exception const &) {
+  }
+}
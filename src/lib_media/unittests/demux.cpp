@@ -6,11 +6,23 @@
 #include "lib_media/out/print.hpp"
 #include "lib_modules/modules.hpp"
 #include "lib_modules/utils/loader.hpp"
+#include "lib_utils/format.hpp"
 #include "lib_utils/string_tools.hpp"
 #include "lib_utils/tools.hpp"
 #include "tests/tests.hpp"
 
+#include <algorithm> // min
+#include <atomic>
+#include <chrono>
+#include <cstring> // memcpy
+#include <fstream>
 #include <iostream> // std::cout
+#include <iterator> // istreambuf_iterator
+#include <thread> // this_thread::sleep_for
+
+extern "C" {
+#include <libavutil/error.h> // AVERROR_EOF
+}
 
 using namespace Tests;
 using namespace Modules;
@@ -77,6 +89,74 @@ unittest("LibavDemux: rollover") {
   ASSERT_EQUALS(expected, deltas(rec->decodingTimes));
 }
 
+secondclasstest("LibavDemux: wake-ups and latency while the input stalls") {
+  using Clock = chrono::steady_clock;
+
+  // a live input: the file in a loop, which stalls for one second once
+  ifstream file("data/simple.ts", ios::binary);
+  vector<uint8_t> const ts((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  ASSERT(!ts.empty());
+
+  atomic<bool> stall{false}, stalling{false}, stop{false};
+  atomic<int64_t> stallEndInUs{0};
+  size_t pos = 0;
+
+  DemuxConfig cfg;
+  cfg.formatName = "mpegts";
+  cfg.func = [&](uint8_t *buf, int size) {
+    if(stop)
+      return (int)AVERROR_EOF;
+    if(stall.exchange(false)) {
+      stalling = true;
+      this_thread::sleep_for(chrono::seconds(1));
+      stallEndInUs = chrono::duration_cast<chrono::microseconds>(Clock::now().time_since_epoch()).count();
+      stalling = false;
+    }
+    auto const n = min<size_t>({(size_t)size, 188 * 64, ts.size() - pos});
+    memcpy(buf, ts.data() + pos, n);
+    pos = (pos + n) % ts.size();
+    return (int)n;
+  };
+
+  struct Receiver : ModuleS {
+    void processOne(Data data) override {
+      if(isDeclaration(data))
+        return;
+      lastInUs = chrono::duration_cast<chrono::microseconds>(Clock::now().time_since_epoch()).count();
+      ++count;
+    }
+    int64_t lastInUs = 0;
+    int count = 0;
+  };
+
+  auto demux = loadModule("LibavDemux", &NullHost, &cfg);
+  auto rec = createModule<Receiver>();
+  ConnectOutputToInput(demux->getOutput(0), rec->getInput(0));
+
+  // the pipeline calls process() in a loop: count the calls while no data is available
+  stall = true;
+  int wakeUps = 0;
+  auto const start = Clock::now();
+  while(!stallEndInUs || rec->lastInUs < stallEndInUs) {
+    ASSERT(Clock::now() - start < chrono::seconds(5));
+    if(stalling)
+      ++wakeUps;
+    demux->process();
+  }
+  auto const latencyInUs = rec->lastInUs - stallEndInUs;
+
+  stop = true;
+  demux->flush();
+
+  cout << format("LibavDemux: %s wake-ups during a 1s stall, %sus from the input resuming to the next packet",
+                wakeUps, latencyInUs)
+       << endl;
+
+  // with 10ms polling, this was about 100 wake-ups and up to 10ms
+  ASSERT(wakeUps <= 20);
+  ASSERT(latencyInUs < 10 * 1000);
+}
+
 unittest("empty param test: Demux") {
   Mp4DemuxConfig cfg{};
   ASSERT_THROWN(loadModule("GPACDemuxMP4Simple", &NullHost, &cfg));
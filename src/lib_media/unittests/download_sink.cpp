@@ -0,0 +1,116 @@
+#include "lib_media/common/download_sink.hpp"
+#include "tests/tests.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring> // strlen
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Modules;
+using namespace In;
+
+namespace {
+std::string toString(Data data) { return std::string((const char *)data->data().ptr, data->data().len); }
+}
+
+unittest("DownloadSink: chunks are coalesced into full buffers") {
+  OutputDefault output(10);
+  std::vector<std::string> received;
+  ConnectOutput(&output, [&](Data data) { received.push_back(toString(data)); });
+
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = 4;
+  cfg.maxLatencyInMs = 1000 * 1000;
+  DownloadSink sink(&output, cfg);
+
+  for(auto chunk : {"ab", "cdefg", "h", "ijklmnopq", "r"})
+    sink.write({(const uint8_t *)chunk, strlen(chunk)});
+  ASSERT_EQUALS(std::vector<std::string>({"abcd", "efgh", "ijkl", "mnop"}), received);
+
+  sink.flush();
+  ASSERT_EQUALS(std::vector<std::string>({"abcd", "efgh", "ijkl", "mnop", "qr"}), received);
+}
+
+unittest("DownloadSink: partial buffers are posted after the latency deadline") {
+  OutputDefault output(10);
+  std::vector<std::string> received;
+  ConnectOutput(&output, [&](Data data) { received.push_back(toString(data)); });
+
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = 1024;
+  cfg.maxLatencyInMs = 20;
+  DownloadSink sink(&output, cfg);
+
+  sink.write({(const uint8_t *)"ab", 2});
+  ASSERT(received.empty());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  sink.write({(const uint8_t *)"c", 1});
+  ASSERT_EQUALS(std::vector<std::string>({"abc"}), received);
+}
+
+unittest("DownloadSink: stale partial buffer, when no data is received") {
+  OutputDefault output(10);
+  std::vector<std::string> received;
+  ConnectOutput(&output, [&](Data data) { received.push_back(toString(data)); });
+
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = 1024;
+  cfg.maxLatencyInMs = 20;
+  DownloadSink sink(&output, cfg);
+
+  sink.flushIfStale();
+  sink.write({(const uint8_t *)"ab", 2});
+  sink.flushIfStale();
+  ASSERT(received.empty());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  sink.flushIfStale();
+  ASSERT_EQUALS(std::vector<std::string>({"ab"}), received);
+}
+
+unittest("DownloadSink: single buffer for the whole download") {
+  OutputDefault output(10);
+
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = 0;
+  DownloadSink sink(&output, cfg);
+  ASSERT(sink.take() == nullptr);
+
+  std::string expected;
+  for(int i = 0; i < 1000; ++i) {
+    auto const chunk = std::to_string(i);
+    sink.write({(const uint8_t *)chunk.data(), chunk.size()});
+    expected += chunk;
+  }
+
+  ASSERT_EQUALS(expected, toString(sink.take()));
+}
+
+unittest("DownloadSink: a slow downstream blocks the writer") {
+  OutputDefault output(2);
+  std::vector<Data> held; // downstream doesn't release anything
+  ConnectOutput(&output, [&](Data data) { held.push_back(data); });
+
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = 1;
+  DownloadSink sink(&output, cfg);
+
+  std::atomic<int> written{0};
+  std::thread writer([&]() {
+    for(int i = 0; i < 3; ++i) {
+      sink.write({(const uint8_t *)"x", 1});
+      written++;
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQUALS(2, written.load());
+
+  // note: 'held' is only modified by the writer, which is now blocked
+  held.clear();
+  writer.join();
+  ASSERT_EQUALS(3, written.load());
+}
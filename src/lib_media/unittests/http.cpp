@@ -5,6 +5,7 @@
 #include "tests/tests.hpp"
 
 #include <cstring> // memcpy
+#include <mutex>
 
 // To run the below tests, you must first launch the fake webserver:
 // $ ./scripts/http-post-server.sh
@@ -92,3 +93,370 @@ secondclasstest("HttpSender: post data to real server, no flush") {
     sender->send(msg);
   }
 }
+
+secondclasstest("HttpSender: post referenced data to real server, with backpressure") {
+  HttpSenderConfig cfg{};
+  cfg.url = "http://127.0.0.1:9000";
+  cfg.maxPendingBytes = 4096;
+
+  auto sender = createHttpSender(cfg, &NullHost);
+
+  for(int i = 0; i < 100; ++i) {
+    auto data = std::make_shared<DataRaw>(1000);
+    memset(data->buffer->data().ptr, 'A' + i % 26, data->data().len);
+    sender->send(data, data->data());
+  }
+
+  sender->send({});
+}
+
+#ifndef _WIN32
+
+#include "loopback_server.hpp"
+
+#include <algorithm> // max
+#include <atomic>
+#include <chrono>
+#include <cstdlib> // strtoul
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Minimal HTTP/1.1 server receiving uploads (chunked or not), with keep-alive.
+// Only the complete request bodies are recorded.
+struct UploadServer {
+  std::string url(std::string const &path) const { return m_server.baseUrl + path; }
+  int connectionCount() const { return m_server.connectionCount; }
+
+  // the next 'count' requests to 'path' get an error
+  void failNext(std::string const &path, int count) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_failures[path] = count;
+  }
+
+  struct Upload {
+    std::string path;
+    std::string body;
+  };
+
+  // in completion order
+  std::vector<Upload> getUploads() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_uploads;
+  }
+
+  int replyDelayInMs = 0;
+  std::atomic<int> requestCount{0}; // received headers
+  std::atomic<int> abortedCount{0}; // connection closed in the middle of a body
+  std::atomic<int> maxActiveCount{0}; // requests being received or processed at the same time
+
+  private:
+  // returns false when the client disconnected, or when the server stops
+  bool receive(int fd, std::string &buf) {
+    if(!m_server.waitReadable(fd))
+      return false;
+
+    char tmp[4096];
+    auto const n = recv(fd, tmp, sizeof tmp, 0);
+    if(n <= 0)
+      return false;
+    buf.append(tmp, n);
+    return true;
+  }
+
+  // reads up to 'delimiter' (consumed)
+  bool readUntil(int fd, std::string &buf, std::string const &delimiter, std::string &out) {
+    size_t pos;
+    while((pos = buf.find(delimiter)) == std::string::npos)
+      if(!receive(fd, buf))
+        return false;
+    out = buf.substr(0, pos);
+    buf.erase(0, pos + delimiter.size());
+    return true;
+  }
+
+  bool readBytes(int fd, std::string &buf, size_t size, std::string &out) {
+    while(buf.size() < size)
+      if(!receive(fd, buf))
+        return false;
+    out.append(buf, 0, size);
+    buf.erase(0, size);
+    return true;
+  }
+
+  bool readBody(int fd, std::string &buf, std::string const &headers, std::string &body) {
+    if(headers.find("Transfer-Encoding: chunked") != std::string::npos) {
+      while(1) {
+        std::string line, crlf;
+        if(!readUntil(fd, buf, "\r\n", line))
+          return false;
+        auto const size = strtoul(line.c_str(), nullptr, 16);
+        if(size == 0)
+          return readUntil(fd, buf, "\r\n", line); // no trailer
+        if(!readBytes(fd, buf, size, body) || !readUntil(fd, buf, "\r\n", crlf))
+          return false;
+      }
+    }
+
+    auto const pos = headers.find("Content-Length: ");
+    if(pos == std::string::npos)
+      return true; // no body
+    return readBytes(fd, buf, strtoul(headers.c_str() + pos + 16, nullptr, 10), body);
+  }
+
+  void serve(int client) {
+    std::string buf, headers;
+    while(readUntil(client, buf, "\r\n\r\n", headers)) {
+      if(!processRequest(client, buf, headers))
+        break;
+    }
+  }
+
+  bool processRequest(int client, std::string &buf, std::string const &headers) {
+    requestCount++;
+    auto const active = ++m_activeCount;
+    for(auto max = maxActiveCount.load(); active > max && !maxActiveCount.compare_exchange_weak(max, active);) {
+    }
+
+    if(headers.find("Expect: 100-continue") != std::string::npos)
+      sendAll(client, "HTTP/1.1 100 Continue\r\n\r\n");
+
+    std::string body;
+    if(!readBody(client, buf, headers, body)) {
+      abortedCount++;
+      m_activeCount--;
+      return false;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(replyDelayInMs));
+
+    auto const pathStart = headers.find(' ') + 1;
+    auto const path = headers.substr(pathStart, headers.find(' ', pathStart) - pathStart);
+
+    auto success = true;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      auto &failures = m_failures[path];
+      if(failures > 0) {
+        failures--;
+        success = false;
+      } else {
+        m_uploads.push_back({path, body});
+      }
+    }
+
+    m_activeCount--;
+    sendAll(client, success ? "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+                            : "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+    return true;
+  }
+
+  static void sendAll(int client, std::string const &data) { LoopbackServer::sendAll(client, data.data(), data.size()); }
+
+  std::atomic<int> m_activeCount{0};
+
+  mutable std::mutex m_mutex;
+  std::map<std::string, int> m_failures;
+  std::vector<Upload> m_uploads;
+
+  LoopbackServer m_server{[this](int client) { serve(client); }}; // last: stopped first
+};
+
+// 'onDone' is called from the uploader thread: the results are checked from the test thread
+struct UploadResults {
+  std::function<void(HttpUploadResult const &)> callback() {
+    return [this](HttpUploadResult const &res) {
+      std::unique_lock<std::mutex> lock(mutex);
+      results.push_back(res);
+    };
+  }
+
+  std::vector<HttpUploadResult> get() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return results;
+  }
+
+  std::mutex mutex;
+  std::vector<HttpUploadResult> results;
+};
+
+void finishUpload(HttpUploader *uploader, std::string const &url, std::string const &contents,
+      std::function<void(HttpUploadResult const &)> onDone, bool afterFinished = false) {
+  HttpSenderConfig cfg{};
+  cfg.url = url;
+  auto sender = uploader->createSender(cfg, afterFinished);
+  sender->send({(const uint8_t *)contents.data(), contents.size()});
+  uploader->finish(std::move(sender), onDone);
+}
+
+}
+
+unittest("HttpUploader: concurrent uploads reuse the connections") {
+  UploadServer server;
+
+  HttpUploaderConfig uploaderCfg{};
+  uploaderCfg.maxParallelUploads = 2;
+  auto uploader = createHttpUploader(uploaderCfg, &NullHost);
+
+  for(int round = 0; round < 4; ++round) {
+    std::vector<std::unique_ptr<HttpSender>> senders;
+    for(int i = 0; i < 2; ++i) {
+      HttpSenderConfig cfg{};
+      cfg.url = server.url("/file" + std::to_string(i));
+      senders.push_back(uploader->createSender(cfg));
+    }
+
+    for(auto &sender : senders) {
+      const uint8_t msg[] = "GutenTag";
+      sender->send(msg);
+    }
+
+    for(auto &sender : senders)
+      sender->send({});
+  }
+
+  auto const stats = uploader->getStats();
+  ASSERT_EQUALS(8, stats.uploadCount);
+  ASSERT(stats.connectionCount <= 2);
+  ASSERT(server.connectionCount() <= 2);
+
+  auto const uploads = server.getUploads();
+  ASSERT_EQUALS(8, (int)uploads.size());
+  for(auto &upload : uploads)
+    ASSERT_EQUALS(std::string("GutenTag", 9), upload.body);
+}
+
+unittest("HttpUploader: background completion, in dependency order") {
+  UploadServer server;
+  server.replyDelayInMs = 50;
+  UploadResults results;
+
+  {
+    HttpUploaderConfig uploaderCfg{};
+    uploaderCfg.maxParallelUploads = 2;
+    uploaderCfg.maxRetries = 2;
+    auto uploader = createHttpUploader(uploaderCfg, &NullHost);
+
+    HttpSenderConfig cfg{};
+    cfg.url = server.url("/segment");
+    auto segment = uploader->createSender(cfg);
+    auto data = std::make_shared<DataRaw>(1024 * 1024);
+    memset(data->buffer->data().ptr, 'S', data->data().len);
+    segment->send(data, data->data());
+    uploader->finish(std::move(segment), results.callback());
+
+    finishUpload(uploader.get(), server.url("/playlist"), "Playlist", results.callback(), true);
+  } // waits for the completion
+
+  auto const res = results.get();
+  ASSERT_EQUALS(2, (int)res.size());
+  ASSERT_EQUALS(server.url("/segment"), res[0].url);
+  ASSERT(res[0].success);
+  ASSERT_EQUALS(server.url("/playlist"), res[1].url);
+  ASSERT(res[1].success);
+
+  auto const uploads = server.getUploads();
+  ASSERT_EQUALS(2, (int)uploads.size());
+  ASSERT_EQUALS("/segment", uploads[0].path);
+  ASSERT_EQUALS(std::string(1024 * 1024, 'S'), uploads[0].body);
+  ASSERT_EQUALS("/playlist", uploads[1].path);
+}
+
+unittest("HttpUploader: retries") {
+  UploadServer server;
+  server.failNext("/segment", 2);
+  UploadResults results;
+
+  {
+    HttpUploaderConfig uploaderCfg{};
+    uploaderCfg.maxRetries = 3;
+    uploaderCfg.retryDelayInMs = 10;
+    auto uploader = createHttpUploader(uploaderCfg, &NullHost);
+    finishUpload(uploader.get(), server.url("/segment"), "SegmentData", results.callback());
+  }
+
+  auto const res = results.get();
+  ASSERT_EQUALS(1, (int)res.size());
+  ASSERT(res[0].success);
+  ASSERT_EQUALS(3, res[0].attemptCount);
+
+  // the whole body is sent again on each attempt
+  auto const uploads = server.getUploads();
+  ASSERT_EQUALS(1, (int)uploads.size());
+  ASSERT_EQUALS("SegmentData", uploads[0].body);
+  ASSERT_EQUALS(3, server.requestCount.load());
+}
+
+unittest("HttpUploader: dependency failure") {
+  UploadServer server;
+  server.failNext("/segment", 100);
+  UploadResults results;
+
+  {
+    HttpUploaderConfig uploaderCfg{};
+    uploaderCfg.maxRetries = 1;
+    uploaderCfg.retryDelayInMs = 10;
+    auto uploader = createHttpUploader(uploaderCfg, &NullHost);
+    finishUpload(uploader.get(), server.url("/segment"), "SegmentData", results.callback());
+    finishUpload(uploader.get(), server.url("/playlist"), "Playlist", results.callback(), true);
+  }
+
+  auto const res = results.get();
+  ASSERT_EQUALS(2, (int)res.size());
+  ASSERT_EQUALS(server.url("/segment"), res[0].url);
+  ASSERT(!res[0].success);
+  ASSERT_EQUALS(server.url("/playlist"), res[1].url);
+  ASSERT(!res[1].success);
+
+  ASSERT(server.getUploads().empty());
+  ASSERT_EQUALS(2, server.requestCount.load()); // never sent the playlist
+}
+
+unittest("HttpUploader: abandoned upload is not completed") {
+  UploadServer server;
+  UploadResults results;
+
+  {
+    auto uploader = createHttpUploader({}, &NullHost);
+
+    HttpSenderConfig cfg{};
+    cfg.url = server.url("/segment");
+    auto sender = uploader->createSender(cfg);
+    sender->send({(const uint8_t *)"Truncated", 9});
+
+    while(server.requestCount == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    sender.reset(); // without flushing
+
+    finishUpload(uploader.get(), server.url("/playlist"), "Playlist", results.callback());
+  }
+
+  auto const uploads = server.getUploads();
+  ASSERT_EQUALS(1, (int)uploads.size());
+  ASSERT_EQUALS("/playlist", uploads[0].path);
+  ASSERT_EQUALS(1, server.abortedCount.load());
+}
+
+unittest("HttpUploader: limited parallel uploads") {
+  UploadServer server;
+  server.replyDelayInMs = 30;
+  UploadResults results;
+
+  {
+    HttpUploaderConfig uploaderCfg{};
+    uploaderCfg.maxParallelUploads = 2;
+    auto uploader = createHttpUploader(uploaderCfg, &NullHost);
+    for(int i = 0; i < 6; ++i)
+      finishUpload(uploader.get(), server.url("/file" + std::to_string(i)), "Data", results.callback());
+  }
+
+  ASSERT_EQUALS(6, (int)results.get().size());
+  ASSERT_EQUALS(6, (int)server.getUploads().size());
+  ASSERT(server.maxActiveCount <= 2);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include "lib_media/common/http_puller.hpp"
+#include "tests/tests.hpp"
+
+#ifndef _WIN32
+
+#include "loopback_server.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio> // sscanf
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Minimal HTTP/1.1 server for a single file: keep-alive, HEAD, and optionally byte ranges.
+struct FileServer {
+  FileServer(std::vector<uint8_t> const &contents, bool acceptRanges)
+      : contents(contents)
+      , acceptRanges(acceptRanges) {}
+
+  std::string url() const { return m_server.baseUrl + "/file.bin"; }
+  int connectionCount() const { return m_server.connectionCount; }
+
+  std::vector<uint8_t> const contents;
+  bool const acceptRanges;
+  std::atomic<int> requestCount{0};
+  int stallInMs = 0; // in the middle of the body
+
+  private:
+  void serve(int client) {
+    std::string request;
+    char buf[4096];
+
+    while(m_server.waitReadable(client)) {
+      auto const n = recv(client, buf, sizeof buf, 0);
+      if(n <= 0)
+        break;
+      request.append(buf, n);
+
+      auto const end = request.find("\r\n\r\n");
+      if(end == std::string::npos)
+        continue;
+
+      reply(client, request.substr(0, end));
+      request.erase(0, end + 4);
+    }
+  }
+
+  void reply(int client, std::string const &request) {
+    requestCount++;
+
+    int64_t first = 0, last = contents.size() - 1;
+    auto partial = false;
+    auto const rangePos = request.find("Range: bytes=");
+    if(acceptRanges && rangePos != std::string::npos) {
+      long long a, b;
+      if(sscanf(request.c_str() + rangePos, "Range: bytes=%lld-%lld", &a, &b) == 2) {
+        first = a;
+        last = b;
+        partial = true;
+      }
+    }
+
+    auto const size = last - first + 1;
+    std::string headers = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+    headers += "Content-Length: " + std::to_string(size) + "\r\n";
+    if(acceptRanges)
+      headers += "Accept-Ranges: bytes\r\n";
+    headers += "\r\n";
+
+    LoopbackServer::sendAll(client, headers.data(), headers.size());
+    if(request.compare(0, 5, "HEAD ") != 0) {
+      LoopbackServer::sendAll(client, contents.data() + first, size / 2);
+      std::this_thread::sleep_for(std::chrono::milliseconds(stallInMs));
+      LoopbackServer::sendAll(client, contents.data() + first + size / 2, size - size / 2);
+    }
+  }
+
+  LoopbackServer m_server{[this](int client) { serve(client); }}; // last: stopped first
+};
+
+std::vector<uint8_t> makeContents(size_t size) {
+  std::vector<uint8_t> r(size);
+  for(size_t i = 0; i < size; ++i)
+    r[i] = (uint8_t)(i * 7 + i / 1000);
+  return r;
+}
+
+}
+
+unittest("HttpSource: parallel ranged download, reassembled in order") {
+  FileServer server(makeContents(10 * 1024 * 1024 + 1234), true);
+  server.stallInMs = 20; // on loopback, a range could otherwise complete before the next one starts
+
+  HttpSourceConfig cfg;
+  cfg.parallelConnections = 4;
+  cfg.rangeSize = 1024 * 1024;
+  auto source = createHttpSource(cfg);
+
+  ASSERT(Modules::In::download(source.get(), server.url().c_str()) == server.contents);
+  ASSERT_EQUALS(11, source->getStats().rangeCount);
+  ASSERT_EQUALS((int64_t)server.contents.size(), source->getStats().bytes);
+  // one per worker, the first one reusing the connection of the probe
+  ASSERT_EQUALS(4, server.connectionCount());
+  ASSERT_EQUALS(4, source->getStats().connectionCount);
+
+  // connections are reused
+  ASSERT(Modules::In::download(source.get(), server.url().c_str()) == server.contents);
+  ASSERT_EQUALS(4, server.connectionCount());
+  ASSERT_EQUALS(4, source->getStats().connectionCount);
+  ASSERT_EQUALS(22, source->getStats().rangeCount);
+}
+
+unittest("HttpSource: parallel ranged download, streamed, with up to date stats") {
+  FileServer server(makeContents(4 * 1024 * 1024), true);
+
+  HttpSourceConfig cfg;
+  cfg.parallelConnections = 2;
+  cfg.rangeSize = 1024 * 1024;
+  auto source = createHttpSource(cfg);
+
+  std::vector<uint8_t> received;
+  size_t firstChunkSize = 0;
+  int64_t lastDuration = 0;
+  source->wget(server.url().c_str(), [&](SpanC chunk) {
+    auto const stats = source->getStats();
+    ASSERT_EQUALS((int64_t)received.size(), stats.bytes);
+    ASSERT(stats.durationInUs >= lastDuration);
+    lastDuration = stats.durationInUs;
+    if(received.empty())
+      firstChunkSize = chunk.len;
+    received.insert(received.end(), chunk.ptr, chunk.ptr + chunk.len);
+  });
+
+  ASSERT(received == server.contents);
+  ASSERT(lastDuration > 0);
+  ASSERT(source->getStats().durationInUs >= lastDuration);
+  ASSERT(firstChunkSize < cfg.rangeSize); // the first range isn't buffered
+}
+
+unittest("HttpSource: ranges not supported, sequential download") {
+  FileServer server(makeContents(3 * 1024 * 1024), false);
+
+  HttpSourceConfig cfg;
+  cfg.parallelConnections = 4;
+  cfg.rangeSize = 256 * 1024;
+  auto source = createHttpSource(cfg);
+
+  ASSERT(Modules::In::download(source.get(), server.url().c_str()) == server.contents);
+  ASSERT_EQUALS(0, source->getStats().rangeCount);
+  ASSERT_EQUALS(2, server.requestCount.load()); // the probe, and the download
+}
+
+unittest("HttpSource: progress callback, during a stalled transfer") {
+  for(auto parallelConnections : {1, 2}) {
+    FileServer server(makeContents(100 * 1000), true);
+    server.stallInMs = 200;
+
+    HttpSourceConfig cfg;
+    cfg.parallelConnections = parallelConnections;
+    cfg.rangeSize = 50 * 1000;
+    auto source = createHttpSource(cfg);
+
+    size_t receivedSize = 0, lastSize = 0;
+    int stalledProgressCount = 0; // called with no new data, in the middle of the transfer
+    source->setProgressCallback([&]() {
+      if(receivedSize > 0 && receivedSize == lastSize)
+        stalledProgressCount++;
+      lastSize = receivedSize;
+    });
+    source->wget(server.url().c_str(), [&](SpanC chunk) { receivedSize += chunk.len; });
+
+    ASSERT_EQUALS(server.contents.size(), receivedSize);
+    ASSERT(stalledProgressCount >= 5);
+  }
+}
+
+unittest("HttpSource: byte range, honored or not by the server") {
+  for(auto acceptRanges : {true, false}) {
+    FileServer server(makeContents(100 * 1000), acceptRanges);
+    auto source = createHttpSource(HttpSourceConfig{});
+
+    std::vector<uint8_t> received;
+    source->wgetRange(server.url().c_str(), 12345, 50000, [&](SpanC chunk) {
+      received.insert(received.end(), chunk.ptr, chunk.ptr + chunk.len);
+    });
+    ASSERT(std::vector<uint8_t>(server.contents.begin() + 12345, server.contents.begin() + 62345) == received);
+  }
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+// Plumbing of the minimal HTTP servers used by the tests: a listening socket on a free loopback port,
+// and one thread per connection. What the servers reply is up to them.
+
+#ifndef _WIN32
+
+#include "tests/tests.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct LoopbackServer {
+  // 'serve' is called from a new thread for each connection, which is closed when it returns.
+  // Declare the server after what 'serve' uses: the connection threads are joined on destruction.
+  LoopbackServer(std::function<void(int fd)> serve)
+      : m_serve(serve) {
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT(bind(m_socket, (sockaddr *)&addr, sizeof addr) == 0);
+    ASSERT(listen(m_socket, 16) == 0);
+
+    socklen_t len = sizeof addr;
+    getsockname(m_socket, (sockaddr *)&addr, &len);
+    baseUrl = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+
+    m_thread = std::thread(&LoopbackServer::acceptLoop, this);
+  }
+
+  ~LoopbackServer() {
+    m_stop = true;
+    m_thread.join();
+    for(auto &t : m_clients)
+      t.join();
+    close(m_socket);
+  }
+
+  // returns false when the server stops
+  bool waitReadable(int fd) {
+    while(!m_stop) {
+      pollfd pfd{fd, POLLIN, 0};
+      if(poll(&pfd, 1, 50) > 0)
+        return true;
+    }
+    return false;
+  }
+
+  static void sendAll(int fd, const void *data, size_t len) {
+    auto p = (const uint8_t *)data;
+    while(len > 0) {
+      auto const n = send(fd, p, len, MSG_NOSIGNAL);
+      if(n <= 0)
+        return;
+      p += n;
+      len -= n;
+    }
+  }
+
+  std::string baseUrl;
+  std::atomic<int> connectionCount{0};
+
+  private:
+  void acceptLoop() {
+    while(waitReadable(m_socket)) {
+      auto const client = accept(m_socket, nullptr, nullptr);
+      if(client < 0)
+        continue;
+      connectionCount++;
+      m_clients.push_back(std::thread([this, client]() {
+        m_serve(client);
+        close(client);
+      }));
+    }
+  }
+
+  std::function<void(int fd)> const m_serve;
+  int m_socket;
+  std::atomic<bool> m_stop{false};
+  std::thread m_thread;
+  std::vector<std::thread> m_clients; // only accessed from the accept thread, and after it's joined
+};
+
+}
+
+#endif
@@ -1,11 +1,15 @@
 #include "lib_media/in/mpeg_dash_input.hpp"
 
 #include "lib_media/common/metadata.hpp" //MetadataPkt
+#include "lib_utils/format.hpp"
+#include "lib_utils/time.hpp" // g_UtcClock
 #include "lib_modules/modules.hpp"
 #include "tests/tests.hpp"
 
+#include <algorithm> // max
 #include <atomic>
 #include <chrono>
+#include <cstring> // strrchr
 #include <map>
 #include <mutex>
 #include <thread>
@@ -399,6 +403,225 @@ unittest("[DISABLED] mpeg_dash_input: get adaptation set SRD descriptor") {
   ASSERT_EQUALS("1,2,3,4,5,6,7", dash->getSRD(0));
 }
 
+namespace {
+struct SessionHost : KHost {
+  void log(int, char const *) override {}
+  void activate(bool enable) override { active = enable; }
+  int32_t *getCounter(char const *name) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    return &counters[name];
+  }
+  std::atomic<bool> active{false};
+  std::map<std::string, int32_t> counters;
+  std::mutex mutex;
+};
+
+void runSession(IModule *dash, SessionHost const &host) {
+  auto const deadline = steady_clock::now() + 10s;
+  while(host.active && steady_clock::now() < deadline)
+    dash->process();
+  ASSERT(!host.active);
+}
+}
+
+unittest("mpeg_dash_input: segments are downloaded concurrently, and delivered in order") {
+  static auto const MPD = R"|(
+<?xml version="1.0"?>
+<MPD>
+  <Period duration="PT8S">
+    <AdaptationSet>
+      <SegmentTemplate initialization="init.mp4" media="$Number$.m4s" startNumber="1" duration="1"/>
+      <Representation id="audio" mimeType="audio/mp4"/>
+    </AdaptationSet>
+  </Period>
+</MPD>)|";
+
+  // odd segments are slower
+  struct SlowSource : IFilePuller {
+    SlowSource(LocalFilesystem *fs, int *concurrent, int *maxConcurrent)
+        : fs(fs)
+        , concurrent(concurrent)
+        , maxConcurrent(maxConcurrent) {}
+    void wget(const char *url, std::function<void(SpanC)> callback) override {
+      {
+        std::unique_lock<std::mutex> lock(fs->mutex);
+        *maxConcurrent = std::max(*maxConcurrent, ++*concurrent);
+      }
+      auto const number = atoi(strrchr(url, '/') + 1);
+      std::this_thread::sleep_for(std::chrono::milliseconds(number % 2 ? 30 : 1));
+      fs->wget(url, callback);
+      std::unique_lock<std::mutex> lock(fs->mutex);
+      --*concurrent;
+    }
+    void askToExit() override {}
+    LocalFilesystem *fs;
+    int *concurrent, *maxConcurrent; // protected by 'fs->mutex'
+  };
+
+  struct Factory : IFilePullerFactory {
+    std::unique_ptr<IFilePuller> create() override {
+      return std::make_unique<SlowSource>(&fs, &concurrent, &maxConcurrent);
+    }
+    LocalFilesystem fs;
+    int concurrent = 0, maxConcurrent = 0;
+  };
+
+  Factory factory;
+  factory.fs.resources["main/live.mpd"] = MPD;
+  factory.fs.resources["main/init.mp4"] = "I";
+  for(int i = 1; i <= 8; ++i)
+    factory.fs.resources["main/" + std::to_string(i) + ".m4s"] = std::to_string(i);
+
+  SessionHost host;
+  MpegDashInputConfig cfg;
+  cfg.segmentsInFlight = 3;
+  auto dash = createModule<MPEG_DASH_Input>(&host, &factory, "main/live.mpd", cfg);
+
+  std::string received;
+  auto onData = [&](Data data) { received += std::string((const char *)data->data().ptr, data->data().len); };
+  ConnectOutput(dash->getOutput(0), onData);
+
+  runSession(dash.get(), host);
+  dash = nullptr;
+
+  ASSERT_EQUALS("I12345678", received);
+  ASSERT_EQUALS(3, factory.maxConcurrent);
+  ASSERT_EQUALS(0, host.counters["segments_in_flight"]);
+}
+
+unittest("mpeg_dash_input: live segments are requested at their availability time") {
+  static auto const MPD = R"|(
+<?xml version="1.0"?>
+<MPD type="dynamic" availabilityStartTime="1970-01-01T00:00:00Z" minimumUpdatePeriod="PT1S">
+  <Period%s>
+    <AdaptationSet>
+      <SegmentTemplate initialization="init.mp4" media="$Number$.m4s" startNumber="1" duration="100" timescale="1000"/>
+      <Representation id="video" mimeType="video/mp4"/>
+    </AdaptationSet>
+  </Period>
+</MPD>)|";
+
+  // the session starts 250ms after the availability start time
+  struct ShiftedClock : IUtcClock {
+    Fraction getTime() override {
+      return Fraction(duration_cast<milliseconds>(steady_clock::now() - start).count() + 250, 1000);
+    }
+    steady_clock::time_point const start = steady_clock::now();
+  };
+
+  struct RecordingSource : IFilePuller, IFilePullerFactory {
+    void wget(const char *url, std::function<void(SpanC)> callback) override {
+      std::string content;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        requestTimes.push_back({url, clock->getTime()});
+        content = std::string(url) == "main/live.mpd" ? mpd : "x";
+      }
+      callback({(const uint8_t *)content.data(), content.size()});
+    }
+    void askToExit() override {}
+    std::unique_ptr<IFilePuller> create() override { return std::make_unique<NotOwningFilePuller>(this); }
+
+    IUtcClock *clock;
+    std::string mpd;
+    std::vector<std::pair<std::string, Fraction>> requestTimes;
+    std::mutex mutex;
+  };
+
+  ShiftedClock clock;
+  auto const oldClock = g_UtcClock;
+  g_UtcClock = &clock;
+
+  RecordingSource source;
+  source.clock = &clock;
+  source.mpd = format(MPD, "");
+
+  SessionHost host;
+  auto dash = createModule<MPEG_DASH_Input>(&host, &source, "main/live.mpd");
+  ConnectOutput(dash->getOutput(0), [](Data) {});
+
+  // the background MPD update ends the presentation after 20 segments
+  std::thread updater([&]() {
+    std::this_thread::sleep_for(500ms);
+    std::unique_lock<std::mutex> lock(source.mutex);
+    source.mpd = format(MPD, " duration=\"PT2S\"");
+  });
+
+  runSession(dash.get(), host);
+  updater.join();
+  dash = nullptr;
+  g_UtcClock = oldClock;
+
+  std::vector<std::string> segments;
+  for(auto &req : source.requestTimes) {
+    auto const &url = req.first;
+    if(url == "main/live.mpd" || url == "main/init.mp4")
+      continue;
+    segments.push_back(url);
+
+    // segment N is available from N*100ms
+    auto const number = atoi(url.c_str() + 5);
+    auto const lateness = req.second - Fraction(number, 10);
+    ASSERT(lateness >= 0);
+    ASSERT(lateness < Fraction(80, 1000));
+  }
+
+  // starts with the latest available segment
+  ASSERT_EQUALS("main/2.m4s", segments.front());
+  ASSERT_EQUALS("main/20.m4s", segments.back());
+  ASSERT_EQUALS(19, (int)segments.size());
+  ASSERT(host.counters["mpd_updates"] >= 1);
+}
+
+unittest("mpeg_dash_input: a live segment missing for good is skipped") {
+  static auto const MPD = R"|(
+<?xml version="1.0"?>
+<MPD type="dynamic" availabilityStartTime="1970-01-01T00:00:00Z">
+  <Period duration="PT1S">
+    <AdaptationSet>
+      <SegmentTemplate initialization="init.mp4" media="$Number$.m4s" startNumber="1" duration="100" timescale="1000"/>
+      <Representation id="video" mimeType="video/mp4"/>
+    </AdaptationSet>
+  </Period>
+</MPD>)|";
+
+  // the session starts 250ms after the availability start time
+  struct ShiftedClock : IUtcClock {
+    Fraction getTime() override {
+      return Fraction(duration_cast<milliseconds>(steady_clock::now() - start).count() + 250, 1000);
+    }
+    steady_clock::time_point const start = steady_clock::now();
+  };
+
+  ShiftedClock clock;
+  auto const oldClock = g_UtcClock;
+  g_UtcClock = &clock;
+
+  LocalFilesystem fs;
+  fs.resources["main/live.mpd"] = MPD;
+  fs.resources["main/init.mp4"] = "I";
+  for(int i = 1; i <= 10; ++i)
+    if(i != 4)
+      fs.resources["main/" + std::to_string(i) + ".m4s"] = std::to_string(i);
+
+  SessionHost host;
+  MpegDashInputConfig cfg;
+  cfg.retryDelayInMs = 10;
+  cfg.maxRetries = 3;
+  auto dash = createModule<MPEG_DASH_Input>(&host, &fs, "main/live.mpd", cfg);
+
+  std::string received;
+  auto onData = [&](Data data) { received += std::string((const char *)data->data().ptr, data->data().len); };
+  ConnectOutput(dash->getOutput(0), onData);
+
+  runSession(dash.get(), host);
+  dash = nullptr;
+  g_UtcClock = oldClock;
+
+  ASSERT_EQUALS("I235678910", received);
+  ASSERT_EQUALS(3, host.counters["segment_retries"]);
+}
+
 std::unique_ptr<IFilePuller> createHttpSource();
 
 secondclasstest("mpeg_dash_input: get MPD from remote server") {
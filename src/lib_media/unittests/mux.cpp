@@ -9,6 +9,7 @@
 #include "tests/tests.hpp"
 
 #include <cassert>
+#include <fstream> // ifstream
 
 #include "modules_common.hpp"
 
@@ -232,6 +233,87 @@ unittest("mux GPAC mp4: fragmented segments, one fragment per frame") {
   ASSERT_EQUALS(ref, runMux(loadModule("GPACMuxMP4", &NullHost, &cfg)));
 }
 
+unittest("mux GPAC mp4: low latency, chunks of several frames flushed in memory") {
+  auto cfg = Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerFrame, SegNumStartsAtZero | FlushFragMemory};
+  cfg.fragmentDurationInMs = 500;
+  auto res = runMux(loadModule("GPACMuxMP4", &NullHost, &cfg));
+
+  // the init segment, then for each segment: its chunks, and an EOS closing it
+  ASSERT(res.size() > 1);
+  int64_t totalDurationIn180k = 0;
+  int chunkCount = 0;
+  for(size_t i = 1; i < res.size(); ++i) {
+    totalDurationIn180k += res[i].durationIn180k;
+    if(res[i].eos)
+      continue;
+
+    chunkCount++;
+    ASSERT_EQUALS(IClock::Rate / 2, (int64_t)res[i].latencyIn180k);
+    if((int64_t)res[i].durationIn180k < IClock::Rate / 2) // only the last chunk of a segment may be shorter
+      ASSERT(res[i + 1].eos);
+  }
+
+  ASSERT_EQUALS(int64_t(363629 + 359445 + 175543), totalDurationIn180k);
+  ASSERT(chunkCount >= 9 && chunkCount <= 12);
+}
+
+unittest("mux GPAC mp4: in memory, named segments for every policy") {
+  struct Recorder : ModuleS {
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      filenames.push_back(meta->filename);
+      contents.push_back(string((const char *)data->data().ptr, data->data().len));
+    }
+    vector<string> filenames, contents;
+  };
+
+  auto run = [](Mp4MuxConfig cfg) {
+    cfg.baseName = "mem";
+    cfg.inMemory = true;
+    auto mux = loadModule("GPACMuxMP4", &NullHost, &cfg);
+    auto recorder = createModule<Recorder>();
+    ConnectModules(mux.get(), 0, recorder.get(), 0);
+    runMux(mux);
+    return recorder;
+  };
+  auto boxType = [](string const &contents, size_t offset = 0) { return contents.substr(offset + 4, 4); };
+  auto isOnDisk = [](string const &fn) { return ifstream(fn).good(); };
+
+  {
+    auto r = run(Mp4MuxConfig{"", 0, NoSegment, NoFragment});
+    ASSERT_EQUALS(vector<string>({"mem.mp4"}), r->filenames);
+    ASSERT_EQUALS("ftyp", boxType(r->contents[0]));
+    ASSERT(r->contents[0].find("moov") != string::npos);
+  }
+  {
+    auto r = run(Mp4MuxConfig{"", 0, NoSegment, OneFragmentPerRAP});
+    ASSERT_EQUALS(vector<string>({"mem.mp4"}), r->filenames);
+    ASSERT(r->contents[0].find("moov") != string::npos);
+    ASSERT(r->contents[0].find("moof") != string::npos);
+  }
+  {
+    auto r = run(Mp4MuxConfig{"", 2000, IndependentSegment, NoFragment, SegNumStartsAtZero});
+    ASSERT_EQUALS(vector<string>({"mem-0.mp4", "mem-1.mp4", "mem-2.mp4"}), r->filenames);
+    for(auto &contents : r->contents)
+      ASSERT_EQUALS("ftyp", boxType(contents));
+  }
+  {
+    auto r = run(Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerSegment, SegNumStartsAtZero});
+    ASSERT_EQUALS(vector<string>({"mem-init.mp4", "mem-0.m4s", "mem-1.m4s", "mem-2.m4s"}), r->filenames);
+    ASSERT(r->contents[0].find("moov") != string::npos);
+    for(size_t i = 1; i < r->contents.size(); ++i)
+      ASSERT_EQUALS("styp", boxType(r->contents[i]));
+  }
+  {
+    auto r = run(Mp4MuxConfig{"", 2000, FragmentedSegment, OneFragmentPerFrame, SegNumStartsAtZero | FlushFragMemory});
+    ASSERT_EQUALS("mem-init.mp4", r->filenames[0]);
+    ASSERT_EQUALS("mem-2.m4s", r->filenames.back());
+  }
+
+  for(auto fn : {"mem.mp4", "mem-init.mp4", "mem-0.mp4", "mem-0.m4s"})
+    ASSERT(!isOnDisk(fn));
+}
+
 // remove this when the below tests are split
 std::vector<Meta> operator+(std::vector<Meta> const &a, std::vector<Meta> const &b) {
   std::vector<Meta> r;
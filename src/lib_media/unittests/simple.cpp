@@ -34,3 +34,51 @@ unittest("print packets size from file: File -> Out::Print") {
 
   f->process();
 }
+
+namespace {
+// the blocks sent by a FileInput
+std::vector<std::vector<uint8_t>> readFile(FileInputConfig cfg) {
+  std::vector<std::vector<uint8_t>> blocks;
+  auto f = loadModule("FileInput", &NullHost, &cfg);
+  ConnectOutput(f->getOutput(0), [&](Data data) {
+    auto buf = data->data();
+    blocks.push_back({buf.ptr, buf.ptr + buf.len});
+  });
+  for(int i = 0; i < 100; ++i)
+    f->process();
+  return blocks;
+}
+}
+
+unittest("FileInput: memory-mapped") {
+  FileInputConfig cfg;
+  cfg.filename = "data/beepbop.mp4";
+  cfg.blockSize = 10000;
+  auto const expected = readFile(cfg);
+  ASSERT_EQUALS(6, (int)expected.size());
+
+  cfg.memoryMapped = true;
+  ASSERT(expected == readFile(cfg));
+}
+
+unittest("FileInput: memory-mapped buffers are read-only") {
+  FileInputConfig cfg;
+  cfg.filename = "data/beepbop.mp4";
+  cfg.memoryMapped = true;
+  auto f = loadModule("FileInput", &NullHost, &cfg);
+  Data received;
+  ConnectOutput(f->getOutput(0), [&](Data data) { received = data; });
+  f->process();
+
+  ASSERT(received->data().len > 0);
+  ASSERT_THROWN(received->buffer->data());
+}
+
+#ifdef __linux__
+unittest("FileInput: memory-mapped, special file fallback") {
+  FileInputConfig cfg;
+  cfg.filename = "/proc/self/stat"; // size is reported as zero
+  cfg.memoryMapped = true;
+  ASSERT(!readFile(cfg).empty());
+}
+#endif
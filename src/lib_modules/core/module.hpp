@@ -7,6 +7,7 @@
 // This is the only header file that third-parties are expected to include.
 // Do not pass or return STL objects or concrete classes here.
 
+#include <cstdint>
 #include <memory>
 
 #include "buffer.hpp"
@@ -53,6 +54,11 @@ struct KHost {
 
   // if 'enable' is true, will cause 'process' to be called repeatedly
   virtual void activate(bool enable) = 0;
+
+  // get a new counter, published by the host (e.g in the stats registry).
+  // The returned pointer is owned by the host and outlives the module.
+  // Returns nullptr if the host doesn't publish counters (see 'HostCounter').
+  virtual int32_t *getCounter(char const * /*name*/) { return nullptr; }
 };
 
 }
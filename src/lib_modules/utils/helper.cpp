@@ -62,6 +62,8 @@ void NullHostType::log(int level, char const *msg) {
     printf("[%d] %s\n", level, msg);
 }
 
+int32_t *NullHostType::getCounter(char const *) { return &m_counter; }
+
 void Output::post(Data data) {
   m_metadataCap.updateMetadata(data);
   signal.emit(data);
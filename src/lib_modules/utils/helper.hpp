@@ -9,7 +9,11 @@
 #include "../core/module.hpp"
 #include "lib_signals/signals.hpp" // Signals::Signal
 
+#include <algorithm> // max
+#include <cstring> // memcpy
+#include <deque>
 #include <memory>
+#include <mutex>
 
 namespace Modules {
 
@@ -56,6 +60,29 @@ class OutputDefault : public Output {
   std::shared_ptr<IAllocator> allocator;
 };
 
+// Writes bytes sequentially into a resizable Data: e.g the output of an XmlWriter.
+// Starts at the beginning of 'data', whose initial size is used as a capacity.
+// Call 'finish()' to set the final size.
+class DataAppender {
+  public:
+  DataAppender(DataRawResizable *data)
+      : m_data(data) {}
+
+  void append(const char *ptr, size_t len) {
+    auto const capacity = m_data->data().len;
+    if(m_size + len > capacity)
+      m_data->resize(std::max(2 * capacity, m_size + len));
+    memcpy(m_data->buffer->data().ptr + m_size, ptr, len);
+    m_size += len;
+  }
+
+  void finish() { m_data->resize(m_size); }
+
+  private:
+  DataRawResizable *const m_data;
+  size_t m_size = 0;
+};
+
 class OutputCap : public virtual IOutputCap {
   public:
   OutputCap(size_t allocatorSize) { this->allocatorSize = allocatorSize; }
@@ -121,9 +148,33 @@ class ModuleS : public Module {
   KInput *const input;
 };
 
+// A counter published by the host, or kept by the module if the host doesn't publish counters.
+// A null 'name' gives a counter which isn't published.
+class HostCounter {
+  public:
+  HostCounter(KHost *host, char const *name)
+      : m_counter(name ? host->getCounter(name) : nullptr) {
+    if(!m_counter)
+      m_counter = &m_local;
+  }
+
+  HostCounter(HostCounter const &) = delete;
+  HostCounter &operator=(HostCounter const &) = delete;
+
+  int32_t &operator*() { return *m_counter; }
+
+  private:
+  int32_t m_local = 0;
+  int32_t *m_counter;
+};
+
 struct NullHostType : KHost {
   void log(int, char const *) override;
   void activate(bool) override {};
+  int32_t *getCounter(char const *) override;
+
+  private:
+  int32_t m_counter = 0; // shared by all the counters: nobody reads it
 };
 
 static NullHostType NullHost;
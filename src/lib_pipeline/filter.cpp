@@ -43,6 +43,10 @@ void Filter::log(int level, char const *msg) {
 
 void Filter::activate(bool enable) { active = enable; }
 
+int32_t *Filter::getCounter(char const *name) {
+  return &statsRegistry->getNewEntry(format("%s.%s", m_name.c_str(), name).c_str())->value;
+}
+
 void Filter::setDelegate(std::shared_ptr<IModule> module) { delegate = module; }
 
 int Filter::getNumInputs() const { return delegate->getNumInputs(); }
@@ -59,6 +59,7 @@ class Filter : public IFilter, public KHost, private IEventSink {
   // KHost implementation
   void log(int level, char const *msg) override;
   void activate(bool enable) override;
+  int32_t *getCounter(char const *name) override;
 
   // IEventSink implementation
   void endOfStream() override;
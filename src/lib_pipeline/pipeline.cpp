@@ -9,6 +9,8 @@
 
 #include <algorithm>
 #include <cstring>
+#include <deque>
+#include <mutex>
 #include <sstream>
 #include <string>
 
@@ -23,18 +25,29 @@ static const size_t ALLOC_NUM_BLOCKS_LOW_LATENCY = 2;
 namespace Pipelines {
 
 struct StatsRegistry : IStatsRegistry {
-  StatsRegistry()
+  StatsRegistry(LogSink *log)
       : shmem(createSharedMemory(size, std::to_string(getPid()).c_str(), true))
-      , entryIdx(0) {
+      , entryIdx(0)
+      , log(log) {
     memset(shmem->data(), 0, size);
   }
 
   StatsEntry *getNewEntry(const char *name) override {
-    entryIdx++;
-    if(entryIdx >= maxNumEntry)
-      throw std::runtime_error(
-            format("SharedMemory: accessing too far (%s with max=%s).", entryIdx - 1, maxNumEntry - 1));
+    // modules may create entries while running, from their own thread
+    std::unique_lock<std::mutex> lock(mutex);
+    if(entryIdx >= maxNumEntry) {
+      // not published, but each entry above the limit still gets its own storage
+      if(!overflowWarned) {
+        auto const msg = format("Stats: too many entries (max=%s): \"%s\" and the next ones won't be published.",
+              int(maxNumEntry), name);
+        log->log(Warning, msg.c_str());
+        overflowWarned = true;
+      }
+      overflowEntries.emplace_back();
+      return &overflowEntries.back();
+    }
 
+    entryIdx++;
     auto entry = (StatsEntry *)shmem->data() + entryIdx - 1;
 
     strncpy(entry->name, name, sizeof(entry->name) - 1);
@@ -48,10 +61,14 @@ struct StatsRegistry : IStatsRegistry {
   static const int maxNumEntry = size / sizeof(StatsEntry);
   StatsEntry **entries;
   int entryIdx;
+  std::deque<StatsEntry> overflowEntries; // stable addresses
+  bool overflowWarned = false;
+  LogSink *const log;
+  std::mutex mutex;
 };
 
 Pipeline::Pipeline(LogSink *log, bool isLowLatency, Threading threading)
-    : statsMem(new StatsRegistry)
+    : statsMem(new StatsRegistry(log ? log : g_Log))
     , graph(new Graph)
     , m_log(log ? log : g_Log)
     , allocatorNumBlocks(isLowLatency ? ALLOC_NUM_BLOCKS_LOW_LATENCY : Modules::ALLOC_NUM_BLOCKS_DEFAULT)
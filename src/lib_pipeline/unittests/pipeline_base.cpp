@@ -120,3 +120,39 @@ unittest("pipeline: multiple inputs (send same packets to 2 inputs and check cal
   p.waitForEndOfStream();
   ASSERT_EQUALS(ThreadedDualInput::numCalls, 1u);
 }
+
+unittest("pipeline: counters above the stats registry capacity") {
+  struct ManyCounters : public Modules::Module {
+    ManyCounters(Modules::KHost *host) {
+      for(int i = 0; i < 1000; ++i)
+        counters.push_back(host->getCounter(std::to_string(i).c_str()));
+      for(auto counter : counters)
+        ++*counter;
+
+      // the ones which aren't published don't share their storage
+      for(auto counter : counters)
+        ASSERT_EQUALS(1, *counter);
+    }
+    void process() override {}
+    std::vector<int32_t *> counters;
+  };
+
+  Pipeline p;
+  p.addModule<ManyCounters>();
+}
+
+unittest("pipeline: host which doesn't publish counters") {
+  struct Host : Modules::KHost {
+    void log(int, char const *) override {}
+    void activate(bool) override {}
+  };
+
+  Host host;
+  ASSERT(host.getCounter("a") == nullptr);
+
+  Modules::HostCounter a(&host, "a"), b(&host, "b");
+  ++*a;
+  *b += 2;
+  ASSERT_EQUALS(1, *a);
+  ASSERT_EQUALS(2, *b);
+}
@@ -0,0 +1,302 @@
+#include "async_writer.hpp"
+
+#include "format.hpp"
+
+#include <algorithm> // min, max
+#include <cerrno>
+#include <chrono>
+#include <cstring> // memcpy, strerror
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define lseek _lseeki64
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+using namespace std;
+
+namespace {
+// O_DIRECT requires aligned buffers, offsets and sizes
+size_t const ALIGNMENT = 4096;
+}
+
+AsyncWriter::AsyncWriter(AsyncWriterConfig const &config)
+    : m_config(config) {
+  if(m_config.blockSize == 0 || m_config.blockSize % ALIGNMENT)
+    throw runtime_error(format("AsyncWriter: block size must be a multiple of %s", ALIGNMENT));
+
+  m_thread = thread(&AsyncWriter::threadProc, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+  for(auto &file : m_current)
+    push({Operation::Close, file.first, {}, move(file.second), {}});
+
+  {
+    unique_lock<mutex> lock(m_mutex);
+    m_stop = true;
+    m_changed.notify_all();
+  }
+
+  m_thread.join();
+}
+
+AsyncWriter::FileId AsyncWriter::open(string const &path) {
+  auto const file = m_nextFile++;
+  m_current[file] = Block(); // allocated on the first write
+  push({Operation::Open, file, path, {}, {}});
+  return file;
+}
+
+void AsyncWriter::write(FileId file, SpanC data) {
+  auto &block = m_current.at(file);
+
+  while(data.len > 0) {
+    if(!block.ptr) {
+      auto const offset = block.offset;
+      block = allocBlock();
+      block.offset = offset;
+    }
+
+    auto const size = min(data.len, m_config.blockSize - block.size);
+    memcpy(block.ptr + block.size, data.ptr, size);
+    block.size += size;
+    data += size;
+
+    if(block.size == m_config.blockSize) {
+      // O_DIRECT: what was submitted is written again, with the rest of the block
+      if(m_config.directIo)
+        block.begin = 0;
+      pushBlock(file, block);
+    }
+  }
+}
+
+void AsyncWriter::submit(FileId file) {
+  auto &block = m_current.at(file);
+  if(block.size == block.begin)
+    return;
+
+  if(!m_config.directIo) {
+    // the next block starts at an unaligned offset, which is fine without O_DIRECT
+    pushBlock(file, block);
+    return;
+  }
+
+  // the block stays aligned in the file: it keeps being filled, and its new bytes are written from a copy
+  auto copy = allocBlock();
+  copy.size = block.size - block.begin;
+  copy.offset = block.offset + block.begin;
+  memcpy(copy.ptr, block.ptr + block.begin, copy.size);
+  push({Operation::Write, file, {}, move(copy), {}});
+  block.begin = block.size;
+}
+
+// 'block' is replaced with an unallocated block, at the following offset
+void AsyncWriter::pushBlock(FileId file, Block &block) {
+  auto const next = block.offset + (int64_t)block.size;
+  push({Operation::Write, file, {}, move(block), {}});
+  block = Block();
+  block.offset = next;
+}
+
+void AsyncWriter::close(FileId file) {
+  auto i = m_current.find(file);
+  push({Operation::Close, file, {}, move(i->second), {}});
+  m_current.erase(i);
+}
+
+void AsyncWriter::post(function<void()> task) { push({Operation::Task, -1, {}, {}, move(task)}); }
+
+void AsyncWriter::flush() {
+  unique_lock<mutex> lock(m_mutex);
+  while(!m_queue.empty() || m_busy)
+    m_changed.wait(lock);
+}
+
+AsyncWriter::Stats AsyncWriter::getStats() const {
+  unique_lock<mutex> lock(m_mutex);
+  return m_stats;
+}
+
+vector<string> AsyncWriter::takeErrors() {
+  unique_lock<mutex> lock(m_mutex);
+  vector<string> r;
+  swap(r, m_errors);
+  return r;
+}
+
+AsyncWriter::Block AsyncWriter::allocBlock() {
+  {
+    unique_lock<mutex> lock(m_mutex);
+    if(!m_freeBlocks.empty()) {
+      auto block = move(m_freeBlocks.back());
+      m_freeBlocks.pop_back();
+      return block;
+    }
+    m_stats.allocatedBytes += m_config.blockSize + ALIGNMENT;
+  }
+
+  Block block;
+  block.storage.reset(new uint8_t[m_config.blockSize + ALIGNMENT]);
+  auto const addr = (uintptr_t)block.storage.get();
+  block.ptr = block.storage.get() + (ALIGNMENT - addr % ALIGNMENT) % ALIGNMENT;
+  return block;
+}
+
+// called with 'm_mutex' locked
+void AsyncWriter::recycleBlock(Block block) {
+  if(!block.storage)
+    return;
+
+  // keep enough blocks for the pending writes, release the others
+  if(m_freeBlocks.size() * m_config.blockSize >= m_config.maxPendingBytes) {
+    m_stats.allocatedBytes -= m_config.blockSize + ALIGNMENT;
+    return;
+  }
+
+  block.size = 0;
+  block.offset = 0;
+  block.begin = 0;
+  m_freeBlocks.push_back(move(block));
+}
+
+// a pending operation costs the whole block it holds, even if partially filled
+size_t AsyncWriter::getPendingBytes(Operation const &op) const { return op.block.storage ? m_config.blockSize : 0; }
+
+void AsyncWriter::push(Operation op) {
+  auto const bytes = getPendingBytes(op);
+  unique_lock<mutex> lock(m_mutex);
+
+  // backpressure
+  while(m_pendingBytes > 0 && m_pendingBytes + bytes > m_config.maxPendingBytes)
+    m_changed.wait(lock);
+
+  m_pendingBytes += bytes;
+  m_queue.push_back(move(op));
+  m_changed.notify_all();
+}
+
+void AsyncWriter::threadProc() {
+  while(1) {
+    Operation op;
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      while(m_queue.empty() && !m_stop)
+        m_changed.wait(lock);
+
+      if(m_queue.empty())
+        return; // stopped, and everything was written
+
+      op = move(m_queue.front());
+      m_queue.pop_front();
+      m_busy = true;
+    }
+
+    execute(op);
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_pendingBytes -= getPendingBytes(op);
+      recycleBlock(move(op.block));
+      m_busy = false;
+      m_changed.notify_all();
+    }
+  }
+}
+
+void AsyncWriter::execute(Operation &op) {
+  switch(op.type) {
+  case Operation::Open: {
+    auto flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+#ifdef O_DIRECT
+    if(m_config.directIo)
+      flags |= O_DIRECT;
+#endif
+    auto fd = ::open(op.path.c_str(), flags, 0644);
+#ifdef O_DIRECT
+    if(fd < 0 && errno == EINVAL && m_config.directIo)
+      fd = ::open(op.path.c_str(), flags & ~O_DIRECT, 0644); // e.g tmpfs
+#endif
+    if(fd < 0)
+      onError(format("Can't open file for writing: '%s' (%s)", op.path, strerror(errno)));
+    m_fds[op.file] = fd;
+    break;
+  }
+  case Operation::Write:
+  case Operation::Close: {
+    auto const fd = m_fds[op.file];
+    if(fd >= 0 && op.block.size > op.block.begin) {
+#ifdef O_DIRECT
+      // submitted data and the last block of a file are usually too small for O_DIRECT
+      if(m_config.directIo) {
+        auto const aligned = (op.block.offset + op.block.begin) % ALIGNMENT == 0 &&
+              (op.block.size - op.block.begin) % ALIGNMENT == 0;
+        auto const flags = fcntl(fd, F_GETFL);
+        if(!!(flags & O_DIRECT) != aligned)
+          fcntl(fd, F_SETFL, aligned ? flags | O_DIRECT : flags & ~O_DIRECT); // fails on e.g tmpfs: no O_DIRECT
+      }
+#endif
+      writeBlock(fd, op.block);
+    }
+
+    if(op.type == Operation::Close) {
+      if(fd >= 0)
+        ::close(fd);
+      m_fds.erase(op.file);
+    }
+    break;
+  }
+  case Operation::Task:
+    try {
+      op.task();
+    } catch(exception const &e) {
+      onError(e.what());
+    }
+    break;
+  }
+}
+
+void AsyncWriter::writeBlock(int fd, Block const &block) {
+  auto const start = chrono::steady_clock::now();
+
+  if(lseek(fd, block.offset + block.begin, SEEK_SET) < 0) {
+    onError(format("Seek failure (%s)", strerror(errno)));
+    return;
+  }
+
+  size_t done = block.begin;
+  while(done < block.size) {
+    auto const n = ::write(fd, block.ptr + done, block.size - done);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      onError(format("Write failure (%s)", strerror(errno)));
+      return;
+    }
+    done += n;
+  }
+
+  auto const latency = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+  unique_lock<mutex> lock(m_mutex);
+  m_stats.bytesWritten += block.size - block.begin;
+  m_stats.writeCount++;
+  m_stats.totalLatencyInUs += latency;
+  m_stats.maxLatencyInUs = max<int64_t>(m_stats.maxLatencyInUs, latency);
+}
+
+void AsyncWriter::onError(string msg) {
+  unique_lock<mutex> lock(m_mutex);
+  m_stats.errorCount++;
+  m_errors.push_back(move(msg));
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "span.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct AsyncWriterConfig {
+  size_t blockSize = 1024 * 1024; // a multiple of 4096
+  size_t maxPendingBytes = 16 * 1024 * 1024;
+  bool directIo = false; // bypass the page cache (O_DIRECT) when the platform and the filesystem allow it
+};
+
+// Writes files from a background thread, so slow storage (e.g NFS) doesn't stall the caller.
+// Small writes are coalesced into large blocks, allocated on the first write to a file and
+// recycled once written. Backpressure: the caller blocks while more than 'maxPendingBytes'
+// are waiting to be written.
+// Operations are executed in order. Not thread-safe: to be used from a single thread.
+class AsyncWriter {
+  public:
+  struct Stats {
+    int64_t bytesWritten = 0;
+    int64_t writeCount = 0;
+    int64_t totalLatencyInUs = 0;
+    int64_t maxLatencyInUs = 0;
+    int64_t errorCount = 0;
+    int64_t allocatedBytes = 0; // blocks, in use or pooled
+  };
+
+  using FileId = int;
+
+  AsyncWriter(AsyncWriterConfig const &config = AsyncWriterConfig());
+  ~AsyncWriter(); // waits until everything is written
+
+  // opening errors are reported later, the writes to such a file are ignored
+  FileId open(std::string const &path);
+  void write(FileId file, SpanC data);
+  void close(FileId file);
+
+  // queues what was written to 'file' so far, even if its current block isn't full (e.g at the end of a chunk).
+  // With 'directIo', the block is later rewritten in full, so the writes stay aligned.
+  void submit(FileId file);
+
+  // runs 'task' on the writer thread, e.g to create directories or remove files
+  void post(std::function<void()> task);
+
+  // blocks until everything queued so far is done
+  void flush();
+
+  Stats getStats() const;
+
+  // the errors which occurred since the last call
+  std::vector<std::string> takeErrors();
+
+  private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> storage;
+    uint8_t *ptr = nullptr; // aligned, for O_DIRECT
+    size_t size = 0;
+    int64_t offset = 0; // in the file, of 'ptr[0]'
+    size_t begin = 0; // the bytes before were already submitted
+  };
+
+  struct Operation {
+    enum Type { Open, Write, Close, Task } type;
+    FileId file;
+    std::string path;
+    Block block;
+    std::function<void()> task;
+  };
+
+  Block allocBlock();
+  void recycleBlock(Block block);
+  void pushBlock(FileId file, Block &block);
+  size_t getPendingBytes(Operation const &op) const;
+  void push(Operation op);
+  void threadProc();
+  void execute(Operation &op);
+  void writeBlock(int fd, Block const &block);
+  void onError(std::string msg);
+
+  AsyncWriterConfig const m_config;
+  FileId m_nextFile = 0;
+  std::map<FileId, Block> m_current; // caller side: the block being filled, for each open file (or just its offset)
+
+  std::map<FileId, int> m_fds; // writer thread side
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_changed;
+  std::deque<Operation> m_queue;
+  std::vector<Block> m_freeBlocks;
+  size_t m_pendingBytes = 0;
+  bool m_busy = false;
+  bool m_stop = false;
+  Stats m_stats;
+  std::vector<std::string> m_errors;
+
+  std::thread m_thread;
+};
@@ -0,0 +1,137 @@
+#include "crc.hpp"
+
+#if(defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC_HAS_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+auto const POLY = 0x04C11DB7u;
+
+// 'data[k][i]' is the CRC (with a zero initial value) of byte 'i' followed by 'k' zero bytes.
+struct CrcTables {
+  uint32_t data[8][256];
+};
+
+constexpr CrcTables initTables() {
+  CrcTables r{};
+  for(int i = 0; i < 256; i++) {
+    uint32_t c = i << 24;
+    for(int j = 0; j < 8; j++)
+      c = (c << 1) ^ (c & 0x80000000 ? POLY : 0);
+    r.data[0][i] = c;
+  }
+
+  for(int k = 1; k < 8; k++)
+    for(int i = 0; i < 256; i++)
+      r.data[k][i] = (r.data[k - 1][i] << 8) ^ r.data[0][r.data[k - 1][i] >> 24];
+
+  return r;
+}
+
+constexpr auto tables = initTables();
+
+uint32_t crcSliceBy8(SpanC data, uint32_t crc) {
+  auto &t = tables.data;
+  auto p = data.ptr;
+  auto len = data.len;
+
+  while(len >= 8) {
+    auto const hi = crc ^ ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+    crc = t[7][hi >> 24] ^ t[6][(hi >> 16) & 0xff] ^ t[5][(hi >> 8) & 0xff] ^ t[4][hi & 0xff] ^ t[3][p[4]] ^
+          t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    p += 8;
+    len -= 8;
+  }
+
+  while(len--)
+    crc = (crc << 8) ^ t[0][((crc >> 24) ^ *p++) & 0xff];
+
+  return crc;
+}
+
+#ifdef CRC_HAS_PCLMUL
+
+// Folding with carry-less multiplication, after Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction".
+// Blocks are loaded big-endian, so bit 'i' of a register is the coefficient of x^i.
+// Folding a block 'H.x^64 + L' forward by N bits gives 'H.(x^(N+64) mod P) + L.(x^N mod P)'.
+auto const X576 = 0x8833794Cull; // x^(512+64) mod P
+auto const X512 = 0xE6228B11ull; // x^512 mod P
+auto const X192 = 0xC5B9CD4Cull; // x^(128+64) mod P
+auto const X128 = 0xE8A45605ull; // x^128 mod P
+
+// Minimum input size for the folding path
+auto const PCLMUL_MIN_SIZE = 64;
+
+__attribute__((target("pclmul,ssse3"))) inline __m128i loadBigEndian(const uint8_t *p) {
+  auto const reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), reverse);
+}
+
+__attribute__((target("pclmul,ssse3"))) inline __m128i fold(__m128i acc, __m128i k) {
+  return _mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x11), _mm_clmulepi64_si128(acc, k, 0x00));
+}
+
+__attribute__((target("pclmul,ssse3"))) uint32_t crcPclmul(SpanC data, uint32_t crc) {
+  auto p = data.ptr;
+  auto len = data.len;
+
+  // the initial CRC value is XOR-ed into the first 32 bits of the message
+  auto acc0 = _mm_xor_si128(loadBigEndian(p), _mm_set_epi32(crc, 0, 0, 0));
+  auto acc1 = loadBigEndian(p + 16);
+  auto acc2 = loadBigEndian(p + 32);
+  auto acc3 = loadBigEndian(p + 48);
+  p += 64;
+  len -= 64;
+
+  // 4 independent lanes, each one folded by 512 bits
+  auto const k512 = _mm_set_epi64x(X576, X512);
+  while(len >= 64) {
+    acc0 = _mm_xor_si128(fold(acc0, k512), loadBigEndian(p + 0));
+    acc1 = _mm_xor_si128(fold(acc1, k512), loadBigEndian(p + 16));
+    acc2 = _mm_xor_si128(fold(acc2, k512), loadBigEndian(p + 32));
+    acc3 = _mm_xor_si128(fold(acc3, k512), loadBigEndian(p + 48));
+    p += 64;
+    len -= 64;
+  }
+
+  // merge the lanes, then fold the remaining blocks one by one
+  auto const k128 = _mm_set_epi64x(X192, X128);
+  auto acc = _mm_xor_si128(fold(acc0, k128), acc1);
+  acc = _mm_xor_si128(fold(acc, k128), acc2);
+  acc = _mm_xor_si128(fold(acc, k128), acc3);
+
+  while(len >= 16) {
+    acc = _mm_xor_si128(fold(acc, k128), loadBigEndian(p));
+    p += 16;
+    len -= 16;
+  }
+
+  // 'acc' is congruent to the message processed so far:
+  // its CRC (with a zero initial value) is the current CRC.
+  uint8_t last[16];
+  auto const reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  _mm_storeu_si128((__m128i *)last, _mm_shuffle_epi8(acc, reverse));
+
+  crc = crcSliceBy8({last, sizeof last}, 0);
+  return crcSliceBy8({p, len}, crc);
+}
+
+bool hasPclmul() {
+  static const bool r = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+  return r;
+}
+
+#endif
+
+}
+
+uint32_t crc32Mpeg2(SpanC data, uint32_t crc) {
+#ifdef CRC_HAS_PCLMUL
+  if(data.len >= PCLMUL_MIN_SIZE && hasPclmul())
+    return crcPclmul(data, crc);
+#endif
+  return crcSliceBy8(data, crc);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "span.hpp"
+
+#include <cstdint>
+
+// CRC-32/MPEG-2, as used by MPEG-2 TS PSI sections (ISO/IEC 13818-1 Annex A):
+// polynomial 0x04C11DB7, MSB-first, no final XOR.
+// Can be computed incrementally by passing the previous result as 'crc'.
+// The CRC of a section including its CRC_32 field is zero.
+uint32_t crc32Mpeg2(SpanC data, uint32_t crc = 0xffffffff);
@@ -32,13 +32,10 @@ void mkdir(string path) {
     throw runtime_error("couldn't create dir \"" + path + "\": please check you have sufficient permissions");
 }
 
+// replaces 'dst', like 'rename' does on the other platforms
 void moveFile(string src, string dst) {
-  if(!MoveFileA(src.c_str(), dst.c_str())) {
-    if(GetLastError() == ERROR_ALREADY_EXISTS) {
-      DeleteFileA(dst.c_str());
-    }
+  if(!MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING))
     throw runtime_error("can't move file");
-  }
 }
 
 void changeDir(string path) {
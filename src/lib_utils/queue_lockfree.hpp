@@ -78,6 +78,20 @@ struct QueueLockFree {
     return true;
   }
 
+  // only a hint when called from another thread than the consumer
+  bool isEmpty() const {
+    return readIndex_.load(std::memory_order_acquire) == writeIndex_.load(std::memory_order_acquire);
+  }
+
+  // only a hint when called from another thread than the producer
+  bool isFull() const {
+    auto nextRecord = writeIndex_.load(std::memory_order_acquire) + 1;
+    if(nextRecord == size_) {
+      nextRecord = 0;
+    }
+    return nextRecord == readIndex_.load(std::memory_order_acquire);
+  }
+
   private:
   const uint32_t size_;
   T *const records_;
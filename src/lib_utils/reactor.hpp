@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+
+// Blocks a thread until a file descriptor becomes readable,
+// or until another thread wakes it up.
+struct IReactor {
+  enum { WAKE_UP = -1, TIMEOUT = -2 };
+
+  virtual ~IReactor() = default;
+
+  // when 'fd' is readable, wait() returns 'id' (must be positive or zero)
+  virtual void add(int fd, int id) = 0;
+  virtual void remove(int fd) = 0;
+
+  // makes the current, or the next, call to wait() return WAKE_UP.
+  // Can be called from any thread.
+  virtual void wakeUp() = 0;
+
+  // returns the id of a readable file descriptor, WAKE_UP or TIMEOUT.
+  // A negative timeout waits forever.
+  virtual int wait(int timeoutInMs) = 0;
+};
+
+std::unique_ptr<IReactor> createReactor();
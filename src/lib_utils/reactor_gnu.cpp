@@ -0,0 +1,183 @@
+#include "reactor.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+
+#include <algorithm> // find_if
+#include <mutex>
+#include <vector>
+#endif
+
+#include "format.hpp"
+
+using namespace std;
+
+namespace {
+
+#ifdef __linux__
+
+// epoll + eventfd
+struct Reactor : IReactor {
+  Reactor() {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(m_epoll < 0)
+      throw runtime_error("epoll_create1 failed");
+
+    m_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_event < 0) {
+      close(m_epoll);
+      throw runtime_error("eventfd failed");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_ID;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_event, &ev);
+  }
+
+  ~Reactor() {
+    close(m_event);
+    close(m_epoll);
+  }
+
+  void add(int fd, int id) override {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+      throw runtime_error(format("Reactor: can't watch file descriptor %s (errno=%s)", fd, errno));
+  }
+
+  void remove(int fd) override { epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr); }
+
+  void wakeUp() override {
+    uint64_t one = 1;
+    auto r = write(m_event, &one, sizeof one);
+    (void)r; // only fails when the counter is saturated: a wake-up is already pending
+  }
+
+  int wait(int timeoutInMs) override {
+    epoll_event ev;
+    auto n = epoll_wait(m_epoll, &ev, 1, timeoutInMs);
+
+    if(n < 0) {
+      if(errno == EINTR)
+        return TIMEOUT;
+      throw runtime_error(format("Reactor: epoll_wait failed (errno=%s)", errno));
+    }
+
+    if(n == 0)
+      return TIMEOUT;
+
+    if(ev.data.u64 == EVENT_ID) {
+      uint64_t count;
+      auto r = read(m_event, &count, sizeof count);
+      (void)r; // another thread may have consumed the event
+      return WAKE_UP;
+    }
+
+    return (int)ev.data.u64;
+  }
+
+  private:
+  static constexpr uint64_t EVENT_ID = ~0ULL;
+  int m_epoll = -1;
+  int m_event = -1;
+};
+
+#else
+
+// poll + self-pipe
+struct Reactor : IReactor {
+  Reactor() {
+    if(pipe(m_pipe) < 0)
+      throw runtime_error("pipe failed");
+
+    for(auto fd : m_pipe)
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  ~Reactor() {
+    close(m_pipe[0]);
+    close(m_pipe[1]);
+  }
+
+  void add(int fd, int id) override {
+    unique_lock<mutex> lock(m_mutex);
+    m_watched.push_back({fd, id});
+  }
+
+  void remove(int fd) override {
+    unique_lock<mutex> lock(m_mutex);
+    auto i = find_if(m_watched.begin(), m_watched.end(), [&](Watched const &w) { return w.fd == fd; });
+    if(i != m_watched.end())
+      m_watched.erase(i);
+  }
+
+  void wakeUp() override {
+    uint8_t one = 1;
+    auto r = write(m_pipe[1], &one, sizeof one);
+    (void)r; // only fails when the pipe is full: a wake-up is already pending
+  }
+
+  int wait(int timeoutInMs) override {
+    vector<Watched> watched;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      watched = m_watched;
+    }
+
+    vector<pollfd> fds;
+    fds.push_back({m_pipe[0], POLLIN, 0});
+    for(auto &w : watched)
+      fds.push_back({w.fd, POLLIN, 0});
+
+    auto n = poll(fds.data(), fds.size(), timeoutInMs);
+
+    if(n < 0) {
+      if(errno == EINTR)
+        return TIMEOUT;
+      throw runtime_error(format("Reactor: poll failed (errno=%s)", errno));
+    }
+
+    if(n == 0)
+      return TIMEOUT;
+
+    if(fds[0].revents) {
+      uint8_t buf[64];
+      while(read(m_pipe[0], buf, sizeof buf) > 0) {
+      }
+      return WAKE_UP;
+    }
+
+    for(size_t i = 1; i < fds.size(); ++i)
+      if(fds[i].revents)
+        return watched[i - 1].id;
+
+    return TIMEOUT;
+  }
+
+  private:
+  struct Watched {
+    int fd;
+    int id;
+  };
+
+  int m_pipe[2];
+  mutex m_mutex; // protects 'm_watched'
+  vector<Watched> m_watched;
+};
+
+#endif
+
+}
+
+std::unique_ptr<IReactor> createReactor() { return make_unique<Reactor>(); }
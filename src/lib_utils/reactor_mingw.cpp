@@ -0,0 +1,99 @@
+#include "reactor.hpp"
+
+#include <winsock2.h>
+
+#include <algorithm> // find_if, min
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// select() only works on sockets, and can't be woken up:
+// wait in slices when sockets are watched, on a condition variable otherwise.
+struct Reactor : IReactor {
+  void add(int fd, int id) override {
+    unique_lock<mutex> lock(m_mutex);
+    m_watched.push_back({fd, id});
+  }
+
+  void remove(int fd) override {
+    unique_lock<mutex> lock(m_mutex);
+    auto i = find_if(m_watched.begin(), m_watched.end(), [&](Watched const &w) { return w.fd == fd; });
+    if(i != m_watched.end())
+      m_watched.erase(i);
+  }
+
+  void wakeUp() override {
+    unique_lock<mutex> lock(m_mutex);
+    m_wokenUp = true;
+    m_cond.notify_all();
+  }
+
+  int wait(int timeoutInMs) override {
+    auto const deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutInMs);
+
+    for(;;) {
+      vector<Watched> watched;
+      {
+        unique_lock<mutex> lock(m_mutex);
+        if(m_watched.empty()) {
+          auto woken = [&]() { return m_wokenUp; };
+          if(timeoutInMs < 0)
+            m_cond.wait(lock, woken);
+          else if(!m_cond.wait_until(lock, deadline, woken))
+            return TIMEOUT;
+        }
+
+        if(m_wokenUp) {
+          m_wokenUp = false;
+          return WAKE_UP;
+        }
+
+        watched = m_watched;
+      }
+
+      fd_set fds;
+      FD_ZERO(&fds);
+      for(auto &w : watched)
+        FD_SET((SOCKET)w.fd, &fds);
+
+      auto sliceInMs = SLICE_IN_MS;
+      if(timeoutInMs >= 0) {
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        sliceInMs = max(0, min(sliceInMs, (int)remaining.count()));
+      }
+
+      timeval tv{0, sliceInMs * 1000};
+      if(select(0, &fds, nullptr, nullptr, &tv) > 0) {
+        for(auto &w : watched)
+          if(FD_ISSET((SOCKET)w.fd, &fds))
+            return w.id;
+      }
+
+      if(timeoutInMs >= 0 && chrono::steady_clock::now() >= deadline)
+        return TIMEOUT;
+    }
+  }
+
+  private:
+  static auto const SLICE_IN_MS = 10;
+
+  struct Watched {
+    int fd;
+    int id;
+  };
+
+  mutex m_mutex; // protects all members
+  condition_variable m_cond;
+  bool m_wokenUp = false;
+  vector<Watched> m_watched;
+};
+
+}
+
+std::unique_ptr<IReactor> createReactor() { return make_unique<Reactor>(); }
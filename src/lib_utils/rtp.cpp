@@ -0,0 +1,129 @@
+#include "rtp.hpp"
+
+namespace Rtp {
+
+namespace {
+// a bigger jump of sequence numbers means the sender was restarted
+auto const MAX_SEQUENCE_JUMP = 3000;
+
+uint32_t readU32(uint8_t const *p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+}
+
+void writeHeader(uint8_t *dst, Header const &hdr) {
+  dst[0] = 0x80; // version 2, no padding, no extension, no CSRC
+  dst[1] = (hdr.marker ? 0x80 : 0) | (hdr.payloadType & 0x7f);
+  dst[2] = hdr.sequenceNumber >> 8;
+  dst[3] = hdr.sequenceNumber;
+  dst[4] = hdr.timestamp >> 24;
+  dst[5] = hdr.timestamp >> 16;
+  dst[6] = hdr.timestamp >> 8;
+  dst[7] = hdr.timestamp;
+  dst[8] = hdr.ssrc >> 24;
+  dst[9] = hdr.ssrc >> 16;
+  dst[10] = hdr.ssrc >> 8;
+  dst[11] = hdr.ssrc;
+}
+
+bool parseHeader(uint8_t const *src, Header &hdr) {
+  if((src[0] >> 6) != 2)
+    return false;
+
+  hdr.padding = src[0] & 0x20;
+  hdr.extension = src[0] & 0x10;
+  hdr.csrcCount = src[0] & 0x0f;
+  hdr.marker = src[1] & 0x80;
+  hdr.payloadType = src[1] & 0x7f;
+  hdr.sequenceNumber = src[2] << 8 | src[3];
+  hdr.timestamp = readU32(src + 4);
+  hdr.ssrc = readU32(src + 8);
+  return true;
+}
+
+bool getPayload(Header const &hdr, SpanC data, SpanC &payload) {
+  size_t begin = hdr.csrcCount * 4;
+
+  if(hdr.extension) {
+    if(data.len < begin + 4)
+      return false;
+    auto const extensionLength = data.ptr[begin + 2] << 8 | data.ptr[begin + 3];
+    begin += 4 + extensionLength * 4;
+  }
+
+  size_t end = data.len;
+
+  if(hdr.padding) {
+    if(end == 0)
+      return false;
+    auto const paddingSize = data.ptr[end - 1];
+    if(end < paddingSize)
+      return false;
+    end -= paddingSize;
+  }
+
+  if(begin > end)
+    return false;
+
+  payload = {data.ptr + begin, end - begin};
+  return true;
+}
+
+ReorderBuffer::ReorderBuffer(int maxPackets)
+    : m_maxPackets(maxPackets) {}
+
+ReorderBuffer::Result ReorderBuffer::push(uint16_t sequenceNumber, SpanC payload) {
+  auto const delta = (int16_t)(sequenceNumber - (uint16_t)m_expected);
+
+  if(!m_started || delta > MAX_SEQUENCE_JUMP || delta < -MAX_SEQUENCE_JUMP) {
+    droppedCount += m_buffered.size();
+    m_buffered.clear();
+    m_expected = sequenceNumber + 1;
+    m_started = true;
+    return Accepted;
+  }
+
+  auto const seq = m_expected + delta;
+
+  if(seq < m_expected || m_buffered.count(seq)) {
+    droppedCount++;
+    return Dropped;
+  }
+
+  if(seq == m_expected) {
+    if(!m_buffered.empty())
+      reorderedCount++; // fills a gap
+    m_expected++;
+    return Accepted;
+  }
+
+  m_buffered[seq].assign(payload.ptr, payload.ptr + payload.len);
+
+  if((int)m_buffered.size() > m_maxPackets)
+    skipGap();
+
+  return Buffered;
+}
+
+bool ReorderBuffer::peek(SpanC &payload) const {
+  if(m_buffered.empty() || m_buffered.begin()->first != m_expected)
+    return false;
+
+  auto &first = m_buffered.begin()->second;
+  payload = {first.data(), first.size()};
+  return true;
+}
+
+void ReorderBuffer::pop() {
+  m_buffered.erase(m_buffered.begin());
+  m_expected++;
+}
+
+void ReorderBuffer::skipGap() {
+  if(m_buffered.empty())
+    return;
+
+  auto const next = m_buffered.begin()->first;
+  lostCount += next - m_expected;
+  m_expected = next;
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "span.hpp"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// RTP (RFC 3550), as used to carry MPEG-TS (RFC 2250).
+namespace Rtp {
+
+auto const HEADER_SIZE = 12; // fixed part of the header
+auto const PAYLOAD_TYPE_MP2T = 33;
+auto const CLOCK_RATE = 90000; // MP2T timestamps
+
+struct Header {
+  int payloadType = PAYLOAD_TYPE_MP2T;
+  bool marker = false;
+  uint16_t sequenceNumber = 0;
+  uint32_t timestamp = 0;
+  uint32_t ssrc = 0;
+
+  // parsing only
+  bool padding = false;
+  bool extension = false;
+  int csrcCount = 0;
+};
+
+// writes HEADER_SIZE bytes
+void writeHeader(uint8_t *dst, Header const &hdr);
+
+// parses HEADER_SIZE bytes. Returns false if this isn't an RTP version 2 header.
+bool parseHeader(uint8_t const *src, Header &hdr);
+
+// the CSRC list, the header extension and the padding are part of what follows the fixed header:
+// returns the actual payload, or false if 'data' is too small.
+bool getPayload(Header const &hdr, SpanC data, SpanC &payload);
+
+// Restores the sequence number order of received packets.
+// In-order packets are accepted as is, so the caller can keep them where they were received.
+// Packets following a gap are buffered (copied) until the gap is filled, or until
+// more than 'maxPackets' are buffered, or the caller gives up: the gap is then counted as lost.
+class ReorderBuffer {
+  public:
+  enum Result {
+    Accepted, // output it now
+    Buffered, // it was copied, and will be output later by 'pop'
+    Dropped, // late or duplicate
+  };
+
+  explicit ReorderBuffer(int maxPackets);
+
+  Result push(uint16_t sequenceNumber, SpanC payload);
+
+  // the next buffered packet, if it can be output. Remains valid until the next call to 'pop' or 'push'.
+  bool peek(SpanC &payload) const;
+  void pop();
+
+  // stop waiting for the missing packets
+  void skipGap();
+
+  bool hasBuffered() const { return !m_buffered.empty(); }
+
+  int64_t lostCount = 0;
+  int64_t reorderedCount = 0; // packets which arrived out of order, in time
+  int64_t droppedCount = 0;
+
+  private:
+  int const m_maxPackets;
+  bool m_started = false;
+  int64_t m_expected = 0; // unwrapped sequence number
+  std::map<int64_t, std::vector<uint8_t>> m_buffered;
+};
+
+}
@@ -7,8 +7,37 @@
 struct ISocket {
   enum Type { UDP, UDP_MULTICAST, TCP };
 
+  struct ReceiveInfo {
+    int datagramCount = 0;
+    int truncatedCount = 0; // datagrams bigger than 'maxDatagramSize', the excess is lost
+    int64_t timestampInUs = -1; // kernel reception time of the first datagram (Unix time), if available
+    int64_t dropCount = -1; // datagrams dropped by the kernel since the socket creation, if available
+  };
+
+  // stores the first 'headerSize' bytes of each datagram apart from the rest, e.g to strip
+  // RTP headers without copying the payloads: 'dst' then only receives the payloads.
+  struct HeaderSplit {
+    size_t headerSize;
+    size_t maxDatagrams; // capacity of 'headers' and 'sizes'
+    uint8_t *headers; // 'headerSize' bytes per datagram
+    size_t *sizes; // size of each datagram, header included
+  };
+
   virtual ~ISocket() = default;
   virtual size_t receive(uint8_t *dst, size_t len) = 0; // non-blocking
+
+  // non-blocking. Receives as many datagrams as fit in 'len' bytes, stored contiguously in 'dst'.
+  // Each datagram must fit in 'maxDatagramSize' bytes (not counting the split header, if any).
+  // TCP sockets behave like 'receive'.
+  virtual size_t receiveMany(uint8_t *dst,
+        size_t len,
+        size_t maxDatagramSize,
+        ReceiveInfo &info,
+        HeaderSplit *split = nullptr)
+        = 0;
+
+  // the descriptor to watch for incoming data (e.g with IReactor). May change once a TCP client connects.
+  virtual int getDescriptor() const = 0;
 };
 
 std::unique_ptr<ISocket> createSocket(const char *address, int port, ISocket::Type type);
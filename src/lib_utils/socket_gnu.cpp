@@ -3,6 +3,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <algorithm> // min
+#include <cerrno>
+#include <cstring> // memmove
 #include <fcntl.h>
 #include <stdexcept>
 #include <unistd.h>
@@ -13,6 +16,9 @@
 
 using namespace std;
 
+// max number of datagrams per receiveMany() call
+static const size_t MAX_BATCH = 64;
+
 struct Socket : ISocket {
   Socket(const char *ipAddr, int port, ISocket::Type type)
       : m_type(type) {
@@ -27,6 +33,12 @@ struct Socket : ISocket {
 
       if(setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0)
         throw runtime_error("setsockopt failed");
+
+#ifdef __linux__
+      // optional: kernel reception timestamps and drop counter, see receiveMany()
+      setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof one);
+      setsockopt(m_socket, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof one);
+#endif
     }
 
     // set non-blocking
@@ -64,7 +76,7 @@ struct Socket : ISocket {
     close(m_socket_client);
   }
 
-  size_t receive(uint8_t *buffer, size_t dstlen) {
+  size_t receive(uint8_t *buffer, size_t dstlen) override {
     if(!ensureAccept())
       return {}; // when needed, connection not established
 
@@ -83,6 +95,114 @@ struct Socket : ISocket {
     return len;
   }
 
+  size_t receiveMany(uint8_t *dst, size_t len, size_t maxDatagramSize, ReceiveInfo &info, HeaderSplit *split) override {
+    info = {};
+
+    if(m_type == TCP)
+      return receive(dst, len);
+
+    auto maxCount = std::min(len / maxDatagramSize, MAX_BATCH);
+    if(split)
+      maxCount = std::min(maxCount, split->maxDatagrams);
+    if(maxCount == 0)
+      return 0;
+
+#ifdef __linux__
+    // one slot of 'maxDatagramSize' bytes per datagram, compacted afterwards.
+    // The split header, if any, is scattered to its own buffer.
+    mmsghdr msgs[MAX_BATCH];
+    iovec iovs[MAX_BATCH][2];
+    uint8_t control[MAX_BATCH][CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+    auto const headerSize = split ? split->headerSize : 0;
+
+    for(size_t i = 0; i < maxCount; ++i) {
+      auto iov = iovs[i];
+      if(split)
+        *iov++ = {split->headers + i * headerSize, headerSize};
+      *iov++ = {dst + i * maxDatagramSize, maxDatagramSize};
+
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_iov = iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = iov - iovs[i];
+      msgs[i].msg_hdr.msg_control = control[i];
+      msgs[i].msg_hdr.msg_controllen = sizeof control[i];
+    }
+
+    auto const count = recvmmsg(m_socket, msgs, maxCount, MSG_DONTWAIT, nullptr);
+
+    if(count < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0; // no data available yet
+
+      throw runtime_error("recvmmsg failed");
+    }
+
+    size_t size = 0;
+
+    for(int i = 0; i < count; ++i) {
+      auto &hdr = msgs[i].msg_hdr;
+
+      if(hdr.msg_flags & MSG_TRUNC)
+        info.truncatedCount++;
+
+      for(auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET)
+          continue;
+
+        if(cmsg->cmsg_type == SCM_TIMESTAMPNS && i == 0) {
+          timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+          info.timestampInUs = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+        } else if(cmsg->cmsg_type == SO_RXQ_OVFL) {
+          uint32_t drops;
+          memcpy(&drops, CMSG_DATA(cmsg), sizeof drops);
+          info.dropCount = drops;
+        }
+      }
+
+      if(split)
+        split->sizes[i] = msgs[i].msg_len;
+
+      auto const payloadSize = msgs[i].msg_len > headerSize ? msgs[i].msg_len - headerSize : 0;
+
+      if(size != i * maxDatagramSize)
+        memmove(dst + size, dst + i * maxDatagramSize, payloadSize);
+
+      size += payloadSize;
+    }
+
+    info.datagramCount = count;
+    return size;
+#else
+    size_t size = 0;
+
+    while(info.datagramCount < (int)maxCount) {
+      auto const headerSize = split ? split->headerSize : 0;
+      if(size + headerSize + maxDatagramSize > len)
+        break;
+
+      auto n = receive(dst + size, headerSize + maxDatagramSize);
+      if(n == 0)
+        break;
+
+      if(split) {
+        auto const i = info.datagramCount;
+        split->sizes[i] = n;
+        memcpy(split->headers + i * headerSize, dst + size, std::min(n, headerSize));
+        n = n > headerSize ? n - headerSize : 0;
+        memmove(dst + size, dst + size + headerSize, n);
+      }
+
+      size += n;
+      info.datagramCount++;
+    }
+
+    return size;
+#endif
+  }
+
+  int getDescriptor() const override { return m_socket_client != -1 ? m_socket_client : m_socket; }
+
   private:
   void joinMulticastGroup(const char *ipAddr) {
     // send IGMP join request
@@ -1,3 +1,5 @@
+#include <algorithm> // min
+#include <cstring> // memcpy, memmove
 #include <stdexcept>
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -64,7 +66,7 @@ struct Socket : ISocket {
     WSACleanup();
   }
 
-  size_t receive(uint8_t *buffer, size_t dstlen) {
+  size_t receive(uint8_t *buffer, size_t dstlen) override {
     if(!ensureAccept())
       return {}; // when needed, connection not established
 
@@ -84,6 +86,40 @@ struct Socket : ISocket {
     return len;
   }
 
+  size_t receiveMany(uint8_t *dst, size_t len, size_t maxDatagramSize, ReceiveInfo &info, HeaderSplit *split) override {
+    info = {};
+
+    if(m_type == TCP)
+      return receive(dst, len);
+
+    size_t size = 0;
+    auto const headerSize = split ? split->headerSize : 0;
+
+    while(size + headerSize + maxDatagramSize <= len) {
+      if(split && info.datagramCount == (int)split->maxDatagrams)
+        break;
+
+      auto n = receive(dst + size, headerSize + maxDatagramSize);
+      if(n == 0)
+        break;
+
+      if(split) {
+        auto const i = info.datagramCount;
+        split->sizes[i] = n;
+        memcpy(split->headers + i * headerSize, dst + size, std::min(n, headerSize));
+        n = n > headerSize ? n - headerSize : 0;
+        memmove(dst + size, dst + size + headerSize, n);
+      }
+
+      size += n;
+      info.datagramCount++;
+    }
+
+    return size;
+  }
+
+  int getDescriptor() const override { return (int)(m_socket_client != INVALID_SOCKET ? m_socket_client : m_socket); }
+
   private:
   void joinMulticastGroup(const char *ipAddr) {
     // send IGMP join request
@@ -0,0 +1,136 @@
+#include "lib_utils/async_writer.hpp"
+#include "tests/tests.hpp"
+
+#include <cstdio> // remove
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+using namespace Tests;
+
+namespace {
+
+std::vector<uint8_t> readAll(const char *path) {
+  std::ifstream f(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+}
+
+unittest("AsyncWriter: small writes are coalesced, files are interleaved") {
+  AsyncWriterConfig cfg;
+  cfg.blockSize = 4096;
+  cfg.maxPendingBytes = 8192; // exercise the backpressure
+
+  std::vector<uint8_t> expected1, expected2;
+
+  {
+    AsyncWriter writer(cfg);
+    auto f1 = writer.open("out/async_writer_1.bin");
+    auto f2 = writer.open("out/async_writer_2.bin");
+
+    for(int i = 0; i < 1000; ++i) {
+      uint8_t pkt[188];
+      for(auto &b : pkt)
+        b = (uint8_t)i;
+      writer.write(f1, pkt);
+      expected1.insert(expected1.end(), pkt, pkt + sizeof pkt);
+
+      if(i % 3 == 0) {
+        writer.write(f2, {pkt, 7});
+        expected2.insert(expected2.end(), pkt, pkt + 7);
+      }
+    }
+
+    writer.close(f1);
+    writer.flush();
+    ASSERT(expected1 == readAll("out/async_writer_1.bin"));
+
+    auto const stats = writer.getStats();
+    ASSERT_EQUALS(188 * 1000, (int)stats.bytesWritten);
+    ASSERT_EQUALS(46, (int)stats.writeCount);
+    ASSERT(writer.takeErrors().empty());
+  }
+
+  // the destructor writes the remaining data
+  ASSERT(expected2 == readAll("out/async_writer_2.bin"));
+
+  remove("out/async_writer_1.bin");
+  remove("out/async_writer_2.bin");
+}
+
+unittest("AsyncWriter: many small files share a few blocks") {
+  AsyncWriterConfig cfg;
+  cfg.blockSize = 64 * 1024;
+  cfg.maxPendingBytes = 4 * cfg.blockSize;
+
+  AsyncWriter writer(cfg);
+
+  // files opened and not written yet don't hold any block
+  std::vector<AsyncWriter::FileId> files;
+  for(int i = 0; i < 100; ++i)
+    files.push_back(writer.open("out/async_writer_small_" + std::to_string(i) + ".bin"));
+  ASSERT_EQUALS(0, (int)writer.getStats().allocatedBytes);
+
+  for(int i = 0; i < 100; ++i) {
+    uint8_t const data[] = {(uint8_t)i, 1, 2, 3};
+    writer.write(files[i], data);
+    writer.close(files[i]);
+  }
+  writer.flush();
+
+  // pending blocks (at most 'maxPendingBytes') + the pool + the block being filled
+  ASSERT(writer.getStats().allocatedBytes <= int64_t(10 * (cfg.blockSize + 4096)));
+  ASSERT(writer.takeErrors().empty());
+
+  for(int i = 0; i < 100; ++i) {
+    auto const path = "out/async_writer_small_" + std::to_string(i) + ".bin";
+    ASSERT(std::vector<uint8_t>({(uint8_t)i, 1, 2, 3}) == readAll(path.c_str()));
+    remove(path.c_str());
+  }
+}
+
+unittest("AsyncWriter: submitted data is written before its block is full") {
+  for(auto directIo : {false, true}) {
+    AsyncWriterConfig cfg;
+    cfg.blockSize = 8192;
+    cfg.directIo = directIo;
+
+    AsyncWriter writer(cfg);
+    auto f = writer.open("out/async_writer_submit.bin");
+    std::vector<uint8_t> expected;
+
+    // chunks of various sizes, some crossing block boundaries
+    for(auto size : {1000, 3000, 4096, 100, 9000, 7}) {
+      std::vector<uint8_t> chunk(size);
+      for(auto &b : chunk)
+        b = (uint8_t)(expected.size() + (&b - chunk.data()));
+      writer.write(f, {chunk.data(), chunk.size()});
+      writer.submit(f);
+      expected.insert(expected.end(), chunk.begin(), chunk.end());
+
+      writer.flush();
+      ASSERT(expected == readAll("out/async_writer_submit.bin"));
+    }
+
+    writer.close(f);
+    writer.flush();
+    ASSERT(expected == readAll("out/async_writer_submit.bin"));
+    ASSERT(writer.takeErrors().empty());
+    remove("out/async_writer_submit.bin");
+  }
+}
+
+unittest("AsyncWriter: errors") {
+  AsyncWriter writer;
+  auto f = writer.open("out/this/directory/does/not/exist.bin");
+  uint8_t data[16] = {};
+  writer.write(f, data);
+  writer.close(f);
+  writer.post([]() { throw std::runtime_error("task failure"); });
+  writer.flush();
+
+  ASSERT_EQUALS(2, (int)writer.takeErrors().size());
+  ASSERT_EQUALS(2, (int)writer.getStats().errorCount);
+  ASSERT(writer.takeErrors().empty());
+}
+
+}
@@ -0,0 +1,55 @@
+#include "lib_utils/crc.hpp"
+#include "tests/tests.hpp"
+
+#include <vector>
+
+using namespace Tests;
+
+namespace {
+
+uint32_t crcBitwise(const uint8_t *data, size_t len) {
+  uint32_t r = 0xffffffff;
+  for(size_t i = 0; i < len; ++i) {
+    r ^= data[i] << 24;
+    for(int j = 0; j < 8; ++j)
+      r = (r << 1) ^ (r & 0x80000000 ? 0x04C11DB7 : 0);
+  }
+  return r;
+}
+
+unittest("crc32Mpeg2: check value") {
+  const uint8_t data[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  ASSERT_EQUALS(0x0376E6E7u, crc32Mpeg2(data));
+}
+
+unittest("crc32Mpeg2: section including its CRC gives zero") {
+  // PAT section: one program, PMT on PID 0x1000
+  const uint8_t section[] = {0x00, 0xB0, 0x0D, 0x00, 0x01, 0xC1, 0x00, 0x00, 0x00, 0x01, 0xF0, 0x00, 0, 0, 0, 0};
+  std::vector<uint8_t> s(section, section + sizeof section);
+  auto crc = crc32Mpeg2({s.data(), s.size() - 4});
+  for(int i = 0; i < 4; ++i)
+    s[s.size() - 4 + i] = crc >> (24 - 8 * i);
+  ASSERT_EQUALS(0u, crc32Mpeg2({s.data(), s.size()}));
+}
+
+unittest("crc32Mpeg2: all sizes and alignments, incremental") {
+  std::vector<uint8_t> buf(1024 + 16);
+  uint32_t seed = 1;
+  for(auto &b : buf) {
+    seed = seed * 1103515245 + 12345;
+    b = seed >> 16;
+  }
+
+  for(size_t offset = 0; offset < 16; offset += 3) {
+    for(size_t len = 0; len <= 1024; len += (len < 200 ? 1 : 37)) {
+      auto const p = buf.data() + offset;
+      auto const expected = crcBitwise(p, len);
+      ASSERT_EQUALS(expected, crc32Mpeg2({p, len}));
+
+      auto const half = len / 3;
+      ASSERT_EQUALS(expected, crc32Mpeg2({p + half, len - half}, crc32Mpeg2({p, half})));
+    }
+  }
+}
+
+}
@@ -0,0 +1,50 @@
+#include "lib_utils/reactor.hpp"
+#include "tests/tests.hpp"
+
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h> // pipe
+#endif
+
+using namespace Tests;
+
+namespace {
+
+unittest("reactor: timeout") {
+  auto reactor = createReactor();
+  ASSERT_EQUALS((int)IReactor::TIMEOUT, reactor->wait(1));
+}
+
+unittest("reactor: wake up from another thread") {
+  auto reactor = createReactor();
+  std::thread t([&]() { reactor->wakeUp(); });
+  ASSERT_EQUALS((int)IReactor::WAKE_UP, reactor->wait(-1));
+  t.join();
+
+  // the wake-up was consumed
+  ASSERT_EQUALS((int)IReactor::TIMEOUT, reactor->wait(0));
+}
+
+#ifndef _WIN32
+unittest("reactor: readable file descriptor") {
+  int fds[2];
+  ASSERT_EQUALS(0, pipe(fds));
+
+  auto reactor = createReactor();
+  reactor->add(fds[0], 7);
+  ASSERT_EQUALS((int)IReactor::TIMEOUT, reactor->wait(0));
+
+  uint8_t byte = 0;
+  ASSERT_EQUALS(1, (int)write(fds[1], &byte, 1));
+  ASSERT_EQUALS(7, reactor->wait(-1));
+
+  reactor->remove(fds[0]);
+  ASSERT_EQUALS((int)IReactor::TIMEOUT, reactor->wait(0));
+
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
+}
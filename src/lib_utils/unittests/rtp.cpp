@@ -0,0 +1,96 @@
+#include "lib_utils/rtp.hpp"
+#include "tests/tests.hpp"
+
+#include <vector>
+
+using namespace Tests;
+using namespace Rtp;
+
+namespace {
+
+std::vector<uint8_t> payloadOf(int value) { return std::vector<uint8_t>(4, (uint8_t)value); }
+
+// pushes the packets, returns the order in which they are output
+std::vector<int> reorder(ReorderBuffer &rb, std::vector<int> sequenceNumbers) {
+  std::vector<int> r;
+  for(auto seq : sequenceNumbers) {
+    auto payload = payloadOf(seq);
+    if(rb.push(seq, {payload.data(), payload.size()}) == ReorderBuffer::Accepted)
+      r.push_back(seq);
+
+    SpanC buffered;
+    while(rb.peek(buffered)) {
+      r.push_back(buffered.ptr[0]);
+      rb.pop();
+    }
+  }
+  return r;
+}
+
+unittest("rtp: header roundtrip") {
+  Header hdr;
+  hdr.marker = true;
+  hdr.sequenceNumber = 0xfffe;
+  hdr.timestamp = 0x12345678;
+  hdr.ssrc = 0xcafebabe;
+
+  uint8_t buf[HEADER_SIZE];
+  writeHeader(buf, hdr);
+  ASSERT_EQUALS(0x80, buf[0]);
+  ASSERT_EQUALS(0x80 | PAYLOAD_TYPE_MP2T, buf[1]);
+
+  Header parsed;
+  ASSERT(parseHeader(buf, parsed));
+  ASSERT_EQUALS(hdr.sequenceNumber, parsed.sequenceNumber);
+  ASSERT_EQUALS(hdr.timestamp, parsed.timestamp);
+  ASSERT_EQUALS(hdr.ssrc, parsed.ssrc);
+  ASSERT_EQUALS(PAYLOAD_TYPE_MP2T, parsed.payloadType);
+  ASSERT(parsed.marker);
+
+  buf[0] = 0x40; // version 1
+  ASSERT(!parseHeader(buf, parsed));
+}
+
+unittest("rtp: CSRC, extension and padding are stripped") {
+  // 1 CSRC, a 1-word extension, 2 payload bytes, 3 padding bytes
+  const uint8_t hdrBytes[HEADER_SIZE] = {0xB1, 33, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+  const uint8_t data[] = {9, 9, 9, 9, 0xBE, 0xDE, 0, 1, 8, 8, 8, 8, 0x47, 0x48, 0, 0, 3};
+
+  Header hdr;
+  ASSERT(parseHeader(hdrBytes, hdr));
+  SpanC payload;
+  ASSERT(getPayload(hdr, data, payload));
+  ASSERT_EQUALS(2, (int)payload.len);
+  ASSERT_EQUALS(0x47, payload.ptr[0]);
+
+  ASSERT(!getPayload(hdr, {data, 6}, payload));
+}
+
+unittest("rtp: reordering") {
+  ReorderBuffer rb(8);
+  ASSERT_EQUALS(std::vector<int>({10, 11, 12, 13, 14, 15}), reorder(rb, {10, 12, 11, 14, 13, 15, 13, 9}));
+  ASSERT_EQUALS(2, (int)rb.reorderedCount);
+  ASSERT_EQUALS(2, (int)rb.droppedCount);
+  ASSERT_EQUALS(0, (int)rb.lostCount);
+}
+
+unittest("rtp: reordering across sequence number wrap-around") {
+  ReorderBuffer rb(8);
+  ASSERT_EQUALS(std::vector<int>({65534, 65535, 0, 1}), reorder(rb, {65534, 0, 65535, 1}));
+}
+
+unittest("rtp: losses") {
+  ReorderBuffer rb(2);
+  // 3 is lost, and so is 7, but we don't wait for it
+  ASSERT_EQUALS(std::vector<int>({1, 2, 4, 5, 6}), reorder(rb, {1, 2, 4, 5, 6, 8}));
+  ASSERT_EQUALS(1, (int)rb.lostCount);
+  ASSERT(rb.hasBuffered());
+  rb.skipGap();
+  ASSERT_EQUALS(std::vector<int>({8, 9}), reorder(rb, {9}));
+  ASSERT_EQUALS(2, (int)rb.lostCount);
+
+  // sender restart
+  ASSERT_EQUALS(std::vector<int>({40000, 40001}), reorder(rb, {40000, 40001}));
+}
+
+}
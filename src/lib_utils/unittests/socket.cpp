@@ -0,0 +1,131 @@
+#include "lib_utils/socket.hpp"
+#include "tests/tests.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring> // memset
+#include <thread>
+#include <vector>
+
+using namespace Tests;
+
+namespace {
+
+auto const PORT = 47913;
+
+void sendDatagram(int fd, int size, uint8_t value) {
+  std::vector<uint8_t> buf(size, value);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(PORT);
+  sendto(fd, buf.data(), buf.size(), 0, (sockaddr *)&addr, sizeof addr);
+}
+
+// the datagrams are delivered asynchronously
+size_t receiveAll(ISocket &socket,
+      uint8_t *dst,
+      size_t len,
+      size_t maxDatagramSize,
+      ISocket::ReceiveInfo &info,
+      ISocket::HeaderSplit *split = nullptr) {
+  size_t size = 0;
+  for(int i = 0; i < 100 && size == 0; ++i) {
+    size = socket.receiveMany(dst, len, maxDatagramSize, info, split);
+    if(size == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return size;
+}
+
+unittest("socket: receive several datagrams at once") {
+  auto socket = createSocket("127.0.0.1", PORT, ISocket::UDP);
+  auto sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+  sendDatagram(sender, 1316, 0x11);
+  sendDatagram(sender, 188, 0x22);
+  sendDatagram(sender, 1316, 0x33);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  uint8_t buf[4 * 2048];
+  memset(buf, 0, sizeof buf);
+  ISocket::ReceiveInfo info;
+  auto size = receiveAll(*socket, buf, sizeof buf, 2048, info);
+
+  ASSERT_EQUALS(1316 + 188 + 1316, (int)size);
+  ASSERT_EQUALS(3, info.datagramCount);
+  ASSERT_EQUALS(0, info.truncatedCount);
+
+  // packed contiguously
+  ASSERT_EQUALS(0x11, buf[1315]);
+  ASSERT_EQUALS(0x22, buf[1316]);
+  ASSERT_EQUALS(0x22, buf[1316 + 187]);
+  ASSERT_EQUALS(0x33, buf[1316 + 188]);
+  ASSERT_EQUALS(0x33, buf[size - 1]);
+
+  close(sender);
+}
+
+unittest("socket: receive datagrams, destination too small") {
+  auto socket = createSocket("127.0.0.1", PORT, ISocket::UDP);
+  auto sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+  sendDatagram(sender, 1316, 0x11);
+  sendDatagram(sender, 1316, 0x22);
+  sendDatagram(sender, 3000, 0x33);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  // room for one datagram at a time
+  uint8_t buf[2000];
+  ISocket::ReceiveInfo info;
+  ASSERT_EQUALS(1316, (int)receiveAll(*socket, buf, sizeof buf, 1500, info));
+  ASSERT_EQUALS(1, info.datagramCount);
+  ASSERT_EQUALS(0x11, buf[0]);
+
+  ASSERT_EQUALS(1316, (int)receiveAll(*socket, buf, sizeof buf, 1500, info));
+  ASSERT_EQUALS(0x22, buf[0]);
+
+  ASSERT_EQUALS(1500, (int)receiveAll(*socket, buf, sizeof buf, 1500, info));
+  ASSERT_EQUALS(1, info.truncatedCount);
+  ASSERT_EQUALS(0x33, buf[0]);
+
+  close(sender);
+}
+
+unittest("socket: receive datagrams, split headers") {
+  auto socket = createSocket("127.0.0.1", PORT, ISocket::UDP);
+  auto sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+  sendDatagram(sender, 12 + 1316, 0x11);
+  sendDatagram(sender, 8, 0x22); // shorter than a header
+  sendDatagram(sender, 12 + 188, 0x33);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  uint8_t headers[4 * 12];
+  size_t sizes[4];
+  ISocket::HeaderSplit split{12, 4, headers, sizes};
+
+  uint8_t buf[4 * 2048];
+  ISocket::ReceiveInfo info;
+  auto size = receiveAll(*socket, buf, sizeof buf, 2048, info, &split);
+
+  ASSERT_EQUALS(1316 + 188, (int)size);
+  ASSERT_EQUALS(3, info.datagramCount);
+  ASSERT_EQUALS(12 + 1316, (int)sizes[0]);
+  ASSERT_EQUALS(8, (int)sizes[1]);
+  ASSERT_EQUALS(12 + 188, (int)sizes[2]);
+  ASSERT_EQUALS(0x11, headers[11]);
+  ASSERT_EQUALS(0x33, headers[2 * 12]);
+  ASSERT_EQUALS(0x11, buf[1315]);
+  ASSERT_EQUALS(0x33, buf[1316]);
+
+  close(sender);
+}
+
+}
+#endif
@@ -16,3 +16,81 @@ unittest("XML serialization: disable escape") {
   std::string expected = "<T>aa<br />bb</T>\n";
   ASSERT_EQUALS(expected, serializeXml(tag, true, false));
 }
+
+unittest("XmlWriter: same layout as serializeXml") {
+  Tag tag{"A"};
+  tag["x"] = "1";
+  {
+    Tag b{"B"};
+    b.content = "text";
+    tag.add(b);
+  }
+  {
+    Tag c{"C"};
+    c["y"] = "2";
+    c.add(Tag{"D"});
+    tag.add(c);
+  }
+
+  std::string r;
+  XmlWriter<std::string> xml(r);
+  xml.openTag("A");
+  xml.attr("x", 1);
+  xml.openTag("B");
+  xml.text("text");
+  xml.closeTag();
+  xml.openTag("C");
+  xml.attr("y", std::string("2"));
+  xml.openTag("D");
+  xml.closeTag();
+  xml.closeTag();
+  xml.closeTag();
+
+  ASSERT_EQUALS(serializeXml(tag), r);
+}
+
+unittest("XmlWriter: escaped values, integers, no prettify") {
+  std::string r;
+  XmlWriter<std::string> xml(r, false);
+  xml.openTag("T");
+  xml.attr("a", "<\"'&>");
+  xml.attr("b", (int64_t)-1234567890123);
+  xml.attr("c", (uint8_t)255);
+  xml.attr("d", 0);
+  xml.text("x < y && y > z");
+  xml.openTag("E");
+  xml.text("");
+  xml.closeTag();
+  xml.closeTag();
+
+  ASSERT_EQUALS("<T a=\"&lt;&quot;&apos;&amp;&gt;\" b=\"-1234567890123\" c=\"255\" d=\"0\">x &lt; y &amp;&amp; y &gt; "
+                "z<E></E></T>",
+        r);
+}
+
+unittest("XmlWriter: unbalanced calls") {
+  std::string r;
+  XmlWriter<std::string> xml(r);
+  ASSERT_THROWN(xml.closeTag());
+  xml.openTag("T");
+  xml.text("t");
+  ASSERT_THROWN(xml.attr("a", "b"));
+}
+
+unittest("XmlWriter: padded start tags") {
+  std::string r;
+  XmlWriter<std::string> xml(r, false);
+  xml.openTag("T");
+  xml.attr("a", "b");
+  xml.padStartTag();
+  xml.openTag("E");
+  xml.padStartTag();
+  xml.closeTag();
+  xml.closeTag();
+  ASSERT_EQUALS("<T a=\"b\" ><E /></T>", r);
+  ASSERT_THROWN(xml.padStartTag());
+}
+
+// only the pointer is kept: a mutable buffer could change before the tag is closed
+static_assert(std::is_constructible<XmlName, const char(&)[2]>::value, "string literals are names");
+static_assert(!std::is_constructible<XmlName, char(&)[2]>::value, "mutable arrays aren't names");
@@ -1,11 +1,17 @@
-// XML generator from a tree
+// XML generators: from a tree, or streamed
 #pragma once
 
-///////////////////////////////////////////////////////////////////////////////
-// XML tree definition
+#include <cstddef> // size_t
+#include <cstdint>
+#include <cstring> // strlen
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+///////////////////////////////////////////////////////////////////////////////
+// XML tree definition
+
 struct Attribute {
   std::string name, value;
 };
@@ -34,3 +40,193 @@ struct Tag {
 // XML tree serialization
 
 std::string serializeXml(Tag const &tag, bool prettify = true, bool escape = true);
+
+///////////////////////////////////////////////////////////////////////////////
+// Streaming XML writer: no intermediate tree, no allocation but the output's.
+
+// Tag and attribute names: string literals, their length is known at compile-time.
+// Only the pointer is kept: the name must outlive the tag (mutable arrays are rejected).
+struct XmlName {
+  template<size_t N>
+  constexpr XmlName(const char (&name)[N])
+      : ptr(name)
+      , len(N - 1) {}
+
+  template<size_t N>
+  XmlName(char (&name)[N]) = delete;
+
+  const char *const ptr;
+  size_t const len;
+};
+
+// 'Output' only needs 'append(const char *ptr, size_t len)': e.g std::string, or a Data with an adapter.
+// Values are escaped. With 'prettify', the layout is the same as serializeXml().
+template<typename Output>
+class XmlWriter {
+  public:
+  XmlWriter(Output &out, bool prettify = true)
+      : out(out)
+      , prettify(prettify) {}
+
+  void declaration() { write("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"); }
+
+  void openTag(XmlName name) {
+    if(depth == MAX_DEPTH)
+      throw std::runtime_error("XmlWriter: too many nested tags");
+
+    endStartTag(true);
+    indent();
+    write("<");
+    out.append(name.ptr, name.len);
+    stack[depth++] = {name.ptr, name.len, false};
+    inStartTag = true;
+  }
+
+  void attr(XmlName name, const char *value, size_t len) {
+    if(!inStartTag)
+      throw std::runtime_error("XmlWriter: attributes must follow 'openTag'");
+
+    write(" ");
+    out.append(name.ptr, name.len);
+    write("=\"");
+    escape(value, len);
+    write("\"");
+  }
+
+  void attr(XmlName name, const char *value) { attr(name, value, strlen(value)); }
+
+  // a space before the end of the current start tag: '<x a="b" >', or '<x />' if it stays empty
+  void padStartTag() {
+    if(!inStartTag)
+      throw std::runtime_error("XmlWriter: 'padStartTag' must follow 'openTag'");
+    write(" ");
+  }
+
+  void attr(XmlName name, std::string const &value) { attr(name, value.data(), value.size()); }
+
+  template<typename Int, typename std::enable_if<std::is_integral<Int>::value, int>::type = 0>
+  void attr(XmlName name, Int value) {
+    char buffer[24];
+    auto const end = buffer + sizeof buffer;
+    auto const begin = std::is_signed<Int>::value ? formatInt(end, (int64_t)value) : formatUInt(end, (uint64_t)value);
+    attr(name, begin, end - begin);
+  }
+
+  void text(const char *value, size_t len) {
+    endStartTag(false);
+    escape(value, len);
+  }
+
+  void text(std::string const &value) { text(value.data(), value.size()); }
+
+  void closeTag() {
+    if(depth == 0)
+      throw std::runtime_error("XmlWriter: no tag to close");
+
+    auto const &tag = stack[--depth];
+
+    if(inStartTag) {
+      write("/>");
+      inStartTag = false;
+    } else {
+      if(tag.hasChildren)
+        indent();
+      write("</");
+      out.append(tag.name, tag.len);
+      write(">");
+    }
+
+    if(prettify)
+      write("\n");
+  }
+
+  private:
+  static auto const MAX_DEPTH = 32;
+
+  struct OpenTag {
+    const char *name;
+    size_t len;
+    bool hasChildren;
+  };
+
+  template<size_t N>
+  void write(const char (&s)[N]) {
+    out.append(s, N - 1);
+  }
+
+  void endStartTag(bool child) {
+    if(inStartTag) {
+      write(">");
+      if(child && prettify)
+        write("\n");
+      inStartTag = false;
+    }
+    if(child && depth > 0)
+      stack[depth - 1].hasChildren = true;
+  }
+
+  void indent() {
+    static const char spaces[] = "                                                                ";
+    if(!prettify)
+      return;
+    for(auto n = (size_t)depth * 2; n > 0;) {
+      auto const len = n < sizeof spaces - 1 ? n : sizeof spaces - 1;
+      out.append(spaces, len);
+      n -= len;
+    }
+  }
+
+  // writes the unescaped runs in one go
+  void escape(const char *s, size_t len) {
+    auto runStart = s;
+    for(auto end = s + len; s != end; ++s) {
+      const char *entity;
+      switch(*s) {
+      case '"':
+        entity = "&quot;";
+        break;
+      case '\'':
+        entity = "&apos;";
+        break;
+      case '<':
+        entity = "&lt;";
+        break;
+      case '>':
+        entity = "&gt;";
+        break;
+      case '&':
+        entity = "&amp;";
+        break;
+      default:
+        continue;
+      }
+      out.append(runStart, s - runStart);
+      out.append(entity, strlen(entity));
+      runStart = s + 1;
+    }
+    out.append(runStart, s - runStart);
+  }
+
+  // these write backwards, and return the first character
+  static char *formatUInt(char *end, uint64_t value) {
+    do {
+      *--end = char('0' + value % 10);
+      value /= 10;
+    } while(value);
+    return end;
+  }
+
+  static char *formatInt(char *end, int64_t value) {
+    if(value >= 0)
+      return formatUInt(end, value);
+    end = formatUInt(end, 0 - (uint64_t)value);
+    *--end = '-';
+    return end;
+  }
+
+  Output &out;
+  bool const prettify;
+  OpenTag stack[MAX_DEPTH];
+  int depth = 0;
+  bool inStartTag = false;
+};
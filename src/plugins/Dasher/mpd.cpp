@@ -1,35 +1,23 @@
 #include "mpd.hpp"
 
-#include "lib_utils/os.hpp"
 #include "lib_utils/xml.hpp"
 
 #include <cassert>
+#include <cstdio> // snprintf
 #include <ctime>
 
 extern const char *g_version;
 
 namespace {
-std::string formatInt(int64_t val) {
-  char buffer[256];
-  snprintf(buffer, sizeof buffer, "%lld", (long long)val);
-  return buffer;
-}
-
-std::string formatBool(bool val) { return val ? "true" : "false"; }
-
-std::string formatDate(int64_t timestamp) {
+void formatDate(char (&buffer)[64], int64_t timestamp) {
   auto t = (time_t)timestamp;
   std::tm date = *std::gmtime(&t);
 
-  char buffer[256];
-  sprintf(buffer, "%04d-%02d-%02dT%02d:%02d:%02dZ", 1900 + date.tm_year, 1 + date.tm_mon, date.tm_mday, date.tm_hour,
-        date.tm_min, date.tm_sec);
-  return buffer;
+  snprintf(buffer, sizeof buffer, "%04d-%02d-%02dT%02d:%02d:%02dZ", 1900 + date.tm_year, 1 + date.tm_mon, date.tm_mday,
+        date.tm_hour, date.tm_min, date.tm_sec);
 }
 
-std::string formatPeriod(int64_t t) {
-  char buffer[256];
-
+void formatPeriod(char (&buffer)[64], int64_t t) {
   auto const msecs = int(t % 1000);
   t /= 1000;
 
@@ -42,143 +30,159 @@ std::string formatPeriod(int64_t t) {
   auto const hours = int(t);
 
   snprintf(buffer, sizeof buffer, "PT%02dH%02dM%d.%03dS", hours, mins, secs, msecs);
-  return buffer;
 }
 
-Tag mpdToTags(MPD const &mpd) {
-  auto tMPD = Tag{"MPD"};
-  tMPD["xmlns"] = "urn:mpeg:dash:schema:mpd:2011";
-  tMPD["type"] = mpd.dynamic ? "dynamic" : "static";
-  tMPD["id"] = mpd.id;
-  tMPD["profiles"] = mpd.profiles;
-  if(mpd.dynamic)
-    tMPD["availabilityStartTime"] = formatDate(mpd.availabilityStartTime / 1000);
-  tMPD["publishTime"] = formatDate(mpd.publishTime / 1000);
-  tMPD["minBufferTime"] = formatPeriod(mpd.minBufferTime);
-  if(mpd.dynamic)
-    tMPD["minimumUpdatePeriod"] = formatPeriod(mpd.minimum_update_period);
-  else
-    tMPD["mediaPresentationDuration"] = formatPeriod(mpd.mediaPresentationDuration);
-
-  {
-    auto tProgramInformation = Tag{"ProgramInformation"};
-    tProgramInformation["moreInformationURL"] = "http://signals.motionspell.com";
-    {
-      auto tCopyright = Tag{"Copyright"};
-      tCopyright.content = "Generated by Signals/" + std::string(g_version);
-      tProgramInformation.add(tCopyright);
+const char *formatBool(bool val) { return val ? "true" : "false"; }
+
+void writeSegmentTimeline(XmlWriter<std::string> &xml, std::deque<MPD::Entry> const &entries) {
+  xml.openTag("SegmentTimeline");
+
+  for(auto &entry : entries) {
+    xml.openTag("S");
+    if(entry.duration)
+      xml.attr("d", entry.duration);
+    if(entry.startTime)
+      xml.attr("t", entry.startTime);
+    if(entry.repeatCount)
+      xml.attr("r", entry.repeatCount);
+    xml.closeTag();
+  }
+
+  xml.closeTag();
+}
+
+void writeMpd(XmlWriter<std::string> &xml, MPD const &mpd) {
+  char buffer[64];
+
+  xml.openTag("MPD");
+  xml.attr("xmlns", "urn:mpeg:dash:schema:mpd:2011");
+  xml.attr("type", mpd.dynamic ? "dynamic" : "static");
+  xml.attr("id", mpd.id);
+  xml.attr("profiles", mpd.profiles);
+  if(mpd.dynamic) {
+    formatDate(buffer, mpd.availabilityStartTime / 1000);
+    xml.attr("availabilityStartTime", buffer);
+  }
+  formatDate(buffer, mpd.publishTime / 1000);
+  xml.attr("publishTime", buffer);
+  formatPeriod(buffer, mpd.minBufferTime);
+  xml.attr("minBufferTime", buffer);
+  if(mpd.dynamic) {
+    formatPeriod(buffer, mpd.minimum_update_period);
+    xml.attr("minimumUpdatePeriod", buffer);
+    if(mpd.timeShiftBufferDepth) {
+      formatPeriod(buffer, mpd.timeShiftBufferDepth);
+      xml.attr("timeShiftBufferDepth", buffer);
     }
-    tMPD.add(tProgramInformation);
+  } else {
+    formatPeriod(buffer, mpd.mediaPresentationDuration);
+    xml.attr("mediaPresentationDuration", buffer);
   }
 
-  for(auto &period : mpd.periods) {
-    auto tPeriod = Tag{"Period"};
-    tPeriod["id"] = period.id;
-    tPeriod["start"] = formatPeriod(period.startTime);
+  xml.openTag("ProgramInformation");
+  xml.attr("moreInformationURL", "http://signals.motionspell.com");
+  xml.openTag("Copyright");
+  xml.text("Generated by Signals/" + std::string(g_version));
+  xml.closeTag();
+  xml.closeTag();
 
-    if(!mpd.dynamic && period.duration)
-      tPeriod["duration"] = formatPeriod(period.duration);
+  for(auto &period : mpd.periods) {
+    xml.openTag("Period");
+    xml.attr("id", period.id);
+    formatPeriod(buffer, period.startTime);
+    xml.attr("start", buffer);
+
+    if(!mpd.dynamic && period.duration) {
+      formatPeriod(buffer, period.duration);
+      xml.attr("duration", buffer);
+    }
 
     // Base URLs
     assert(!mpd.baseUrlPrefixes.empty());
     for(auto &baseUrl : mpd.baseUrlPrefixes) {
-      auto tBaseUrl = Tag{"BaseURL"};
-
       if(!baseUrl.empty()) {
-        tBaseUrl["serviceLocation"] = baseUrl;
-        tPeriod.add(tBaseUrl);
+        xml.openTag("BaseURL");
+        xml.attr("serviceLocation", baseUrl);
+        xml.closeTag();
       }
     }
 
     for(auto &adaptationSet : period.adaptationSets) {
-      auto tAdaptationSet = Tag{"AdaptationSet"};
-      tAdaptationSet["segmentAlignment"] = formatBool(adaptationSet.segmentAlignment);
-      tAdaptationSet["bitstreamSwitching"] = formatBool(adaptationSet.bitstreamSwitching);
+      xml.openTag("AdaptationSet");
+      xml.attr("segmentAlignment", formatBool(adaptationSet.segmentAlignment));
+      xml.attr("bitstreamSwitching", formatBool(adaptationSet.bitstreamSwitching));
 
       if(!adaptationSet.lang.empty())
-        tAdaptationSet["lang"] = adaptationSet.lang;
+        xml.attr("lang", adaptationSet.lang);
 
       if(!adaptationSet.supplementalProperty.empty()) {
-        auto tSupplementalProperty = Tag{"SupplementalProperty"};
-        tSupplementalProperty["schemeIdUri"] = "urn:mpeg:dash:srd:2014";
-        tSupplementalProperty["value"] = adaptationSet.supplementalProperty;
-        tAdaptationSet.add(tSupplementalProperty);
+        xml.openTag("SupplementalProperty");
+        xml.attr("schemeIdUri", "urn:mpeg:dash:srd:2014");
+        xml.attr("value", adaptationSet.supplementalProperty);
+        xml.closeTag();
       }
 
       // segment template common to all adaptation sets
-      {
-        auto tSegmentTemplate = Tag{"SegmentTemplate"};
-        tSegmentTemplate["timescale"] = formatInt(adaptationSet.timescale);
-        tSegmentTemplate["duration"] = formatInt(adaptationSet.duration);
-        if(mpd.dynamic)
-          tSegmentTemplate["startNumber"] = formatInt(0);
-        else
-          tSegmentTemplate["startNumber"] = formatInt(adaptationSet.startNumber);
-
-        tAdaptationSet.add(tSegmentTemplate);
+      xml.openTag("SegmentTemplate");
+      xml.attr("timescale", adaptationSet.timescale);
+      xml.attr("duration", adaptationSet.duration);
+      xml.attr("startNumber", mpd.dynamic ? 0 : adaptationSet.startNumber);
+      if(adaptationSet.availabilityTimeOffset > 0) {
+        snprintf(buffer, sizeof buffer, "%g", adaptationSet.availabilityTimeOffset);
+        xml.attr("availabilityTimeOffset", buffer);
       }
+      if(!adaptationSet.availabilityTimeComplete)
+        xml.attr("availabilityTimeComplete", formatBool(false));
+      xml.closeTag();
 
       for(auto &representation : adaptationSet.representations) {
-        auto tRepresentation = Tag{"Representation"};
-        tRepresentation["id"] = representation.id;
-        tRepresentation["bandwidth"] = formatInt(representation.bandwidth);
+        xml.openTag("Representation");
+        xml.attr("id", representation.id);
+        xml.attr("bandwidth", representation.bandwidth);
         if(representation.audioSamplingRate)
-          tRepresentation["audioSamplingRate"] = formatInt(representation.audioSamplingRate);
+          xml.attr("audioSamplingRate", representation.audioSamplingRate);
         if(representation.width)
-          tRepresentation["width"] = formatInt(representation.width);
+          xml.attr("width", representation.width);
         if(representation.height)
-          tRepresentation["height"] = formatInt(representation.height);
-        tRepresentation["mimeType"] = representation.mimeType;
-        tRepresentation["codecs"] = representation.codecs;
-        tRepresentation["startWithSAP"] = formatInt(representation.startWithSAP);
-
-        {
-          auto tSegmentTemplate = Tag{"SegmentTemplate"};
-          tSegmentTemplate["media"] = representation.media;
-          tSegmentTemplate["initialization"] = representation.initialization;
-          if(mpd.dynamic) {
-            tSegmentTemplate["startNumber"] = formatInt(0);
-          } else {
-            tSegmentTemplate["startNumber"] = formatInt(adaptationSet.startNumber);
-
-            auto const pto = (mpd.sessionStartTime + period.startTime) * adaptationSet.timescale / 1000;
-            if(pto)
-              tSegmentTemplate["presentationTimeOffset"] = formatInt(pto);
-          }
-
-          if(adaptationSet.entries.size()) {
-            auto tSegmentTimeline = Tag{"SegmentTimeline"};
-
-            for(auto &entry : adaptationSet.entries) {
-              auto tS = Tag{"S"};
-              if(entry.duration)
-                tS["d"] = formatInt(entry.duration);
-              if(entry.startTime)
-                tS["t"] = formatInt(entry.startTime);
-              if(entry.repeatCount)
-                tS["r"] = formatInt(entry.repeatCount);
-              tSegmentTimeline.add(tS);
-            }
-
-            tSegmentTemplate.add(tSegmentTimeline);
-          }
-
-          tRepresentation.add(tSegmentTemplate);
+          xml.attr("height", representation.height);
+        xml.attr("mimeType", representation.mimeType);
+        xml.attr("codecs", representation.codecs);
+        xml.attr("startWithSAP", representation.startWithSAP);
+
+        xml.openTag("SegmentTemplate");
+        xml.attr("media", representation.media);
+        xml.attr("initialization", representation.initialization);
+        if(mpd.dynamic) {
+          xml.attr("startNumber", 0);
+        } else {
+          xml.attr("startNumber", adaptationSet.startNumber);
+
+          auto const pto = (mpd.sessionStartTime + period.startTime) * adaptationSet.timescale / 1000;
+          if(pto)
+            xml.attr("presentationTimeOffset", pto);
         }
 
-        tAdaptationSet.add(tRepresentation);
+        if(adaptationSet.entries.size())
+          writeSegmentTimeline(xml, adaptationSet.entries);
+
+        xml.closeTag();
+        xml.closeTag();
       }
 
-      tPeriod.add(tAdaptationSet);
+      xml.closeTag();
     }
 
-    tMPD.add(tPeriod);
+    xml.closeTag();
   }
 
-  return tMPD;
+  xml.closeTag();
 }
 }
 
-std::string serializeMpd(MPD const &mpd) {
-  return "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" + serializeXml(mpdToTags(mpd));
+void serializeMpd(MPD const &mpd, std::string &buffer) {
+  buffer.clear();
+
+  XmlWriter<std::string> xml(buffer);
+  xml.declaration();
+  writeMpd(xml, mpd);
 }
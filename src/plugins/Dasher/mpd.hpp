@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -21,11 +22,12 @@ struct MPD {
   struct AdaptationSet {
     std::vector<Representation> representations;
 
-    std::vector<Entry> entries;
+    std::deque<Entry> entries; // SegmentTimeline
     int startNumber;
     int duration;
     int timescale;
-    int64_t availabilityTimeOffset;
+    double availabilityTimeOffset; // in seconds
+    bool availabilityTimeComplete;
     bool segmentAlignment;
     bool bitstreamSwitching;
     std::string lang;
@@ -54,4 +56,5 @@ struct MPD {
   std::vector<Period> periods;
 };
 
-std::string serializeMpd(MPD const &mpd);
+// 'buffer' is overwritten: reuse it across calls to avoid reallocations
+void serializeMpd(MPD const &mpd, std::string &buffer);
@@ -45,6 +45,14 @@ struct Quality {
   uint64_t avg_bitrate_in_bps = 0;
   std::string prefix; // typically a subdir, ending with a dir separator '/'
 
+  // low latency: a segment may be received as several chunks, the last one (EOS) possibly empty
+  uint64_t segmentDurIn180k = 0, segmentSize = 0; // received so far
+  bool segmentComplete = true;
+  uint64_t chunkLatencyIn180k = 0; // non-null once chunks were received
+
+  // segment timeline: start times of the segment being received and of the last completed one
+  int64_t segStartInMs = 0, lastSegStartInMs = 0;
+
   struct PendingSegment {
     uint64_t durationIn180k;
     std::string filename;
@@ -182,13 +190,29 @@ struct AdaptiveStreamer : ModuleDynI {
     }
   }
 
-  uint64_t getCurSegNum() const { return (startTimeInMs + totalDurationInMs) / segDurationInMs; }
+  // with a segment timeline, segments are identified by their start time
+  int64_t getCurSegNum(Quality const &quality) const {
+    if(!segDurationInMs)
+      return quality.segStartInMs;
+    return (startTimeInMs + totalDurationInMs) / segDurationInMs;
+  }
+
+  std::string getPrefixedSegmentName(Quality const &quality, size_t index, int64_t segmentNum) const {
+    return manifestDir + getSegmentName(quality, index, segmentNum * segDurationInMs, std::to_string(segmentNum));
+  }
+
+  // with a segment timeline, segments have their real duration
+  int64_t getCurSegDurationInMs() const {
+    if(segDurationInMs || qualities.empty())
+      return segDurationInMs;
+    return clockToTimescale(qualities[0].curSegDurIn180k, 1000);
+  }
 
   std::shared_ptr<DataBase> getPresignalledData(uint64_t size, Data data, bool EOS) {
     if(!(flags & PresignalNextSegment)) {
       return data->clone();
     }
-    if(!safe_cast<const MetadataFile>(data->getMetadata())->filename.empty() && !EOS) {
+    if(isOnDisk(data) && !EOS) {
       return nullptr;
     }
 
@@ -257,8 +281,11 @@ struct AdaptiveStreamer : ModuleDynI {
   }
 
   void ensureStartTime(int repIdx) {
-    if(startTimeInMs == -2)
+    if(startTimeInMs == -2) {
       startTimeInMs = clockToTimescale(qualities[repIdx].lastData->get<PresentationTime>().time, DASH_TIMESCALE);
+      for(auto &quality : qualities)
+        quality.segStartInMs = quality.lastSegStartInMs = startTimeInMs;
+    }
   }
 
   void sendLocalData(Data currData, int repIdx, uint64_t size, bool EOS) {
@@ -268,8 +295,7 @@ struct AdaptiveStreamer : ModuleDynI {
       auto const &meta = qualities[repIdx].getMeta();
 
       auto metaFn = make_shared<MetadataFile>(SEGMENT);
-      metaFn->filename =
-            getSegmentName(qualities[repIdx], repIdx, getCurSegNum() * segDurationInMs, std::to_string(getCurSegNum()));
+      metaFn->filename = getPrefixedSegmentName(qualities[repIdx], repIdx, getCurSegNum(qualities[repIdx]));
       metaFn->mimeType = meta->mimeType;
       metaFn->codecName = meta->codecName;
       metaFn->lang = meta->lang;
@@ -320,19 +346,28 @@ struct AdaptiveStreamer : ModuleDynI {
       return true;
     }
 
+    if(quality.segmentComplete) {
+      quality.segmentDurIn180k = 0;
+      quality.segmentSize = 0;
+    }
+    quality.segmentDurIn180k += curDurIn180k;
+    quality.segmentSize += meta->filesize;
+    quality.segmentComplete = meta->EOS;
+    if(!meta->EOS)
+      quality.chunkLatencyIn180k = meta->latencyIn180k;
+
     // update average bitrate
-    if(segDurationInMs && curDurIn180k) {
+    if(segDurationInMs && meta->EOS && quality.segmentDurIn180k) {
       auto const numSeg = totalDurationInMs / segDurationInMs;
-      quality.avg_bitrate_in_bps =
-            ((meta->filesize * 8 * IClock::Rate) / meta->durationIn180k + quality.avg_bitrate_in_bps * numSeg) /
-            (numSeg + 1);
+      auto const bitrate = (quality.segmentSize * 8 * IClock::Rate) / quality.segmentDurIn180k;
+      quality.avg_bitrate_in_bps = (bitrate + quality.avg_bitrate_in_bps * numSeg) / (numSeg + 1);
     }
 
     // update current segment duration
     if(flags & ForceRealDurations) {
       quality.curSegDurIn180k += meta->durationIn180k;
     } else {
-      quality.curSegDurIn180k = segDurationIn180k ? segDurationIn180k : meta->durationIn180k;
+      quality.curSegDurIn180k = segDurationIn180k ? segDurationIn180k : quality.segmentDurIn180k;
     }
 
     if(!meta->EOS)
@@ -358,7 +393,7 @@ struct AdaptiveStreamer : ModuleDynI {
 
       ensureStartTime(0);
       onNewSegment();
-      totalDurationInMs += segDurationInMs;
+      totalDurationInMs += getCurSegDurationInMs();
       m_host->log(Debug, format("Processes segment (total processed: %ss)", totalDurationInMs / 1000.0).c_str());
 
       for(auto &quality : qualities)
@@ -371,6 +406,38 @@ struct AdaptiveStreamer : ModuleDynI {
   }
 };
 
+struct AdaptationSetParams {
+  int type;
+  std::string lang;
+  std::string supplementalProperty; // contains generic info e.g. tiling
+
+  bool operator==(const AdaptationSetParams &other) const {
+    return this->type == other.type && this->lang == other.lang &&
+          this->supplementalProperty == other.supplementalProperty;
+  }
+};
+
+int64_t entryEnd(MPD::Entry const &entry) { return entry.startTime + entry.duration * (entry.repeatCount + 1); }
+
+// removes the segments starting before 'windowStart'
+void trimTimeline(std::deque<MPD::Entry> &entries, int64_t windowStart) {
+  while(!entries.empty()) {
+    auto &first = entries.front();
+    if(first.startTime >= windowStart || first.duration <= 0)
+      return;
+
+    auto const expired = (windowStart - first.startTime + first.duration - 1) / first.duration;
+    if(expired > first.repeatCount) {
+      entries.pop_front();
+      continue;
+    }
+
+    first.startTime += expired * first.duration;
+    first.repeatCount -= expired;
+    return;
+  }
+}
+
 AdaptiveStreamingCommonFlags getFlags(DasherConfig *cfg) {
   uint32_t r = 0;
 
@@ -405,6 +472,14 @@ class Dasher : public AdaptiveStreamer {
       throw error("'Next segment pre-signalling' or 'segments not owned' cannot be used with a segment timeline.");
     if(m_cfg.timeShiftBufferDepthInMs && m_cfg.multiPeriodFoldersInMs)
       throw error("Timeshift buffer depth cannot be set when multi-period folders are active.");
+
+    m_mpd.id = m_cfg.id;
+    m_mpd.profiles = g_profiles;
+    m_mpd.timeShiftBufferDepth = m_cfg.timeShiftBufferDepthInMs;
+    if(m_cfg.baseUrlPrefixes.empty())
+      m_mpd.baseUrlPrefixes = {""};
+    else
+      m_mpd.baseUrlPrefixes = m_cfg.baseUrlPrefixes;
   }
 
   protected:
@@ -412,82 +487,74 @@ class Dasher : public AdaptiveStreamer {
   DasherConfig const m_cfg;
   const bool useSegmentTimeline = false;
 
-  void postManifest(std::string contents) {
-    auto out = outputManifest->allocData<DataRaw>(contents.size());
+  // The manifest is updated in place on each new segment, instead of being rebuilt:
+  // the segment timelines only get their last entries modified.
+  MPD m_mpd{};
+  std::vector<SmallMap<AdaptationSetParams, size_t>> m_adaptationSetIndices; // per period
+  std::string m_manifest; // serialization buffer, reused across updates
+
+  void postManifest() {
+    serializeMpd(m_mpd, m_manifest);
+
+    auto out = outputManifest->allocData<DataRaw>(m_manifest.size());
     auto metadata = make_shared<MetadataFile>(PLAYLIST);
     metadata->filename = manifestDir + m_cfg.mpdName;
     metadata->durationIn180k = segDurationIn180k;
-    metadata->filesize = contents.size();
+    metadata->filesize = m_manifest.size();
     out->setMetadata(metadata);
     out->set(PresentationTime{timescaleToClock(totalDurationInMs, 1000)});
-    memcpy(out->buffer->data().ptr, contents.data(), contents.size());
+    memcpy(out->buffer->data().ptr, m_manifest.data(), m_manifest.size());
     outputManifest->post(out);
   }
 
-  std::string getPrefixedSegmentName(Quality const &quality, size_t index, int64_t segmentNum) const {
-    return manifestDir + getSegmentName(quality, index, segmentNum * segDurationInMs, std::to_string(segmentNum));
-  }
-
   void onNewSegment() {
     // check configuration consistency
     if(!m_cfg.tileInfo.empty())
       if(m_cfg.tileInfo.size() != getInputs().size())
         throw error("Tile info size different from the number of inputs.");
 
-    // create manifest
-    auto xml = createManifest(m_cfg, !manifestPublished);
+    // update manifest
+    auto const dryRun = !manifestPublished;
+    updateManifest(m_cfg, dryRun, !dryRun);
 
     // post manifest
     if(live)
-      postManifest(xml);
+      postManifest();
   }
 
-  std::string createManifest(DasherConfig m_cfg, bool dryRun) {
-    MPD mpd{};
-    if(live)
-      mpd.minimum_update_period = 1000;
+  // 'newSegment': the current segments are appended to the segment timelines
+  void updateManifest(DasherConfig const &cfg, bool dryRun, bool newSegment) {
+    auto &mpd = m_mpd;
+    mpd.minimum_update_period = live ? 1000 : 0;
     mpd.timeline = useSegmentTimeline;
-    mpd.dynamic = m_cfg.live;
-    mpd.id = m_cfg.id;
-    mpd.profiles = g_profiles;
-    mpd.minBufferTime = m_cfg.minBufferTimeInMs;
-    mpd.mediaPresentationDuration = totalDurationInMs + segDurationInMs;
+    mpd.dynamic = cfg.live;
+    mpd.minBufferTime = cfg.minBufferTimeInMs;
+    mpd.mediaPresentationDuration = totalDurationInMs + getCurSegDurationInMs();
     mpd.sessionStartTime = startTimeInMs;
     mpd.availabilityStartTime =
-          segDurationInMs /*time at which the first segment is available*/ + m_cfg.initialOffsetInMs;
-    mpd.timeShiftBufferDepth = m_cfg.timeShiftBufferDepthInMs;
-    mpd.publishTime = int64_t(m_cfg.utcClock->getTime() * 1000);
-
-    if(m_cfg.baseUrlPrefixes.empty())
-      mpd.baseUrlPrefixes = {""};
-    else
-      mpd.baseUrlPrefixes = m_cfg.baseUrlPrefixes;
-
-    std::vector<MPD::Period> periods{MPD::Period()};
-    if(m_cfg.multiPeriodFoldersInMs > 0)
-      periods.resize(1 + mpd.mediaPresentationDuration / m_cfg.multiPeriodFoldersInMs);
-
-    int periodIdx = 1;
-    for(auto &period : periods) {
-      period.id = format("%s", periodIdx);
-      period.startTime = (periodIdx - 1) * m_cfg.multiPeriodFoldersInMs;
-      period.duration = (periodIdx == (int)periods.size()) ? mpd.mediaPresentationDuration - period.startTime
-                                                           : m_cfg.multiPeriodFoldersInMs;
-
-      if(period.duration == 0)
-        continue;
-
-      struct AdaptationSetParams {
-        int type;
-        std::string lang;
-        std::string supplementalProperty; // contains generic info e.g. tiling
-
-        bool operator==(const AdaptationSetParams &other) const {
-          return this->type == other.type && this->lang == other.lang &&
-                this->supplementalProperty == other.supplementalProperty;
-        }
-      };
-      SmallMap<AdaptationSetParams, MPD::AdaptationSet> adaptationSets;
+          segDurationInMs /*time at which the first segment is available*/ + cfg.initialOffsetInMs;
+    mpd.publishTime = int64_t(cfg.utcClock->getTime() * 1000);
+
+    // empty periods are not listed
+    size_t numPeriods = 1;
+    if(cfg.multiPeriodFoldersInMs > 0)
+      numPeriods = 1 + mpd.mediaPresentationDuration / cfg.multiPeriodFoldersInMs;
+    if(mpd.mediaPresentationDuration == int64_t(numPeriods - 1) * (int64_t)cfg.multiPeriodFoldersInMs)
+      numPeriods--;
+    mpd.periods.resize(numPeriods);
+    m_adaptationSetIndices.resize(numPeriods);
+
+    for(size_t periodIdx = 0; periodIdx < numPeriods; ++periodIdx) {
+      auto &period = mpd.periods[periodIdx];
+      auto const isLastPeriod = periodIdx + 1 == numPeriods;
+      period.id = std::to_string(periodIdx + 1);
+      period.startTime = periodIdx * cfg.multiPeriodFoldersInMs;
+      period.duration = isLastPeriod ? mpd.mediaPresentationDuration - period.startTime : cfg.multiPeriodFoldersInMs;
+
+      for(auto &as : period.adaptationSets)
+        as.representations.clear();
+
+      auto &adaptationSetIndices = m_adaptationSetIndices[periodIdx];
 
       for(auto repIdx : getInputs()) {
         auto &quality = qualities[repIdx];
@@ -496,16 +563,23 @@ class Dasher : public AdaptiveStreamer {
           continue;
 
         std::string supplementalProperty;
-        if(!m_cfg.tileInfo.empty()) {
-          auto &ti = m_cfg.tileInfo[repIdx];
+        if(!cfg.tileInfo.empty()) {
+          auto &ti = cfg.tileInfo[repIdx];
           supplementalProperty = format("%s,%s,%s,%s,%s,%s,%s", ti.sourceId, ti.objectX, ti.objectY, ti.objectWidth,
                 ti.objectHeight, ti.totalWidth, ti.totalHeight);
         }
 
-        auto &as = adaptationSets[{meta->type, meta->lang, supplementalProperty}];
+        AdaptationSetParams const params{meta->type, meta->lang, supplementalProperty};
+        if(adaptationSetIndices.find(params) == adaptationSetIndices.end()) {
+          adaptationSetIndices[params] = period.adaptationSets.size();
+          period.adaptationSets.push_back({});
+        }
+
+        auto &as = period.adaptationSets[adaptationSetIndices[params]];
         as.duration = segDurationInMs;
         as.timescale = DASH_TIMESCALE;
         as.availabilityTimeOffset = AVAILABILITY_TIMEOFFSET_IN_S;
+        as.availabilityTimeComplete = true;
         as.lang = meta->lang;
         as.supplementalProperty = supplementalProperty;
 
@@ -521,19 +595,24 @@ class Dasher : public AdaptiveStreamer {
         if(useSegmentTimeline) {
           templateName = "$Time$";
           if(live)
-            mpd.minimum_update_period = m_cfg.minUpdatePeriodInMs;
+            mpd.minimum_update_period = cfg.minUpdatePeriodInMs;
         } else {
           templateName = "$Number$";
-          mpd.minimum_update_period = m_cfg.minUpdatePeriodInMs * MIN_UPDATE_PERIOD_FACTOR;
-          as.startNumber = (startTimeInMs + (periodIdx - 1) * m_cfg.multiPeriodFoldersInMs) / segDurationInMs;
+          mpd.minimum_update_period = cfg.minUpdatePeriodInMs * MIN_UPDATE_PERIOD_FACTOR;
+          as.startNumber = (startTimeInMs + periodIdx * cfg.multiPeriodFoldersInMs) / segDurationInMs;
         }
         rep.mimeType = meta->mimeType;
         rep.codecs = meta->codecName;
         rep.startWithSAP = true;
-        if(live && meta->latencyIn180k) {
-          as.availabilityTimeOffset =
-                std::max(0.0, (segDurationInMs - clockToTimescale(meta->latencyIn180k, DASH_TIMESCALE)) / 1000.0);
-          mpd.minBufferTime = clockToTimescale(meta->latencyIn180k, DASH_TIMESCALE);
+        auto const latencyIn180k = quality.chunkLatencyIn180k ? quality.chunkLatencyIn180k : meta->latencyIn180k;
+        if(live && latencyIn180k)
+          mpd.minBufferTime = clockToTimescale(latencyIn180k, DASH_TIMESCALE);
+
+        // low latency: the segments are available chunk by chunk, before they are complete
+        if(cfg.live && quality.chunkLatencyIn180k) {
+          auto const latencyInMs = (int64_t)clockToTimescale(quality.chunkLatencyIn180k, DASH_TIMESCALE);
+          as.availabilityTimeOffset = std::max<int64_t>(0, getCurSegDurationInMs() - latencyInMs) / 1000.0;
+          as.availabilityTimeComplete = false;
         }
         switch(meta->type) {
         case AUDIO_PKT:
@@ -555,47 +634,50 @@ class Dasher : public AdaptiveStreamer {
 
         std::string segFilename, nextSegFilename;
         if(useSegmentTimeline) {
-          auto prevEnt = as.entries.size() ? &as.entries.back() : nullptr;
-          auto const currDur = (int64_t)clockToTimescale(meta->durationIn180k, DASH_TIMESCALE);
-          uint64_t segTime = 0;
-          if(!prevEnt || prevEnt->duration != currDur) {
-            segTime = prevEnt ? prevEnt->startTime + prevEnt->duration * (prevEnt->repeatCount + 1) : startTimeInMs;
-            MPD::Entry ent{};
-            ent.startTime = segTime;
-            ent.duration = currDur;
-            as.entries.push_back(ent);
-          } else {
-            prevEnt->repeatCount++;
-            segTime = prevEnt->startTime + prevEnt->duration * (prevEnt->repeatCount);
+          // the timeline is shared by the representations of the adaptation set
+          if(newSegment && isLastPeriod) {
+            auto duration = (int64_t)clockToTimescale(quality.segmentDurIn180k, DASH_TIMESCALE);
+            if(as.representations.empty())
+              appendToTimeline(as.entries, duration, cfg.live ? cfg.timeShiftBufferDepthInMs : 0);
+            else if(!as.entries.empty())
+              duration = as.entries.back().duration;
+
+            quality.lastSegStartInMs = quality.segStartInMs;
+            quality.segStartInMs += duration;
           }
 
-          segFilename = getPrefixedSegmentName(quality, repIdx, segTime);
+          segFilename = getPrefixedSegmentName(quality, repIdx, quality.lastSegStartInMs);
         } else {
-          auto n = getCurSegNum();
+          auto n = getCurSegNum(quality);
           segFilename = getPrefixedSegmentName(quality, repIdx, n);
-          if(m_cfg.presignalNextSegment)
+          if(cfg.presignalNextSegment)
             nextSegFilename = getPrefixedSegmentName(quality, repIdx, n + 1);
         }
 
-        as.representations.push_back(rep);
+        as.representations.push_back(std::move(rep));
 
         if(dryRun)
           continue;
 
         postSegment(quality, segFilename, nextSegFilename);
 
-        if(m_cfg.timeShiftBufferDepthInMs)
+        if(cfg.timeShiftBufferDepthInMs)
           deleteOldSegments(quality);
       }
+    }
+  }
 
-      for(auto &as : adaptationSets)
-        period.adaptationSets.push_back(as.value);
-
-      mpd.periods.push_back(period);
-      periodIdx++;
+  void appendToTimeline(std::deque<MPD::Entry> &entries, int64_t duration, int64_t timeShiftBufferDepthInMs) {
+    if(!entries.empty() && entries.back().duration == duration) {
+      entries.back().repeatCount++;
+    } else {
+      auto const startTime = entries.empty() ? startTimeInMs : entryEnd(entries.back());
+      entries.push_back({startTime, duration, 0});
     }
 
-    return serializeMpd(mpd);
+    // same window as 'deleteOldSegments'
+    if(timeShiftBufferDepthInMs)
+      trimTimeline(entries, entryEnd(entries.back()) - timeShiftBufferDepthInMs);
   }
 
   void deleteOldSegments(Quality &quality) {
@@ -630,7 +712,7 @@ class Dasher : public AdaptiveStreamer {
     metaFn->mimeType = meta->mimeType;
     metaFn->codecName = meta->codecName;
     metaFn->lang = meta->lang;
-    metaFn->durationIn180k = meta->durationIn180k;
+    metaFn->durationIn180k = quality.segmentDurIn180k;
     metaFn->filesize = meta->filesize;
     metaFn->latencyIn180k = meta->latencyIn180k;
     metaFn->startsWithRAP = meta->startsWithRAP;
@@ -675,8 +757,8 @@ class Dasher : public AdaptiveStreamer {
       cfg.live = false;
       cfg.minUpdatePeriodInMs = 0;
       totalDurationInMs -= segDurationInMs;
-      auto xml = createManifest(cfg, false);
-      postManifest(xml);
+      updateManifest(cfg, false, false);
+      postManifest();
     }
   }
 };
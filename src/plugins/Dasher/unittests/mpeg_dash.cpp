@@ -5,6 +5,7 @@
 #include "lib_modules/modules.hpp"
 #include "lib_modules/utils/loader.hpp"
 #include "lib_utils/format.hpp"
+#include "lib_utils/profiler.hpp"
 #include "lib_utils/tools.hpp" // safe_cast
 #include "tests/tests.hpp"
 
@@ -482,3 +483,216 @@ unittest("dasher: tiles") {
 
   ASSERT_EQUALS(expectedMpd, mpdAnalyzer->mpd);
 }
+
+namespace {
+std::shared_ptr<DataBase> getTestSegmentWithDuration(int64_t durationInMs) {
+  auto r = getTestSegment();
+  auto meta = make_shared<MetadataFile>(*safe_cast<const MetadataFile>(r->getMetadata()));
+  meta->durationIn180k = timescaleToClock(durationInMs, 1000);
+  r->setMetadata(meta);
+  return r;
+}
+}
+
+unittest("dasher: segment timeline is updated within the timeshift buffer") {
+  DasherConfig cfg{};
+  cfg.live = true;
+  cfg.timeShiftBufferDepthInMs = 5000;
+  auto dasher = loadModule("MPEG_DASH", &NullHost, &cfg);
+
+  struct OutStubMpd : ModuleS {
+    std::string mpd;
+    void processOne(Data data) override { mpd = std::string((char *)data->data().ptr, data->data().len); }
+  };
+
+  struct OutStubFns : ModuleS {
+    std::vector<std::string> filenames;
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      if(meta->filesize != INT64_MAX) // not a "DELETE"
+        filenames.push_back(meta->filename);
+    }
+  };
+
+  auto fnsAnalyzer = createModule<OutStubFns>();
+  ConnectOutputToInput(dasher->getOutput(0), fnsAnalyzer->getInput(0));
+
+  auto mpdAnalyzer = createModule<OutStubMpd>();
+  ConnectOutputToInput(dasher->getOutput(1), mpdAnalyzer->getInput(0));
+
+  dasher->getInput(0)->connect();
+
+  // the first segment only triggers the initial manifest
+  for(auto durationInMs : {1000, 1000, 1000, 2000, 2000, 1000, 3000})
+    dasher->getInput(0)->push(getTestSegmentWithDuration(durationInMs));
+
+  auto const begin = mpdAnalyzer->mpd.find("<SegmentTimeline>");
+  auto const end = mpdAnalyzer->mpd.find("</SegmentTimeline>");
+  ASSERT(begin != std::string::npos && end != std::string::npos);
+  ASSERT_EQUALS("<SegmentTimeline>\n"
+                "            <S d=\"1000\" t=\"6000\"/>\n"
+                "            <S d=\"3000\" t=\"7000\"/>\n"
+                "          ",
+        mpdAnalyzer->mpd.substr(begin, end - begin));
+  ASSERT(mpdAnalyzer->mpd.find(" timeShiftBufferDepth=\"PT00H00M5.000S\"") != std::string::npos);
+
+  ASSERT_EQUALS("v_0_0x0/v_0_0x0-7000.m4s", fnsAnalyzer->filenames.back());
+}
+
+secondclasstest("dasher: manifest generation time vs. timeshift depth") {
+  for(int64_t depthInMs : {60 * 1000, 600 * 1000, 3600 * 1000}) {
+    DasherConfig cfg{};
+    cfg.live = true;
+    cfg.timeShiftBufferDepthInMs = depthInMs;
+    auto dasher = loadModule("MPEG_DASH", &NullHost, &cfg);
+
+    auto recMpd = createModule<MyOutput>();
+    ConnectOutputToInput(dasher->getOutput(1), recMpd->getInput(0));
+
+    dasher->getInput(0)->connect();
+
+    // alternate durations: one timeline entry per segment
+    auto const numSegments = depthInMs / 2000;
+    for(int i = 0; i < numSegments; ++i)
+      dasher->getInput(0)->push(getTestSegmentWithDuration(i % 2 ? 1900 : 2100));
+
+    auto const numManifests = 1000;
+    {
+      Tools::Profiler profiler(format("%s timeline entries: %s manifests", numSegments, numManifests));
+      for(int i = 0; i < numManifests; ++i)
+        dasher->getInput(0)->push(getTestSegmentWithDuration(i % 2 ? 1900 : 2100));
+    }
+  }
+}
+
+unittest("dasher: low latency, segments are forwarded chunk by chunk") {
+  DasherConfig cfg{};
+  cfg.segDurationInMs = segmentDurationInMs;
+  cfg.live = true;
+  auto dasher = loadModule("MPEG_DASH", &NullHost, &cfg);
+
+  struct OutStubMpd : ModuleS {
+    std::string mpd;
+    void processOne(Data data) override { mpd = std::string((char *)data->data().ptr, data->data().len); }
+  };
+
+  struct OutStubChunks : ModuleS {
+    std::vector<std::string> chunks;
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      chunks.push_back(format("%s %s %s", meta->filename, data->data().len, meta->EOS ? "EOS" : ""));
+    }
+  };
+
+  auto chunksAnalyzer = createModule<OutStubChunks>();
+  ConnectOutputToInput(dasher->getOutput(0), chunksAnalyzer->getInput(0));
+
+  auto mpdAnalyzer = createModule<OutStubMpd>();
+  ConnectOutputToInput(dasher->getOutput(1), mpdAnalyzer->getInput(0));
+
+  dasher->getInput(0)->connect();
+
+  auto pushChunk = [&](size_t size, int64_t durationInMs, bool EOS) {
+    auto chunk = make_shared<DataRaw>(size);
+    chunk->set(PresentationTime{0});
+    auto meta = make_shared<MetadataFile>(VIDEO_PKT);
+    meta->durationIn180k = timescaleToClock(durationInMs, 1000);
+    meta->latencyIn180k = timescaleToClock(1000, 1000);
+    meta->filesize = size;
+    meta->EOS = EOS;
+    chunk->setMetadata(meta);
+    dasher->getInput(0)->push(chunk);
+  };
+
+  // three one-second chunks per segment, then an empty EOS
+  for(int i = 0; i < 2; ++i) {
+    for(int j = 0; j < 3; ++j)
+      pushChunk(6, 1000, false);
+    pushChunk(0, 0, true);
+  }
+
+  auto const expected = std::vector<std::string>({
+        "v_0_0x0/v_0_0x0-0.m4s 6 ",
+        "v_0_0x0/v_0_0x0-0.m4s 6 ",
+        "v_0_0x0/v_0_0x0-0.m4s 6 ",
+        "v_0_0x0/v_0_0x0-0.m4s 0 EOS",
+        "v_0_0x0/v_0_0x0-1.m4s 6 ",
+        "v_0_0x0/v_0_0x0-1.m4s 6 ",
+        "v_0_0x0/v_0_0x0-1.m4s 6 ",
+        "v_0_0x0/v_0_0x0-1.m4s 0 EOS",
+  });
+  ASSERT_EQUALS(expected, chunksAnalyzer->chunks);
+
+  ASSERT(mpdAnalyzer->mpd.find(" availabilityTimeOffset=\"2\" availabilityTimeComplete=\"false\"/>") !=
+        std::string::npos);
+  ASSERT(mpdAnalyzer->mpd.find(" bandwidth=\"48\"") != std::string::npos); // 18 bytes per 3s
+}
+
+unittest("dasher: low latency with a segment timeline, chunks are named after their adaptation set timeline") {
+  DasherConfig cfg{};
+  cfg.live = true;
+  auto dasher = loadModule("MPEG_DASH", &NullHost, &cfg);
+
+  struct OutStubMpd : ModuleS {
+    std::string mpd;
+    void processOne(Data data) override { mpd = std::string((char *)data->data().ptr, data->data().len); }
+  };
+
+  struct OutStubChunks : ModuleS {
+    std::vector<std::string> chunks;
+    void processOne(Data data) override {
+      auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+      chunks.push_back(format("%s%s", meta->filename, meta->EOS ? " EOS" : ""));
+    }
+  };
+
+  auto chunksAnalyzer = createModule<OutStubChunks>();
+  ConnectOutputToInput(dasher->getOutput(0), chunksAnalyzer->getInput(0));
+
+  auto mpdAnalyzer = createModule<OutStubMpd>();
+  ConnectOutputToInput(dasher->getOutput(1), mpdAnalyzer->getInput(0));
+
+  dasher->getInput(0)->connect();
+  dasher->getInput(1)->connect();
+
+  auto pushChunk = [&](int input, StreamType type, int64_t durationInMs, bool EOS) {
+    auto chunk = make_shared<DataRaw>(EOS ? 0 : 6);
+    chunk->set(PresentationTime{0});
+    auto meta = make_shared<MetadataFile>(type);
+    meta->durationIn180k = timescaleToClock(durationInMs, 1000);
+    meta->latencyIn180k = timescaleToClock(durationInMs, 1000);
+    meta->filesize = chunk->data().len;
+    meta->EOS = EOS;
+    chunk->setMetadata(meta);
+    dasher->getInput(input)->push(chunk);
+  };
+
+  // the audio segments are shorter than the video ones: the timelines differ
+  for(int i = 0; i < 2; ++i) {
+    for(int j = 0; j < 2; ++j)
+      pushChunk(0, VIDEO_PKT, 1000, false);
+    pushChunk(0, VIDEO_PKT, 0, true);
+    for(int j = 0; j < 2; ++j)
+      pushChunk(1, AUDIO_PKT, 990, false);
+    pushChunk(1, AUDIO_PKT, 0, true);
+  }
+
+  auto const expected = std::vector<std::string>({
+        "v_0_0x0/v_0_0x0-0.m4s",
+        "v_0_0x0/v_0_0x0-0.m4s",
+        "a_1/a_1-0.m4s",
+        "a_1/a_1-0.m4s",
+        "v_0_0x0/v_0_0x0-0.m4s EOS",
+        "a_1/a_1-0.m4s EOS",
+        "v_0_0x0/v_0_0x0-2000.m4s",
+        "v_0_0x0/v_0_0x0-2000.m4s",
+        "a_1/a_1-1980.m4s",
+        "a_1/a_1-1980.m4s",
+        "v_0_0x0/v_0_0x0-2000.m4s EOS",
+        "a_1/a_1-1980.m4s EOS",
+  });
+  ASSERT_EQUALS(expected, chunksAnalyzer->chunks);
+
+  ASSERT(mpdAnalyzer->mpd.find("<S d=\"2000\" r=\"1\"/>") != std::string::npos);
+  ASSERT(mpdAnalyzer->mpd.find("<S d=\"1980\" r=\"1\"/>") != std::string::npos);
+}
@@ -2,15 +2,23 @@
 #include "hls_demux.hpp"
 
 #include "lib_media/common/attributes.hpp"
+#include "lib_media/common/download_sink.hpp"
 #include "lib_modules/utils/factory.hpp"
 #include "lib_modules/utils/helper.hpp" // ActiveModule
+#include "lib_utils/format.hpp"
 #include "lib_utils/log_sink.hpp"
+#include "lib_utils/queue.hpp"
 #include "lib_utils/time.hpp" // parseDate
 #include "lib_utils/tools.hpp" // enforce
 
-#include <cstring> // memcpy
+#include <algorithm> // min
+#include <chrono>
+#include <condition_variable>
+#include <cstring> // strlen
+#include <map>
 #include <memory>
-#include <sstream>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 using namespace Modules;
@@ -37,6 +45,117 @@ string serverName(string path) {
   return path;
 }
 
+string resolveUrl(string const &playlistUrl, string const &url) {
+  if(startsWith(url, "http"))
+    return url;
+  else if(startsWith(url, "/"))
+    return serverName(playlistUrl) + url;
+  else
+    return dirName(playlistUrl) + url;
+}
+
+struct Playlist {
+  struct Entry {
+    string url;
+    int64_t sequence;
+    int64_t programDateTime; // -1: unknown
+    int64_t duration;
+    int discontinuityNum;
+    int64_t rangeOffset = 0;
+    int64_t rangeSize = -1; // -1: the whole resource
+  };
+
+  vector<Entry> entries;
+  bool isMaster = true; // no segment: the entries are variant playlists
+  bool endList = false;
+  int64_t targetDuration = 0;
+  int64_t lastSequence = -1;
+};
+
+// Entries with a sequence number lower than 'firstSequence' are skipped.
+Playlist parsePlaylist(SpanC text, int64_t firstSequence) {
+  Playlist r;
+  int64_t programDateTime = -1, sequence = 0, rangeOffset = 0, rangeSize = -1;
+  int64_t segDur = 0;
+  int discNum = 0;
+
+  auto const end = text.ptr + text.len;
+  for(auto p = text.ptr; p < end;) {
+    auto eol = (const uint8_t *)memchr(p, '\n', end - p);
+    if(!eol)
+      eol = end;
+    auto len = eol - p;
+    if(len > 0 && p[len - 1] == '\r')
+      len--;
+    string const line((const char *)p, len);
+    p = eol + 1;
+
+    if(line.empty())
+      continue;
+
+    if(line[0] == '#') {
+      if(startsWith(line, "#EXT-X-PROGRAM-DATE-TIME:"))
+        programDateTime = fractionToClock(parseDate(line.substr(strlen("#EXT-X-PROGRAM-DATE-TIME:"))));
+      else if(startsWith(line, "#EXT-X-TARGETDURATION:")) {
+        segDur = (int64_t)(stof(line.substr(strlen("#EXT-X-TARGETDURATION:"))) * IClock::Rate);
+        r.targetDuration = segDur;
+      } else if(startsWith(line, "#EXT-X-MEDIA-SEQUENCE:"))
+        sequence = atoll(line.substr(strlen("#EXT-X-MEDIA-SEQUENCE:")).c_str());
+      else if(startsWith(line, "#EXT-X-DISCONTINUITY-SEQUENCE:")) {
+        discNum = atoi(line.substr(strlen("#EXT-X-DISCONTINUITY-SEQUENCE:")).c_str());
+      } else if(startsWith(line, "#EXT-X-DISCONTINUITY"))
+        discNum++;
+      else if(startsWith(line, "#EXTINF:")) {
+        segDur = (int64_t)(stof(line.substr(strlen("#EXTINF:"))) * IClock::Rate);
+        r.isMaster = false;
+      } else if(startsWith(line, "#EXT-X-BYTERANGE:")) {
+        // <size>[@<offset>], the offset defaults to the end of the previous range
+        auto const value = line.substr(strlen("#EXT-X-BYTERANGE:"));
+        auto const at = value.find('@');
+        rangeSize = atoll(value.c_str());
+        if(at != value.npos)
+          rangeOffset = atoll(value.c_str() + at + 1);
+      } else if(startsWith(line, "#EXT-X-ENDLIST"))
+        r.endList = true;
+
+      continue;
+    }
+
+    if(sequence >= firstSequence)
+      r.entries.push_back({line, sequence, programDateTime, segDur, discNum, rangeOffset, rangeSize});
+
+    r.lastSequence = sequence++;
+    if(programDateTime >= 0)
+      programDateTime += segDur;
+    if(rangeSize >= 0)
+      rangeOffset += rangeSize;
+    rangeSize = -1;
+  }
+
+  return r;
+}
+
+// serializes the calls to a puller shared by several threads
+struct SharedPuller : IFilePuller {
+  SharedPuller(IFilePuller *puller, mutex *m)
+      : puller(puller)
+      , m(m) {}
+  void wget(const char *url, function<void(SpanC)> callback) override {
+    lock_guard<mutex> lock(*m);
+    puller->wget(url, callback);
+  }
+  void wgetRange(const char *url, int64_t offset, int64_t size, function<void(SpanC)> callback) override {
+    lock_guard<mutex> lock(*m);
+    puller->wgetRange(url, offset, size, callback);
+  }
+  void askToExit() override {} // the puller isn't ours
+  IFilePuller *const puller;
+  mutex *const m;
+};
+
+// Live playlists are reloaded every target duration (half of it when nothing changed), and only the new
+// segments, identified by their media sequence number, are added.
+// Segments are downloaded concurrently, and delivered in order.
 class HlsDemuxer : public Module {
   public:
   HlsDemuxer(KHost *host, HlsDemuxConfig *cfg)
@@ -45,14 +164,43 @@ class HlsDemuxer : public Module {
 
     m_host->activate(true);
 
-    m_puller = cfg->filePuller;
-    if(!m_puller) {
-      m_internalPuller = createHttpSource();
-      m_puller = m_internalPuller.get();
-    }
+    auto createPuller = [&]() -> unique_ptr<IFilePuller> {
+      if(cfg->filePullerFactory)
+        return cfg->filePullerFactory->create();
+      else if(cfg->filePuller)
+        return make_unique<SharedPuller>(cfg->filePuller, &m_sharedPullerMutex);
+      else
+        return createHttpSource();
+    };
+
+    auto const workerCount = cfg->filePuller && !cfg->filePullerFactory ? 1 : cfg->parallelDownloads;
+    enforce(workerCount >= 1, "HlsDemuxer: parallelDownloads must be positive");
+    // the segments waiting for their turn hold output buffers
+    enforce(workerCount < (int)ALLOC_NUM_BLOCKS_DEFAULT, "HlsDemuxer: too many parallel downloads");
+
+    m_playlistPuller = createPuller();
+    for(int i = 0; i < workerCount; ++i)
+      m_pullers.push_back(createPuller());
 
-    m_dirName = dirName(cfg->url);
     m_output = addOutput();
+
+    for(auto &puller : m_pullers)
+      m_workers.push_back(thread(&HlsDemuxer::downloadProc, this, puller.get()));
+  }
+
+  ~HlsDemuxer() {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+
+    for(auto &puller : m_pullers) {
+      puller->askToExit();
+      m_jobs.push(nullptr);
+    }
+
+    for(auto &worker : m_workers)
+      worker.join();
   }
 
   void process() override {
@@ -61,107 +209,254 @@ class HlsDemuxer : public Module {
   }
 
   private:
-  struct Entry {
+  struct Segment {
+    Playlist::Entry entry;
     string url;
     int64_t timestamp;
-    int discontinuityNum;
+    bool download = true;
+    shared_ptr<DataRaw> data;
+    bool complete = false;
   };
 
   bool doProcess() {
-    string variantDirName;
-    if(!m_hasPlaylist) {
-      auto main = downloadPlaylist(m_playlistUrl);
-      if(main.empty()) {
-        m_host->log(Error, "No main playlist");
+    if(m_done)
+      return false;
+
+    if(m_mediaPlaylistUrl.empty()) {
+      if(!loadPlaylists()) {
+        m_done = true;
         return false;
       }
+    }
 
-      string subUrl;
-      if(startsWith(main[0].url, "http"))
-        subUrl = main[0].url;
-      else if(startsWith(main[0].url, "/"))
-        subUrl = serverName(m_playlistUrl) + main[0].url;
-      else
-        subUrl = m_dirName + main[0].url;
+    unique_lock<mutex> lock(m_mutex);
 
-      m_chunks = downloadPlaylist(subUrl);
-      m_hasPlaylist = true;
-      variantDirName = dirName(subUrl);
+    if(m_error) {
+      m_done = true;
+      rethrow_exception(m_error);
     }
 
-    if(m_chunks.empty()) {
+    if(m_endList && m_pending.empty()) {
       m_host->log(Debug, "Stopping");
+      m_done = true;
       return false;
     }
 
-    while(!m_chunks.empty()) {
-      auto const chunkUrl = variantDirName + m_chunks[0].url;
-      m_host->log(Debug, ("Process chunk: '" + chunkUrl + "'").c_str());
+    auto const now = chrono::steady_clock::now();
+    if(!m_endList && now >= m_nextReload) {
+      lock.unlock();
+      auto contents = download(m_playlistPuller.get(), m_mediaPlaylistUrl.c_str());
+      if(contents.empty())
+        m_host->log(Warning, format("Can't reload playlist '%s'", m_mediaPlaylistUrl).c_str());
+      updatePlaylist(contents);
+      return true;
+    }
 
-      // live mode: signal segments but only download the last one
-      std::vector<uint8_t> chunk;
-      if(!m_live || m_chunks.size() == 1)
-        chunk = download(m_puller, chunkUrl.c_str());
+    // the downloads happen in the background
+    auto deadline = now + chrono::milliseconds(50);
+    if(!m_endList)
+      deadline = std::min(deadline, m_nextReload);
+    m_changed.wait_until(lock, deadline);
+    return true;
+  }
 
-      auto data = m_output->allocData<DataRaw>(chunk.size());
-      data->set(PresentationTime{m_chunks[0].timestamp});
-      CueFlags flags{};
-      flags.discontinuity = m_chunks[0].discontinuityNum;
-      data->set(flags);
-      if(chunk.size())
-        memcpy(data->buffer->data().ptr, chunk.data(), chunk.size());
-      m_output->post(data);
+  bool loadPlaylists() {
+    auto main = download(m_playlistPuller.get(), m_playlistUrl.c_str());
+    if(main.empty()) {
+      m_host->log(Error, "No main playlist");
+      return false;
+    }
 
-      m_chunks.erase(m_chunks.begin());
+    auto playlist = parsePlaylist({main.data(), main.size()}, 0);
+    if(!playlist.isMaster) {
+      m_mediaPlaylistUrl = m_playlistUrl;
+      updatePlaylist(main);
+      return true;
+    }
+
+    if(playlist.entries.empty()) {
+      m_host->log(Error, "No variant in main playlist");
+      return false;
     }
 
+    m_mediaPlaylistUrl = resolveUrl(m_playlistUrl, playlist.entries[0].url);
+    auto contents = download(m_playlistPuller.get(), m_mediaPlaylistUrl.c_str());
+    if(contents.empty()) {
+      m_host->log(Debug, "Stopping");
+      return false;
+    }
+
+    updatePlaylist(contents);
     return true;
   }
 
-  vector<Entry> downloadPlaylist(string url) {
-    auto contents = download(m_puller, url.c_str());
-    vector<Entry> r;
-    int64_t programDateTime = 0;
-    int segDur = 0, discNum = 0;
-    m_live = true;
-    string line;
-    stringstream ss(string(contents.begin(), contents.end()));
-    while(getline(ss, line)) {
-      if(line.empty())
-        continue;
+  // queues the segments we don't know yet
+  void updatePlaylist(vector<uint8_t> const &contents) {
+    auto const playlist = parsePlaylist({contents.data(), contents.size()}, m_nextSequence);
+    auto const firstLoad = m_nextSequence == 0;
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+
+      for(auto &entry : playlist.entries) {
+        auto segment = make_shared<Segment>();
+        segment->entry = entry;
+        segment->url = resolveUrl(m_mediaPlaylistUrl, entry.url);
+        segment->timestamp = entry.programDateTime >= 0 ? entry.programDateTime : m_nextTimestamp;
+        m_nextTimestamp = segment->timestamp + entry.duration;
+
+        // live mode: signal segments but only download the last one
+        if(firstLoad && !playlist.endList && entry.sequence != playlist.lastSequence)
+          segment->download = false;
+
+        m_pending[entry.sequence] = segment;
+        m_toFetch.push_back(segment);
+      }
+
+      if(!playlist.entries.empty())
+        m_nextSequence = playlist.lastSequence + 1;
+
+      m_endList = playlist.endList;
+
+      auto reloadDelay = playlist.targetDuration ? playlist.targetDuration : IClock::Rate;
+      if(playlist.entries.empty())
+        reloadDelay /= 2;
+      m_nextReload = chrono::steady_clock::now() + chrono::microseconds(reloadDelay * 1000000 / IClock::Rate);
 
-      if(line[0] == '#') {
-        if(startsWith(line, "#EXT-X-PROGRAM-DATE-TIME:"))
-          programDateTime = fractionToClock(parseDate(line.substr(strlen("#EXT-X-PROGRAM-DATE-TIME:"))));
-        else if(startsWith(line, "#EXT-X-TARGETDURATION:"))
-          segDur = (int)(stof(line.substr(strlen("#EXT-X-TARGETDURATION:"))) * IClock::Rate);
-        else if(startsWith(line, "#EXT-X-DISCONTINUITY-SEQUENCE:")) {
-          discNum = atoi(line.substr(strlen("#EXT-X-DISCONTINUITY-SEQUENCE:")).c_str());
-        } else if(startsWith(line, "#EXT-X-DISCONTINUITY"))
-          discNum++;
-        else if(startsWith(line, "#EXTINF:"))
-          segDur = (int)(stof(line.substr(strlen("#EXTINF:"))) * IClock::Rate);
-        else if(startsWith(line, "#EXT-X-ENDLIST"))
-          m_live = false;
+      startDownloads();
+    }
+
+    deliver();
+  }
+
+  // called with 'm_mutex' held.
+  // The downloads don't get further than 'workerCount' segments from the oldest undelivered one:
+  // the complete segments waiting for their turn hold output buffers.
+  void startDownloads() {
+    auto const workerCount = (int64_t)m_pullers.size();
+    while(!m_toFetch.empty() && m_inFlight < workerCount) {
+      auto segment = m_toFetch.front();
 
+      if(!segment->download) {
+        m_toFetch.erase(m_toFetch.begin());
+        segment->complete = true;
         continue;
       }
 
-      r.push_back({line, programDateTime, discNum});
-      programDateTime += segDur;
+      if(segment->entry.sequence - m_pending.begin()->first >= workerCount)
+        break;
+
+      m_toFetch.erase(m_toFetch.begin());
+
+      m_inFlight++;
+      m_jobs.push(segment);
+    }
+  }
+
+  void downloadProc(IFilePuller *puller) {
+    while(auto segment = m_jobs.pop()) {
+      try {
+        downloadSegment(puller, segment);
+      } catch(std::exception const &) {
+        lock_guard<mutex> lock(m_mutex);
+        if(!m_error)
+          m_error = current_exception();
+        m_changed.notify_all();
+      }
+    }
+  }
+
+  void downloadSegment(IFilePuller *puller, shared_ptr<Segment> segment) {
+    m_host->log(Debug, ("Process chunk: '" + segment->url + "'").c_str());
+
+    // one Data per segment, downloaded in place
+    DownloadSinkConfig sinkCfg;
+    sinkCfg.bufferSize = 0;
+    DownloadSink sink(m_output, sinkCfg);
+    auto onBuffer = [&](SpanC chunk) { sink.write(chunk); };
+
+    auto const &entry = segment->entry;
+    if(entry.rangeSize >= 0)
+      puller->wgetRange(segment->url.c_str(), entry.rangeOffset, entry.rangeSize, onBuffer);
+    else
+      puller->wget(segment->url.c_str(), onBuffer);
+
+    auto data = sink.take();
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if(m_stopping)
+        return;
+
+      if(!data)
+        m_host->log(Warning, format("Can't download segment '%s'", segment->url).c_str());
+
+      segment->data = data;
+      segment->complete = true;
+      m_inFlight--;
+      startDownloads();
+    }
+
+    deliver();
+  }
+
+  // posts the completed segments, in order
+  void deliver() {
+    lock_guard<mutex> deliveryLock(m_deliveryMutex);
+
+    vector<shared_ptr<Segment>> ready;
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+      while(!m_pending.empty() && m_pending.begin()->second->complete) {
+        ready.push_back(m_pending.begin()->second);
+        m_pending.erase(m_pending.begin());
+      }
+
+      // the window moved
+      startDownloads();
+    }
+
+    for(auto &segment : ready) {
+      auto data = segment->data ? segment->data : m_output->allocData<DataRaw>(0);
+      data->set(PresentationTime{segment->timestamp});
+      CueFlags flags{};
+      flags.discontinuity = segment->entry.discontinuityNum;
+      data->set(flags);
+      m_output->post(data);
     }
-    return r;
+
+    m_changed.notify_all();
   }
 
   KHost *const m_host;
   string const m_playlistUrl;
-  IFilePuller *m_puller;
   OutputDefault *m_output = nullptr;
-  bool m_hasPlaylist = false;
-  bool m_live = true;
-  string m_dirName;
-  vector<Entry> m_chunks;
-  unique_ptr<IFilePuller> m_internalPuller;
+
+  mutex m_sharedPullerMutex;
+  unique_ptr<IFilePuller> m_playlistPuller;
+  vector<unique_ptr<IFilePuller>> m_pullers; // one per worker
+
+  // filter thread only
+  bool m_done = false;
+  string m_mediaPlaylistUrl;
+  int64_t m_nextSequence = 0;
+
+  mutex m_mutex; // protects all the following
+  condition_variable m_changed;
+  bool m_stopping = false;
+  exception_ptr m_error;
+  bool m_endList = false;
+  chrono::steady_clock::time_point m_nextReload;
+  int64_t m_nextTimestamp = 0;
+  map<int64_t, shared_ptr<Segment>> m_pending; // by sequence number: queued, not delivered yet
+  vector<shared_ptr<Segment>> m_toFetch;
+  int m_inFlight = 0;
+
+  mutex m_deliveryMutex; // serializes the posts
+
+  Queue<shared_ptr<Segment>> m_jobs; // nullptr: exit
+  vector<thread> m_workers;
 };
 
 IModule *createObject(KHost *host, void *va) {
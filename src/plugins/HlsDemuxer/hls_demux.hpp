@@ -6,5 +6,9 @@
 
 struct HlsDemuxConfig {
   std::string url;
-  Modules::In::IFilePuller *filePuller = nullptr; // if null, use internal HTTP puller.
+  Modules::In::IFilePuller *filePuller = nullptr; // if null, use internal HTTP puller. Used by one thread at a time.
+  Modules::In::IFilePullerFactory *filePullerFactory = nullptr; // if set, used instead of 'filePuller'
+
+  // segments downloaded concurrently. Only one with 'filePuller'.
+  int parallelDownloads = 3;
 };
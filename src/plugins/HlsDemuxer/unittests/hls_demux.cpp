@@ -4,9 +4,13 @@
 #include "lib_modules/utils/loader.hpp"
 #include "tests/tests.hpp"
 
+#include <algorithm> // max
+#include <chrono>
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
@@ -31,6 +35,41 @@ struct MemoryFileSystem : IFilePuller {
   std::mutex mutex;
 };
 
+// one puller per download thread, slowing down the odd segments
+struct SlowFileSystem : IFilePullerFactory {
+  struct Puller : IFilePuller {
+    Puller(SlowFileSystem *fs)
+        : fs(fs) {}
+    void wget(const char *url, std::function<void(SpanC)> callback) override {
+      {
+        std::unique_lock<std::mutex> lock(fs->fs.mutex);
+        fs->maxConcurrent = std::max(fs->maxConcurrent, ++fs->concurrent);
+      }
+      auto const slow = string(url).back() == 's' && (atoi(url + strlen("http://test.com/chunk-")) % 2);
+      std::this_thread::sleep_for(std::chrono::milliseconds(slow ? 30 : 1));
+      fs->fs.wget(url, callback);
+      std::unique_lock<std::mutex> lock(fs->fs.mutex);
+      --fs->concurrent;
+    }
+    void askToExit() override {}
+    SlowFileSystem *const fs;
+  };
+
+  unique_ptr<IFilePuller> create() override { return make_unique<Puller>(this); }
+
+  MemoryFileSystem fs;
+  int concurrent = 0, maxConcurrent = 0; // protected by 'fs.mutex'
+};
+
+vector<string> receiveAll(IModule *demux) {
+  vector<string> received;
+  ConnectOutput(demux->getOutput(0), [&](Data data) {
+    received.push_back(data->data().len ? string((const char *)data->data().ptr, data->data().len) : "");
+  });
+  for(int i = 0; i < 100; ++i)
+    demux->process();
+  return received;
+}
 }
 
 unittest("hls demux: download main playlist") {
@@ -63,3 +102,181 @@ chunk-last.ts
                 }),
         fs.requests);
 }
+
+unittest("hls demux: one Data per segment") {
+  MemoryFileSystem fs;
+  fs.resources["http://test.com/playlist.m3u8"] = "#EXTM3U\nsub.m3u8\n";
+  fs.resources["http://test.com/sub.m3u8"] = "#EXTM3U\nchunk-01.ts\nchunk-02.ts\n#EXT-X-ENDLIST\n";
+  fs.resources["http://test.com/chunk-01.ts"] = "first segment";
+  fs.resources["http://test.com/chunk-02.ts"] = "second";
+
+  HlsDemuxConfig cfg{};
+  cfg.url = "http://test.com/playlist.m3u8";
+  cfg.filePuller = &fs;
+  auto demux = loadModule("HlsDemuxer", &NullHost, &cfg);
+
+  ASSERT_EQUALS(vector<string>({"first segment", "second"}), receiveAll(demux.get()));
+}
+
+unittest("hls demux: parallel downloads, delivered in order") {
+  SlowFileSystem factory;
+  factory.fs.resources["http://test.com/sub.m3u8"] = "#EXTM3U\n#EXTINF:1\nchunk-1.ts\n#EXTINF:1\nchunk-2.ts\n"
+                                                       "#EXTINF:1\nchunk-3.ts\n#EXTINF:1\nchunk-4.ts\n"
+                                                       "#EXTINF:1\nchunk-5.ts\n#EXT-X-ENDLIST\n";
+  for(int i = 1; i <= 5; ++i)
+    factory.fs.resources["http://test.com/chunk-" + to_string(i) + ".ts"] = to_string(i);
+
+  HlsDemuxConfig cfg{};
+  cfg.url = "http://test.com/sub.m3u8"; // a media playlist
+  cfg.filePullerFactory = &factory;
+  cfg.parallelDownloads = 3;
+  auto demux = loadModule("HlsDemuxer", &NullHost, &cfg);
+
+  ASSERT_EQUALS(vector<string>({"1", "2", "3", "4", "5"}), receiveAll(demux.get()));
+  ASSERT_EQUALS(3, factory.maxConcurrent);
+}
+
+unittest("hls demux: byte-range segments") {
+  MemoryFileSystem fs;
+  fs.resources["http://test.com/sub.m3u8"] = R"(#EXTM3U
+#EXTINF:1
+#EXT-X-BYTERANGE:5@0
+all.ts
+#EXTINF:1
+#EXT-X-BYTERANGE:3
+all.ts
+#EXTINF:1
+#EXT-X-BYTERANGE:2@9
+all.ts
+#EXT-X-ENDLIST
+)";
+  fs.resources["http://test.com/all.ts"] = "abcdefghijkl";
+
+  HlsDemuxConfig cfg{};
+  cfg.url = "http://test.com/sub.m3u8";
+  cfg.filePuller = &fs;
+  auto demux = loadModule("HlsDemuxer", &NullHost, &cfg);
+
+  ASSERT_EQUALS(vector<string>({"abcde", "fgh", "jk"}), receiveAll(demux.get()));
+}
+
+unittest("hls demux: the downloads don't get ahead of the delivery") {
+  // the first segment is held until released
+  struct BlockingFileSystem : IFilePullerFactory {
+    struct Puller : IFilePuller {
+      Puller(BlockingFileSystem *fs)
+          : fs(fs) {}
+      void wget(const char *url, std::function<void(SpanC)> callback) override {
+        if(string(url) == "http://test.com/chunk-1.ts") {
+          std::unique_lock<std::mutex> lock(fs->mutex);
+          fs->releasedChanged.wait(lock, [&]() { return fs->released; });
+        }
+        fs->fs.wget(url, callback);
+      }
+      void askToExit() override {}
+      BlockingFileSystem *const fs;
+    };
+
+    unique_ptr<IFilePuller> create() override { return make_unique<Puller>(this); }
+
+    void release() {
+      std::unique_lock<std::mutex> lock(mutex);
+      released = true;
+      releasedChanged.notify_all();
+    }
+
+    MemoryFileSystem fs;
+    std::mutex mutex;
+    std::condition_variable releasedChanged;
+    bool released = false;
+  };
+
+  BlockingFileSystem factory;
+  string playlist = "#EXTM3U\n";
+  for(int i = 1; i <= 5; ++i) {
+    playlist += "#EXTINF:1\nchunk-" + to_string(i) + ".ts\n";
+    factory.fs.resources["http://test.com/chunk-" + to_string(i) + ".ts"] = to_string(i);
+  }
+  factory.fs.resources["http://test.com/sub.m3u8"] = playlist + "#EXT-X-ENDLIST\n";
+
+  HlsDemuxConfig cfg{};
+  cfg.url = "http://test.com/sub.m3u8";
+  cfg.filePullerFactory = &factory;
+  cfg.parallelDownloads = 2;
+  auto demux = loadModule("HlsDemuxer", &NullHost, &cfg);
+
+  vector<string> received;
+  ConnectOutput(demux->getOutput(0), [&](Data data) {
+    received.push_back(string((const char *)data->data().ptr, data->data().len));
+  });
+
+  for(int i = 0; i < 5; ++i)
+    demux->process();
+
+  vector<string> requestsWhileBlocked;
+  {
+    std::unique_lock<std::mutex> lock(factory.fs.mutex);
+    requestsWhileBlocked = factory.fs.requests;
+  }
+  factory.release();
+
+  for(int i = 0; i < 100; ++i)
+    demux->process();
+
+  // 'chunk-1' isn't recorded before being released
+  ASSERT_EQUALS(vector<string>({"http://test.com/sub.m3u8", "http://test.com/chunk-2.ts"}), requestsWhileBlocked);
+  ASSERT_EQUALS(vector<string>({"1", "2", "3", "4", "5"}), received);
+}
+
+unittest("hls demux: live playlist reload") {
+  auto playlist = [](int firstSequence, int lastSequence, bool end) {
+    string r = "#EXTM3U\n#EXT-X-TARGETDURATION:0.01\n#EXT-X-MEDIA-SEQUENCE:" + to_string(firstSequence) + "\n";
+    for(int i = firstSequence; i <= lastSequence; ++i)
+      r += "#EXTINF:0.01\nchunk-" + to_string(i) + ".ts\n";
+    return r + (end ? "#EXT-X-ENDLIST\n" : "");
+  };
+
+  // sliding window: each reload of the playlist gets one more segment
+  struct LiveFileSystem : IFilePuller {
+    void wget(const char *url, std::function<void(SpanC)> callback) override {
+      if(string(url) == "http://test.com/sub.m3u8") {
+        std::unique_lock<std::mutex> lock(fs.mutex);
+        auto const last = std::min(12 + reloadCount++, 20);
+        fs.resources[url] = playlist(last - 2, last, last == 20);
+      }
+      fs.wget(url, callback);
+    }
+    void askToExit() override {}
+
+    std::function<string(int, int, bool)> playlist;
+    MemoryFileSystem fs;
+    int reloadCount = 0;
+  };
+
+  LiveFileSystem live;
+  live.playlist = playlist;
+  for(int i = 10; i <= 20; ++i)
+    live.fs.resources["http://test.com/chunk-" + to_string(i) + ".ts"] = to_string(i);
+
+  HlsDemuxConfig cfg{};
+  cfg.url = "http://test.com/sub.m3u8";
+  cfg.filePuller = &live;
+  auto demux = loadModule("HlsDemuxer", &NullHost, &cfg);
+
+  vector<string> received;
+  ConnectOutput(demux->getOutput(0), [&](Data data) {
+    received.push_back(data->data().len ? string((const char *)data->data().ptr, data->data().len) : "");
+  });
+  for(int i = 0; i < 1000 && (received.empty() || received.back() != "20"); ++i)
+    demux->process();
+
+  // the first segments are only signaled
+  ASSERT_EQUALS(vector<string>({"", "", "12", "13", "14", "15", "16", "17", "18", "19", "20"}), received);
+
+  // each segment is downloaded once
+  int chunkRequests = 0;
+  for(auto &url : live.fs.requests)
+    if(url != "http://test.com/sub.m3u8")
+      chunkRequests++;
+  ASSERT_EQUALS(9, chunkRequests);
+}
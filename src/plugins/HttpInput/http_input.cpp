@@ -1,6 +1,7 @@
 #include "http_input.hpp"
 
-#include "lib_media/common/file_puller.hpp"
+#include "lib_media/common/download_sink.hpp"
+#include "lib_media/common/http_puller.hpp"
 #include "lib_modules/utils/factory.hpp" // registerModule
 #include "lib_modules/utils/helper.hpp"
 #include "lib_utils/format.hpp"
@@ -11,15 +12,27 @@
 
 using namespace Modules;
 
-std::unique_ptr<In::IFilePuller> createHttpSource();
-
 namespace {
 
+// the downloaded data is coalesced into buffers of this size
+auto const OUTPUT_BUFFER_SIZE = 1024 * 1024;
+
+DownloadSinkConfig sinkConfig() {
+  DownloadSinkConfig cfg;
+  cfg.bufferSize = OUTPUT_BUFFER_SIZE;
+  return cfg;
+}
+
 struct HttpInput : Module {
   HttpInput(KHost *host, HttpInputConfig const &cfg)
       : m_host(host)
-      , url(cfg.url) {
+      , url(cfg.url)
+      , m_downloadedMB(host, "downloaded_mb")
+      , m_throughputKbps(host, "download_throughput_kbps") {
+    m_sourceConfig.parallelConnections = cfg.parallelConnections;
+    m_sourceConfig.rangeSize = cfg.rangeSize;
     out = addOutput();
+    m_sink = std::make_unique<In::DownloadSink>(out, sinkConfig(), [this](Data data) { post(data); });
     host->activate(true);
   }
   void flush() override {
@@ -30,26 +43,37 @@ struct HttpInput : Module {
   }
   void process() override {
     if(!source) {
-      source = createHttpSource();
+      source = createHttpSource(m_sourceConfig);
 
       workingThread = std::thread([&]() {
-        auto onBuffer = [&](SpanC chunk) {
-          auto data = out->allocData<DataRaw>(chunk.len);
-          memcpy(data->buffer->data().ptr, chunk.ptr, chunk.len);
-          outputs[0]->post(data);
-        };
+        auto onBuffer = [&](SpanC chunk) { m_sink->write(chunk); };
+        source->setProgressCallback([&]() { m_sink->flushIfStale(); });
         m_host->log(Info, format("starting download of %s", url.c_str()).c_str());
         source->wget(url.c_str(), onBuffer);
+        m_sink->flush();
         m_host->log(Info, format("download of %s completed", url.c_str()).c_str());
       });
     }
   }
 
   private:
+  void post(Data data) {
+    out->post(data);
+
+    auto const stats = source->getStats();
+    *m_downloadedMB = (int32_t)(stats.bytes / (1024 * 1024));
+    if(stats.durationInUs > 0)
+      *m_throughputKbps = (int32_t)(stats.bytes * 8 * 1000 / stats.durationInUs);
+  }
+
   KHost *const m_host;
   OutputDefault *out;
   const std::string url;
-  std::unique_ptr<In::IFilePuller> source;
+  HttpSourceConfig m_sourceConfig;
+  std::unique_ptr<IHttpSource> source;
+  std::unique_ptr<In::DownloadSink> m_sink;
+  HostCounter m_downloadedMB;
+  HostCounter m_throughputKbps;
   std::thread workingThread;
 };
 
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 struct HttpInputConfig {
   std::string url;
+
+  // more than 1: large files are downloaded with several ranged requests at once
+  int parallelConnections = 1;
+  size_t rangeSize = 4 * 1024 * 1024;
 };
@@ -0,0 +1,577 @@
+#include "http_origin.hpp"
+
+#include "lib_media/common/metadata_file.hpp"
+#include "lib_modules/utils/factory.hpp" // registerModule
+#include "lib_modules/utils/helper.hpp"
+#include "lib_utils/format.hpp"
+#include "lib_utils/log_sink.hpp" // Info
+#include "lib_utils/reactor.hpp"
+#include "lib_utils/tools.hpp" // enforce
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sys/socket.h>
+#include <sys/time.h> // timeval
+#include <unistd.h>
+
+#include <algorithm> // transform
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib> // atoll
+#include <cstring> // strlen
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace Modules;
+using namespace std;
+
+namespace {
+
+auto const MAX_REQUEST_SIZE = 16 * 1024;
+
+// a blocking playlist reload can't ask for a segment further than this in the future
+auto const MAX_MSN_AHEAD = 2;
+
+// a blocking playlist reload waits three target durations: this one, until the playlist tells its own
+auto const DEFAULT_TARGET_DURATION_IN_MS = 6000;
+
+// A file of the store. The chunks are the buffers received from upstream, nothing is copied.
+// Replacing, deleting or evicting an entry doesn't disturb the responses still sending it.
+struct Entry {
+  vector<shared_ptr<const IBuffer>> chunks;
+  size_t size = 0;
+  string mimeType;
+  bool isPlaylist = false;
+  bool isHlsPlaylist = false;
+  bool complete = false;
+  bool removed = false; // deleted or evicted: pending chunked responses are interrupted
+  uint64_t durationIn180k = 0;
+
+  // HLS playlists: what they list, for the blocking playlist reloads
+  int64_t nextMsn = 0; // media sequence number of the first segment not listed yet
+  int64_t nextPart = 0; // the parts listed of this segment
+  bool ended = false;
+  int64_t targetDurationInMs = 0;
+};
+
+void parseHlsPlaylist(Entry &entry) {
+  string text;
+  for(auto &chunk : entry.chunks)
+    text.append((const char *)chunk->data().ptr, chunk->data().len);
+
+  int64_t mediaSequence = 0, segments = 0;
+  size_t pos = 0;
+  while(pos < text.size()) {
+    auto end = text.find('\n', pos);
+    if(end == string::npos)
+      end = text.size();
+    auto line = text.substr(pos, end - pos);
+    pos = end + 1;
+    if(!line.empty() && line.back() == '\r')
+      line.pop_back();
+
+    auto startsWith = [&](const char *prefix) { return line.compare(0, strlen(prefix), prefix) == 0; };
+    if(startsWith("#EXT-X-MEDIA-SEQUENCE:"))
+      mediaSequence = atoll(line.c_str() + strlen("#EXT-X-MEDIA-SEQUENCE:"));
+    else if(startsWith("#EXT-X-TARGETDURATION:"))
+      entry.targetDurationInMs = 1000 * atoll(line.c_str() + strlen("#EXT-X-TARGETDURATION:"));
+    else if(startsWith("#EXT-X-PART:"))
+      entry.nextPart++;
+    else if(startsWith("#EXT-X-ENDLIST"))
+      entry.ended = true;
+    else if(!line.empty() && line[0] != '#') {
+      // a segment URI: the parts listed before belong to this segment
+      segments++;
+      entry.nextPart = 0;
+    }
+  }
+  entry.nextMsn = mediaSequence + segments;
+}
+
+// 'query': "name=value&..."
+bool getQueryParam(string const &query, string const &name, int64_t &value) {
+  size_t pos = 0;
+  while(pos <= query.size()) {
+    auto end = query.find('&', pos);
+    if(end == string::npos)
+      end = query.size();
+    if(query.compare(pos, name.size() + 1, name + "=") == 0) {
+      value = atoll(query.c_str() + pos + name.size() + 1);
+      return true;
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+
+string mimeTypeOf(string const &path, string const &fallback) {
+  static const map<string, string> byExtension = {
+        {"mpd", "application/dash+xml"},
+        {"m3u8", "application/vnd.apple.mpegurl"},
+        {"vtt", "text/vtt"},
+  };
+
+  auto const i = byExtension.find(path.substr(path.rfind('.') + 1));
+  if(i != byExtension.end())
+    return i->second;
+  return fallback.empty() ? "application/octet-stream" : fallback;
+}
+
+int listenTcp(string const &address, int port) {
+  auto const fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0)
+    throw error("HttpOrigin: socket failed");
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr(address.c_str());
+  addr.sin_port = htons(port);
+
+  if(::bind(fd, (sockaddr *)&addr, sizeof addr) < 0 || listen(fd, 64) < 0) {
+    auto const err = errno;
+    close(fd);
+    throw error(format("HttpOrigin: can't listen on %s:%s (errno=%s)", address, port, err));
+  }
+
+  return fd;
+}
+
+bool sendAll(int fd, const void *data, size_t len) {
+  auto p = (const uint8_t *)data;
+  while(len > 0) {
+    auto const n = send(fd, p, len, MSG_NOSIGNAL);
+    if(n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool sendAll(int fd, string const &s) { return sendAll(fd, s.data(), s.size()); }
+
+bool sendChunk(int fd, SpanC chunk) {
+  if(!chunk.len)
+    return true; // an empty chunk would end the response
+
+  char header[32];
+  snprintf(header, sizeof header, "%zx\r\n", chunk.len);
+  return sendAll(fd, header) && sendAll(fd, chunk.ptr, chunk.len) && sendAll(fd, "\r\n", 2);
+}
+
+// The store is written from the module thread, and read from one thread per HTTP connection.
+class HttpOrigin : public ModuleS {
+  public:
+  HttpOrigin(KHost *host, HttpOriginConfig const &cfg)
+      : m_host(host)
+      , m_timeShiftBufferDepthInMs(cfg.timeShiftBufferDepthInMs)
+      , m_maxConnections(cfg.maxConnections)
+      , m_idleTimeoutInMs(cfg.idleTimeoutInMs)
+      , m_utcClock(cfg.utcClock)
+      , m_reactor(createReactor())
+      , m_storedFiles(host, "stored_files")
+      , m_storedMB(host, "stored_mb") {
+    enforce(m_utcClock, "HttpOrigin: utcClock can't be NULL");
+    enforce(m_timeShiftBufferDepthInMs >= 0, "HttpOrigin: timeShiftBufferDepthInMs can't be negative");
+    enforce(m_maxConnections > 0, "HttpOrigin: maxConnections must be positive");
+    enforce(m_idleTimeoutInMs > 0, "HttpOrigin: idleTimeoutInMs must be positive");
+
+    m_socket = listenTcp(cfg.address, cfg.port);
+    m_reactor->add(m_socket, 0);
+    m_acceptThread = thread(&HttpOrigin::acceptLoop, this);
+
+    m_host->log(Info, format("Serving on %s:%s", cfg.address, cfg.port).c_str());
+  }
+
+  ~HttpOrigin() {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_changed.notify_all();
+    m_reactor->wakeUp();
+    m_acceptThread.join();
+
+    // unblocks the connections waiting for a request, or for a slow client
+    for(auto &connection : m_connections)
+      shutdown(connection.fd, SHUT_RDWR);
+
+    for(auto &connection : m_connections) {
+      connection.worker.join();
+      close(connection.fd);
+    }
+
+    close(m_socket);
+  }
+
+  void processOne(Data data) override {
+    auto meta = safe_cast<const MetadataFile>(data->getMetadata());
+    auto const nowInMs = fractionToTimescale(m_utcClock->getTime(), 1000);
+
+    // only the data received in memory can be served
+    if(meta->filesize != INT64_MAX && meta->filesize > 0 && data->data().len == 0) {
+      m_host->log(Warning, format("\"%s\" was written to disk, ignored.", meta->filename).c_str());
+      return;
+    }
+
+    {
+      lock_guard<mutex> lock(m_mutex);
+
+      if(meta->filesize == INT64_MAX)
+        remove(meta->filename);
+      else
+        store(meta->filename, *meta, data, nowInMs);
+
+      evict(nowInMs);
+
+      *m_storedFiles = (int32_t)m_entries.size();
+      *m_storedMB = (int32_t)(m_storedBytes >> 20);
+    }
+
+    m_changed.notify_all();
+  }
+
+  private:
+  struct Connection {
+    Connection(int fd)
+        : fd(fd) {}
+    int const fd;
+    thread worker;
+    atomic<bool> done{false};
+  };
+
+  void store(string const &path, MetadataFile const &meta, Data data, int64_t nowInMs) {
+    auto &entry = m_entries[path];
+
+    // a new version of a manifest, or of a segment, replaces the complete one
+    if(!entry || entry->complete) {
+      if(entry)
+        m_storedBytes -= entry->size;
+      entry = make_shared<Entry>();
+      entry->mimeType = mimeTypeOf(path, meta.mimeType);
+      entry->isPlaylist = meta.type == PLAYLIST;
+      entry->isHlsPlaylist = entry->mimeType == "application/vnd.apple.mpegurl";
+    }
+
+    if(data->buffer) {
+      entry->chunks.push_back(data->buffer);
+      entry->size += data->data().len;
+      m_storedBytes += data->data().len;
+    }
+    entry->durationIn180k += meta.durationIn180k;
+
+    if(meta.EOS) {
+      entry->complete = true;
+
+      if(entry->isHlsPlaylist)
+        parseHlsPlaylist(*entry);
+
+      // initialization segments have no duration: they stay available
+      if(!entry->isPlaylist && entry->durationIn180k)
+        m_evictionQueue.push_back({nowInMs, path, entry});
+    }
+  }
+
+  void remove(string const &path) {
+    auto i = m_entries.find(path);
+    if(i == m_entries.end())
+      return;
+
+    i->second->removed = true;
+    m_storedBytes -= i->second->size;
+    m_entries.erase(i);
+  }
+
+  void evict(int64_t nowInMs) {
+    if(!m_timeShiftBufferDepthInMs)
+      return;
+
+    while(!m_evictionQueue.empty() && nowInMs - m_evictionQueue.front().timeInMs > m_timeShiftBufferDepthInMs) {
+      auto const &candidate = m_evictionQueue.front();
+
+      // the file may have been deleted, or replaced, since
+      auto i = m_entries.find(candidate.path);
+      if(i != m_entries.end() && i->second == candidate.entry.lock())
+        remove(candidate.path);
+
+      m_evictionQueue.pop_front();
+    }
+  }
+
+  // the connections wake this thread up when they are done
+  void acceptLoop() {
+    for(;;) {
+      auto const event = m_reactor->wait(-1);
+      if(event == IReactor::WAKE_UP) {
+        {
+          lock_guard<mutex> lock(m_mutex);
+          if(m_stop)
+            break;
+        }
+        reapConnections();
+        continue;
+      }
+      if(event == IReactor::TIMEOUT)
+        continue;
+
+      reapConnections();
+
+      auto const fd = accept(m_socket, nullptr, nullptr);
+      if(fd < 0)
+        continue;
+
+      if((int)m_connections.size() >= m_maxConnections) {
+        m_host->log(Warning, format("Too many connections (%s), rejecting a new one.", m_connections.size()).c_str());
+        sendStatus(fd, "503 Service Unavailable", false);
+        close(fd);
+        continue;
+      }
+
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+      // the connection threads block in 'recv' and 'send': an idle or stalled client can't hold one forever
+      timeval timeout{m_idleTimeoutInMs / 1000, (m_idleTimeoutInMs % 1000) * 1000};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+      m_connections.emplace_back(fd);
+      auto &connection = m_connections.back();
+      connection.worker = thread(&HttpOrigin::serve, this, &connection);
+    }
+  }
+
+  // closing is deferred to the accept thread: the destructor must not shut down a recycled descriptor
+  void reapConnections() {
+    for(auto i = m_connections.begin(); i != m_connections.end();) {
+      if(!i->done) {
+        ++i;
+        continue;
+      }
+      i->worker.join();
+      close(i->fd);
+      i = m_connections.erase(i);
+    }
+  }
+
+  void serve(Connection *connection) {
+    auto const fd = connection->fd;
+    string request;
+    char buffer[4096];
+
+    for(;;) {
+      auto const end = request.find("\r\n\r\n");
+      if(end == string::npos) {
+        if(request.size() > MAX_REQUEST_SIZE)
+          break;
+        auto const n = recv(fd, buffer, sizeof buffer, 0);
+        if(n <= 0)
+          break;
+        request.append(buffer, n);
+        continue;
+      }
+
+      auto const keepAlive = reply(fd, request.substr(0, end));
+      request.erase(0, end + 4);
+      if(!keepAlive)
+        break;
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    connection->done = true;
+    m_reactor->wakeUp();
+  }
+
+  // returns false when the connection must be closed
+  bool reply(int fd, string const &request) {
+    auto const requestLine = request.substr(0, request.find("\r\n"));
+    auto const sp1 = requestLine.find(' ');
+    auto const sp2 = requestLine.rfind(' ');
+    if(sp1 == string::npos || sp2 == sp1)
+      return sendStatus(fd, "400 Bad Request", false);
+
+    // header names and values are case-insensitive, the path isn't
+    auto headers = request.substr(requestLine.size());
+    transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+    auto keepAlive = requestLine.substr(sp2 + 1) != "HTTP/1.0";
+    if(headers.find("\r\nconnection: close") != string::npos)
+      keepAlive = false;
+    else if(headers.find("\r\nconnection: keep-alive") != string::npos)
+      keepAlive = true;
+
+    auto const method = requestLine.substr(0, sp1);
+    if(method != "GET" && method != "HEAD")
+      return sendStatus(fd, "405 Method Not Allowed", keepAlive);
+
+    auto path = requestLine.substr(sp1 + 1, sp2 - sp1 - 1);
+    auto const queryPos = path.find('?');
+    auto const query = queryPos == string::npos ? string() : path.substr(queryPos + 1);
+    path = path.substr(0, queryPos);
+    if(!path.empty() && path[0] == '/')
+      path.erase(0, 1);
+
+    int64_t msn = -1, part = -1;
+    auto const blocking = getQueryParam(query, "_HLS_msn", msn);
+    if(getQueryParam(query, "_HLS_part", part) && (!blocking || part < 0))
+      return sendStatus(fd, "400 Bad Request", keepAlive);
+    if(blocking && msn < 0)
+      return sendStatus(fd, "400 Bad Request", keepAlive);
+
+    shared_ptr<Entry> entry;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      auto find = [&]() {
+        auto i = m_entries.find(path);
+        entry = i != m_entries.end() ? i->second : nullptr;
+      };
+      find();
+
+      if(blocking && entry && entry->isHlsPlaylist) {
+        // a version still being received lists nothing yet
+        if(entry->complete && msn > entry->nextMsn + MAX_MSN_AHEAD)
+          return sendStatus(fd, "400 Bad Request", keepAlive);
+
+        // blocking playlist reload: hold the request until the playlist lists the requested segment or part
+        auto isListed = [&]() {
+          if(!entry->complete)
+            return false;
+          return entry->ended || msn < entry->nextMsn || (part >= 0 && msn == entry->nextMsn && part < entry->nextPart);
+        };
+        auto const targetDurationInMs =
+              entry->targetDurationInMs ? entry->targetDurationInMs : DEFAULT_TARGET_DURATION_IN_MS;
+        auto const timeout = chrono::milliseconds(3 * targetDurationInMs);
+        auto const listed = m_changed.wait_for(lock, timeout, [&]() {
+          find();
+          return m_stop || !entry || !entry->isHlsPlaylist || isListed();
+        });
+        if(m_stop)
+          return false;
+        if(!listed)
+          return sendStatus(fd, "503 Service Unavailable", keepAlive);
+      }
+    }
+
+    if(!entry)
+      return sendStatus(fd, "404 Not Found", keepAlive);
+
+    return sendEntry(fd, entry, method == "HEAD", keepAlive);
+  }
+
+  bool sendEntry(int fd, shared_ptr<Entry> entry, bool headOnly, bool keepAlive) {
+    vector<shared_ptr<const IBuffer>> chunks;
+    bool complete;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      chunks = entry->chunks;
+      complete = entry->complete;
+    }
+
+    string headers = "HTTP/1.1 200 OK\r\nContent-Type: " + entry->mimeType + "\r\n";
+    if(entry->isPlaylist)
+      headers += "Cache-Control: no-cache\r\n";
+    if(complete) {
+      size_t size = 0;
+      for(auto &chunk : chunks)
+        size += chunk->data().len;
+      headers += format("Content-Length: %s\r\n", size);
+    } else {
+      headers += "Transfer-Encoding: chunked\r\n";
+    }
+    if(!keepAlive)
+      headers += "Connection: close\r\n";
+    headers += "\r\n";
+
+    if(!sendAll(fd, headers))
+      return false;
+
+    if(headOnly)
+      return keepAlive;
+
+    if(complete) {
+      for(auto &chunk : chunks) {
+        auto const data = chunk->data();
+        if(!sendAll(fd, data.ptr, data.len))
+          return false;
+      }
+      return keepAlive;
+    }
+
+    // still being written: forward the chunks as they arrive
+    size_t sent = 0;
+    for(;;) {
+      {
+        unique_lock<mutex> lock(m_mutex);
+        m_changed.wait(
+              lock, [&]() { return m_stop || entry->removed || entry->complete || entry->chunks.size() > sent; });
+        if(m_stop || entry->removed)
+          return false;
+        chunks.assign(entry->chunks.begin() + sent, entry->chunks.end());
+        complete = entry->complete;
+      }
+
+      for(auto &chunk : chunks)
+        if(!sendChunk(fd, chunk->data()))
+          return false;
+      sent += chunks.size();
+
+      if(complete)
+        return sendAll(fd, "0\r\n\r\n") && keepAlive;
+    }
+  }
+
+  bool sendStatus(int fd, const char *status, bool keepAlive) {
+    auto const headers = format("HTTP/1.1 %s\r\nContent-Length: 0\r\n%s\r\n", status,
+          keepAlive ? "" : "Connection: close\r\n");
+    return sendAll(fd, headers) && keepAlive;
+  }
+
+  KHost *const m_host;
+  int64_t const m_timeShiftBufferDepthInMs;
+  int const m_maxConnections;
+  int const m_idleTimeoutInMs;
+  IUtcClock *const m_utcClock;
+
+  mutex m_mutex;
+  condition_variable m_changed; // an entry got new data, or was completed or removed
+  map<string, shared_ptr<Entry>> m_entries;
+  int64_t m_storedBytes = 0;
+  struct Completed {
+    int64_t timeInMs;
+    string path;
+    weak_ptr<Entry> entry;
+  };
+  deque<Completed> m_evictionQueue;
+  bool m_stop = false;
+
+  unique_ptr<IReactor> const m_reactor;
+  int m_socket;
+  thread m_acceptThread;
+  list<Connection> m_connections; // only accessed from the accept thread, and after it's joined
+
+  HostCounter m_storedFiles;
+  HostCounter m_storedMB;
+};
+
+IModule *createObject(KHost *host, void *va) {
+  auto config = (HttpOriginConfig *)va;
+  enforce(host, "HttpOrigin: host can't be NULL");
+  enforce(config, "HttpOrigin: config can't be NULL");
+  return createModule<HttpOrigin>(host, *config).release();
+}
+
+auto const registered = Factory::registerModule("HttpOrigin", &createObject);
+
+}
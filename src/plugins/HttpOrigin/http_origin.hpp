@@ -0,0 +1,30 @@
+#pragma once
+
+#include "lib_utils/time.hpp" // IUtcClock
+
+#include <cstdint>
+#include <string>
+
+// Keeps the segments and manifests received on its input in memory,
+// and serves them over HTTP/1.1 (GET and HEAD, keep-alive).
+// Segments still being written are served with chunked transfer encoding,
+// their content is sent as it arrives.
+// LL-HLS blocking playlist reloads ("_HLS_msn" and "_HLS_part" query parameters) are held
+// until the playlist lists the requested segment or part.
+// Each connection is served by its own thread: see 'maxConnections' and 'idleTimeoutInMs'.
+struct HttpOriginConfig {
+  std::string address = "0.0.0.0";
+  int port = 8080;
+
+  // media segments are evicted this long after they are complete. 0: keep everything.
+  // Initialization segments (zero duration) and manifests are never evicted.
+  int64_t timeShiftBufferDepthInMs = 0;
+
+  // beyond this, new connections get a "503 Service Unavailable" response and are closed
+  int maxConnections = 256;
+
+  // connections not sending a complete request, or not reading the response, for this long are closed
+  int idleTimeoutInMs = 30000;
+
+  IUtcClock *utcClock = g_UtcClock;
+};
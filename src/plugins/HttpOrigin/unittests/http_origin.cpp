@@ -0,0 +1,338 @@
+#include "../http_origin.hpp"
+
+#include "lib_media/common/metadata_file.hpp"
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "tests/tests.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib> // strtol
+#include <cstring> // memcpy
+#include <thread> // this_thread::sleep_for
+
+using namespace Modules;
+
+namespace {
+
+auto const PORT = 47931;
+
+// Blocking HTTP/1.1 client, on a single connection
+struct Client {
+  Client() {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(PORT);
+    ASSERT(connect(fd, (sockaddr *)&addr, sizeof addr) == 0);
+
+    timeval timeout{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  }
+
+  ~Client() { close(fd); }
+
+  void request(std::string method, std::string path) {
+    auto const req = method + " " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQUALS((int)req.size(), (int)send(fd, req.data(), req.size(), 0));
+  }
+
+  // returns the status line and the headers
+  std::string readHeaders() { return readUntil("\r\n\r\n"); }
+
+  // returns an empty string for the last chunk
+  std::string readChunk() {
+    auto const size = (size_t)strtol(readUntil("\r\n").c_str(), nullptr, 16);
+    auto const chunk = read(size + 2);
+    ASSERT_EQUALS("\r\n", chunk.substr(size));
+    return chunk.substr(0, size);
+  }
+
+  std::string get(std::string path) {
+    request("GET", path);
+    auto const headers = readHeaders();
+    auto const pos = headers.find("Content-Length: ");
+    if(pos == std::string::npos)
+      return headers;
+    return headers + read(atoi(headers.c_str() + pos + 16));
+  }
+
+  std::string readUntil(std::string const &pattern) {
+    while(received.find(pattern) == std::string::npos)
+      receive();
+    auto const end = received.find(pattern) + pattern.size();
+    auto const r = received.substr(0, end);
+    received.erase(0, end);
+    return r;
+  }
+
+  std::string read(size_t size) {
+    while(received.size() < size)
+      receive();
+    auto const r = received.substr(0, size);
+    received.erase(0, size);
+    return r;
+  }
+
+  void receive() {
+    char buf[4096];
+    auto const n = recv(fd, buf, sizeof buf, 0);
+    ASSERT(n > 0);
+    received.append(buf, n);
+  }
+
+  int fd;
+  std::string received;
+};
+
+struct ManualClock : IUtcClock {
+  Fraction getTime() override { return Fraction(timeInMs, 1000); }
+  int64_t timeInMs = 0;
+};
+
+void push(IModule *origin, std::string filename, std::string contents, int64_t durationInMs, bool EOS,
+      StreamType type = SEGMENT) {
+  auto data = std::make_shared<DataRaw>(contents.size());
+  if(!contents.empty())
+    memcpy(data->buffer->data().ptr, contents.data(), contents.size());
+  auto meta = std::make_shared<MetadataFile>(type);
+  meta->filename = filename;
+  meta->mimeType = "video/mp4";
+  meta->durationIn180k = timescaleToClock(durationInMs, 1000);
+  meta->filesize = contents.size();
+  meta->EOS = EOS;
+  data->setMetadata(meta);
+  origin->getInput(0)->push(data);
+}
+
+void deleteFile(IModule *origin, std::string filename) {
+  auto data = std::make_shared<DataRaw>(0);
+  auto meta = std::make_shared<MetadataFile>(SEGMENT);
+  meta->filename = filename;
+  meta->filesize = INT64_MAX;
+  data->setMetadata(meta);
+  origin->getInput(0)->push(data);
+}
+
+HttpOriginConfig loopback() {
+  HttpOriginConfig cfg;
+  cfg.address = "127.0.0.1";
+  cfg.port = PORT;
+  return cfg;
+}
+
+}
+
+unittest("HttpOrigin: files served from memory, on a persistent connection") {
+  auto cfg = loopback();
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  push(origin.get(), "dash/live.mpd", "<MPD/>", 0, true, PLAYLIST);
+  push(origin.get(), "dash/v-init.mp4", "init", 0, true);
+  push(origin.get(), "dash/v-0.m4s", "moof", 2000, false);
+  push(origin.get(), "dash/v-0.m4s", "mdat", 0, true);
+
+  Client client;
+  ASSERT_EQUALS("HTTP/1.1 200 OK\r\n"
+                "Content-Type: application/dash+xml\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Content-Length: 6\r\n"
+                "\r\n"
+                "<MPD/>",
+        client.get("/dash/live.mpd"));
+  ASSERT_EQUALS("HTTP/1.1 200 OK\r\n"
+                "Content-Type: video/mp4\r\n"
+                "Content-Length: 8\r\n"
+                "\r\n"
+                "moofmdat",
+        client.get("/dash/v-0.m4s?param=1"));
+  ASSERT_EQUALS("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", client.get("/dash/v-1.m4s"));
+
+  // manifests are replaced, segments deleted
+  push(origin.get(), "dash/live.mpd", "<MPD></MPD>", 0, true, PLAYLIST);
+  deleteFile(origin.get(), "dash/v-0.m4s");
+  ASSERT(client.get("/dash/live.mpd").find("\r\n\r\n<MPD></MPD>") != std::string::npos);
+  ASSERT_EQUALS("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", client.get("/dash/v-0.m4s"));
+
+  client.request("HEAD", "/dash/v-init.mp4");
+  ASSERT_EQUALS("HTTP/1.1 200 OK\r\nContent-Type: video/mp4\r\nContent-Length: 4\r\n\r\n", client.readHeaders());
+  ASSERT_EQUALS("HTTP/1.1 200 OK\r\nContent-Type: video/mp4\r\nContent-Length: 4\r\n\r\ninit",
+        client.get("/dash/v-init.mp4"));
+}
+
+unittest("HttpOrigin: segment being written, chunked response") {
+  auto cfg = loopback();
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  push(origin.get(), "v-0.m4s", "styp+moof+mdat", 500, false);
+
+  Client client;
+  client.request("GET", "/v-0.m4s");
+  ASSERT_EQUALS("HTTP/1.1 200 OK\r\nContent-Type: video/mp4\r\nTransfer-Encoding: chunked\r\n\r\n",
+        client.readHeaders());
+  ASSERT_EQUALS("styp+moof+mdat", client.readChunk());
+
+  push(origin.get(), "v-0.m4s", "moof+mdat", 500, false);
+  ASSERT_EQUALS("moof+mdat", client.readChunk());
+
+  push(origin.get(), "v-0.m4s", "", 0, true);
+  ASSERT_EQUALS("", client.readChunk());
+
+  // the connection is still usable, the segment is now complete
+  ASSERT(client.get("/v-0.m4s").find("Content-Length: 23\r\n\r\nstyp+moof+mdatmoof+mdat") != std::string::npos);
+}
+
+unittest("HttpOrigin: timeshift eviction") {
+  ManualClock clock;
+  auto cfg = loopback();
+  cfg.timeShiftBufferDepthInMs = 4000;
+  cfg.utcClock = &clock;
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  push(origin.get(), "v-init.mp4", "init", 0, true);
+  for(int i = 0; i < 5; ++i) {
+    clock.timeInMs = (i + 1) * 2000;
+    push(origin.get(), "v-" + std::to_string(i) + ".m4s", "segment", 2000, true);
+  }
+
+  Client client;
+  auto isAvailable = [&](std::string path) { return client.get(path).compare(0, 15, "HTTP/1.1 200 OK") == 0; };
+  ASSERT(isAvailable("/v-init.mp4"));
+  ASSERT(!isAvailable("/v-0.m4s"));
+  ASSERT(!isAvailable("/v-1.m4s"));
+  ASSERT(isAvailable("/v-2.m4s"));
+  ASSERT(isAvailable("/v-4.m4s"));
+}
+
+unittest("HttpOrigin: files written to disk are not served") {
+  auto cfg = loopback();
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  auto data = std::make_shared<DataRaw>(0);
+  auto meta = std::make_shared<MetadataFile>(SEGMENT);
+  meta->filename = "v-0.m4s";
+  meta->filesize = 1000;
+  data->setMetadata(meta);
+  origin->getInput(0)->push(data);
+
+  Client client;
+  ASSERT_EQUALS("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", client.get("/v-0.m4s"));
+}
+
+unittest("HttpOrigin: LL-HLS blocking playlist reload") {
+  auto cfg = loopback();
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  auto playlist = [](int parts, bool ended) {
+    std::string r = "#EXTM3U\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:5\n"
+                    "#EXT-X-PART:DURATION=0.5,URI=\"v-5.m4s\",BYTERANGE=\"1000@0\"\n"
+                    "#EXTINF:2\nv-5.m4s\n";
+    for(int i = 0; i < parts; ++i)
+      r += "#EXT-X-PART:DURATION=0.5,URI=\"v-6.m4s\",BYTERANGE=\"1000@" + std::to_string(i * 1000) + "\"\n";
+    return r + (ended ? "#EXT-X-ENDLIST\n" : "");
+  };
+  Client client;
+  auto isServed = [&](std::string path, std::string contents) {
+    auto const response = client.get(path);
+    return response.compare(0, 15, "HTTP/1.1 200 OK") == 0 &&
+           response.substr(response.find("\r\n\r\n") + 4) == contents;
+  };
+
+  // the first version, still being received, has no target duration yet: the response waits for it
+  auto const first = playlist(1, false);
+  push(origin.get(), "v.m3u8", first.substr(0, 10), 0, false, PLAYLIST);
+  client.request("GET", "/v.m3u8?_HLS_msn=5");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  push(origin.get(), "v.m3u8", first.substr(10), 0, true, PLAYLIST);
+  {
+    auto const headers = client.readHeaders();
+    ASSERT_EQUALS(0, (int)headers.find("HTTP/1.1 200 OK\r\n"));
+    ASSERT_EQUALS(first, client.read(atoi(headers.c_str() + headers.find("Content-Length: ") + 16)));
+  }
+
+  // already listed
+  ASSERT(isServed("/v.m3u8?_HLS_msn=5", playlist(1, false)));
+  ASSERT(isServed("/v.m3u8?_HLS_msn=6&_HLS_part=0", playlist(1, false)));
+
+  // the response waits for the next part
+  client.request("GET", "/v.m3u8?_HLS_msn=6&_HLS_part=1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  push(origin.get(), "v.m3u8", playlist(2, false), 0, true, PLAYLIST);
+  auto const headers = client.readHeaders();
+  ASSERT_EQUALS(playlist(2, false), client.read(atoi(headers.c_str() + headers.find("Content-Length: ") + 16)));
+
+  // too far in the future, and malformed
+  ASSERT_EQUALS("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n", client.get("/v.m3u8?_HLS_msn=9"));
+  ASSERT_EQUALS("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n", client.get("/v.m3u8?_HLS_part=1"));
+
+  // the end of the stream releases all the requests
+  client.request("GET", "/v.m3u8?_HLS_msn=7");
+  push(origin.get(), "v.m3u8", playlist(2, true), 0, true, PLAYLIST);
+  ASSERT(client.readHeaders().compare(0, 15, "HTTP/1.1 200 OK") == 0);
+}
+
+unittest("HttpOrigin: idle connections are closed") {
+  auto cfg = loopback();
+  cfg.maxConnections = 1;
+  cfg.idleTimeoutInMs = 100;
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+  push(origin.get(), "v-init.mp4", "init", 0, true);
+
+  {
+    Client idle;
+    auto const partialRequest = std::string("GET /v-init.mp4 HTTP/1.1\r\n");
+    send(idle.fd, partialRequest.data(), partialRequest.size(), 0);
+    char buf[16];
+    ASSERT_EQUALS(0, (int)recv(idle.fd, buf, sizeof buf, 0)); // closed by the origin, before our own timeout
+  }
+
+  // the connection slot was released
+  for(int i = 0;; ++i) {
+    Client client;
+    client.request("GET", "/v-init.mp4");
+    if(client.readHeaders().compare(0, 15, "HTTP/1.1 200 OK") == 0)
+      break;
+    ASSERT(i < 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+unittest("HttpOrigin: connection limit") {
+  auto cfg = loopback();
+  cfg.maxConnections = 2;
+  auto origin = loadModule("HttpOrigin", &NullHost, &cfg);
+
+  push(origin.get(), "v-init.mp4", "init", 0, true);
+  auto isAvailable = [&](Client &client) {
+    return client.get("/v-init.mp4").compare(0, 15, "HTTP/1.1 200 OK") == 0;
+  };
+
+  auto first = std::make_unique<Client>();
+  Client second;
+  ASSERT(isAvailable(*first));
+  ASSERT(isAvailable(second));
+
+  {
+    Client third;
+    ASSERT_EQUALS("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+          third.readHeaders());
+  }
+
+  // a closed connection makes room for a new one
+  first.reset();
+  for(int i = 0;; ++i) {
+    Client client;
+    client.request("GET", "/v-init.mp4");
+    if(client.readHeaders().compare(0, 15, "HTTP/1.1 200 OK") == 0)
+      break;
+    ASSERT(i < 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+#endif
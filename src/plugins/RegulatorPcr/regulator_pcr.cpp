@@ -0,0 +1,261 @@
+// PCR-driven regulation of an MPEG-TS stream.
+//
+// The departure time of each TS packet is interpolated between two
+// consecutive PCRs (ISO/IEC 13818-1 2.4.2.2), which makes the output rate
+// follow the actual multiplex rate, including VBR streams.
+// Packets are released in bursts of at most 'maxBurstPackets' packets, at
+// the departure time of the first packet of the burst: the thread sleeps
+// until shortly before the deadline, then spins until it is reached.
+//
+#include "regulator_pcr.hpp"
+
+#include "lib_media/common/attributes.hpp" // DecodingTime, PresentationTime
+#include "lib_modules/utils/factory.hpp" // registerModule
+#include "lib_modules/utils/helper.hpp"
+#include "lib_utils/clock.hpp" // IClock::Rate
+#include "lib_utils/format.hpp"
+#include "lib_utils/log_sink.hpp" // Warning, Debug
+#include "lib_utils/tools.hpp" // enforce
+
+#include <algorithm> // find
+#include <chrono>
+#include <cstring> // memcpy
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Modules;
+
+namespace {
+
+auto const TS_PACKET_LEN = 188;
+auto const SYNC_BYTE = 0x47;
+
+auto const PCR_FREQ = 27000000LL;
+auto const PCR_WRAP = (1LL << 33) * 300;
+
+// ISO/IEC 13818-1 requires a PCR at least every 100ms: be more tolerant
+// before considering the time base is discontinuous.
+auto const MAX_PCR_GAP = PCR_FREQ;
+
+// above this size, pending packets are released with an extrapolated rate
+auto const MAX_PENDING_BYTES = 16 * 1024 * 1024;
+
+// sleeping is only accurate to a few hundred microseconds: spin for the rest
+auto const SPIN_DURATION = chrono::microseconds(500);
+
+// being late by more than this means we can't keep up (or we were paused): resync
+auto const MAX_LATENESS = chrono::milliseconds(500);
+
+int getPid(const uint8_t *pkt) { return ((pkt[1] & 0x1f) << 8) | pkt[2]; }
+
+bool getPcr(const uint8_t *pkt, int64_t &pcr, bool &discontinuity) {
+  auto const hasAdaptationField = pkt[3] & 0x20;
+  if(!hasAdaptationField)
+    return false;
+
+  auto const adaptationFieldLength = pkt[4];
+  if(adaptationFieldLength < 7)
+    return false;
+
+  auto const flags = pkt[5];
+  auto const pcrFlag = flags & 0x10;
+  if(!pcrFlag)
+    return false;
+
+  int64_t const base = ((int64_t)pkt[6] << 25) | (pkt[7] << 17) | (pkt[8] << 9) | (pkt[9] << 1) | (pkt[10] >> 7);
+  int64_t const ext = ((pkt[10] & 1) << 8) | pkt[11];
+  pcr = base * 300 + ext;
+  discontinuity = flags & 0x80;
+  return true;
+}
+
+class RegulatorPcr : public ModuleS {
+  public:
+  RegulatorPcr(KHost *host, RegulatorPcrConfig &cfg)
+      : m_host(host)
+      , m_maxBurstPackets(cfg.maxBurstPackets)
+      , m_pcrPid(cfg.pcrPid)
+      , m_realTime(cfg.realTime) {
+    enforce(m_maxBurstPackets > 0, "RegulatorPcr: maxBurstPackets must be positive");
+    m_output = addOutput();
+
+    if(cfg.fallbackBitrate > 0) {
+      m_rateTicks = TS_PACKET_LEN * 8 * PCR_FREQ;
+      m_ratePackets = cfg.fallbackBitrate;
+    }
+  }
+
+  void processOne(Data data) override {
+    auto buf = data->data();
+    m_pending.insert(m_pending.end(), buf.ptr, buf.ptr + buf.len);
+
+    while(m_scanPos + TS_PACKET_LEN <= m_pending.size()) {
+      auto pkt = m_pending.data() + m_scanPos;
+
+      if(pkt[0] != SYNC_BYTE) {
+        resync();
+        continue;
+      }
+
+      int64_t pcr;
+      bool discontinuity;
+      if(getPcr(pkt, pcr, discontinuity)) {
+        if(m_pcrPid < 0) {
+          m_pcrPid = getPid(pkt);
+          m_host->log(Debug, format("Using PCRs from PID %s", m_pcrPid).c_str());
+        }
+
+        if(getPid(pkt) == m_pcrPid)
+          onPcr(m_scanPos / TS_PACKET_LEN, pcr, discontinuity);
+      }
+
+      m_scanPos += TS_PACKET_LEN;
+    }
+
+    if(m_pending.size() > MAX_PENDING_BYTES) {
+      m_host->log(Warning, "No PCR found in a long time: extrapolating the rate");
+      release(m_scanPos / TS_PACKET_LEN);
+      m_hasPcr = false;
+    }
+  }
+
+  void flush() override {
+    release(m_scanPos / TS_PACKET_LEN);
+    m_pending.clear();
+    m_scanPos = 0;
+    sendBurst();
+  }
+
+  private:
+  // drop bytes until the next sync byte
+  void resync() {
+    auto const begin = m_pending.begin() + m_scanPos;
+    auto const next = find(begin + 1, m_pending.end(), SYNC_BYTE);
+    m_host->log(Warning, format("Lost TS sync: skipping %s bytes", next - begin).c_str());
+    m_pending.erase(begin, next);
+  }
+
+  // 'packetIndex' is the position of the PCR packet in 'm_pending'
+  void onPcr(size_t packetIndex, int64_t pcr, bool discontinuity) {
+    if(m_hasPcr && !discontinuity) {
+      auto const delta = (pcr - m_anchorPcr + PCR_WRAP) % PCR_WRAP;
+      if(delta == 0 || delta > MAX_PCR_GAP) {
+        m_host->log(Warning, format("PCR discontinuity (%s ms)", (pcr - m_anchorPcr) * 1000 / PCR_FREQ).c_str());
+      } else {
+        m_rateTicks = delta;
+        m_ratePackets = packetIndex;
+      }
+    }
+
+    release(packetIndex);
+
+    m_anchorPcr = pcr;
+    m_hasPcr = true;
+  }
+
+  // time-stamps and sends the first 'packetCount' pending packets, at the current rate
+  void release(size_t packetCount) {
+    for(size_t i = 0; i < packetCount; ++i) {
+      auto const time = m_anchorTime + packetTime(i);
+      if(m_burst.empty())
+        m_burstTime = time;
+
+      auto const pkt = m_pending.data() + i * TS_PACKET_LEN;
+      m_burst.insert(m_burst.end(), pkt, pkt + TS_PACKET_LEN);
+
+      if((int)(m_burst.size() / TS_PACKET_LEN) >= m_maxBurstPackets)
+        sendBurst();
+    }
+
+    m_anchorTime += packetTime(packetCount);
+
+    auto const releasedBytes = packetCount * TS_PACKET_LEN;
+    m_pending.erase(m_pending.begin(), m_pending.begin() + releasedBytes);
+    m_scanPos -= releasedBytes;
+  }
+
+  int64_t packetTime(size_t packetIndex) const {
+    if(m_ratePackets == 0)
+      return 0; // unknown rate: as fast as possible
+    return (int64_t)packetIndex * m_rateTicks / m_ratePackets;
+  }
+
+  void sendBurst() {
+    if(m_burst.empty())
+      return;
+
+    if(m_realTime)
+      waitUntil(m_burstTime);
+
+    auto out = m_output->allocData<DataRaw>(m_burst.size());
+    memcpy(out->buffer->data().ptr, m_burst.data(), m_burst.size());
+    auto const time = m_burstTime / (PCR_FREQ / IClock::Rate);
+    out->set(DecodingTime{time});
+    out->set(PresentationTime{time});
+    m_output->post(out);
+
+    m_burst.clear();
+  }
+
+  void waitUntil(int64_t pcrTime) {
+    using namespace chrono;
+
+    auto const now = steady_clock::now();
+    if(!m_started) {
+      m_startTime = now - nanoseconds(pcrTime * 1000 / 27);
+      m_started = true;
+    }
+
+    auto const deadline = m_startTime + nanoseconds(pcrTime * 1000 / 27);
+
+    if(now > deadline + MAX_LATENESS) {
+      auto const latenessInMs = duration_cast<milliseconds>(now - deadline).count();
+      m_host->log(Warning, format("Late by %s ms: resyncing", latenessInMs).c_str());
+      m_startTime += now - deadline;
+      return;
+    }
+
+    if(deadline - now > SPIN_DURATION)
+      this_thread::sleep_for(deadline - now - SPIN_DURATION);
+
+    while(steady_clock::now() < deadline) {
+      // spin
+    }
+  }
+
+  KHost *const m_host;
+  OutputDefault *m_output;
+  int const m_maxBurstPackets;
+  int m_pcrPid;
+  bool const m_realTime;
+
+  // packets received but not released yet. Starts with the last PCR packet, if any.
+  vector<uint8_t> m_pending;
+  size_t m_scanPos = 0;
+
+  // current packet rate: 'm_ratePackets' packets every 'm_rateTicks' (27MHz)
+  int64_t m_rateTicks = 0;
+  int64_t m_ratePackets = 0;
+
+  // output time (27MHz, starts at zero) of the first pending packet, and its PCR value
+  int64_t m_anchorTime = 0;
+  int64_t m_anchorPcr = 0;
+  bool m_hasPcr = false;
+
+  vector<uint8_t> m_burst;
+  int64_t m_burstTime = 0;
+
+  bool m_started = false;
+  chrono::steady_clock::time_point m_startTime;
+};
+
+IModule *createObject(KHost *host, void *va) {
+  auto config = (RegulatorPcrConfig *)va;
+  enforce(host, "RegulatorPcr: host can't be NULL");
+  enforce(config, "RegulatorPcr: config can't be NULL");
+  return createModuleWithSize<RegulatorPcr>(256, host, *config).release();
+}
+
+auto const registered = Factory::registerModule("RegulatorPcr", &createObject);
+}
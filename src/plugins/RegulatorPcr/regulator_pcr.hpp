@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+struct RegulatorPcrConfig {
+  // max number of TS packets released at once (7 packets fit in one UDP datagram)
+  int maxBurstPackets = 7;
+
+  // PID carrying the PCRs. -1 means the first PID seen with a PCR.
+  int pcrPid = -1;
+
+  // bitrate assumed until the first two PCRs are seen, or when the PCRs are
+  // missing. 0 means as fast as possible.
+  int64_t fallbackBitrate = 0;
+
+  // when false, bursts are only timestamped (DecodingTime), not delayed
+  bool realTime = true;
+};
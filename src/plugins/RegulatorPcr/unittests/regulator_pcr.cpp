@@ -0,0 +1,164 @@
+#include "../regulator_pcr.hpp"
+
+#include "lib_media/common/attributes.hpp"
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "tests/tests.hpp"
+
+#include <chrono>
+#include <cstring> // memcpy
+
+using namespace Tests;
+using namespace Modules;
+
+namespace {
+
+auto const PCR_PID = 0x100;
+
+// a TS packet, with a PCR when 'pcr' is positive
+std::vector<uint8_t> makePacket(int pid, int64_t pcr = -1, bool discontinuity = false) {
+  std::vector<uint8_t> pkt(188, 0xff);
+  pkt[0] = 0x47;
+  pkt[1] = pid >> 8;
+  pkt[2] = pid & 0xff;
+  pkt[3] = 0x10;
+  if(pcr >= 0) {
+    auto const base = pcr / 300;
+    auto const ext = pcr % 300;
+    pkt[3] = 0x30;
+    pkt[4] = 7;
+    pkt[5] = 0x10 | (discontinuity ? 0x80 : 0);
+    pkt[6] = base >> 25;
+    pkt[7] = base >> 17;
+    pkt[8] = base >> 9;
+    pkt[9] = base >> 1;
+    pkt[10] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+    pkt[11] = ext & 0xff;
+  }
+  return pkt;
+}
+
+// 'packetCount' packets, the first one carrying 'pcr'
+std::vector<uint8_t> makeSegment(int64_t pcr, int packetCount, bool discontinuity = false) {
+  auto r = makePacket(PCR_PID, pcr, discontinuity);
+  for(int i = 1; i < packetCount; ++i) {
+    auto pkt = makePacket(0x101);
+    r.insert(r.end(), pkt.begin(), pkt.end());
+  }
+  return r;
+}
+
+std::shared_ptr<DataBase> createData(std::vector<uint8_t> const &bytes) {
+  auto data = make_shared<DataRaw>(bytes.size());
+  memcpy(data->buffer->data().ptr, bytes.data(), bytes.size());
+  return data;
+}
+
+struct Recorder : ModuleS {
+  void processOne(Data data) override {
+    sizes.push_back((int)data->data().len / 188);
+    times.push_back(data->get<DecodingTime>().time);
+  }
+  std::vector<int> sizes;
+  std::vector<int64_t> times;
+};
+
+struct Fixture {
+  Fixture(RegulatorPcrConfig cfg) {
+    regulator = loadModule("RegulatorPcr", &NullHost, &cfg);
+    rec = createModule<Recorder>();
+    ConnectOutputToInput(regulator->getOutput(0), rec->getInput(0));
+  }
+
+  void push(std::vector<uint8_t> const &bytes) { regulator->getInput(0)->push(createData(bytes)); }
+
+  std::shared_ptr<IModule> regulator;
+  std::shared_ptr<Recorder> rec;
+};
+
+RegulatorPcrConfig nonRealTime(int maxBurstPackets) {
+  RegulatorPcrConfig cfg;
+  cfg.maxBurstPackets = maxBurstPackets;
+  cfg.realTime = false;
+  return cfg;
+}
+
+}
+
+unittest("RegulatorPcr: packet times are interpolated between PCRs") {
+  Fixture f(nonRealTime(2));
+
+  // 4 packets in 1ms, then 4 packets in 2ms (VBR)
+  f.push(makeSegment(1000000, 4));
+  f.push(makeSegment(1000000 + 27000, 4));
+  f.push(makeSegment(1000000 + 27000 + 54000, 1));
+  f.regulator->flush();
+
+  // time of the first packet of each burst, in 180kHz
+  ASSERT_EQUALS(std::vector<int>({2, 2, 2, 2, 1}), f.rec->sizes);
+  ASSERT_EQUALS(std::vector<int64_t>({0, 90, 180, 360, 540}), f.rec->times);
+}
+
+unittest("RegulatorPcr: bursts span input buffers and PCR intervals") {
+  Fixture f(nonRealTime(7));
+
+  auto ts = makeSegment(0, 5);
+  auto seg2 = makeSegment(5 * 2700, 5);
+  ts.insert(ts.end(), seg2.begin(), seg2.end());
+  auto seg3 = makeSegment(10 * 2700, 5);
+  ts.insert(ts.end(), seg3.begin(), seg3.end());
+
+  // feed misaligned input buffers
+  for(size_t i = 0; i < ts.size(); i += 1000)
+    f.push({ts.begin() + i, ts.begin() + std::min(i + 1000, ts.size())});
+  f.regulator->flush();
+
+  ASSERT_EQUALS(std::vector<int>({7, 7, 1}), f.rec->sizes);
+  ASSERT_EQUALS(std::vector<int64_t>({0, 7 * 18, 14 * 18}), f.rec->times);
+}
+
+unittest("RegulatorPcr: PCR wrap-around and discontinuities") {
+  Fixture f(nonRealTime(1));
+
+  auto const PCR_WRAP = (1LL << 33) * 300;
+  f.push(makeSegment(PCR_WRAP - 2700, 2));
+  f.push(makeSegment(2700, 2)); // wraps: 2 packets in 200us
+  f.push(makeSegment(123456789, 2, true)); // explicit discontinuity
+  f.push(makeSegment(9, 2)); // backward jump
+  f.push(makeSegment(9 + 5400, 1));
+  f.regulator->flush();
+
+  // across discontinuities, the last known rate is used
+  ASSERT_EQUALS(std::vector<int64_t>({0, 18, 36, 54, 72, 90, 108, 126, 144}), f.rec->times);
+}
+
+unittest("RegulatorPcr: lost sync and fallback bitrate") {
+  auto cfg = nonRealTime(1);
+  cfg.fallbackBitrate = 188 * 8 * 1000; // 1000 packets per second
+  Fixture f(cfg);
+
+  auto ts = makePacket(0x101);
+  ts.insert(ts.end(), {0x00, 0x01, 0x02}); // garbage
+  auto seg = makeSegment(27000000, 2);
+  ts.insert(ts.end(), seg.begin(), seg.end());
+  f.push(ts);
+  f.regulator->flush();
+
+  ASSERT_EQUALS(std::vector<int64_t>({0, 180, 360}), f.rec->times);
+}
+
+unittest("RegulatorPcr: real-time pacing") {
+  RegulatorPcrConfig cfg;
+  cfg.maxBurstPackets = 7;
+  Fixture f(cfg);
+
+  // 20ms of stream
+  auto const start = std::chrono::steady_clock::now();
+  for(int i = 0; i <= 20; ++i)
+    f.push(makeSegment(i * 27000, 14));
+  f.regulator->flush();
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT(elapsed >= std::chrono::milliseconds(20));
+  ASSERT_EQUALS(42, (int)f.rec->sizes.size());
+}
@@ -1,34 +1,58 @@
 #include "socket_input.hpp"
 
+#include "lib_media/common/attributes.hpp" // ReceptionTime
 #include "lib_modules/utils/factory.hpp" // registerModule
 #include "lib_modules/utils/helper.hpp"
+#include "lib_utils/format.hpp"
 #include "lib_utils/log_sink.hpp"
 #include "lib_utils/os.hpp" // setHighThreadPriority
+#include "lib_utils/reactor.hpp"
+#include "lib_utils/rtp.hpp"
 #include "lib_utils/socket.hpp"
 #include "lib_utils/tools.hpp" // enforce
 
-#include <thread>
+#include <algorithm> // min, max
+#include <chrono>
+#include <cstring> // memcpy, memmove
 
 using namespace Modules;
 using namespace std;
 
 namespace {
 
+// max RTP datagrams per receiveMany() call
+auto const MAX_RTP_DATAGRAMS = 64;
+
 struct SocketInput : Module {
   SocketInput(KHost *host, SocketInputConfig const &config)
-      : m_host(host) {
+      : m_host(host)
+      , m_bufferSize(config.bufferSize)
+      , m_maxLatency(chrono::milliseconds(config.maxLatencyInMs))
+      , m_maxDatagramSize(config.maxDatagramSize)
+      , m_kernelDrops(host, "kernel_drops")
+      , m_truncatedDatagrams(host, "truncated_datagrams")
+      , m_rtp(config.rtp)
+      , m_reorder(config.rtpReorderPackets)
+      , m_rtpLost(host, m_rtp ? "rtp_lost" : nullptr)
+      , m_rtpReordered(host, m_rtp ? "rtp_reordered" : nullptr)
+      , m_rtpDropped(host, m_rtp ? "rtp_dropped" : nullptr) {
+    enforce(m_maxDatagramSize > 0 && m_maxDatagramSize <= m_bufferSize,
+          "SocketInput: maxDatagramSize must be positive and fit in bufferSize");
+    enforce(!m_rtp || !config.isTcp, "SocketInput: RTP is only supported over UDP");
+
     char buffer[256];
     sprintf(buffer, "%d.%d.%d.%d", config.ipAddr[0], config.ipAddr[1], config.ipAddr[2], config.ipAddr[3]);
     auto type = config.isTcp ? ISocket::TCP : ISocket::UDP;
     type = config.isMulticast ? ISocket::UDP_MULTICAST : type;
     m_socket = createSocket(buffer, config.port, type);
+    m_reactor = createReactor();
 
     m_highPriority = !config.isTcp;
     m_output = addOutput();
     m_host->activate(true);
   }
 
-  // must be able to receive at least 35Mbps
+  // must be able to receive at least 100Mbps
   void process() override {
     if(m_highPriority == 1) {
       if(!setHighThreadPriority())
@@ -37,29 +61,197 @@ struct SocketInput : Module {
       m_highPriority = 2;
     }
 
-    auto const bufSize = 0x60000 / 188 * 188;
-    auto buf = m_output->allocData<DataRawResizable>(bufSize);
-    auto dst = buf->buffer->data();
+    if(!m_buf) {
+      m_buf = m_output->allocData<DataRawResizable>(m_bufferSize);
+      m_size = 0;
+    }
+
+    auto dst = m_buf->buffer->data();
+
+    ISocket::ReceiveInfo info;
+    auto size = m_rtp ? receiveRtp(dst, info)
+                      : m_socket->receiveMany(dst.ptr + m_size, dst.len - m_size, m_maxDatagramSize, info);
 
-    auto size = m_socket->receive(dst.ptr, dst.len);
     if(size > 0) {
-      buf->resize(size);
-      m_output->post(buf);
-    } else
-      std::this_thread::sleep_for(1ms);
+      if(m_size == 0) {
+        m_firstReceptionTime = chrono::steady_clock::now();
+        auto const timeInUs = info.timestampInUs >= 0 ? info.timestampInUs : getUnixTimeInUs();
+        m_buf->set(ReceptionTime{timeInUs});
+      }
+      m_size += size;
+    }
+
+    if(size > 0 || info.datagramCount > 0)
+      updateStats(info);
+
+    if(m_size > 0) {
+      auto const full = dst.len - m_size < (size_t)m_maxDatagramSize;
+      if(full || chrono::steady_clock::now() - m_firstReceptionTime >= m_maxLatency) {
+        m_buf->resize(m_size);
+        m_output->post(m_buf);
+        m_buf = nullptr;
+        return;
+      }
+    }
+
+    if(size == 0 && info.datagramCount == 0)
+      waitForData();
+  }
+
+  private:
+  // payloads stay where they were received, unless they need to be reordered.
+  // Returns the number of bytes appended to 'dst'.
+  size_t receiveRtp(Span dst, ISocket::ReceiveInfo &info) {
+    auto const begin = m_size;
+    auto size = popReordered(dst, m_size);
+
+    uint8_t headers[MAX_RTP_DATAGRAMS * Rtp::HEADER_SIZE];
+    size_t sizes[MAX_RTP_DATAGRAMS];
+    ISocket::HeaderSplit split{Rtp::HEADER_SIZE, MAX_RTP_DATAGRAMS, headers, sizes};
+    auto const payloads = dst.ptr + begin + size;
+    m_socket->receiveMany(payloads, dst.len - begin - size, m_maxDatagramSize, info, &split);
+
+    size_t readPos = 0;
+    for(int i = 0; i < info.datagramCount; ++i) {
+      auto const payloadSize = sizes[i] > Rtp::HEADER_SIZE ? sizes[i] - Rtp::HEADER_SIZE : 0;
+      SpanC data{payloads + readPos, payloadSize};
+      readPos += payloadSize;
+
+      Rtp::Header hdr;
+      SpanC payload;
+      if(sizes[i] < Rtp::HEADER_SIZE || !Rtp::parseHeader(headers + i * Rtp::HEADER_SIZE, hdr)
+            || !Rtp::getPayload(hdr, data, payload)) {
+        m_reorder.droppedCount++;
+        continue;
+      }
+
+      if(m_reorder.push(hdr.sequenceNumber, payload) == Rtp::ReorderBuffer::Accepted) {
+        memmove(dst.ptr + begin + size, payload.ptr, payload.len);
+        size += payload.len;
+      }
+    }
+
+    // don't wait for a missing packet longer than the output latency
+    auto const now = chrono::steady_clock::now();
+    if(m_reorder.hasBuffered() && !m_inGap) {
+      m_inGap = true;
+      m_gapStartTime = now;
+    } else if(m_inGap && now - m_gapStartTime >= m_maxLatency) {
+      m_reorder.skipGap();
+      m_gapStartTime = now;
+    }
+
+    size += popReordered(dst, begin + size);
+    m_inGap = m_reorder.hasBuffered();
+
+    return size;
+  }
+
+  // appends the buffered packets which are now in order, at 'pos'
+  size_t popReordered(Span dst, size_t pos) {
+    size_t size = 0;
+    SpanC payload;
+    while(m_reorder.peek(payload) && payload.len <= dst.len - pos - size) {
+      memcpy(dst.ptr + pos + size, payload.ptr, payload.len);
+      size += payload.len;
+      m_reorder.pop();
+    }
+    return size;
+  }
+
+  // block until data arrives, or the pending buffer must be sent.
+  // Also return regularly, so the pipeline can stop us.
+  void waitForData() {
+    auto const fd = m_socket->getDescriptor();
+    if(fd != m_watchedFd) {
+      if(m_watchedFd != -1)
+        m_reactor->remove(m_watchedFd);
+      m_reactor->add(fd, 0);
+      m_watchedFd = fd;
+    }
+
+    auto timeout = chrono::milliseconds(IDLE_TIMEOUT_IN_MS);
+    auto const now = chrono::steady_clock::now();
+    if(m_size > 0)
+      timeout = std::min(timeout, getRemainingTime(now - m_firstReceptionTime));
+    if(m_inGap)
+      timeout = std::min(timeout, getRemainingTime(now - m_gapStartTime));
+
+    m_reactor->wait((int)timeout.count());
+  }
+
+  chrono::milliseconds getRemainingTime(chrono::steady_clock::duration elapsed) const {
+    auto const remaining = chrono::duration_cast<chrono::milliseconds>(m_maxLatency - elapsed);
+    return std::max(chrono::milliseconds(0), remaining + chrono::milliseconds(1));
+  }
+
+  void updateStats(ISocket::ReceiveInfo const &info) {
+    if(info.truncatedCount) {
+      m_host->log(Warning, format("%s datagram(s) bigger than %s bytes were truncated", info.truncatedCount,
+                                 m_maxDatagramSize)
+                                 .c_str());
+      *m_truncatedDatagrams += info.truncatedCount;
+    }
+
+    // the counters may be shared with other modules (e.g the NullHost ones): they're never read back
+    if(info.dropCount >= 0 && info.dropCount != m_lastDropCount) {
+      m_host->log(Warning, format("%s datagram(s) dropped by the kernel", info.dropCount - m_lastDropCount).c_str());
+      m_lastDropCount = info.dropCount;
+      *m_kernelDrops = (int32_t)info.dropCount;
+    }
+
+    if(m_rtp) {
+      if(m_reorder.lostCount != m_lastLostCount)
+        m_host->log(Warning, format("%s RTP packet(s) lost", m_reorder.lostCount - m_lastLostCount).c_str());
+
+      m_lastLostCount = m_reorder.lostCount;
+      *m_rtpLost = (int32_t)m_reorder.lostCount;
+      *m_rtpReordered = (int32_t)m_reorder.reorderedCount;
+      *m_rtpDropped = (int32_t)m_reorder.droppedCount;
+    }
+  }
+
+  static int64_t getUnixTimeInUs() {
+    auto const now = chrono::system_clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::microseconds>(now).count();
   }
 
   KHost *const m_host;
+  int const m_bufferSize;
+  chrono::milliseconds const m_maxLatency;
+  int const m_maxDatagramSize;
+  HostCounter m_kernelDrops;
+  HostCounter m_truncatedDatagrams;
+  int64_t m_lastDropCount = 0;
+
+  bool const m_rtp;
+  Rtp::ReorderBuffer m_reorder;
+  HostCounter m_rtpLost;
+  HostCounter m_rtpReordered;
+  HostCounter m_rtpDropped;
+  int64_t m_lastLostCount = 0;
+  bool m_inGap = false; // waiting for a missing RTP packet
+  chrono::steady_clock::time_point m_gapStartTime;
+
+  static auto const IDLE_TIMEOUT_IN_MS = 100;
+
   std::unique_ptr<ISocket> m_socket;
+  std::unique_ptr<IReactor> m_reactor;
+  int m_watchedFd = -1;
   OutputDefault *m_output;
   int m_highPriority = 0;
+
+  // output buffer being filled
+  std::shared_ptr<DataRawResizable> m_buf;
+  size_t m_size = 0;
+  chrono::steady_clock::time_point m_firstReceptionTime;
 };
 
 IModule *createObject(KHost *host, void *va) {
   auto config = (SocketInputConfig *)va;
   enforce(host, "SocketInput: host can't be NULL");
   enforce(config, "SocketInput: config can't be NULL");
-  return createModuleWithSize<SocketInput>(10000, host, *config).release();
+  return createModuleWithSize<SocketInput>(256, host, *config).release();
 }
 
 auto const registered = Factory::registerModule("SocketInput", &createObject);
@@ -5,4 +5,17 @@ struct SocketInputConfig {
   int port = 0;
   bool isTcp = false;
   bool isMulticast = false;
+
+  // received data is packed into output buffers of at most 'bufferSize' bytes.
+  // A buffer is sent when full, or 'maxLatencyInMs' after its first byte was received.
+  int bufferSize = 50 * 7 * 188;
+  int maxLatencyInMs = 10;
+
+  // UDP: bigger datagrams are truncated
+  int maxDatagramSize = 2048;
+
+  // UDP: RTP (RFC 2250) headers are stripped, and packets are put back in sequence order.
+  // After a missing packet, wait for at most 'rtpReorderPackets' packets, or 'maxLatencyInMs'.
+  bool rtp = false;
+  int rtpReorderPackets = 64;
 };
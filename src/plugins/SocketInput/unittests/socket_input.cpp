@@ -0,0 +1,107 @@
+#include "../socket_input.hpp"
+
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "lib_utils/rtp.hpp"
+#include "plugins/UdpOutput/udp_output.hpp"
+#include "tests/tests.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring> // memset
+
+using namespace Tests;
+using namespace Modules;
+
+namespace {
+
+auto const PORT = 47933;
+
+struct Recorder : ModuleS {
+  void processOne(Data data) override {
+    auto buf = data->data();
+    bytes.insert(bytes.end(), buf.ptr, buf.ptr + buf.len);
+  }
+  std::vector<uint8_t> bytes;
+};
+
+SocketInputConfig rtpInput() {
+  SocketInputConfig cfg;
+  cfg.ipAddr[0] = 127;
+  cfg.ipAddr[3] = 1;
+  cfg.port = PORT;
+  cfg.rtp = true;
+  cfg.maxLatencyInMs = 1;
+  return cfg;
+}
+
+void sendRtp(int fd, uint16_t sequenceNumber) {
+  Rtp::Header hdr;
+  hdr.sequenceNumber = sequenceNumber;
+  uint8_t buf[Rtp::HEADER_SIZE + 188];
+  Rtp::writeHeader(buf, hdr);
+  memset(buf + Rtp::HEADER_SIZE, (uint8_t)sequenceNumber, 188);
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(PORT);
+  sendto(fd, buf, sizeof buf, 0, (sockaddr *)&addr, sizeof addr);
+}
+
+void receive(IModule *input) {
+  for(int i = 0; i < 20; ++i)
+    input->process();
+}
+
+}
+
+unittest("SocketInput: RTP from UdpOutput") {
+  auto inputCfg = rtpInput();
+  auto input = loadModule("SocketInput", &NullHost, &inputCfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(input->getOutput(0), rec->getInput(0));
+
+  UdpOutputConfig outputCfg;
+  outputCfg.ipAddr[0] = 127;
+  outputCfg.ipAddr[3] = 1;
+  outputCfg.port = PORT;
+  outputCfg.rtp = true;
+  auto output = loadModule("UdpOutput", &NullHost, &outputCfg);
+
+  std::vector<uint8_t> ts(20 * 1316 + 188);
+  for(size_t i = 0; i < ts.size(); ++i)
+    ts[i] = (uint8_t)(i / 188);
+  auto data = std::make_shared<DataRaw>(ts.size());
+  memcpy(data->buffer->data().ptr, ts.data(), ts.size());
+  output->getInput(0)->push(data);
+
+  receive(input.get());
+  ASSERT(ts == rec->bytes);
+}
+
+unittest("SocketInput: RTP reordering and losses") {
+  auto inputCfg = rtpInput();
+  inputCfg.rtpReorderPackets = 4;
+  auto input = loadModule("SocketInput", &NullHost, &inputCfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(input->getOutput(0), rec->getInput(0));
+
+  auto sender = socket(AF_INET, SOCK_DGRAM, 0);
+  // 3 arrives late, 6 is lost, 2 is duplicated
+  for(auto seq : {1, 2, 4, 5, 3, 2, 7, 8})
+    sendRtp(sender, seq);
+  close(sender);
+
+  receive(input.get());
+
+  std::vector<int> order;
+  for(size_t i = 0; i < rec->bytes.size(); i += 188)
+    order.push_back(rec->bytes[i]);
+  ASSERT_EQUALS(std::vector<int>({1, 2, 3, 4, 5, 7, 8}), order);
+}
+#endif
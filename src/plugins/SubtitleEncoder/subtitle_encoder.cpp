@@ -10,9 +10,11 @@
 #include "lib_utils/small_map.hpp"
 #include "lib_utils/time.hpp" // timeInMsToStr
 #include "lib_utils/tools.hpp" // enforce
+#include "lib_utils/xml.hpp"
 
 #include <algorithm> // std::max
 #include <cassert>
+#include <cstdio> // snprintf
 #include <sstream>
 
 using namespace Modules;
@@ -69,6 +71,7 @@ class SubtitleEncoder : public ModuleS {
   int64_t intClock = 0;
   const int64_t maxPageDurIn180k, splitDurationIn180k;
   std::vector<Page> currentPages;
+  size_t lastTtmlSize = 4096; // initial capacity of the next TTML sample
 
   void enqueuePage(const DataSubtitle *page) {
     if(!page)
@@ -94,18 +97,24 @@ class SubtitleEncoder : public ModuleS {
           clockToTimescale(page.showTimestamp, 1000) < endTimeInMs;
   };
 
-  std::string
-  serializePageToTtml(Page const &page, int regionId, int64_t startTimeInMs, int64_t endTimeInMs, bool useBr) const {
+  template<typename Output>
+  void writePageToTtml(XmlWriter<Output> &xml, Page const &page, int regionId, int64_t startTimeInMs,
+        int64_t endTimeInMs, bool useBr) const {
     auto const timecodeShow = timecodeToString(startTimeInMs);
     auto const timecodeHide = timecodeToString(endTimeInMs);
 
     assert(!page.lines.empty());
 
-    std::stringstream ttml;
+    char buffer[64];
 
-    if(useBr)
-      ttml << "      <p region=\"Region" << regionId << "\" begin=\"" << timecodeShow << "\" end=\"" << timecodeHide
-           << "\" style=\"textCenter\">\n";
+    if(useBr) {
+      snprintf(buffer, sizeof buffer, "Region%d", regionId);
+      xml.openTag("p");
+      xml.attr("region", buffer);
+      xml.attr("begin", timecodeShow);
+      xml.attr("end", timecodeHide);
+      xml.attr("style", "textCenter");
+    }
 
     int lineIdx = 0;
     for(auto &line : page.lines) {
@@ -113,27 +122,38 @@ class SubtitleEncoder : public ModuleS {
         continue;
 
       if(useBr) {
-        ttml << "        <span style=\"text_" << lineIdx++ << "\">" << line.text << "</span>\n";
-        if(&line != &page.lines.back())
-          ttml << "        <br />\n";
+        snprintf(buffer, sizeof buffer, "text_%d", lineIdx++);
+        xml.openTag("span");
+        xml.attr("style", buffer);
+        xml.text(line.text);
+        xml.closeTag();
+        if(&line != &page.lines.back()) {
+          xml.openTag("br");
+          xml.padStartTag();
+          xml.closeTag();
+        }
       } else {
-        ttml << "      <p region=\"Region" << regionId << "_" << line.region.row << "\" style=\"Style0_0";
-        if(line.style.doubleHeight)
-          ttml << "_double";
-        ttml << "\" begin=\"" << timecodeShow << "\" end=\"" << timecodeHide << "\">\n";
-        ttml << "        <span tts:color=\"" << line.style.color << "\" tts:backgroundColor=\"" << line.style.bgColor
-             << "\">" << line.text << "</span>\n";
-        ttml << "      </p>\n";
+        snprintf(buffer, sizeof buffer, "Region%d_%d", regionId, line.region.row);
+        xml.openTag("p");
+        xml.attr("region", buffer);
+        xml.attr("style", line.style.doubleHeight ? "Style0_0_double" : "Style0_0");
+        xml.attr("begin", timecodeShow);
+        xml.attr("end", timecodeHide);
+        xml.openTag("span");
+        xml.attr("tts:color", line.style.color);
+        xml.attr("tts:backgroundColor", line.style.bgColor);
+        xml.text(line.text);
+        xml.closeTag();
+        xml.closeTag();
       }
     }
 
     if(useBr)
-      ttml << "      </p>\n";
-
-    return ttml.str();
+      xml.closeTag();
   }
 
-  std::string toTTML(int64_t startTimeInMs, int64_t endTimeInMs) const {
+  template<typename Output>
+  void toTTML(Output &out, int64_t startTimeInMs, int64_t endTimeInMs) const {
     int64_t offsetInMs;
     switch(timingPolicy) {
     case SubtitleEncoderConfig::AbsoluteUTC:
@@ -177,24 +197,39 @@ class SubtitleEncoder : public ModuleS {
     };
 
     SmallMap<const Page *, int> pageToRegionId;
+    char buffer[64];
+
+    XmlWriter<Output> xml(out);
+    xml.declaration();
+
+    xml.openTag("tt");
+    xml.attr("xmlns", "http://www.w3.org/ns/ttml");
+    xml.attr("xmlns:tt", "http://www.w3.org/ns/ttml");
+    xml.attr("xmlns:ttm", "http://www.w3.org/ns/ttml#metadata");
+    xml.attr("xmlns:tts", "http://www.w3.org/ns/ttml#styling");
+    xml.attr("xmlns:ttp", "http://www.w3.org/ns/ttml#parameter");
+    xml.attr("xml:lang", lang);
+    if(legacyElementalMode || currentPages.empty())
+      xml.attr("ttp:cellResolution", "50 30");
+    else {
+      snprintf(buffer, sizeof buffer, "%d %d", currentPages.front().numCols, currentPages.front().numRows);
+      xml.attr("ttp:cellResolution", buffer);
+    }
+    xml.padStartTag(); // legacy layout
 
-    std::stringstream ttml;
-    ttml << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+    xml.openTag("head");
+    xml.openTag("styling");
 
     if(legacyElementalMode) {
-      ttml << "<tt xmlns=\"http://www.w3.org/ns/ttml\" xmlns:tt=\"http://www.w3.org/ns/ttml\" "
-              "xmlns:ttm=\"http://www.w3.org/ns/ttml#metadata\" xmlns:tts=\"http://www.w3.org/ns/ttml#styling\" "
-              "xmlns:ttp=\"http://www.w3.org/ns/ttml#parameter\" xml:lang=\""
-           << lang << "\" ttp:cellResolution=\"50 30\" >\n";
-      ttml << "  <head>\n";
-      ttml << "    <styling>\n";
-      if(!hasDoubleHeight())
-        ttml << "      <style xml:id=\"Style0_0\" tts:fontSize=\"100%\" tts:fontFamily=\"monospaceSansSerif\" />\n";
-      else
-        ttml << "      <style xml:id=\"Style0_0_double\" tts:fontSize=\"100%\" tts:fontFamily=\"monospaceSansSerif\" "
-                "/>\n";
-      ttml << "    </styling>\n";
-      ttml << "    <layout>\n";
+      xml.openTag("style");
+      xml.attr("xml:id", hasDoubleHeight() ? "Style0_0_double" : "Style0_0");
+      xml.attr("tts:fontSize", "100%");
+      xml.attr("tts:fontFamily", "monospaceSansSerif");
+      xml.padStartTag();
+      xml.closeTag();
+      xml.closeTag(); // styling
+
+      xml.openTag("layout");
 
       // We currently assign one Region per line per page with positioning aligned on a 40x25 grid
       // Single or double height
@@ -232,64 +267,84 @@ class SubtitleEncoder : public ModuleS {
             auto const margin = 10.0; // percentage
             auto const origin = (margin + (100 - 2 * margin) * line.region.col / (double)page.numCols) / factorH;
             auto const width = 100 - origin - margin;
-            ttml << "      <region xml:id=\"Region" << pageToRegionId[&page] << "_" << line.region.row << "\" ";
-            ttml << "tts:origin=\"" << origin << "% " << verticalOrigin << "%\" tts:extent=\"" << width << "% "
-                 << (double)height * factorH << "%\" ";
-            ttml << "tts:displayAlign=\"center\" tts:textAlign=\"center\" />\n";
+            xml.openTag("region");
+            snprintf(buffer, sizeof buffer, "Region%d_%d", pageToRegionId[&page], line.region.row);
+            xml.attr("xml:id", buffer);
+            snprintf(buffer, sizeof buffer, "%g%% %g%%", origin, verticalOrigin);
+            xml.attr("tts:origin", buffer);
+            snprintf(buffer, sizeof buffer, "%g%% %g%%", width, (double)height * factorH);
+            xml.attr("tts:extent", buffer);
+            xml.attr("tts:displayAlign", "center");
+            xml.attr("tts:textAlign", "center");
+            xml.padStartTag();
+            xml.closeTag();
           } else if(forceTtmlLegacy) {
-            ttml << "      <region xml:id=\"Region" << pageToRegionId[&page] << "_" << line.region.row
-                 << "\" tts:origin=\"10% 95.8333%\" tts:extent=\"80% 4.16667%\" tts:displayAlign=\"center\" "
-                    "tts:textAlign=\"center\" />\n";
+            xml.openTag("region");
+            snprintf(buffer, sizeof buffer, "Region%d_%d", pageToRegionId[&page], line.region.row);
+            xml.attr("xml:id", buffer);
+            xml.attr("tts:origin", "10% 95.8333%");
+            xml.attr("tts:extent", "80% 4.16667%");
+            xml.attr("tts:displayAlign", "center");
+            xml.attr("tts:textAlign", "center");
+            xml.padStartTag();
+            xml.closeTag();
           } else
             m_host->log(Warning,
                   format("Impossible to compute text position for \"%s\". Contact your vendor.", line.text).c_str());
         }
       }
 
-      ttml << "    </layout>\n";
-      ttml << "  </head>\n";
-      ttml << "  <body>\n";
-      ttml << "    <div>\n";
+      xml.closeTag(); // layout
+      xml.closeTag(); // head
+      xml.openTag("body");
+      xml.openTag("div");
     } else {
-      if(currentPages.empty())
-        ttml << "<tt xmlns=\"http://www.w3.org/ns/ttml\" xmlns:tt=\"http://www.w3.org/ns/ttml\" "
-                "xmlns:ttm=\"http://www.w3.org/ns/ttml#metadata\" xmlns:tts=\"http://www.w3.org/ns/ttml#styling\" "
-                "xmlns:ttp=\"http://www.w3.org/ns/ttml#parameter\" xml:lang=\""
-             << lang << "\" ttp:cellResolution=\"50 30\" >\n";
-      else
-        ttml << "<tt xmlns=\"http://www.w3.org/ns/ttml\" xmlns:tt=\"http://www.w3.org/ns/ttml\" "
-                "xmlns:ttm=\"http://www.w3.org/ns/ttml#metadata\" xmlns:tts=\"http://www.w3.org/ns/ttml#styling\" "
-                "xmlns:ttp=\"http://www.w3.org/ns/ttml#parameter\" xml:lang=\""
-             << lang << "\" ttp:cellResolution=\"" << currentPages.front().numCols << " "
-             << currentPages.front().numRows << "\" >\n";
-      ttml << "  <head>\n";
-      ttml << "    <styling>\n";
-      ttml << "      <style xml:id=\"defaultStyle\" tts:fontFamily=\"Verdana, Arial, Tiresias\" tts:fontSize=\"160%\" "
-              "tts:lineHeight=\"125%\" />\n";
+      xml.openTag("style");
+      xml.attr("xml:id", "defaultStyle");
+      xml.attr("tts:fontFamily", "Verdana, Arial, Tiresias");
+      xml.attr("tts:fontSize", "160%");
+      xml.attr("tts:lineHeight", "125%");
+      xml.padStartTag();
+      xml.closeTag();
       for(auto &page : currentPages) {
         pageToRegionId[&page] = 0;
         int textIdx = 0;
         for(auto &line : page.lines) {
-          ttml << "      <style xml:id=\"text_" << textIdx++ << "\" tts:color=\"" << line.style.color
-               << "\" tts:backgroundColor=\"" << line.style.bgColor << "\" />\n";
+          snprintf(buffer, sizeof buffer, "text_%d", textIdx++);
+          xml.openTag("style");
+          xml.attr("xml:id", buffer);
+          xml.attr("tts:color", line.style.color);
+          xml.attr("tts:backgroundColor", line.style.bgColor);
+          xml.padStartTag();
+          xml.closeTag();
         }
-        ttml << "      <style xml:id=\"textCenter\" tts:textAlign=\"center\" />\n";
+        xml.openTag("style");
+        xml.attr("xml:id", "textCenter");
+        xml.attr("tts:textAlign", "center");
+        xml.padStartTag();
+        xml.closeTag();
       }
-      ttml << "    </styling>\n";
-      ttml << "    <layout>\n";
+      xml.closeTag(); // styling
+
+      xml.openTag("layout");
       for(auto &page : currentPages) {
         if(!page.lines.empty()) {
           auto const &line = page.lines.front();
-          ttml << "      <region xml:id=\"Region" << pageToRegionId[&page] << "\" tts:origin=\""
-               << (line.region.originOri.empty() ? "10% 10%" : line.region.originOri) << "\" tts:extent=\""
-               << (line.region.extentOri.empty() ? "80% 80%" : line.region.extentOri) << "\" tts:displayAlign=\""
-               << line.region.displayAlign << "\" />\n";
+          snprintf(buffer, sizeof buffer, "Region%d", pageToRegionId[&page]);
+          xml.openTag("region");
+          xml.attr("xml:id", buffer);
+          xml.attr("tts:origin", line.region.originOri.empty() ? "10% 10%" : line.region.originOri.c_str());
+          xml.attr("tts:extent", line.region.extentOri.empty() ? "80% 80%" : line.region.extentOri.c_str());
+          xml.attr("tts:displayAlign", line.region.displayAlign);
+          xml.padStartTag();
+          xml.closeTag();
         }
       }
-      ttml << "    </layout>\n";
-      ttml << "  </head>\n";
-      ttml << "  <body>\n";
-      ttml << "    <div style=\"defaultStyle\">\n";
+      xml.closeTag(); // layout
+      xml.closeTag(); // head
+      xml.openTag("body");
+      xml.openTag("div");
+      xml.attr("style", "defaultStyle");
     }
 
     for(auto &page : currentPages) {
@@ -300,18 +355,14 @@ class SubtitleEncoder : public ModuleS {
               format("[TTML][%s-%s]: %s - %s: \"%s\"", startTimeInMs, endTimeInMs, localStartTimeInMs, localEndTimeInMs,
                     page.toString())
                     .c_str());
-        ttml << serializePageToTtml(page, pageToRegionId[&page], localStartTimeInMs + offsetInMs,
+        writePageToTtml(xml, page, pageToRegionId[&page], localStartTimeInMs + offsetInMs,
               localEndTimeInMs + offsetInMs, !legacyElementalMode);
       }
     }
-    ttml << "    </div>\n";
-    ttml << "  </body>\n";
-    ttml << "</tt>\n\n";
-
-    if(0)
-      m_host->log(Warning, ttml.str().c_str());
-
-    return ttml.str();
+    xml.closeTag(); // div
+    xml.closeTag(); // body
+    xml.closeTag(); // tt
+    out.append("\n", 1);
   }
 
   std::string toWebVTT(int64_t startTimeInMs, int64_t endTimeInMs) const {
@@ -401,6 +452,21 @@ class SubtitleEncoder : public ModuleS {
 
   void sendSample(const std::string &sample) {
     auto out = output->allocData<DataRaw>(sample.size());
+    memcpy(out->buffer->data().ptr, (uint8_t *)sample.c_str(), sample.size());
+    postSample(out);
+  }
+
+  // the TTML is written directly into the output Data
+  void sendTtml(int64_t startTimeInMs, int64_t endTimeInMs) {
+    auto out = output->allocData<DataRawResizable>(lastTtmlSize);
+    DataAppender appender(out.get());
+    toTTML(appender, startTimeInMs, endTimeInMs);
+    appender.finish();
+    lastTtmlSize = std::max<size_t>(lastTtmlSize, out->data().len);
+    postSample(out);
+  }
+
+  void postSample(std::shared_ptr<DataBase> out) {
     out->set(DecodingTime{intClock});
     out->set(PresentationTime{intClock});
 
@@ -408,7 +474,6 @@ class SubtitleEncoder : public ModuleS {
     flags.keyframe = true;
     out->set(flags);
 
-    memcpy(out->buffer->data().ptr, (uint8_t *)sample.c_str(), sample.size());
     output->post(out);
   }
 
@@ -450,7 +515,10 @@ class SubtitleEncoder : public ModuleS {
         currentPages.push_back(page);
       }
 
-      sendSample(isWebVTT ? toWebVTT(startInMs, endInMs) : toTTML(startInMs, endInMs));
+      if(isWebVTT)
+        sendSample(toWebVTT(startInMs, endInMs));
+      else
+        sendTtml(startInMs, endInMs);
       removeOutdatedPages(endInMs);
 
       intClock = nextSplit;
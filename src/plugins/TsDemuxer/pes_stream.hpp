@@ -5,6 +5,7 @@
 #include "lib_media/common/attributes.hpp"
 #include "lib_utils/format.hpp"
 
+#include <algorithm> // min
 #include <cstring> // memcpy
 #include <utility> // exchange
 #include <vector>
@@ -97,136 +98,71 @@ private:
       , type(type_)
       , m_restamper(restamper_)
       , m_output(output_)
-      , m_pesBuffer(256 * 1024) {
+      , m_spill(4096) {
     if(type == TsDemuxerConfig::VIDEO)
       m_output->setMetadata(make_shared<MetadataPkt>(VIDEO_PKT));
     else
       m_output->setMetadata(make_shared<MetadataPkt>(AUDIO_PKT));
   }
 
-  void push(SpanC data, bool pusi) override {
+  // The PES packet is not copied while being assembled: we keep references to
+  // the TS payloads inside the input buffers ('owner'), and copy them exactly
+  // once into the output buffer.
+  // When PES_packet_length is known, the output buffer is allocated as soon as
+  // the PES header is parsed and the payloads are copied into it directly.
+  // Otherwise, once too many input buffers are referenced, the payloads are
+  // appended to a growing output buffer.
+  void push(SpanC data, bool pusi, Data const &owner) override {
     // if we missed the start of the PES packet ...
-    if(!pusi && m_pesBuffer.empty())
+    if(!pusi && empty())
       return; // ... discard the rest
 
-    m_pesBuffer.insert(data.ptr, data.len);
-
-    // try to early-parse PES_packet_length
-    if(m_pesBuffer.size() >= 6) {
-      auto PES_packet_length = (m_pesBuffer[4] << 8) + m_pesBuffer[5];
-      if(PES_packet_length > 0 && (int)m_pesBuffer.size() >= PES_packet_length + 6) {
-        m_pesBuffer.resize(6 + PES_packet_length);
-        flush();
+    try {
+      if(m_out) {
+        pushToOutput(data);
+        return;
       }
+
+      pushSlice(data, owner);
+
+      if(!m_hasHeader && parseHeader(false))
+        startOutputIfSizeIsKnown();
+    } catch(const std::runtime_error &e) {
+      clear();
+      throw(e);
     }
   }
 
   void flush() override {
-    if(m_pesBuffer.empty())
+    if(empty())
       return; // nothing to flush
 
     try {
-      BitReader r = {SpanC(m_pesBuffer.data(), m_pesBuffer.size())};
-      if(m_pesBuffer.size() < 3)
-        throw runtime_error(format("[%s] truncated PES packet", pid));
-
-      auto const start_code_prefix = r.u(24);
-      if(start_code_prefix != 0x000001)
-        throw runtime_error(format("[%s] invalid PES start code (%s)", pid, start_code_prefix));
-
-      /*auto const stream_id =*/r.u(8);
-      /*auto const pes_packet_length =*/r.u(16);
-
-      // optional PES header
-      auto const markerBits = r.u(2);
-      if(markerBits != 0x2)
-        throw runtime_error("invalid PES header");
-
-      auto const scramblingControl = r.u(2); // 00 implies not scrambled
-      /*auto const Priority =*/r.u(1);
-      /*auto const Data_alignment_indicator =*/r.u(1);
-      /*auto const copyrighted =*/r.u(1);
-      /*auto const original =*/r.u(1);
-      auto const PTS_DTS_indicator = r.u(2); // 11 = both present, 01 is forbidden, 10 = only PTS, 00 = no PTS or DTS
-      /*auto const ESCR_flag =*/r.u(1);
-      /*auto const ES_rate_flag =*/r.u(1);
-      /*auto const DSM_trick_mode_flag =*/r.u(1);
-      /*auto const Additional_copy_info_flag =*/r.u(1);
-      /*auto const CRC_flag =*/r.u(1);
-      /*auto const extension_flag =*/r.u(1);
-      auto const PES_header_data_length = r.u(8);
-      auto const PES_header_data_end = r.byteOffset() + PES_header_data_length;
-
-      if(scramblingControl)
-        throw runtime_error("discarding scrambled PES packet");
-
-      if(PES_header_data_length > r.remaining())
-        throw runtime_error("Invalid PES_header_data_length");
-
-      int64_t pts = 0;
-
-      if(PTS_DTS_indicator & 0b10) {
-        /*auto const reservedBits =*/r.u(4); // 0b0010
-        pts |= r.u(3); // PTS [32..30]
-        /*auto marker_bit0 =*/r.u(1);
-        pts <<= 15;
-        pts |= r.u(15); // PTS [29..15]
-        /*auto marker_bit1 =*/r.u(1);
-        pts <<= 15;
-        pts |= r.u(15); // PTS [14..0]
-        /*auto marker_bit2 =*/r.u(1);
-      }
-
-      int64_t dts = pts;
-
-      if(PTS_DTS_indicator & 0b01) {
-        dts = 0;
-        /*auto const reservedBits =*/r.u(4); // 0b0010
-        dts |= r.u(3); // DTS [32..30]
-        /*auto marker_bit0 =*/r.u(1);
-        dts <<= 15;
-        dts |= r.u(15); // DTS [29..15]
-        /*auto marker_bit1 =*/r.u(1);
-        dts <<= 15;
-        dts |= r.u(15); // DTS [14..0]
-        /*auto marker_bit2 =*/r.u(1);
+      if(!m_out) {
+        if(!m_hasHeader)
+          parseHeader(true);
+
+        // PES_packet_length is unknown: the PES packet ends here.
+        auto pesPayloadSize = m_size - m_headerSize;
+        m_out = m_output->allocData<DataRawResizable>(pesPayloadSize);
+        gather(m_out->buffer->data().ptr, m_headerSize, pesPayloadSize);
+        m_outPos = pesPayloadSize;
       }
 
-      // skip extra remaining headers
-      while(r.byteOffset() < PES_header_data_end)
-        r.u(8);
-
-      auto pesPayloadSize = m_pesBuffer.size() - r.byteOffset();
-      auto buf = m_output->allocData<DataRaw>(pesPayloadSize);
-
-      if(PTS_DTS_indicator & 0b10) {
-        m_restamper->restamp(pts);
-        int64_t presentationTime = timescaleToClock(pts, 90000); // PTS are in 90kHz units
-        buf->set(PresentationTime{presentationTime});
-      }
-      {
-        m_restamper->restamp(dts);
-        int64_t decodingTime = timescaleToClock(dts, 90000); // DTS are in 90kHz units
-        buf->set(DecodingTime{decodingTime});
-      }
-      buf->set(CueFlags{discontinuity, rap, true});
-      memcpy(buf->buffer->data().ptr, m_pesBuffer.data() + r.byteOffset(), pesPayloadSize);
-      m_output->post(buf);
-
-      m_pesBuffer.clear();
-      discontinuity = false;
-      rap = false;
+      // truncated PES packets are sent anyway
+      m_out->resize(m_outPos);
+      post();
     } catch(const std::runtime_error &e) {
-      m_pesBuffer.clear();
+      clear();
       throw(e);
     }
   }
 
   bool reset() override {
-    if(m_pesBuffer.empty())
+    if(empty())
       return false;
 
-    m_pesBuffer.clear();
+    clear();
     discontinuity = true;
     return true;
   }
@@ -243,8 +179,299 @@ private:
   int type;
 
   private:
+  // Holding too many input buffers could starve the upstream allocator:
+  // above this count, pending payloads are copied into a growing output buffer
+  // (or into 'm_spill' when the PES header isn't known yet).
+  static auto const MAX_INPUT_REFS = 4;
+  static auto const MIN_GROWING_SIZE = 64 * 1024;
+
+  // A chunk of the pending PES packet: either a view on an input buffer
+  // (ptr != nullptr), or a range of 'm_spill'.
+  struct Slice {
+    const uint8_t *ptr;
+    size_t spillOffset;
+    size_t len;
+  };
+
+  bool empty() const { return m_size == 0 && !m_out; }
+
+  void pushSlice(SpanC data, Data const &owner) {
+    if(!owner) {
+      // transient data (e.g the demuxer's remainder): we must copy it
+      pushSpill(data);
+      return;
+    }
+
+    if(m_refs.empty() || m_refs.back() != owner) {
+      if(m_refs.size() >= MAX_INPUT_REFS) {
+        if(m_hasHeader) {
+          startGrowingOutput();
+          pushToOutput(data);
+          return;
+        }
+        spillAll();
+      }
+      m_refs.push_back(owner);
+    }
+
+    m_slices.push_back({data.ptr, 0, data.len});
+    m_size += data.len;
+  }
+
+  void pushSpill(SpanC data) {
+    auto const offset = m_spill.size();
+    m_spill.insert(data.ptr, data.len);
+    m_size += data.len;
+
+    // merge with the previous slice when contiguous
+    if(!m_slices.empty()) {
+      auto &last = m_slices.back();
+      if(!last.ptr && last.spillOffset + last.len == offset) {
+        last.len += data.len;
+        return;
+      }
+    }
+
+    m_slices.push_back({nullptr, offset, data.len});
+  }
+
+  void spillAll() {
+    for(auto &s : m_slices) {
+      if(!s.ptr)
+        continue;
+      s.spillOffset = m_spill.size();
+      m_spill.insert(s.ptr, s.len);
+      s.ptr = nullptr;
+    }
+    m_refs.clear();
+  }
+
+  // copy 'len' bytes of the pending PES packet, starting at 'offset'
+  void gather(uint8_t *dst, size_t offset, size_t len) const {
+    for(auto &s : m_slices) {
+      if(len == 0)
+        break;
+
+      if(offset >= s.len) {
+        offset -= s.len;
+        continue;
+      }
+
+      auto const src = s.ptr ? s.ptr : m_spill.data() + s.spillOffset;
+      auto const n = std::min(s.len - offset, len);
+      memcpy(dst, src + offset, n);
+      dst += n;
+      len -= n;
+      offset = 0;
+    }
+  }
+
+  void pushToOutput(SpanC data) {
+    if(m_outGrowing && m_outPos + data.len > m_out->buffer->data().len)
+      m_out->resize(std::max(2 * m_out->buffer->data().len, m_outPos + data.len));
+
+    auto const dst = m_out->buffer->data();
+    auto const n = std::min(data.len, dst.len - m_outPos);
+    memcpy(dst.ptr + m_outPos, data.ptr, n);
+    m_outPos += n;
+
+    if(m_outPos == dst.len && !m_outGrowing)
+      post();
+  }
+
+  // PES_packet_length is unknown: the pending payloads are moved to an output
+  // buffer which grows until the next PUSI.
+  void startGrowingOutput() {
+    auto const available = m_size - m_headerSize;
+    m_out = m_output->allocData<DataRawResizable>(std::max<size_t>(2 * available, MIN_GROWING_SIZE));
+    gather(m_out->buffer->data().ptr, m_headerSize, available);
+    m_outPos = available;
+    m_outGrowing = true;
+    clearPending();
+  }
+
+  void clearPending() {
+    m_slices.clear();
+    m_refs.clear();
+    m_spill.clear();
+    m_size = 0;
+  }
+
+  void startOutputIfSizeIsKnown() {
+    if(m_pesPacketLength == 0)
+      return; // unbounded: wait for the next PUSI
+
+    auto const pesSize = 6 + m_pesPacketLength;
+    if(pesSize < m_headerSize)
+      throw runtime_error(format("[%s] invalid PES_packet_length (%s)", pid, m_pesPacketLength));
+
+    auto const pesPayloadSize = pesSize - m_headerSize;
+    m_out = m_output->allocData<DataRawResizable>(pesPayloadSize);
+
+    auto const available = std::min(m_size, pesSize) - m_headerSize;
+    gather(m_out->buffer->data().ptr, m_headerSize, available);
+    m_outPos = available;
+
+    // from now on, payloads are copied directly into 'm_out'
+    clearPending();
+
+    if(m_outPos == pesPayloadSize)
+      post();
+  }
+
+  // Returns false if more data is needed to parse the PES header.
+  // When 'final' is set, missing data is an error.
+  bool parseHeader(bool final) {
+    auto const PES_HEADER_FIXED_SIZE = 9;
+    uint8_t header[PES_HEADER_FIXED_SIZE + 255];
+
+    auto needMore = [&](const char *msg) {
+      if(final)
+        throw runtime_error(msg);
+      return false;
+    };
+
+    if(m_size < 3)
+      return needMore(format("[%s] truncated PES packet", pid).c_str());
+
+    auto const fixedSize = std::min<size_t>(m_size, PES_HEADER_FIXED_SIZE);
+    gather(header, 0, fixedSize);
+
+    BitReader r = {SpanC(header, fixedSize)};
+    auto const start_code_prefix = r.u(24);
+    if(start_code_prefix != 0x000001)
+      throw runtime_error(format("[%s] invalid PES start code (%s)", pid, start_code_prefix));
+
+    if(m_size < PES_HEADER_FIXED_SIZE)
+      return needMore(format("[%s] truncated PES packet", pid).c_str());
+
+    /*auto const stream_id =*/r.u(8);
+    auto const pes_packet_length = r.u(16);
+
+    // optional PES header
+    auto const markerBits = r.u(2);
+    if(markerBits != 0x2)
+      throw runtime_error("invalid PES header");
+
+    auto const scramblingControl = r.u(2); // 00 implies not scrambled
+    /*auto const Priority =*/r.u(1);
+    /*auto const Data_alignment_indicator =*/r.u(1);
+    /*auto const copyrighted =*/r.u(1);
+    /*auto const original =*/r.u(1);
+    auto const PTS_DTS_indicator = r.u(2); // 11 = both present, 01 is forbidden, 10 = only PTS, 00 = no PTS or DTS
+    /*auto const ESCR_flag =*/r.u(1);
+    /*auto const ES_rate_flag =*/r.u(1);
+    /*auto const DSM_trick_mode_flag =*/r.u(1);
+    /*auto const Additional_copy_info_flag =*/r.u(1);
+    /*auto const CRC_flag =*/r.u(1);
+    /*auto const extension_flag =*/r.u(1);
+    auto const PES_header_data_length = r.u(8);
+
+    if(scramblingControl)
+      throw runtime_error("discarding scrambled PES packet");
+
+    auto const headerSize = PES_HEADER_FIXED_SIZE + PES_header_data_length;
+    if(m_size < (size_t)headerSize)
+      return needMore("Invalid PES_header_data_length");
+
+    gather(header, 0, headerSize);
+    r.src = SpanC(header, headerSize);
+
+    int64_t pts = 0;
+
+    if(PTS_DTS_indicator & 0b10) {
+      if(r.remaining() < 5)
+        throw runtime_error("Invalid PES_header_data_length");
+      /*auto const reservedBits =*/r.u(4); // 0b0010
+      pts |= r.u(3); // PTS [32..30]
+      /*auto marker_bit0 =*/r.u(1);
+      pts <<= 15;
+      pts |= r.u(15); // PTS [29..15]
+      /*auto marker_bit1 =*/r.u(1);
+      pts <<= 15;
+      pts |= r.u(15); // PTS [14..0]
+      /*auto marker_bit2 =*/r.u(1);
+    }
+
+    int64_t dts = pts;
+
+    if(PTS_DTS_indicator & 0b01) {
+      if(r.remaining() < 5)
+        throw runtime_error("Invalid PES_header_data_length");
+      dts = 0;
+      /*auto const reservedBits =*/r.u(4); // 0b0010
+      dts |= r.u(3); // DTS [32..30]
+      /*auto marker_bit0 =*/r.u(1);
+      dts <<= 15;
+      dts |= r.u(15); // DTS [29..15]
+      /*auto marker_bit1 =*/r.u(1);
+      dts <<= 15;
+      dts |= r.u(15); // DTS [14..0]
+      /*auto marker_bit2 =*/r.u(1);
+    }
+
+    // extra remaining headers are skipped
+
+    m_hasHeader = true;
+    m_headerSize = headerSize;
+    m_pesPacketLength = pes_packet_length;
+    m_ptsDtsIndicator = PTS_DTS_indicator;
+    m_pts = pts;
+    m_dts = dts;
+    return true;
+  }
+
+  void post() {
+    auto buf = m_out;
+
+    // timestamps are restamped in output order
+    if(m_ptsDtsIndicator & 0b10) {
+      m_restamper->restamp(m_pts);
+      int64_t presentationTime = timescaleToClock(m_pts, 90000); // PTS are in 90kHz units
+      buf->set(PresentationTime{presentationTime});
+    }
+    {
+      m_restamper->restamp(m_dts);
+      int64_t decodingTime = timescaleToClock(m_dts, 90000); // DTS are in 90kHz units
+      buf->set(DecodingTime{decodingTime});
+    }
+    buf->set(CueFlags{discontinuity, rap, true});
+
+    clear();
+    discontinuity = false;
+    rap = false;
+
+    m_output->post(buf);
+  }
+
+  void clear() {
+    clearPending();
+    m_hasHeader = false;
+    m_out = nullptr;
+    m_outPos = 0;
+    m_outGrowing = false;
+  }
+
   IRestamper *const m_restamper;
   OutputDefault *const m_output = nullptr;
-  MyVector m_pesBuffer;
   bool discontinuity = false;
+
+  // pending PES packet, when its size is still unknown
+  std::vector<Slice> m_slices;
+  std::vector<Data> m_refs; // keeps the input buffers referenced by 'm_slices' alive
+  MyVector m_spill; // storage for the data we couldn't keep a reference on
+  size_t m_size = 0;
+
+  // parsed PES header
+  bool m_hasHeader = false;
+  size_t m_headerSize = 0;
+  size_t m_pesPacketLength = 0;
+  int m_ptsDtsIndicator = 0;
+  int64_t m_pts = 0;
+  int64_t m_dts = 0;
+
+  // output buffer, allocated once the PES packet size is known (or bounded)
+  std::shared_ptr<DataRawResizable> m_out;
+  size_t m_outPos = 0;
+  bool m_outGrowing = false; // PES_packet_length is unknown: 'm_out' is resized as needed
 };
@@ -1,6 +1,8 @@
 // A stream parsing PSI tables (i.e PAT, PMT)
 #pragma once
 
+#include "lib_utils/crc.hpp"
+
 #include <vector>
 
 #include "stream.hpp"
@@ -24,6 +26,7 @@ struct PsiStream : Stream {
   struct Listener {
     virtual void onPat(span<int> pmtPids) = 0;
     virtual void onPmt(span<EsInfo> esInfo) = 0;
+    virtual void onCrcError() = 0;
   };
 
   PsiStream(int pid_, KHost *host, Listener *listener_)
@@ -31,7 +34,7 @@ struct PsiStream : Stream {
       , m_host(host)
       , listener(listener_) {}
 
-  void push(SpanC data, bool pusi) override {
+  void push(SpanC data, bool pusi, Data const &) override {
     BitReader r = {data};
     if(pusi) {
       int pointerField = r.u(8);
@@ -57,6 +60,12 @@ struct PsiStream : Stream {
     if(r.remaining() < section_length)
       throw runtime_error("Invalid section_length in PSI header");
 
+    // reject corrupted sections before parsing them
+    if(crc32Mpeg2({r.src.ptr, size_t(sectionStart + section_length)}) != 0) {
+      listener->onCrcError();
+      throw runtime_error(format("[%s] Invalid CRC in PSI section", pid));
+    }
+
     /*auto const table_id_extension =*/r.u(16);
     /*auto const reserved2 =*/r.u(2);
     /*auto const version_number =*/r.u(5);
@@ -124,7 +133,7 @@ struct PsiStream : Stream {
     } break;
     }
 
-    /*auto const crc32 = r.u(crcSize * 8);*/
+    // CRC_32 was checked above
   }
 
   void flush() override {}
@@ -10,8 +10,10 @@ struct Stream {
       , m_host(host) {}
   virtual ~Stream() = default;
 
-  // send data for processing
-  virtual void push(SpanC data, bool pusi) = 0;
+  // send data for processing.
+  // 'owner' is the input buffer 'data' points to: streams may keep a reference
+  // on it instead of copying 'data'. When null, 'data' is transient.
+  virtual void push(SpanC data, bool pusi, Data const &owner) = 0;
 
   // tell the stream when the payload unit is finished (e.g PUSI=1 or EOS)
   virtual void flush() = 0;
@@ -0,0 +1,371 @@
+// Incremental ETSI TR 101 290 priority 1 and 2 checks.
+//
+// Every TS packet goes through 'onPacket', including the ones the demuxer
+// doesn't output. The per-PID state has a fixed size, and errors are only
+// counted: counters are published through the host (e.g the stats registry).
+//
+// Repetition intervals are measured on the time base of the first PCR PID,
+// so the checks give the same results on live inputs and on files.
+#pragma once
+
+#include <algorithm> // max
+#include <cstdlib> // llabs
+#include <memory>
+#include <vector>
+
+#include "psi_stream.hpp" // EsInfo
+
+struct TsAnalyzer {
+  TsAnalyzer(KHost *host)
+      : m_host(host)
+      , m_syncLoss(host, "sync_loss")
+      , m_patErrors(host, "pat_errors")
+      , m_ccErrors(host, "cc_errors")
+      , m_pmtErrors(host, "pmt_errors")
+      , m_pidErrors(host, "pid_errors")
+      , m_transportErrors(host, "transport_errors")
+      , m_crcErrors(host, "crc_errors")
+      , m_pcrRepetitionErrors(host, "pcr_repetition_errors")
+      , m_pcrDiscontinuityErrors(host, "pcr_discontinuity_errors")
+      , m_pcrAccuracyErrors(host, "pcr_accuracy_errors")
+      , m_pcrJitterNs(host, "pcr_jitter_ns")
+      , m_ptsErrors(host, "pts_errors")
+      , m_catErrors(host, "cat_errors")
+      , m_pids(new PidState[MAX_PID]) {
+    monitor(PID_PAT, PAT);
+  }
+
+  // 1.1 TS_sync_loss
+  void onSyncLoss() { ++*m_syncLoss; }
+
+  // 2.2 CRC_error
+  void onCrcError() { ++*m_crcErrors; }
+
+  void onPat(span<int> pmtPids) {
+    for(auto pid : pmtPids)
+      monitor(pid, PMT);
+  }
+
+  void onPmt(span<PsiStream::EsInfo> esInfo) {
+    for(auto es : esInfo)
+      monitor(es.pid, ES);
+  }
+
+  void onPacket(const uint8_t *pkt) {
+    auto const packetIndex = m_packetCount++;
+
+    auto const transportErrorIndicator = pkt[1] & 0x80;
+    auto const payloadUnitStartIndicator = pkt[1] & 0x40;
+    auto const pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    auto const scrambling = pkt[3] >> 6;
+    auto const adaptationFieldControl = (pkt[3] >> 4) & 0x3;
+    auto const continuityCounter = pkt[3] & 0xf;
+
+    // 2.1 Transport_error: the rest of the packet can't be trusted
+    if(transportErrorIndicator) {
+      ++*m_transportErrors;
+      return;
+    }
+
+    if(pid == PID_NULL)
+      return;
+
+    auto &s = m_pids[pid];
+    s.lastSeen = m_now;
+
+    int payloadOffset = TS_HEADER_LEN;
+    bool discontinuity = false;
+    if(adaptationFieldControl & 0b10) {
+      auto const length = pkt[4];
+      payloadOffset += 1 + length;
+      if(length > 0) {
+        discontinuity = pkt[5] & 0x80;
+        auto const pcrFlag = pkt[5] & 0x10;
+        if(pcrFlag && length >= 7)
+          onPcr(pid, s, readPcr(pkt + 6), discontinuity, packetIndex);
+      }
+    }
+
+    auto const hasPayload = (adaptationFieldControl & 0b01) && payloadOffset < TS_PACKET_LEN;
+    checkContinuity(pid, s, continuityCounter, hasPayload, discontinuity);
+
+    if(scrambling) {
+      if(s.kind & PAT)
+        ++*m_patErrors;
+      else if(s.kind & PMT)
+        ++*m_pmtErrors;
+      else if(!m_catFound && !(s.kind & SCRAMBLED)) // 2.6 CAT_error: once per PID
+        ++*m_catErrors;
+      s.kind |= SCRAMBLED;
+      return;
+    }
+
+    if(!hasPayload || !payloadUnitStartIndicator)
+      return;
+
+    SpanC payload{pkt + payloadOffset, size_t(TS_PACKET_LEN - payloadOffset)};
+
+    if(pid == PID_PAT || pid == PID_CAT) {
+      auto const pointerField = payload[0];
+      if(1 + pointerField >= (int)payload.len)
+        return;
+      auto const tableId = payload[1 + pointerField];
+      if(pid == PID_PAT && tableId != TABLE_ID_PAT)
+        ++*m_patErrors;
+      if(pid == PID_CAT) {
+        if(tableId == TABLE_ID_CAT)
+          m_catFound = true;
+        else
+          ++*m_catErrors;
+      }
+    } else if(s.kind & ES) {
+      checkPts(s, payload);
+    }
+  }
+
+  private:
+  enum : uint8_t {
+    PAT = 1,
+    PMT = 2,
+    ES = 4,
+    SCRAMBLED = 8,
+  };
+
+  struct PidState {
+    uint8_t kind = 0;
+    int8_t cc = -1;
+    bool duplicated = false;
+    int32_t *ccErrors = nullptr;
+
+    // in m_now units
+    int64_t lastSeen = 0;
+    int64_t lastPtsTime = 0;
+
+    int64_t lastPts = -1;
+
+    int64_t lastPcr = -1;
+    int64_t lastPcrPacket = 0;
+    double ticksPerPacket = 0;
+  };
+
+  void monitor(int pid, uint8_t kind) {
+    auto &s = m_pids[pid];
+    if(s.kind & kind)
+      return;
+    if(!(s.kind & (PAT | PMT | ES)))
+      m_monitored.push_back(pid);
+    s.kind |= kind;
+    s.lastSeen = m_now;
+  }
+
+  // 1.4 Continuity_count_error
+  void checkContinuity(int pid, PidState &s, int cc, bool hasPayload, bool discontinuity) {
+    if(s.cc < 0 || discontinuity) {
+      s.cc = cc;
+      s.duplicated = false;
+      return;
+    }
+
+    if(!hasPayload) {
+      if(cc != s.cc)
+        ccError(pid, s);
+      return;
+    }
+
+    if(cc == s.cc) {
+      // a packet may be sent twice, not more
+      if(s.duplicated)
+        ccError(pid, s);
+      s.duplicated = true;
+      return;
+    }
+
+    if(cc != (s.cc + 1) % 16)
+      ccError(pid, s);
+
+    s.cc = cc;
+    s.duplicated = false;
+  }
+
+  void ccError(int pid, PidState &s) {
+    ++*m_ccErrors;
+
+    if(!s.ccErrors && m_pidCounterCount < MAX_PID_COUNTERS) {
+      s.ccErrors = m_host->getCounter(format("cc_errors.%s", pid).c_str());
+      m_pidCounterCount++;
+    }
+
+    if(s.ccErrors)
+      ++*s.ccErrors;
+  }
+
+  // 2.3 PCR_error, 2.4 PCR_accuracy_error
+  void onPcr(int pid, PidState &s, int64_t pcr, bool discontinuity, int64_t packetIndex) {
+    if(m_clockPid < 0)
+      m_clockPid = pid;
+
+    if(s.lastPcr >= 0 && !discontinuity) {
+      auto delta = (pcr - s.lastPcr + PCR_WRAP) % PCR_WRAP;
+      if(delta > PCR_WRAP / 2)
+        delta -= PCR_WRAP;
+
+      if(delta < 0 || delta > MAX_PCR_DISCONTINUITY) {
+        ++*m_pcrDiscontinuityErrors;
+        s.ticksPerPacket = 0;
+      } else {
+        if(delta > MAX_PCR_INTERVAL)
+          ++*m_pcrRepetitionErrors;
+
+        // the rate of the previous PCR interval predicts the current PCR
+        auto const packets = packetIndex - s.lastPcrPacket;
+        if(s.ticksPerPacket > 0) {
+          auto const deviation = std::abs(delta - packets * s.ticksPerPacket);
+          if(deviation > MAX_PCR_INACCURACY)
+            ++*m_pcrAccuracyErrors;
+          m_maxPcrDeviation = std::max(m_maxPcrDeviation, deviation);
+        }
+        s.ticksPerPacket = packets > 0 ? double(delta) / packets : 0;
+
+        if(pid == m_clockPid)
+          advanceClock(delta);
+      }
+    } else {
+      s.ticksPerPacket = 0;
+    }
+
+    s.lastPcr = pcr;
+    s.lastPcrPacket = packetIndex;
+  }
+
+  // 2.5 PTS_error
+  void checkPts(PidState &s, SpanC pes) {
+    if(pes.len < 14 || pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01)
+      return;
+
+    switch(pes[3]) {
+    case 0xBC: // program_stream_map
+    case 0xBE: // padding_stream
+    case 0xBF: // private_stream_2
+    case 0xF0: // ECM
+    case 0xF1: // EMM
+    case 0xF2: // DSMCC_stream
+    case 0xF8: // ITU-T Rec. H.222.1 type E
+    case 0xFF: // program_stream_directory
+      return;
+    }
+
+    auto const ptsFlag = pes[7] & 0x80;
+    if(!ptsFlag)
+      return;
+
+    int64_t const pts = ((int64_t)(pes[9] & 0x0e) << 29) | (pes[10] << 22) | ((pes[11] & 0xfe) << 14) | (pes[12] << 7)
+          | (pes[13] >> 1);
+
+    if(s.lastPts >= 0) {
+      auto gap = (pts - s.lastPts + PTS_WRAP) % PTS_WRAP;
+      if(gap > PTS_WRAP / 2)
+        gap -= PTS_WRAP;
+      if(std::llabs(gap) > MAX_PTS_INTERVAL / 300)
+        ++*m_ptsErrors;
+    }
+
+    s.lastPts = pts;
+    s.lastPtsTime = m_now;
+  }
+
+  void advanceClock(int64_t delta) {
+    m_now += delta;
+
+    if(m_now - m_jitterWindowStart >= PCR_FREQ) {
+      *m_pcrJitterNs = int32_t(m_maxPcrDeviation * 1000 / 27);
+      m_maxPcrDeviation = 0;
+      m_jitterWindowStart = m_now;
+    }
+
+    checkRepetitions();
+  }
+
+  // 1.3 PAT_error, 1.5 PMT_error, 1.6 PID_error, 2.5 PTS_error
+  void checkRepetitions() {
+    for(auto pid : m_monitored) {
+      auto &s = m_pids[pid];
+
+      if(s.kind & PAT)
+        check(s.lastSeen, MAX_PSI_INTERVAL, m_patErrors);
+      if(s.kind & PMT)
+        check(s.lastSeen, MAX_PSI_INTERVAL, m_pmtErrors);
+      if(s.kind & ES) {
+        check(s.lastSeen, MAX_PID_INTERVAL, m_pidErrors);
+        if(s.lastPts >= 0 && !(s.kind & SCRAMBLED))
+          check(s.lastPtsTime, MAX_PTS_INTERVAL, m_ptsErrors);
+      }
+    }
+  }
+
+  // one error per elapsed interval
+  void check(int64_t &lastTime, int64_t maxInterval, HostCounter &counter) {
+    if(m_now - lastTime > maxInterval) {
+      ++*counter;
+      lastTime = m_now;
+    }
+  }
+
+  static int64_t readPcr(const uint8_t *p) {
+    int64_t const base = ((int64_t)p[0] << 25) | (p[1] << 17) | (p[2] << 9) | (p[3] << 1) | (p[4] >> 7);
+    int64_t const ext = ((p[4] & 1) << 8) | p[5];
+    return base * 300 + ext;
+  }
+
+  static auto const TS_PACKET_LEN = 188;
+  static auto const TS_HEADER_LEN = 4;
+  static auto const MAX_PID = 8192;
+  static auto const PID_PAT = 0;
+  static auto const PID_CAT = 1;
+  static auto const PID_NULL = 0x1FFF;
+  static auto const TABLE_ID_CAT = 1;
+
+  static constexpr int64_t PCR_FREQ = 27000000;
+  static constexpr int64_t PCR_WRAP = (1LL << 33) * 300;
+  static constexpr int64_t PTS_WRAP = 1LL << 33;
+
+  // ETSI TR 101 290, 5.2
+  static constexpr int64_t MAX_PSI_INTERVAL = PCR_FREQ / 2;
+  static constexpr int64_t MAX_PID_INTERVAL = PCR_FREQ * 5; // "user specified"
+  static constexpr int64_t MAX_PCR_INTERVAL = PCR_FREQ * 40 / 1000;
+  static constexpr int64_t MAX_PCR_DISCONTINUITY = PCR_FREQ * 100 / 1000;
+  static constexpr int64_t MAX_PTS_INTERVAL = PCR_FREQ * 700 / 1000;
+  static constexpr double MAX_PCR_INACCURACY = PCR_FREQ * 500e-9;
+
+  // the stats registry has a limited number of entries
+  static auto const MAX_PID_COUNTERS = 16;
+
+  KHost *const m_host;
+
+  HostCounter m_syncLoss;
+  HostCounter m_patErrors;
+  HostCounter m_ccErrors;
+  HostCounter m_pmtErrors;
+  HostCounter m_pidErrors;
+  HostCounter m_transportErrors;
+  HostCounter m_crcErrors;
+  HostCounter m_pcrRepetitionErrors;
+  HostCounter m_pcrDiscontinuityErrors;
+  HostCounter m_pcrAccuracyErrors;
+  HostCounter m_pcrJitterNs;
+  HostCounter m_ptsErrors;
+  HostCounter m_catErrors;
+
+  std::unique_ptr<PidState[]> const m_pids;
+  std::vector<int> m_monitored; // PIDs with a repetition check
+  int m_pidCounterCount = 0;
+  bool m_catFound = false;
+
+  int64_t m_packetCount = 0;
+
+  // stream time, in 27MHz units, driven by the PCRs of 'm_clockPid'
+  int m_clockPid = -1;
+  int64_t m_now = 0;
+
+  double m_maxPcrDeviation = 0;
+  int64_t m_jitterWindowStart = 0;
+};
@@ -21,6 +21,7 @@ using namespace Modules;
 #include "pes_stream.hpp"
 #include "psi_stream.hpp"
 #include "stream.hpp"
+#include "ts_analyzer.hpp"
 
 namespace {
 
@@ -36,6 +37,9 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
     m_unwrapper.WRAP_PERIOD = PTS_PERIOD;
     m_streams[PID_PAT] = make_unique<PsiStream>(PID_PAT, m_host, this);
 
+    if(config.analyze)
+      m_analyzer = make_unique<TsAnalyzer>(m_host);
+
     for(auto &pid : config.pids)
       if(pid.type != TsDemuxerConfig::NONE) {
         auto pess = make_unique<PesStream>(pid.pid, pid.type, this, m_host, addOutput());
@@ -49,10 +53,11 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
   void processOne(Data data) override {
     auto buf = data->data();
     processRemainder(buf);
-    processSpan(buf);
+    processSpan(buf, data);
   }
 
-  void processSpan(SpanC &buf) {
+  // 'owner' is the buffer 'buf' points to (null when 'buf' is transient)
+  void processSpan(SpanC &buf, Data const &owner) {
     bool syncing = true;
     auto syncFound = [&]() {
       if(*buf.ptr == SYNC_BYTE) {
@@ -62,6 +67,8 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
       if(!syncing) {
         m_host->log(Warning, "Looking for sync byte");
         syncing = true;
+        if(m_analyzer)
+          m_analyzer->onSyncLoss();
       }
       buf += 1;
       return false;
@@ -80,7 +87,7 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
       }
 
       try {
-        processTsPacket({buf.ptr, TS_PACKET_LEN});
+        processTsPacket({buf.ptr, TS_PACKET_LEN}, owner);
         syncing = false;
       } catch(exception const &e) {
         m_host->log(Error, e.what());
@@ -110,7 +117,7 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
 
     assert(m_remainderSize == TS_PACKET_LEN);
     SpanC remBuf{m_remainder, m_remainderSize};
-    processSpan(remBuf);
+    processSpan(remBuf, nullptr);
     m_remainderSize = 0;
   }
 
@@ -130,6 +137,9 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
     m_host->log(Debug, format("Found PAT (%s programs)", pmtPids.len).c_str());
     for(auto pid : pmtPids)
       m_streams[pid] = make_unique<PsiStream>(pid, m_host, this);
+
+    if(m_analyzer)
+      m_analyzer->onPat(pmtPids);
   }
 
   void onPmt(span<PsiStream::EsInfo> esInfo) override {
@@ -143,6 +153,14 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
           m_host->log(Warning, format("[%s] unknown MPEG stream type: %s", es.pid, es.mpegStreamType).c_str());
       }
     }
+
+    if(m_analyzer)
+      m_analyzer->onPmt(esInfo);
+  }
+
+  void onCrcError() override {
+    if(m_analyzer)
+      m_analyzer->onCrcError();
   }
 
   // PesStream::IRestamper implementation
@@ -159,7 +177,10 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
   }
 
   private:
-  void processTsPacket(const SpanC pkt) {
+  void processTsPacket(const SpanC pkt, Data const &owner) {
+    if(m_analyzer)
+      m_analyzer->onPacket(pkt.ptr);
+
     BitReader r = {pkt};
     const int syncByte = r.u(8);
     (void)syncByte;
@@ -237,7 +258,7 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
       stream->flush();
 
     if(adaptationFieldControl & 0b01)
-      stream->push(r.payload(), payloadUnitStartIndicator);
+      stream->push(r.payload(), payloadUnitStartIndicator, owner);
   }
 
   PesStream *findMatchingStream(PsiStream::EsInfo es) {
@@ -279,6 +300,7 @@ struct TsDemuxer : ModuleS, PsiStream::Listener, PesStream::IRestamper {
   int64_t m_ptsOrigin = INT64_MAX;
   TimeUnwrapper m_unwrapper;
   bool m_needsRestamp;
+  unique_ptr<TsAnalyzer> m_analyzer;
 
   // incomplete packet from previous data: size < TS_PACKET_LEN and starts with SYNC_BYTE
   uint8_t m_remainder[TS_PACKET_LEN]{};
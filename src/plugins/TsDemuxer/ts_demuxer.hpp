@@ -17,4 +17,8 @@ struct TsDemuxerConfig {
   std::vector<Pid> pids = {ANY_VIDEO(), ANY_AUDIO()};
 
   bool timestampStartsAtZero = true;
+
+  // count ETSI TR 101 290 priority 1 and 2 errors, as host counters.
+  // Use with an empty 'pids' for a standalone analysis.
+  bool analyze = false;
 };
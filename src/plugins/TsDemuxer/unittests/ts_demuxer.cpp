@@ -7,6 +7,7 @@
 #include "tests/tests.hpp"
 
 #include <cstring> // memcpy
+#include <map>
 
 using namespace Tests;
 using namespace Modules;
@@ -219,6 +220,163 @@ unittest("TsDemuxer: PES demux should not wait for next AU") {
   ASSERT_EQUALS(5, rec->totalLength);
 }
 
+namespace {
+struct FrameRecorder : ModuleS {
+  void processOne(Data data) override {
+    auto s = data->data();
+    frames.push_back(std::vector<uint8_t>(s.ptr, s.ptr + s.len));
+  }
+  std::vector<std::vector<uint8_t>> frames;
+};
+
+// PES packet spread over 3 TS packets (PES_packet_length is zero),
+// followed by the start of another PES packet.
+std::vector<uint8_t> getMultiPacketPesTs() {
+  std::vector<uint8_t> tsPackets(4 * 188);
+  BitWriter w{{tsPackets.data(), tsPackets.size()}};
+
+  for(int i = 0; i < 4; ++i) {
+    w.seek(i * 188);
+    w.u(8, 0x47); // sync byte
+    w.u(1, 0); // TEI
+    w.u(1, i == 0 || i == 3); // PUSI
+    w.u(1, 0); // priority
+    w.u(13, 120); // PID
+    w.u(2, 0); // scrambling control
+    w.u(2, 0b01); // adaptation field control
+    w.u(4, i); // continuity counter
+
+    if(i == 0 || i == 3)
+      writeSimplePes(w);
+
+    while(w.m_pos < (i + 1) * 188 * 8)
+      w.u(8, i); // payload
+  }
+
+  return tsPackets;
+}
+}
+
+unittest("TsDemuxer: PES demux across input buffers") {
+  auto const ts = getMultiPacketPesTs();
+
+  // cut the input in the middle of TS packets
+  for(auto cut : {188, 200, 2 * 188 + 7}) {
+    TsDemuxerConfig cfg;
+    cfg.pids = {};
+    cfg.pids.push_back({120, 1});
+
+    auto demux = loadModule("TsDemuxer", &NullHost, &cfg);
+    auto rec = createModule<FrameRecorder>();
+    ConnectOutputToInput(demux->getOutput(0), rec->getInput(0));
+
+    demux->getInput(0)->push(createPacket({ts.data(), (size_t)cut}));
+    demux->getInput(0)->push(createPacket({ts.data() + cut, ts.size() - cut}));
+
+    ASSERT_EQUALS(1, (int)rec->frames.size());
+
+    std::vector<uint8_t> expected;
+    expected.insert(expected.end(), 184 - 14, 0);
+    expected.insert(expected.end(), 184, 1);
+    expected.insert(expected.end(), 184, 2);
+    ASSERT_EQUALS(expected, rec->frames[0]);
+  }
+}
+
+unittest("TsDemuxer: large PES demux, one TS packet per input buffer") {
+  // unbounded PES packet (PES_packet_length is zero) much bigger than the input buffers it spans
+  auto const numPackets = 1000;
+  std::vector<uint8_t> tsPackets((numPackets + 1) * 188);
+  BitWriter w{{tsPackets.data(), tsPackets.size()}};
+
+  for(int i = 0; i <= numPackets; ++i) {
+    w.seek(i * 188);
+    w.u(8, 0x47); // sync byte
+    w.u(1, 0); // TEI
+    w.u(1, i == 0 || i == numPackets); // PUSI
+    w.u(1, 0); // priority
+    w.u(13, 120); // PID
+    w.u(2, 0); // scrambling control
+    w.u(2, 0b01); // adaptation field control
+    w.u(4, i % 16); // continuity counter
+
+    if(i == 0 || i == numPackets)
+      writeSimplePes(w);
+
+    while(w.m_pos < (i + 1) * 188 * 8)
+      w.u(8, i % 256); // payload
+  }
+
+  TsDemuxerConfig cfg;
+  cfg.pids = {};
+  cfg.pids.push_back({120, 1});
+
+  auto demux = loadModule("TsDemuxer", &NullHost, &cfg);
+  auto rec = createModule<FrameRecorder>();
+  ConnectOutputToInput(demux->getOutput(0), rec->getInput(0));
+
+  for(int i = 0; i <= numPackets; ++i)
+    demux->getInput(0)->push(createPacket({tsPackets.data() + i * 188, 188}));
+
+  ASSERT_EQUALS(1, (int)rec->frames.size());
+
+  std::vector<uint8_t> expected;
+  expected.insert(expected.end(), 184 - 14, 0);
+  for(int i = 1; i < numPackets; ++i)
+    expected.insert(expected.end(), 184, i % 256);
+  ASSERT_EQUALS(expected, rec->frames[0]);
+}
+
+unittest("TsDemuxer: PES demux with PES_packet_length across TS packets") {
+  uint8_t tsPackets[2 * 188]{};
+  BitWriter w{{tsPackets, sizeof tsPackets}};
+
+  auto const payloadSize = 184 - 9 + 100;
+
+  for(int i = 0; i < 2; ++i) {
+    w.seek(i * 188);
+    w.u(8, 0x47); // sync byte
+    w.u(1, 0); // TEI
+    w.u(1, i == 0); // PUSI
+    w.u(1, 0); // priority
+    w.u(13, 222); // PID
+    w.u(2, 0); // scrambling control
+    w.u(2, 0b01); // adaptation field control: only payload
+    w.u(4, i); // continuity counter
+
+    if(i == 0) {
+      w.u(24, 0x000001); // start_code_prefix
+      w.u(8, 0x0); // stream_id
+      w.u(16, 3 + payloadSize); // PES_packet_length
+      w.u(8, 0x80); // marker_bits, no flags
+      w.u(8, 0x00); // no PTS/DTS, no flags
+      w.u(8, 0x0); // PES_header_data_length
+    }
+
+    while(w.m_pos < (i + 1) * 188 * 8)
+      w.u(8, 0x10 + i); // payload (with trailing garbage)
+  }
+
+  TsDemuxerConfig cfg;
+  cfg.pids = {};
+  cfg.pids.push_back({222, 1});
+
+  auto demux = loadModule("TsDemuxer", &NullHost, &cfg);
+  auto rec = createModule<FrameRecorder>();
+  ConnectOutputToInput(demux->getOutput(0), rec->getInput(0));
+
+  demux->getInput(0)->push(createPacket({tsPackets, 188}));
+  ASSERT_EQUALS(0, (int)rec->frames.size());
+
+  demux->getInput(0)->push(createPacket({tsPackets + 188, 188}));
+  ASSERT_EQUALS(1, (int)rec->frames.size());
+
+  std::vector<uint8_t> expected;
+  expected.insert(expected.end(), 184 - 9, 0x10);
+  expected.insert(expected.end(), 100, 0x11);
+  ASSERT_EQUALS(expected, rec->frames[0]);
+}
+
 unittest("TsDemuxer: two pins, one PID") {
   TsDemuxerConfig cfg;
   cfg.pids = {};
@@ -294,9 +452,9 @@ unittest("TsDemuxer: two pins, two PIDs") {
   ASSERT_EQUALS(1, pid1->frameCount);
 }
 
-unittest("TsDemuxer: get codec from PMT") {
-
-  uint8_t tsPackets[2 * 188]{};
+namespace {
+// PAT + PMT with one MPEG-2 audio, one H.264 and one AC-3 stream
+void writePatPmt(uint8_t (&tsPackets)[2 * 188]) {
   BitWriter w{{tsPackets, sizeof tsPackets}};
 
   // PAT
@@ -336,7 +494,7 @@ unittest("TsDemuxer: get codec from PMT") {
     w.u(3, 0x7); // reserved bits
     w.u(13, 50); // program map PID
 
-    w.u(32, 0x2ab104b2); // CRC32
+    w.u(32, 0x97c5f0ea); // CRC32
   }
 
   // PMT
@@ -405,8 +563,14 @@ unittest("TsDemuxer: get codec from PMT") {
     w.u(8, 0x6a); // ES info: descriptor_tag for AC-3
     w.u(8, 0x0); //  ES info: descriptor_length
 
-    w.u(32, 0x896249fe); // CRC32
+    w.u(32, 0x4577abc5); // CRC32
   }
+}
+}
+
+unittest("TsDemuxer: get codec from PMT") {
+  uint8_t tsPackets[2 * 188]{};
+  writePatPmt(tsPackets);
 
   TsDemuxerConfig cfg;
   cfg.pids = {};
@@ -432,6 +596,136 @@ unittest("TsDemuxer: get codec from PMT") {
   ASSERT_EQUALS("ac3", meta2->codec);
 }
 
+unittest("TsDemuxer: PSI sections with an invalid CRC are discarded") {
+  uint8_t tsPackets[2 * 188]{};
+  writePatPmt(tsPackets);
+  tsPackets[188 + 30] ^= 0x01; // corrupt the PMT
+
+  TsDemuxerConfig cfg;
+  cfg.pids = {};
+  cfg.pids.push_back(TsDemuxerConfig::ANY_VIDEO());
+
+  auto demux = loadModule("TsDemuxer", &NullHost, &cfg);
+
+  demux->getInput(0)->push(createPacket(tsPackets));
+  demux->flush();
+
+  // metadata from the configuration, not from the PMT
+  auto meta = safe_cast<const MetadataPkt>(demux->getOutput(0)->getMetadata());
+  ASSERT(meta != nullptr);
+  ASSERT_EQUALS("", meta->codec);
+}
+
+namespace {
+struct CounterHost : KHost {
+  void log(int, char const *) override {}
+  void activate(bool) override {}
+  int32_t *getCounter(char const *name) override { return &counters[name]; }
+  std::map<std::string, int32_t> counters;
+};
+
+// adaptation_field only when 'pcr' is positive, payload only otherwise
+std::vector<uint8_t> makeTsPacket(int pid, int cc, int64_t pcr = -1, bool discontinuity = false) {
+  std::vector<uint8_t> pkt(188, 0xff);
+  pkt[0] = 0x47;
+  pkt[1] = pid >> 8;
+  pkt[2] = pid & 0xff;
+  pkt[3] = 0x10 | cc;
+  if(pcr >= 0) {
+    auto const base = pcr / 300;
+    auto const ext = pcr % 300;
+    pkt[3] = 0x20 | cc;
+    pkt[4] = 183;
+    pkt[5] = 0x10 | (discontinuity ? 0x80 : 0);
+    pkt[6] = base >> 25;
+    pkt[7] = base >> 17;
+    pkt[8] = base >> 9;
+    pkt[9] = base >> 1;
+    pkt[10] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+    pkt[11] = ext & 0xff;
+  }
+  return pkt;
+}
+}
+
+unittest("TsDemuxer: analysis of continuity, transport and CRC errors") {
+  uint8_t patPmt[2 * 188]{};
+  writePatPmt(patPmt);
+
+  std::vector<uint8_t> ts(patPmt, patPmt + sizeof patPmt);
+  auto append = [&](std::vector<uint8_t> pkt) { ts.insert(ts.end(), pkt.begin(), pkt.end()); };
+  append(makeTsPacket(777, 0));
+  append(makeTsPacket(777, 1));
+  append(makeTsPacket(777, 1)); // duplicate: allowed
+  append(makeTsPacket(777, 1)); // 3rd time: error
+  append(makeTsPacket(777, 3)); // lost packet: error
+  append(makeTsPacket(666, 5));
+  append(makeTsPacket(666, 6));
+  auto tei = makeTsPacket(666, 9);
+  tei[1] |= 0x80;
+  append(tei);
+  append({patPmt + 188, patPmt + 2 * 188});
+  ts[ts.size() - 188 + 30] ^= 0x01; // corrupt the PMT
+  ts[ts.size() - 188 + 3] |= 0x01; // keep its continuity_counter valid
+
+  TsDemuxerConfig cfg;
+  cfg.pids = {};
+  cfg.analyze = true;
+
+  CounterHost host;
+  auto demux = loadModule("TsDemuxer", &host, &cfg);
+  ASSERT_EQUALS(0, demux->getNumOutputs());
+
+  demux->getInput(0)->push(createPacket({ts.data(), ts.size()}));
+  demux->flush();
+
+  ASSERT_EQUALS(2, host.counters["cc_errors"]);
+  ASSERT_EQUALS(2, host.counters["cc_errors.777"]);
+  ASSERT_EQUALS(0, (int)host.counters.count("cc_errors.666"));
+  ASSERT_EQUALS(1, host.counters["transport_errors"]);
+  ASSERT_EQUALS(1, host.counters["crc_errors"]);
+  ASSERT_EQUALS(0, host.counters["sync_loss"]);
+}
+
+unittest("TsDemuxer: analysis of PCR and PSI repetition") {
+  uint8_t patPmt[2 * 188]{};
+  writePatPmt(patPmt);
+
+  std::vector<uint8_t> ts(patPmt, patPmt + sizeof patPmt);
+  auto append = [&](std::vector<uint8_t> pkt) { ts.insert(ts.end(), pkt.begin(), pkt.end()); };
+
+  // one PCR every millisecond, for 600ms: the PAT and the PMT are missing after 500ms
+  int64_t pcr = 0;
+  for(int i = 0; i < 600; ++i, pcr += 27000)
+    append(makeTsPacket(0x100, 0, pcr));
+
+  append(makeTsPacket(0x100, 0, pcr += 60 * 27000)); // > 40ms
+  append(makeTsPacket(0x100, 0, pcr += 150 * 27000)); // > 100ms
+  append(makeTsPacket(0x100, 0, pcr -= 500 * 27000, true)); // signaled discontinuity
+  append(makeTsPacket(0x100, 0, pcr += 27000));
+
+  // garbage, then back in sync
+  ts.insert(ts.end(), {0x00, 0x01, 0x02});
+  append(makeTsPacket(0x100, 0, pcr += 27000));
+
+  TsDemuxerConfig cfg;
+  cfg.pids = {};
+  cfg.analyze = true;
+
+  CounterHost host;
+  auto demux = loadModule("TsDemuxer", &host, &cfg);
+  demux->getInput(0)->push(createPacket({ts.data(), ts.size()}));
+  demux->flush();
+
+  ASSERT_EQUALS(1, host.counters["pat_errors"]);
+  ASSERT_EQUALS(1, host.counters["pmt_errors"]);
+  ASSERT_EQUALS(0, host.counters["cc_errors"]);
+  ASSERT_EQUALS(1, host.counters["pcr_repetition_errors"]);
+  ASSERT_EQUALS(1, host.counters["pcr_discontinuity_errors"]);
+  ASSERT_EQUALS(1, host.counters["pcr_accuracy_errors"]);
+  ASSERT_EQUALS(1, host.counters["sync_loss"]);
+}
+
 fuzztest("TsDemuxer") {
   SpanC testdata;
   GetFuzzTestData(testdata.ptr, testdata.len);
@@ -440,6 +734,7 @@ fuzztest("TsDemuxer") {
   cfg.pids = {};
   cfg.pids.push_back(TsDemuxerConfig::ANY_VIDEO());
   cfg.pids.push_back(TsDemuxerConfig::ANY_AUDIO());
+  cfg.analyze = true;
 
   auto demux = loadModule("TsDemuxer", &NullHost, &cfg);
 
@@ -4,6 +4,7 @@
 #include "lib_media/common/metadata.hpp"
 #include "lib_modules/utils/factory.hpp"
 #include "lib_modules/utils/helper_dyn.hpp"
+#include "lib_utils/crc.hpp"
 #include "lib_utils/log_sink.hpp"
 #include "lib_utils/tools.hpp"
 
@@ -18,8 +19,6 @@ static auto const TS_PACKET_SIZE = 188;
 using namespace Modules;
 using namespace std;
 
-uint32_t Crc32(SpanC data);
-
 namespace {
 static auto const PAT_INTERVAL_MS = 100;
 static auto const PMT_INTERVAL_MS = 100;
@@ -212,7 +211,7 @@ class TsMuxer : public ModuleDynI {
     ws.u(12, w.offset() - sectionStart + 4);
 
     // compute and write the CRC (skip pointer_field)
-    w.u(32, Crc32({payload + 1, (size_t)w.offset() - 1}));
+    w.u(32, crc32Mpeg2({payload + 1, (size_t)w.offset() - 1}));
 
     auto sp = SpanC{payload, (size_t)(w.offset())};
     sendTsPacket(PAT_PID, sp, 1);
@@ -259,7 +258,7 @@ class TsMuxer : public ModuleDynI {
     ws.u(12, (w.offset() - sectionStart + 4));
 
     // compute and write the CRC (skip pointer_field)
-    w.u(32, Crc32({payload + 1, (size_t)w.offset() - 1}));
+    w.u(32, crc32Mpeg2({payload + 1, (size_t)w.offset() - 1}));
 
     auto sp = SpanC{payload, (size_t)(w.offset())};
     sendTsPacket(PMT_PID, sp, 1);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+struct TsPidFilterConfig {
+  // program_number of the programs to keep. Empty means all programs.
+  std::vector<int> programs;
+
+  struct Remap {
+    int from;
+    int to;
+  };
+
+  // PIDs to rename on output (PMT, PCR and elementary streams).
+  std::vector<Remap> remaps;
+
+  // PIDs to keep even though no kept PMT references them (e.g EIT, TDT).
+  std::vector<int> extraPids;
+};
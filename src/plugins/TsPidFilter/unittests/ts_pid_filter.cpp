@@ -0,0 +1,297 @@
+#include "../ts_pid_filter.hpp"
+
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "lib_utils/crc.hpp"
+#include "tests/tests.hpp"
+
+#include <cstring> // memcpy
+
+using namespace Tests;
+using namespace Modules;
+
+namespace {
+
+struct TsPacket {
+  int pid;
+  bool pusi;
+  int cc;
+  std::vector<uint8_t> payload;
+};
+
+std::vector<uint8_t> serialize(std::vector<TsPacket> const &packets) {
+  std::vector<uint8_t> r;
+  for(auto &p : packets) {
+    uint8_t pkt[188];
+    memset(pkt, 0xFF, sizeof pkt);
+    pkt[0] = 0x47;
+    pkt[1] = (p.pusi ? 0x40 : 0) | (p.pid >> 8);
+    pkt[2] = p.pid & 0xff;
+    pkt[3] = 0x10 | p.cc;
+    memcpy(pkt + 4, p.payload.data(), p.payload.size());
+    r.insert(r.end(), pkt, pkt + 188);
+  }
+  return r;
+}
+
+std::vector<TsPacket> parse(SpanC data) {
+  std::vector<TsPacket> r;
+  for(size_t i = 0; i + 188 <= data.len; i += 188) {
+    auto pkt = data.ptr + i;
+    r.push_back({((pkt[1] & 0x1f) << 8) | pkt[2], (pkt[1] & 0x40) != 0, pkt[3] & 0xf, {pkt + 4, pkt + 188}});
+  }
+  return r;
+}
+
+// 'body' starts after the 'last_section_number' field
+std::vector<uint8_t> makeSection(int tableId, int tableIdExtension, int version, std::vector<uint8_t> body) {
+  std::vector<uint8_t> s;
+  auto const section_length = 5 + body.size() + 4;
+  s.push_back(0x00); // pointer_field
+  s.push_back(tableId);
+  s.push_back(0xb0 | (section_length >> 8));
+  s.push_back(section_length & 0xff);
+  s.push_back(tableIdExtension >> 8);
+  s.push_back(tableIdExtension & 0xff);
+  s.push_back(0xc1 | (version << 1));
+  s.push_back(0x00); // section_number
+  s.push_back(0x00); // last_section_number
+  s.insert(s.end(), body.begin(), body.end());
+  auto crc = crc32Mpeg2({s.data() + 1, s.size() - 1});
+  for(int i = 3; i >= 0; --i)
+    s.push_back((crc >> (i * 8)) & 0xff);
+  return s;
+}
+
+std::vector<uint8_t> makePat(int version) {
+  return makeSection(0x00, 1, version,
+        {
+              0x00, 0x01, 0xe1, 0x00, // program 1: PMT on PID 0x100
+              0x00, 0x02, 0xe2, 0x00, // program 2: PMT on PID 0x200
+        });
+}
+
+std::vector<uint8_t> makePmt(int program, int pcrPid, std::vector<int> esPids) {
+  std::vector<uint8_t> body = {uint8_t(0xe0 | (pcrPid >> 8)), uint8_t(pcrPid & 0xff), 0xf0, 0x00};
+  for(auto pid : esPids) {
+    std::vector<uint8_t> es = {0x1b, uint8_t(0xe0 | (pid >> 8)), uint8_t(pid & 0xff), 0xf0, 0x03, 0x52, 0x01, 0x42};
+    body.insert(body.end(), es.begin(), es.end());
+  }
+  return makeSection(0x02, program, 0, body);
+}
+
+struct Recorder : ModuleS {
+  void processOne(Data data) override {
+    auto pkts = parse(data->data());
+    packets.insert(packets.end(), pkts.begin(), pkts.end());
+  }
+  std::vector<TsPacket> packets;
+};
+
+std::shared_ptr<DataBase> createData(std::vector<uint8_t> const &bytes) {
+  auto data = make_shared<DataRaw>(bytes.size());
+  memcpy(data->buffer->data().ptr, bytes.data(), bytes.size());
+  return data;
+}
+
+std::vector<uint8_t> getMpts(int patVersion = 0) {
+  return serialize({
+        {0x000, true, 0, makePat(patVersion)},
+        {0x100, true, 0, makePmt(1, 0x101, {0x101, 0x102})},
+        {0x200, true, 0, makePmt(2, 0x201, {0x201})},
+        {0x101, true, 0, {0x11}},
+        {0x201, true, 0, {0x21}},
+        {0x102, true, 0, {0x12}},
+        {0x201, false, 1, {0x22}},
+  });
+}
+
+}
+
+unittest("TsPidFilter: keep one program and remap its PIDs") {
+  TsPidFilterConfig cfg;
+  cfg.programs = {2};
+  cfg.remaps = {{0x200, 0x300}, {0x201, 0x301}};
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  filter->getInput(0)->push(createData(getMpts()));
+
+  auto &pkts = rec->packets;
+  ASSERT_EQUALS(4, (int)pkts.size());
+
+  // PAT: only program 2 remains, pointing to the remapped PMT
+  ASSERT_EQUALS(0x000, pkts[0].pid);
+  auto pat = pkts[0].payload.data() + 1;
+  ASSERT_EQUALS(5 + 4 + 4, ((pat[1] & 0xf) << 8) | pat[2]);
+  ASSERT_EQUALS(0x0002, (pat[8] << 8) | pat[9]);
+  ASSERT_EQUALS(0x300, ((pat[10] & 0x1f) << 8) | pat[11]);
+  ASSERT_EQUALS(0u, crc32Mpeg2({pat, 3 + 13}));
+
+  // PMT: PCR and ES PIDs are remapped
+  ASSERT_EQUALS(0x300, pkts[1].pid);
+  auto pmt = pkts[1].payload.data() + 1;
+  ASSERT_EQUALS(0x301, ((pmt[8] & 0x1f) << 8) | pmt[9]);
+  ASSERT_EQUALS(0x301, ((pmt[13] & 0x1f) << 8) | pmt[14]);
+  ASSERT_EQUALS(0u, crc32Mpeg2({pmt, size_t(3 + (((pmt[1] & 0xf) << 8) | pmt[2]))}));
+
+  // payload packets are untouched, except for their PID
+  ASSERT_EQUALS(0x301, pkts[2].pid);
+  ASSERT_EQUALS(0x21, (int)pkts[2].payload[0]);
+  ASSERT_EQUALS(0, pkts[2].cc);
+  ASSERT_EQUALS(0x301, pkts[3].pid);
+  ASSERT_EQUALS(0x22, (int)pkts[3].payload[0]);
+  ASSERT_EQUALS(1, pkts[3].cc);
+}
+
+unittest("TsPidFilter: PSI version is bumped only when the output changes") {
+  TsPidFilterConfig cfg;
+  cfg.programs = {1};
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  auto patVersion = [&](int i) { return (rec->packets[i].payload[1 + 5] >> 1) & 0x1f; };
+
+  filter->getInput(0)->push(createData(getMpts(3)));
+  ASSERT_EQUALS(4, (int)rec->packets.size());
+  ASSERT_EQUALS(3, patVersion(0));
+
+  // same PAT: same version, continuity counter is regenerated
+  filter->getInput(0)->push(createData(getMpts(3)));
+  ASSERT_EQUALS(8, (int)rec->packets.size());
+  ASSERT_EQUALS(0x000, rec->packets[4].pid);
+  ASSERT_EQUALS(3, patVersion(4));
+  ASSERT_EQUALS(1, rec->packets[4].cc);
+
+  // new input version, same output content: same version
+  filter->getInput(0)->push(createData(getMpts(4)));
+  ASSERT_EQUALS(3, patVersion(8));
+}
+
+unittest("TsPidFilter: packets split across buffers, corrupted PSI") {
+  TsPidFilterConfig cfg;
+  cfg.extraPids = {0x102};
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  auto ts = getMpts();
+  ts[188 * 1 + 20] ^= 0xff; // corrupt PMT #1
+
+  filter->getInput(0)->push(createData({ts.begin(), ts.begin() + 100}));
+  filter->getInput(0)->push(createData({ts.begin() + 100, ts.end()}));
+
+  // PAT, PMT #2, and the packets of program #2 + extra PID
+  std::vector<int> pids;
+  for(auto &p : rec->packets)
+    pids.push_back(p.pid);
+  ASSERT_EQUALS(std::vector<int>({0x000, 0x200, 0x201, 0x102, 0x201}), pids);
+}
+
+unittest("TsPidFilter: several PSI sections per TS packet") {
+  TsPidFilterConfig cfg;
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  // 9 PAT sections per packet: each one is rewritten into its own packet
+  auto const pat = makePat(0);
+  std::vector<uint8_t> payload = {0x00}; // pointer_field
+  for(int i = 0; i < 9; ++i)
+    payload.insert(payload.end(), pat.begin() + 1, pat.end());
+
+  std::vector<TsPacket> packets;
+  for(int i = 0; i < 4; ++i)
+    packets.push_back({0x000, true, i, payload});
+
+  filter->getInput(0)->push(createData(serialize(packets)));
+
+  auto &pkts = rec->packets;
+  ASSERT_EQUALS(4 * 9, (int)pkts.size());
+  for(int i = 0; i < (int)pkts.size(); ++i) {
+    ASSERT_EQUALS(0x000, pkts[i].pid);
+    ASSERT_EQUALS(i % 16, pkts[i].cc);
+  }
+}
+
+unittest("TsPidFilter: conflicting remaps") {
+  auto create = [](TsPidFilterConfig cfg) { loadModule("TsPidFilter", &NullHost, &cfg); };
+
+  TsPidFilterConfig cfg;
+  cfg.remaps = {{0x101, 0x300}, {0x102, 0x300}};
+  ASSERT_THROWN(create(cfg));
+
+  cfg.remaps = {{0x101, 0x300}, {0x101, 0x301}};
+  ASSERT_THROWN(create(cfg));
+
+  cfg.remaps = {{0x101, 0x102}};
+  cfg.extraPids = {0x102};
+  ASSERT_THROWN(create(cfg));
+
+  // swapping PIDs is fine
+  cfg.remaps = {{0x101, 0x102}, {0x102, 0x101}};
+  create(cfg);
+}
+
+unittest("TsPidFilter: remap destination collides with a PID of the input") {
+  TsPidFilterConfig cfg;
+  cfg.remaps = {{0x101, 0x201}};
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  filter->getInput(0)->push(createData(getMpts()));
+
+  // program #1 comes first: the input PID 0x201 is dropped
+  std::vector<int> pids, payloads;
+  for(auto &p : rec->packets) {
+    pids.push_back(p.pid);
+    payloads.push_back(p.payload[0]);
+  }
+  ASSERT_EQUALS(std::vector<int>({0x000, 0x100, 0x200, 0x201, 0x102}), pids);
+  ASSERT_EQUALS(0x11, payloads[3]);
+}
+
+unittest("TsPidFilter: continuity counters are regenerated") {
+  TsPidFilterConfig cfg;
+
+  auto filter = loadModule("TsPidFilter", &NullHost, &cfg);
+  auto rec = createModule<Recorder>();
+  ConnectOutputToInput(filter->getOutput(0), rec->getInput(0));
+
+  auto const patWithoutProgram2 = makeSection(0x00, 1, 1, {0x00, 0x01, 0xe1, 0x00});
+  auto const pmt2 = makePmt(2, 0x201, {0x201});
+
+  filter->getInput(0)->push(createData(serialize({
+        {0x000, true, 0, makePat(0)},
+        {0x200, true, 0, pmt2},
+        {0x201, true, 0, {0x21}},
+        {0x201, false, 1, {0x22}},
+        // program #2 leaves, then comes back
+        {0x000, true, 1, patWithoutProgram2},
+        {0x201, false, 2, {0x23}},
+        {0x201, false, 3, {0x24}},
+        {0x000, true, 2, makePat(2)},
+        {0x200, true, 1, pmt2},
+        {0x201, true, 4, {0x25}},
+        {0x201, true, 4, {0x25}}, // duplicate
+        {0x201, false, 5, {0x26}},
+  })));
+
+  std::vector<int> ccs, payloads;
+  for(auto &p : rec->packets) {
+    if(p.pid == 0x201) {
+      ccs.push_back(p.cc);
+      payloads.push_back(p.payload[0]);
+    }
+  }
+  ASSERT_EQUALS(std::vector<int>({0x21, 0x22, 0x25, 0x25, 0x26}), payloads);
+  ASSERT_EQUALS(std::vector<int>({0, 1, 2, 2, 3}), ccs);
+}
@@ -3,10 +3,35 @@
 #include <cstddef>
 #include <cstdint> //uint8_t
 #include <memory>
+#include <string>
+#include <vector>
 
 struct IOutputSocket {
+  struct Destination {
+    std::string address;
+    int port;
+  };
+
+  struct SendInfo {
+    int datagramCount = 0; // datagrams handed to the kernel, all destinations included
+    int wouldBlockCount = 0; // datagrams dropped because the send queue was full
+    int errorCount = 0; // datagrams dropped for another reason
+    int lastError = 0; // errno of the last failure
+  };
+
+  // 'data' is split into payloads of 'payloadSize' bytes (the last one may be shorter), one per datagram
+  struct Datagrams {
+    uint8_t const *data;
+    size_t len;
+    size_t payloadSize;
+    uint8_t const *headers = nullptr; // optional: 'headerSize' bytes prepended to each payload
+    size_t headerSize = 0;
+  };
+
   virtual ~IOutputSocket() = default;
-  virtual void send(uint8_t const *data, size_t len) = 0;
+
+  // sends the datagrams to every destination, with as few syscalls as possible
+  virtual void send(Datagrams const &datagrams, SendInfo &info) = 0;
 };
 
-std::unique_ptr<IOutputSocket> createOutputSocket(const char *address, int port);
+std::unique_ptr<IOutputSocket> createOutputSocket(std::vector<IOutputSocket::Destination> const &destinations);
@@ -1,8 +1,10 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <algorithm> // min
 #include <cstdio> // sprintf
 #include <errno.h>
 #include <fcntl.h>
@@ -19,17 +21,37 @@ using namespace std;
 // 2Mb: can handle 4 redundant 20Mbps outputs.
 static auto const SEND_BUFFER_SIZE = 2 * 1024 * 1024;
 
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // linux/udp.h, Linux 4.18
+#endif
+
+// messages per sendmmsg() call
+static size_t const MAX_BATCH = 64;
+
+// UDP GSO limits: segments per sendmsg() call, and IPv4 payload size
+static size_t const MAX_GSO_SEGMENTS = 64;
+static size_t const MAX_GSO_SIZE = 65507;
+#endif
+
 namespace {
 struct Socket : IOutputSocket {
-  Socket(const char *address, int port) {
+  Socket(vector<Destination> const &destinations) {
+    if(destinations.empty())
+      throw runtime_error("no destination");
+
     m_socket = socket(AF_INET, SOCK_DGRAM, 0);
 
     if(m_socket < 0)
       throw runtime_error("socket failed");
 
-    m_dstAddr.sin_family = AF_INET;
-    m_dstAddr.sin_addr.s_addr = inet_addr(address);
-    m_dstAddr.sin_port = htons(port);
+    for(auto &dst : destinations) {
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = inet_addr(dst.address.c_str());
+      addr.sin_port = htons(dst.port);
+      m_dstAddrs.push_back(addr);
+    }
 
     unsigned int size = SEND_BUFFER_SIZE;
     int err = setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
@@ -46,23 +68,169 @@ struct Socket : IOutputSocket {
       sprintf(msg, "UDP send buffer is too small: %.2f kbytes", size / 1024.0);
       throw runtime_error(msg);
     }
+
+#ifdef __linux__
+    int segmentSize = 0;
+    optlen = sizeof(segmentSize);
+    m_useGso = getsockopt(m_socket, IPPROTO_UDP, UDP_SEGMENT, &segmentSize, &optlen) == 0;
+#endif
   }
 
   ~Socket() { close(m_socket); }
 
-  void send(const uint8_t *buffer, size_t len) override {
-    if(::sendto(m_socket, buffer, len, 0, (sockaddr *)&m_dstAddr, sizeof(m_dstAddr)) < 0) {
-      char msg[256];
-      sprintf(msg, "UDP send %d bytes failed: %s", (int)len, strerror(errno));
-      throw runtime_error(msg);
+  void send(Datagrams const &datagrams, SendInfo &info) override {
+    auto const count = getCount(datagrams);
+
+#ifdef __linux__
+    if(m_useGso && count > 1) {
+      for(auto &dst : m_dstAddrs) {
+        auto const next = sendSegmented(datagrams, dst, info);
+        // GSO isn't usable: send the remaining datagrams normally
+        if(next < count) {
+          vector<sockaddr_in> single{dst};
+          sendMany(datagrams, next, count, single, info);
+        }
+      }
+      return;
+    }
+
+    sendMany(datagrams, 0, count, m_dstAddrs, info);
+#else
+    for(size_t i = 0; i < count; ++i) {
+      for(auto &dst : m_dstAddrs) {
+        iovec iov[2];
+        msghdr msg{};
+        msg.msg_name = &dst;
+        msg.msg_namelen = sizeof(dst);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = getIov(datagrams, i, iov);
+
+        if(sendmsg(m_socket, &msg, 0) < 0)
+          onError(info, 1);
+        else
+          info.datagramCount++;
+      }
     }
+#endif
+  }
+
+  private:
+  static size_t getCount(Datagrams const &datagrams) {
+    return (datagrams.len + datagrams.payloadSize - 1) / datagrams.payloadSize;
+  }
+
+  // the header and the payload of the i-th datagram: returns the number of entries used
+  static int getIov(Datagrams const &datagrams, size_t i, iovec *iov) {
+    int n = 0;
+    if(datagrams.headerSize)
+      iov[n++] = {(void *)(datagrams.headers + i * datagrams.headerSize), datagrams.headerSize};
+
+    auto const pos = i * datagrams.payloadSize;
+    iov[n++] = {(void *)(datagrams.data + pos), min(datagrams.payloadSize, datagrams.len - pos)};
+    return n;
+  }
+
+#ifdef __linux__
+  // one sendmsg() per group of segments: the kernel (or the NIC) splits them into datagrams.
+  // A group which can't be sent this way is sent again as separate datagrams.
+  // Returns the first datagram not sent, if GSO turns out to be unusable.
+  size_t sendSegmented(Datagrams const &datagrams, sockaddr_in &dst, SendInfo &info) {
+    auto const count = getCount(datagrams);
+    auto const segmentSize = datagrams.headerSize + datagrams.payloadSize;
+    auto const maxSegments = min(MAX_GSO_SEGMENTS, MAX_GSO_SIZE / segmentSize);
+
+    size_t first = 0;
+    while(first < count && m_useGso) {
+      auto const segmentCount = min(maxSegments, count - first);
+
+      iovec iovs[MAX_GSO_SEGMENTS * 2];
+      int iovCount = 0;
+      for(size_t i = 0; i < segmentCount; ++i)
+        iovCount += getIov(datagrams, first + i, iovs + iovCount);
+
+      char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+      msghdr msg{};
+      msg.msg_name = &dst;
+      msg.msg_namelen = sizeof(dst);
+      msg.msg_iov = iovs;
+      msg.msg_iovlen = iovCount;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      auto cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = IPPROTO_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t const size = segmentSize;
+      memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+
+      if(sendmsg(m_socket, &msg, 0) < 0) {
+        if(errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT) {
+          m_useGso = false; // e.g the route doesn't support it
+          break;
+        }
+
+        vector<sockaddr_in> single{dst};
+        sendMany(datagrams, first, first + segmentCount, single, info);
+      } else {
+        info.datagramCount += segmentCount;
+      }
+
+      first += segmentCount;
+    }
+
+    return first;
+  }
+
+  // each datagram in [first, last) is a separate message to every destination
+  void sendMany(Datagrams const &datagrams, size_t first, size_t last, vector<sockaddr_in> &dsts, SendInfo &info) {
+    auto const dstCount = dsts.size();
+    auto const messageCount = (last - first) * dstCount;
+
+    mmsghdr msgs[MAX_BATCH];
+    iovec iovs[MAX_BATCH][2];
+
+    for(size_t done = 0; done < messageCount;) {
+      auto const count = min(MAX_BATCH, messageCount - done);
+
+      for(size_t i = 0; i < count; ++i) {
+        auto const message = done + i;
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_name = &dsts[message % dstCount];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = getIov(datagrams, first + message / dstCount, iovs[i]);
+      }
+
+      auto const sent = sendmmsg(m_socket, msgs, count, 0);
+
+      if(sent < 0) {
+        // the first message failed: skip it
+        onError(info, 1);
+        done++;
+      } else {
+        info.datagramCount += sent;
+        done += sent;
+      }
+    }
+  }
+
+  bool m_useGso = false;
+#endif
+
+  static void onError(SendInfo &info, int datagramCount) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+      info.wouldBlockCount += datagramCount;
+    else
+      info.errorCount += datagramCount;
+    info.lastError = errno;
   }
 
   int m_socket = -1;
-  sockaddr_in m_dstAddr{};
+  vector<sockaddr_in> m_dstAddrs;
 };
 }
 
-std::unique_ptr<IOutputSocket> createOutputSocket(const char *address, int port) {
-  return make_unique<Socket>(address, port);
+std::unique_ptr<IOutputSocket> createOutputSocket(vector<IOutputSocket::Destination> const &destinations) {
+  return make_unique<Socket>(destinations);
 }
@@ -1,3 +1,4 @@
+#include <algorithm> // min
 #include <stdexcept>
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -8,7 +9,10 @@ using namespace std;
 
 namespace {
 struct Socket : IOutputSocket {
-  Socket(const char *address, int port) {
+  Socket(vector<Destination> const &destinations) {
+    if(destinations.empty())
+      throw runtime_error("no destination");
+
     WSADATA wsaData;
     auto res = WSAStartup(MAKEWORD(2, 2), &wsaData);
 
@@ -20,9 +24,13 @@ struct Socket : IOutputSocket {
     if(m_socket == INVALID_SOCKET)
       throw runtime_error("socket failed");
 
-    m_dstAddr.sin_family = AF_INET;
-    m_dstAddr.sin_addr.s_addr = inet_addr(address);
-    m_dstAddr.sin_port = htons(port);
+    for(auto &dst : destinations) {
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = inet_addr(dst.address.c_str());
+      addr.sin_port = htons(dst.port);
+      m_dstAddrs.push_back(addr);
+    }
   }
 
   ~Socket() {
@@ -30,16 +38,38 @@ struct Socket : IOutputSocket {
     WSACleanup();
   }
 
-  void send(const uint8_t *buffer, size_t len) override {
-    if(::sendto(m_socket, (const char *)buffer, len, 0, (sockaddr *)&m_dstAddr, sizeof(m_dstAddr)) < 0)
-      throw runtime_error("UDP send failed");
+  void send(Datagrams const &datagrams, SendInfo &info) override {
+    for(size_t pos = 0; pos < datagrams.len; pos += datagrams.payloadSize) {
+      auto const payloadSize = min(datagrams.payloadSize, datagrams.len - pos);
+      auto const header = datagrams.headers + pos / datagrams.payloadSize * datagrams.headerSize;
+
+      WSABUF bufs[2];
+      DWORD bufCount = 0;
+      if(datagrams.headerSize)
+        bufs[bufCount++] = {(ULONG)datagrams.headerSize, (CHAR *)header};
+      bufs[bufCount++] = {(ULONG)payloadSize, (CHAR *)datagrams.data + pos};
+
+      for(auto &dst : m_dstAddrs) {
+        DWORD sent;
+        if(WSASendTo(m_socket, bufs, bufCount, &sent, 0, (sockaddr *)&dst, sizeof(dst), nullptr, nullptr) != 0) {
+          auto const err = WSAGetLastError();
+          if(err == WSAEWOULDBLOCK || err == WSAENOBUFS)
+            info.wouldBlockCount++;
+          else
+            info.errorCount++;
+          info.lastError = err;
+        } else {
+          info.datagramCount++;
+        }
+      }
+    }
   }
 
   SOCKET m_socket = INVALID_SOCKET;
-  sockaddr_in m_dstAddr{};
+  vector<sockaddr_in> m_dstAddrs;
 };
 }
 
-std::unique_ptr<IOutputSocket> createOutputSocket(const char *address, int port) {
-  return make_unique<Socket>(address, port);
+std::unique_ptr<IOutputSocket> createOutputSocket(vector<IOutputSocket::Destination> const &destinations) {
+  return make_unique<Socket>(destinations);
 }
@@ -2,26 +2,164 @@
 
 #include "lib_modules/utils/factory.hpp" // registerModule
 #include "lib_modules/utils/helper.hpp"
+#include "lib_utils/format.hpp"
+#include "lib_utils/log_sink.hpp" // Warning
+#include "lib_utils/rtp.hpp"
 #include "lib_utils/tools.hpp" // enforce
 
 #include "socket.hpp"
 
+#include <algorithm> // min
+#include <chrono>
+#include <cstdio> // sprintf
+#include <random>
+#include <thread>
+
 using namespace Modules;
+using namespace std;
 
 namespace {
 
+// sleeping is only accurate to a few dozen microseconds: spin for the rest
+auto const SPIN_DURATION = chrono::microseconds(200);
+
+// being late by more than this means the input was starved: don't try to catch up
+auto const MAX_LATENESS = chrono::milliseconds(100);
+
+string toString(int const ipAddr[4]) {
+  char buffer[256];
+  sprintf(buffer, "%d.%d.%d.%d", ipAddr[0], ipAddr[1], ipAddr[2], ipAddr[3]);
+  return buffer;
+}
+
 struct UdpOutput : ModuleS {
   UdpOutput(KHost *host, UdpOutputConfig const &config)
-      : m_host(host) {
-    char buffer[256];
-    sprintf(buffer, "%d.%d.%d.%d", config.ipAddr[0], config.ipAddr[1], config.ipAddr[2], config.ipAddr[3]);
-    m_socket = createOutputSocket(buffer, config.port);
+      : m_host(host)
+      , m_datagramSize(config.datagramSize)
+      , m_bitrate(config.bitrate)
+      , m_maxBurstDatagrams(config.maxBurstDatagrams)
+      , m_rtp(config.rtp)
+      , m_sendErrors(host, "send_errors")
+      , m_sendWouldBlock(host, "send_would_block") {
+    enforce(m_datagramSize > 0 && m_datagramSize <= 65507, "UdpOutput: invalid datagramSize");
+    enforce(m_bitrate <= 0 || m_maxBurstDatagrams > 0, "UdpOutput: maxBurstDatagrams must be positive");
+
+    vector<IOutputSocket::Destination> destinations;
+    destinations.push_back({toString(config.ipAddr), config.port});
+    for(auto &dst : config.extraDestinations)
+      destinations.push_back({toString(dst.ipAddr), dst.port});
+    m_socket = createOutputSocket(destinations);
+
+    if(m_rtp) {
+      std::random_device random;
+      m_rtpHeader.ssrc = random();
+      m_rtpHeader.sequenceNumber = (uint16_t)random();
+    }
   }
 
-  void processOne(Data data) override { m_socket->send(data->data().ptr, data->data().len); }
+  void processOne(Data data) override {
+    auto buf = data->data();
+
+    if(m_bitrate <= 0) {
+      send(buf.ptr, buf.len);
+      return;
+    }
+
+    auto const burstSize = (size_t)m_maxBurstDatagrams * m_datagramSize;
+    for(size_t pos = 0; pos < buf.len; pos += burstSize) {
+      auto const size = min(burstSize, buf.len - pos);
+      waitForDeparture();
+      send(buf.ptr + pos, size);
+      m_sentBytes += size;
+    }
+  }
+
+  private:
+  void send(uint8_t const *data, size_t len) {
+    IOutputSocket::Datagrams datagrams{data, len, (size_t)m_datagramSize};
+
+    if(m_rtp) {
+      writeRtpHeaders((len + m_datagramSize - 1) / m_datagramSize);
+      datagrams.headers = m_rtpHeaders.data();
+      datagrams.headerSize = Rtp::HEADER_SIZE;
+    }
+
+    IOutputSocket::SendInfo info;
+    m_socket->send(datagrams, info);
+
+    if(info.errorCount + info.wouldBlockCount == 0) {
+      m_lastError = 0;
+      return;
+    }
+
+    *m_sendErrors += info.errorCount;
+    *m_sendWouldBlock += info.wouldBlockCount;
+
+    // don't flood the log when a destination stays unreachable
+    if(info.lastError != m_lastError) {
+      m_host->log(Warning, format("%s datagram(s) couldn't be sent (error %s)", info.errorCount + info.wouldBlockCount,
+                                 info.lastError)
+                                 .c_str());
+      m_lastError = info.lastError;
+    }
+  }
+
+  // RTP timestamps are the sending time (RFC 2250)
+  void writeRtpHeaders(size_t count) {
+    auto const now = chrono::steady_clock::now().time_since_epoch();
+    m_rtpHeader.timestamp = (uint32_t)(chrono::duration_cast<chrono::microseconds>(now).count() * 9 / 100);
+
+    m_rtpHeaders.resize(count * Rtp::HEADER_SIZE);
+    for(size_t i = 0; i < count; ++i) {
+      Rtp::writeHeader(m_rtpHeaders.data() + i * Rtp::HEADER_SIZE, m_rtpHeader);
+      m_rtpHeader.sequenceNumber++;
+    }
+  }
+
+  // the departure time of a byte only depends on its position in the stream
+  void waitForDeparture() {
+    using namespace chrono;
+
+    auto const now = steady_clock::now();
+    if(!m_started) {
+      m_startTime = now;
+      m_sentBytes = 0;
+      m_started = true;
+    }
+
+    auto const bits = m_sentBytes * 8;
+    auto const elapsed = seconds(bits / m_bitrate) + nanoseconds(bits % m_bitrate * 1000000000 / m_bitrate);
+    auto const deadline = m_startTime + elapsed;
+
+    if(now > deadline + MAX_LATENESS) {
+      m_startTime += now - deadline;
+      return;
+    }
+
+    if(deadline - now > SPIN_DURATION)
+      this_thread::sleep_for(deadline - now - SPIN_DURATION);
+
+    while(steady_clock::now() < deadline) {
+      // spin
+    }
+  }
 
   KHost *const m_host;
+  int const m_datagramSize;
+  int64_t const m_bitrate;
+  int const m_maxBurstDatagrams;
+  bool const m_rtp;
+  HostCounter m_sendErrors;
+  HostCounter m_sendWouldBlock;
   std::unique_ptr<IOutputSocket> m_socket;
+  int m_lastError = 0;
+
+  Rtp::Header m_rtpHeader;
+  vector<uint8_t> m_rtpHeaders;
+
+  bool m_started = false;
+  chrono::steady_clock::time_point m_startTime;
+  int64_t m_sentBytes = 0;
 };
 
 IModule *createObject(KHost *host, void *va) {
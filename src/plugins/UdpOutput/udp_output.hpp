@@ -1,6 +1,27 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 struct UdpOutputConfig {
-  int ipAddr[4];
-  int port;
+  int ipAddr[4]{};
+  int port = 0;
+
+  // redundant outputs: every datagram is also sent to these destinations
+  struct Destination {
+    int ipAddr[4];
+    int port;
+  };
+  std::vector<Destination> extraDestinations;
+
+  // input data is split into datagrams of at most 'datagramSize' bytes (RTP header excluded)
+  int datagramSize = 7 * 188;
+
+  // encapsulate each datagram in RTP (RFC 2250), with a random SSRC
+  bool rtp = false;
+
+  // if positive, datagrams are paced to this bitrate (in bits/s), in bursts of at most 'maxBurstDatagrams'.
+  // Otherwise, input data is sent as soon as it is received.
+  int64_t bitrate = 0;
+  int maxBurstDatagrams = 4;
 };
@@ -0,0 +1,104 @@
+#include "../udp_output.hpp"
+
+#include "lib_modules/modules.hpp"
+#include "lib_modules/utils/loader.hpp"
+#include "tests/tests.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring> // memset
+
+using namespace Tests;
+using namespace Modules;
+
+namespace {
+
+auto const PORT = 47923;
+
+struct Receiver {
+  Receiver(int port) {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(port);
+    bind(fd, (sockaddr *)&addr, sizeof addr);
+
+    timeval timeout{0, 100 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  }
+
+  ~Receiver() { close(fd); }
+
+  // sizes of the datagrams received, checking their content
+  std::vector<int> receive(uint8_t expected) {
+    std::vector<int> sizes;
+    uint8_t buf[65536];
+    int size;
+    while((size = recv(fd, buf, sizeof buf, 0)) > 0) {
+      for(int i = 0; i < size; ++i)
+        if(buf[i] != expected)
+          return {};
+      sizes.push_back(size);
+    }
+    return sizes;
+  }
+
+  int fd;
+};
+
+UdpOutputConfig loopback(int port) {
+  UdpOutputConfig cfg;
+  cfg.ipAddr[0] = 127;
+  cfg.ipAddr[3] = 1;
+  cfg.port = port;
+  return cfg;
+}
+
+void push(IModule *sender, int size, uint8_t value) {
+  auto data = std::make_shared<DataRaw>(size);
+  memset(data->buffer->data().ptr, value, size);
+  sender->getInput(0)->push(data);
+}
+
+}
+
+unittest("UdpOutput: input is split into datagrams, sent to every destination") {
+  Receiver rx1(PORT), rx2(PORT + 1);
+
+  auto cfg = loopback(PORT);
+  cfg.extraDestinations.push_back({{127, 0, 0, 1}, PORT + 1});
+  auto sender = loadModule("UdpOutput", &NullHost, &cfg);
+
+  push(sender.get(), 2 * 1316 + 188, 0x47);
+  auto const expected = std::vector<int>({1316, 1316, 188});
+  ASSERT_EQUALS(expected, rx1.receive(0x47));
+  ASSERT_EQUALS(expected, rx2.receive(0x47));
+
+  push(sender.get(), 40 * 1316, 0x48);
+  ASSERT_EQUALS(40, (int)rx1.receive(0x48).size());
+  ASSERT_EQUALS(40, (int)rx2.receive(0x48).size());
+}
+
+unittest("UdpOutput: pacing") {
+  Receiver rx(PORT);
+
+  auto cfg = loopback(PORT);
+  cfg.bitrate = 8 * 1000 * 1000;
+  cfg.maxBurstDatagrams = 2;
+  auto sender = loadModule("UdpOutput", &NullHost, &cfg);
+
+  // 50ms of stream at 1Mbyte/s
+  auto const start = std::chrono::steady_clock::now();
+  push(sender.get(), 50 * 1000 + 2 * 1316, 0x47);
+  auto const elapsed = std::chrono::steady_clock::now() - start;
+
+  ASSERT(elapsed >= std::chrono::milliseconds(50));
+  ASSERT_EQUALS(40, (int)rx.receive(0x47).size());
+}
+#endif